@@ -0,0 +1,400 @@
+// Bus benchmarks against simulated io-boards.
+//
+// Measures, for one to eight boards on the switch chain:
+//   - startup: Connect() through board config, chain config, setup and
+//     mapping frames,
+//   - switch chain round trips per second and how many were missed,
+//   - output frames per second while outputs keep changing every
+//     --output-interval-ms.
+//
+// By default the host talks to the simulator over a loopback pair paced at
+// the bus baud rate, so wire time is accounted for. --pty puts the simulator
+// behind a pseudo terminal instead and opens it through libserialport, which
+// includes SerialTransport but has no wire time. --config runs a real game
+// YAML through PPUC::Connect(), and reports how many config records it
+// compiles to and how long that took; without it a synthetic config burst of
+// --config-frames frames per board is sent through RS485Comm directly.
+// --config-window sends that many config frames ahead of their acks; the
+// simulator can take them, a shared half-duplex bus cannot.
+//
+// Usage: ppuc_bench [--boards N] [--seconds S] [--turnaround-us US]
+//                   [--reply-delay-us US] [--output-interval-ms MS]
+//                   [--config-frames N] [--config FILE] [--pty]
+//                   [--rx-thread] [--delta-frames] [--config-window N]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "BoardSimulator.h"
+#include "LoopbackTransport.h"
+#include "PPUC.h"
+#include "RS485Comm.h"
+#ifndef _WIN32
+#include "PtyTransport.h"
+#endif
+
+namespace {
+
+struct BenchOptions {
+  int boards = 4;
+  int seconds = 5;
+  uint32_t turnaroundUs = 100;
+  uint32_t replyDelayUs = 0;
+  // Eight fully mapped boards make a 2.5ms output frame at the bus baud rate,
+  // so changing outputs every 4ms would already saturate the line.
+  uint32_t outputIntervalMs = 10;
+  int configFramesPerBoard = 64;
+  const char* configFile = nullptr;
+  bool pty = false;
+  bool receiveThread = false;
+  bool deltaFrames = false;
+  uint8_t configWindow = 1;
+};
+
+struct BenchResult {
+  size_t configRecords = 0;  // with --config
+  double compileMs = 0;
+  double startupMs = 0;
+  uint32_t chains = 0;
+  uint32_t cleanChains = 0;
+  uint32_t misses = 0;
+  uint32_t outputFrames = 0;
+  uint32_t outputDeltaFrames = 0;
+  double seconds = 0;
+};
+
+// Coils, lamps and switches per board in the synthetic setup.
+constexpr uint16_t kSyntheticCoilsPerBoard = 16;
+constexpr uint16_t kSyntheticLampsPerBoard = 32;
+constexpr uint16_t kSyntheticSwitchesPerBoard = 16;
+
+double ElapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+void PrintUsage() {
+  printf(
+      "Usage: ppuc_bench [--boards N] [--seconds S] [--turnaround-us US]\n"
+      "                  [--reply-delay-us US] [--output-interval-ms MS]\n"
+      "                  [--config-frames N] [--config FILE] [--pty]\n"
+      "                  [--rx-thread] [--delta-frames] [--config-window N]\n");
+}
+
+bool ParseOptions(int argc, char** argv, BenchOptions* options) {
+  for (int i = 1; i < argc; ++i) {
+    const bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "--boards") == 0 && hasValue) {
+      options->boards = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seconds") == 0 && hasValue) {
+      options->seconds = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--turnaround-us") == 0 && hasValue) {
+      options->turnaroundUs = static_cast<uint32_t>(atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--reply-delay-us") == 0 && hasValue) {
+      options->replyDelayUs = static_cast<uint32_t>(atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--output-interval-ms") == 0 && hasValue) {
+      options->outputIntervalMs = static_cast<uint32_t>(atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--config-frames") == 0 && hasValue) {
+      options->configFramesPerBoard = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--config") == 0 && hasValue) {
+      options->configFile = argv[++i];
+    } else if (strcmp(argv[i], "--pty") == 0) {
+      options->pty = true;
+    } else if (strcmp(argv[i], "--rx-thread") == 0) {
+      options->receiveThread = true;
+    } else if (strcmp(argv[i], "--delta-frames") == 0) {
+      options->deltaFrames = true;
+    } else if (strcmp(argv[i], "--config-window") == 0 && hasValue) {
+      options->configWindow = static_cast<uint8_t>(atoi(argv[++i]));
+    } else {
+      return false;
+    }
+  }
+  if (options->boards < 1 || options->boards > 8 || options->seconds < 1 ||
+      options->outputIntervalMs < 1) {
+    return false;
+  }
+#ifdef _WIN32
+  if (options->pty) {
+    printf("--pty is not available on Windows.\n");
+    return false;
+  }
+#endif
+  return true;
+}
+
+// Creates the simulator and the host end of the bus. With --pty the host end
+// is the pty's device path, to be opened through libserialport, and
+// *hostTransport stays NULL.
+BoardSimulator* CreateBus(const BenchOptions& options,
+                          Transport** hostTransport, std::string* devicePath) {
+  Transport* boardTransport = NULL;
+  *hostTransport = NULL;
+#ifndef _WIN32
+  if (options.pty) {
+    PtyTransport* pty = new PtyTransport();
+    if (!pty->Open()) {
+      printf("Unable to open a pty: %s\n", pty->LastErrorMessage().c_str());
+      delete pty;
+      return NULL;
+    }
+    *devicePath = pty->GetDevicePath();
+    boardTransport = pty;
+  }
+#endif
+  if (!boardTransport) {
+    LoopbackTransport* host = NULL;
+    LoopbackTransport* boards = NULL;
+    LoopbackTransport::CreatePair(&host, &boards, RS485_COMM_BAUD_RATE);
+    *hostTransport = host;
+    boardTransport = boards;
+  }
+
+  BoardSimulator* sim = new BoardSimulator(boardTransport);
+  sim->SetTurnaroundUs(options.turnaroundUs);
+  return sim;
+}
+
+// Keeps outputs changing for the measurement window and counts chains and
+// output frames over it. Changing outputs faster than their frames cross the
+// wire only measures how deep the transmit backlog gets.
+template <typename QueueToggle, typename GetHealth>
+void MeasureRuntime(const BenchOptions& options, BoardSimulator* sim,
+                    QueueToggle queueToggle, GetHealth getHealth,
+                    BenchResult* result) {
+  const PPUCBusHealth healthBefore = getHealth();
+  const uint32_t outputFramesBefore = sim->GetStats().outputFrames;
+  const uint32_t deltaFramesBefore = sim->GetStats().outputDeltaFrames;
+  const auto start = std::chrono::steady_clock::now();
+  const auto end = start + std::chrono::seconds(options.seconds);
+  int toggle = 0;
+  while (std::chrono::steady_clock::now() < end) {
+    queueToggle(toggle++);
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(options.outputIntervalMs));
+  }
+  result->seconds = ElapsedMs(start) / 1000.0;
+  const PPUCBusHealth healthAfter = getHealth();
+  result->chains = healthAfter.switchReplyChains - healthBefore.switchReplyChains;
+  result->cleanChains =
+      healthAfter.switchReplyChainsClean - healthBefore.switchReplyChainsClean;
+  result->misses =
+      healthAfter.switchReplyMisses - healthBefore.switchReplyMisses;
+  result->outputFrames = sim->GetStats().outputFrames - outputFramesBefore;
+  result->outputDeltaFrames =
+      sim->GetStats().outputDeltaFrames - deltaFramesBefore;
+}
+
+// Drives RS485Comm directly with a synthetic machine: one block of coils,
+// lamps and switches per board and a burst of config frames per board
+// standing in for a game's device config.
+bool RunSynthetic(const BenchOptions& options, BenchResult* result) {
+  Transport* hostTransport = NULL;
+  std::string devicePath;
+  BoardSimulator* sim = CreateBus(options, &hostTransport, &devicePath);
+  if (!sim) {
+    return false;
+  }
+
+  std::vector<uint8_t> boards;
+  std::vector<uint16_t> coils;
+  std::vector<uint16_t> lamps;
+  std::vector<uint16_t> switches;
+  std::unordered_map<uint8_t, std::vector<uint16_t>> switchesByBoard;
+  for (int b = 0; b < options.boards; ++b) {
+    const uint8_t board = static_cast<uint8_t>(b);
+    boards.push_back(board);
+    sim->AddBoard(board);
+    for (uint16_t i = 0; i < kSyntheticCoilsPerBoard; ++i) {
+      coils.push_back(static_cast<uint16_t>(b * 100 + i + 1));
+    }
+    for (uint16_t i = 0; i < kSyntheticLampsPerBoard; ++i) {
+      lamps.push_back(static_cast<uint16_t>(b * 100 + i + 1));
+    }
+    for (uint16_t i = 0; i < kSyntheticSwitchesPerBoard; ++i) {
+      const uint16_t number = static_cast<uint16_t>(b * 100 + i + 1);
+      switches.push_back(number);
+      switchesByBoard[board].push_back(number);
+    }
+  }
+  if (!sim->Start()) {
+    delete sim;
+    delete hostTransport;
+    return false;
+  }
+
+  RS485Comm* comm = new RS485Comm();
+  comm->SetSwitchReplyDelayUs(options.replyDelayUs);
+  comm->SetReceiveThreadEnabled(options.receiveThread);
+  comm->SetOutputDeltaFramesEnabled(options.deltaFrames);
+  comm->SetConfigWindow(options.configWindow);
+
+  const auto start = std::chrono::steady_clock::now();
+  const bool connected = hostTransport ? comm->Connect(hostTransport)
+                                       : comm->Connect(devicePath.c_str());
+  if (!connected) {
+    printf("Unable to connect to the simulated boards.\n");
+    delete comm;
+    sim->Stop();
+    delete sim;
+    return false;
+  }
+
+  ppuc::v2::RuntimeConfig config;
+  config.coilBits = static_cast<uint16_t>(coils.size());
+  config.lampBits = static_cast<uint16_t>(lamps.size());
+  config.switchBits = static_cast<uint16_t>(switches.size());
+  comm->SetRuntimeConfig(config);
+  comm->SetMappings(coils, lamps, switches);
+  comm->SetConfiguredBoards(boards);
+  comm->SetSwitchNumbersByBoard(switchesByBoard);
+
+  for (const uint8_t board : boards) {
+    for (int i = 0; i < options.configFramesPerBoard; ++i) {
+      comm->SendConfigEvent(new ConfigEvent(board, CONFIG_TOPIC_SWITCHES,
+                                            static_cast<uint8_t>(i % 16),
+                                            CONFIG_TOPIC_NUMBER,
+                                            static_cast<uint32_t>(i)));
+    }
+  }
+  comm->FlushConfigEvents();
+  comm->FinalizeConfiguredBoardPresence();
+  comm->SetActiveSwitchBoards(boards);
+  for (size_t i = 0; i < boards.size(); ++i) {
+    const uint8_t next =
+        i + 1 < boards.size() ? boards[i + 1] : ppuc::v2::kNoBoard;
+    comm->SendConfigEvent(new ConfigEvent(boards[i], CONFIG_TOPIC_SWITCH_CHAIN,
+                                          0, CONFIG_TOPIC_NEXT_BOARD, next));
+    comm->SendConfigEvent(new ConfigEvent(
+        boards[i], CONFIG_TOPIC_SWITCH_CHAIN, 1,
+        CONFIG_TOPIC_SWITCH_REPLY_DELAY_US, options.replyDelayUs));
+  }
+  comm->FlushConfigEvents();
+  const bool setUp = comm->SendSetupFrame() && comm->SendMappingFrames() &&
+                     !comm->HadConfigurationFailure();
+  result->startupMs = ElapsedMs(start);
+  if (!setUp) {
+    printf("Configuring the simulated boards failed.\n");
+  } else {
+    comm->Run();
+    MeasureRuntime(
+        options, sim,
+        [comm, &coils](int toggle) {
+          comm->SetCoilState(coils[toggle % coils.size()],
+                             (toggle / coils.size()) % 2 == 0);
+        },
+        [comm]() { return comm->GetBusHealth(); }, result);
+  }
+
+  comm->Disconnect();
+  delete comm;
+  sim->Stop();
+  delete sim;
+  return setUp;
+}
+
+// Runs a game YAML through PPUC. Every board number the protocol allows is
+// simulated, so whichever boards the config names are found.
+bool RunWithConfig(const BenchOptions& options, BenchResult* result) {
+  Transport* hostTransport = NULL;
+  std::string devicePath;
+  BoardSimulator* sim = CreateBus(options, &hostTransport, &devicePath);
+  if (!sim) {
+    return false;
+  }
+  for (uint8_t board = 0; board < ppuc::v2::kMaxBoards; ++board) {
+    sim->AddBoard(board);
+  }
+  if (!sim->Start()) {
+    delete sim;
+    delete hostTransport;
+    return false;
+  }
+
+  PPUC* ppuc = new PPUC();
+  ppuc->LoadConfiguration(options.configFile);
+  ppuc->SetSwitchReplyDelayUs(options.replyDelayUs);
+  ppuc->SetReceiveThreadEnabled(options.receiveThread);
+  ppuc->SetOutputDeltaFramesEnabled(options.deltaFrames);
+  ppuc->SetConfigWindow(options.configWindow);
+  if (hostTransport) {
+    ppuc->SetTransport(hostTransport);
+  } else {
+    ppuc->SetSerial(devicePath.c_str());
+  }
+
+  const auto compileStart = std::chrono::steady_clock::now();
+  try {
+    result->configRecords = ppuc->CompileConfiguration().records.size();
+  } catch (const std::exception&) {
+    // Connect() reports it.
+  }
+  result->compileMs = ElapsedMs(compileStart);
+
+  const auto start = std::chrono::steady_clock::now();
+  const bool connected = ppuc->Connect();
+  result->startupMs = ElapsedMs(start);
+  if (!connected) {
+    printf("PPUC::Connect() failed against the simulated boards.\n");
+  } else {
+    const std::vector<PPUCCoil> coils = ppuc->GetCoils();
+    MeasureRuntime(
+        options, sim,
+        [ppuc, &coils](int toggle) {
+          if (!coils.empty()) {
+            ppuc->SetSolenoidState(
+                coils[toggle % coils.size()].number,
+                (toggle / coils.size()) % 2 == 0 ? 1 : 0);
+          }
+        },
+        [ppuc]() { return ppuc->GetBusHealth(); }, result);
+  }
+
+  ppuc->Disconnect();
+  delete ppuc;
+  sim->Stop();
+  delete sim;
+  return connected;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage();
+    return 1;
+  }
+
+  BenchResult result;
+  const bool ok = options.configFile ? RunWithConfig(options, &result)
+                                     : RunSynthetic(options, &result);
+  if (!ok) {
+    return 1;
+  }
+
+  printf("boards:              %d\n", options.boards);
+  printf("transport:           %s\n", options.pty ? "pty" : "loopback");
+  printf("receive thread:      %s\n", options.receiveThread ? "yes" : "no");
+  printf("turnaround:          %u us\n", options.turnaroundUs);
+  printf("switch reply delay:  %u us\n", options.replyDelayUs);
+  if (options.configFile) {
+    printf("config records:      %zu (compiled in %.1f ms)\n",
+           result.configRecords, result.compileMs);
+  }
+  printf("startup:             %.1f ms\n", result.startupMs);
+  printf("switch chains:       %.1f /s (%u clean, %u missed)\n",
+         result.chains / result.seconds, result.cleanChains, result.misses);
+  printf("output frames:       %.1f /s (%u as deltas)\n",
+         result.outputFrames / result.seconds, result.outputDeltaFrames);
+  return 0;
+}
@@ -0,0 +1,192 @@
+// Microbenchmarks for the host's per-frame hot paths.
+//
+// Each case times the current code against the straightforward version it
+// replaced, on the same inputs, and prints nanoseconds per call for both.
+// The numbers are only comparable within one run on one machine.
+//
+// Usage: ppuc_microbench [--iterations N]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "RS485Comm.h"
+#include "SwitchBitmapDiff.h"
+#include "io-boards/Event.h"
+#include "io-boards/PPUCProtocolV2.h"
+
+namespace {
+
+// Keeps the compiler from discarding work whose result is otherwise unused.
+volatile uint32_t g_sink = 0;
+
+template <typename Body>
+double NsPerCall(int iterations, Body body) {
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    body(i);
+  }
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now() - start)
+             .count() /
+         iterations;
+}
+
+// ApplySwitchBitmapDiff() before it compared whole words: three bit reads
+// per switch, for every switch in the table.
+template <typename Visit>
+void ForEachChangedBitBitwise(const uint8_t* before, const uint8_t* after,
+                              const uint8_t* mask, uint16_t bits,
+                              Visit visit) {
+  for (uint16_t n = 0; n < bits; ++n) {
+    if (mask && !ppuc::v2::GetBitmapBit(mask, n)) {
+      continue;
+    }
+    const bool oldState = ppuc::v2::GetBitmapBit(before, n);
+    const bool newState = ppuc::v2::GetBitmapBit(after, n);
+    if (oldState != newState) {
+      visit(n, newState);
+    }
+  }
+}
+
+void BenchSwitchDiff(int iterations) {
+  const uint16_t bits = ppuc::v2::kMaxSwitchBits;
+  uint8_t mask[ppuc::v2::kMaxSwitchBytes];
+  // One board of eight owns every eighth byte's worth of switches.
+  memset(mask, 0, sizeof(mask));
+  for (size_t i = 0; i < sizeof(mask); i += 8) {
+    mask[i] = 0xFF;
+  }
+
+  printf("switch bitmap diff, %u switches (ns per reply):\n", bits);
+  printf("  %-24s %10s %10s\n", "changed", "bitwise", "word-wise");
+  const int changedCounts[] = {0, 1, 8, 64, 256};
+  for (const int changed : changedCounts) {
+    uint8_t before[ppuc::v2::kMaxSwitchBytes] = {0};
+    uint8_t after[ppuc::v2::kMaxSwitchBytes] = {0};
+    for (int i = 0; i < changed; ++i) {
+      ppuc::v2::SetBitmapBit(after, static_cast<uint16_t>((i * 37) % bits),
+                             true);
+    }
+    auto count = [](uint16_t n, bool state) { g_sink = g_sink + n + state; };
+    const double bitwise = NsPerCall(iterations, [&](int) {
+      ForEachChangedBitBitwise(before, after, nullptr, bits, count);
+    });
+    const double wordwise = NsPerCall(iterations, [&](int) {
+      ForEachChangedBit(before, after, nullptr, bits, count);
+    });
+    char label[32];
+    snprintf(label, sizeof(label), "%d", changed);
+    printf("  %-24s %10.1f %10.1f\n", label, bitwise, wordwise);
+  }
+
+  uint8_t before[ppuc::v2::kMaxSwitchBytes] = {0};
+  uint8_t after[ppuc::v2::kMaxSwitchBytes];
+  memset(after, 0xFF, sizeof(after));
+  auto count = [](uint16_t n, bool state) { g_sink = g_sink + n + state; };
+  const double bitwise = NsPerCall(iterations, [&](int) {
+    ForEachChangedBitBitwise(before, after, mask, bits, count);
+  });
+  const double wordwise = NsPerCall(iterations, [&](int) {
+    ForEachChangedBit(before, after, mask, bits, count);
+  });
+  printf("  %-24s %10.1f %10.1f\n", "all, 1/8 owned", bitwise, wordwise);
+}
+
+// QueueEvent() for a lamp before the dense tables: a hashed number lookup,
+// then the bit set under the state lock.
+class HashedLampPath {
+ public:
+  explicit HashedLampPath(const std::vector<uint16_t>& lamps) {
+    for (uint16_t i = 0; i < lamps.size(); ++i) {
+      m_lampNumberToIndex[lamps[i]] = i;
+    }
+  }
+
+  uint16_t IndexFor(uint16_t number) const {
+    auto it = m_lampNumberToIndex.find(number);
+    return it == m_lampNumberToIndex.end() ? RS485_COMM_UNMAPPED_INDEX
+                                           : it->second;
+  }
+
+  void QueueEvent(Event* event) {
+    auto it = m_lampNumberToIndex.find(event->eventId);
+    if (it != m_lampNumberToIndex.end() &&
+        it->second < ppuc::v2::kMaxLampBits) {
+      std::lock_guard<std::mutex> lock(m_stateMutex);
+      ppuc::v2::SetBitmapBit(m_lampBitmap, it->second, event->value != 0);
+    }
+    delete event;
+  }
+
+ private:
+  std::unordered_map<uint16_t, uint16_t> m_lampNumberToIndex;
+  std::mutex m_stateMutex;
+  uint8_t m_lampBitmap[ppuc::v2::kMaxLampBytes] = {0};
+};
+
+void BenchLampUpdates(int iterations) {
+  std::vector<uint16_t> lamps;
+  for (uint16_t n = 1; n <= 200; ++n) {
+    lamps.push_back(n);
+  }
+  HashedLampPath hashed(lamps);
+  RS485Comm comm;
+  comm.SetMappings({1}, lamps, {1});
+
+  std::vector<uint16_t> dense(201, RS485_COMM_UNMAPPED_INDEX);
+  for (uint16_t i = 0; i < lamps.size(); ++i) {
+    dense[lamps[i]] = i;
+  }
+
+  printf("lamp update, 200 lamps mapped (ns per call):\n");
+  const double hashedLookup = NsPerCall(iterations, [&](int i) {
+    g_sink = g_sink + hashed.IndexFor(static_cast<uint16_t>(1 + i % 200));
+  });
+  const double denseLookup = NsPerCall(iterations, [&](int i) {
+    const uint16_t number = static_cast<uint16_t>(1 + i % 200);
+    g_sink = g_sink + (number < dense.size() ? dense[number]
+                                             : RS485_COMM_UNMAPPED_INDEX);
+  });
+  const double before = NsPerCall(iterations, [&](int i) {
+    hashed.QueueEvent(new Event(EVENT_SOURCE_LIGHT, 1 + i % 200, i & 1));
+  });
+  const double queueEvent = NsPerCall(iterations, [&](int i) {
+    comm.QueueEvent(new Event(EVENT_SOURCE_LIGHT, 1 + i % 200, i & 1));
+  });
+  const double direct = NsPerCall(iterations, [&](int i) {
+    comm.SetLampState(static_cast<uint16_t>(1 + i % 200), (i & 1) != 0);
+  });
+  printf("  %-24s %10.1f\n", "hashed lookup only", hashedLookup);
+  printf("  %-24s %10.1f\n", "dense lookup only", denseLookup);
+  printf("  %-24s %10.1f\n", "hashed QueueEvent", before);
+  printf("  %-24s %10.1f\n", "dense QueueEvent", queueEvent);
+  printf("  %-24s %10.1f\n", "SetLampState", direct);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int iterations = 200000;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    } else {
+      printf("Usage: ppuc_microbench [--iterations N]\n");
+      return 1;
+    }
+  }
+  if (iterations < 1) {
+    iterations = 1;
+  }
+
+  BenchSwitchDiff(iterations);
+  BenchLampUpdates(iterations);
+  return 0;
+}
@@ -0,0 +1,959 @@
+#include "BoardSimulator.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "io-boards/Event.h"
+#include "io-boards/PPUCTimings.h"
+
+namespace {
+
+constexpr size_t kMaxOutputFrameBytes =
+    ppuc::v2::kHeaderBytes + ppuc::v2::kMaxCoilBytes +
+    ppuc::v2::kMaxLampBytes + ppuc::v2::kGiBytes + ppuc::v2::kCrcBytes;
+constexpr size_t kMaxSwitchFrameBytes =
+    ppuc::v2::kHeaderBytes + ppuc::v2::kSwitchStatusBytes +
+    ppuc::v2::kMaxSwitchBytes + ppuc::v2::kCrcBytes;
+constexpr size_t kMaxFrameBytes =
+    std::max({kMaxOutputFrameBytes, kMaxSwitchFrameBytes,
+              OutputDeltaEncoder::kMaxFrameBytes,
+              ppuc::v2::kUpdateChunkMaxFrameBytes, ppuc::v2::kAdminFrameBytes,
+              ppuc::v2::kConfigFrameBytes,
+              MultiKeyConfigFrame::kMaxFrameBytes});
+
+// Where a builder put the bytes of one integer field, lowest byte first.
+struct FieldLayout {
+  size_t offset[4] = {0, 0, 0, 0};
+  uint8_t width = 0;
+};
+
+// Builds the frame once with the field zero and once per byte with only that
+// byte set, and records which payload byte changed. Only assumes the field is
+// stored a whole byte at a time, which every v2 field is.
+template <typename Build>
+FieldLayout LocateField(Build build, uint8_t width) {
+  FieldLayout layout;
+  layout.width = width;
+  uint8_t base[kMaxFrameBytes] = {0};
+  uint8_t probe[kMaxFrameBytes] = {0};
+  const size_t frameBytes = build(base, 0u);
+  for (uint8_t b = 0; b < width; ++b) {
+    memset(probe, 0, sizeof(probe));
+    build(probe, 1u << (8 * b));
+    for (size_t i = ppuc::v2::kHeaderBytes;
+         i + ppuc::v2::kCrcBytes < frameBytes; ++i) {
+      if (probe[i] != base[i]) {
+        layout.offset[b] = i;
+        break;
+      }
+    }
+  }
+  return layout;
+}
+
+uint32_t ReadField(const uint8_t* frame, const FieldLayout& layout) {
+  uint32_t value = 0;
+  for (uint8_t b = 0; b < layout.width; ++b) {
+    value |= static_cast<uint32_t>(frame[layout.offset[b]]) << (8 * b);
+  }
+  return value;
+}
+
+// The inverse of ppuc::v2::ReadU32(), whichever byte order that uses.
+void StoreU32(uint8_t* dst, uint32_t value) {
+  static const bool bigEndian = [] {
+    const uint8_t probe[4] = {0x01, 0x02, 0x03, 0x04};
+    return ppuc::v2::ReadU32(probe) == 0x01020304u;
+  }();
+  for (int b = 0; b < 4; ++b) {
+    const uint8_t byte = static_cast<uint8_t>(value >> (8 * b));
+    dst[bigEndian ? 3 - b : b] = byte;
+  }
+}
+
+void WriteFrameCrc(uint8_t* frame, size_t frameBytes) {
+  const uint16_t crc =
+      ppuc::v2::Crc16Ccitt(frame, frameBytes - ppuc::v2::kCrcBytes);
+  frame[frameBytes - 2] = static_cast<uint8_t>(crc >> 8);
+  frame[frameBytes - 1] = static_cast<uint8_t>(crc & 0xFF);
+}
+
+struct Layouts {
+  FieldLayout configValue;
+  FieldLayout setupCoilBits;
+  FieldLayout setupLampBits;
+  FieldLayout setupSwitchBits;
+  FieldLayout mappingDomain;
+  FieldLayout mappingIndex;
+  FieldLayout mappingNumber;
+  FieldLayout updateBeginSize;
+  FieldLayout updateBeginCrc;
+  size_t adminDataOffset = 2;     // within the admin payload
+  size_t updateAckStatus = 2;     // within the admin payload
+  size_t updateAckOffset = 3;     // within the admin payload
+  size_t updateChunkOverhead = 0; // chunk frame bytes besides the data
+};
+
+const Layouts& GetLayouts() {
+  static const Layouts layouts = [] {
+    using namespace ppuc::v2;
+    Layouts l;
+    l.configValue = LocateField(
+        [](uint8_t* f, uint32_t v) {
+          BuildConfigFrame(f, kNoBoard, 0, 0, 0, 0, 0, 0, v);
+          return kConfigFrameBytes;
+        },
+        4);
+
+    auto setup = [](uint8_t* f, RuntimeConfig config) {
+      BuildSetupFrame(f, kNoBoard, 0, 0, config);
+      return kSetupFrameBytes;
+    };
+    l.setupCoilBits = LocateField(
+        [&](uint8_t* f, uint32_t v) {
+          RuntimeConfig c;
+          c.coilBits = static_cast<uint16_t>(v);
+          c.lampBits = 0;
+          c.switchBits = 0;
+          return setup(f, c);
+        },
+        2);
+    l.setupLampBits = LocateField(
+        [&](uint8_t* f, uint32_t v) {
+          RuntimeConfig c;
+          c.coilBits = 0;
+          c.lampBits = static_cast<uint16_t>(v);
+          c.switchBits = 0;
+          return setup(f, c);
+        },
+        2);
+    l.setupSwitchBits = LocateField(
+        [&](uint8_t* f, uint32_t v) {
+          RuntimeConfig c;
+          c.coilBits = 0;
+          c.lampBits = 0;
+          c.switchBits = static_cast<uint16_t>(v);
+          return setup(f, c);
+        },
+        2);
+
+    l.mappingDomain = LocateField(
+        [](uint8_t* f, uint32_t v) {
+          BuildMappingFrame(f, kNoBoard, 0, 0, static_cast<uint8_t>(v), 0, 0);
+          return kMappingFrameBytes;
+        },
+        1);
+    l.mappingIndex = LocateField(
+        [](uint8_t* f, uint32_t v) {
+          BuildMappingFrame(f, kNoBoard, 0, 0, 0, static_cast<uint16_t>(v), 0);
+          return kMappingFrameBytes;
+        },
+        2);
+    l.mappingNumber = LocateField(
+        [](uint8_t* f, uint32_t v) {
+          BuildMappingFrame(f, kNoBoard, 0, 0, 0, 0, static_cast<uint16_t>(v));
+          return kMappingFrameBytes;
+        },
+        2);
+
+    l.updateBeginSize = LocateField(
+        [](uint8_t* f, uint32_t v) {
+          BuildUpdateBeginFrame(f, 0, 0, 0, v, 0);
+          return kUpdateBeginFrameBytes;
+        },
+        4);
+    l.updateBeginCrc = LocateField(
+        [](uint8_t* f, uint32_t v) {
+          BuildUpdateBeginFrame(f, 0, 0, 0, 0, static_cast<uint16_t>(v));
+          return kUpdateBeginFrameBytes;
+        },
+        2);
+
+    // Admin replies are read on the host with ReadAdminPayload() and
+    // ReadUpdateAck(), so ask those where they look.
+    uint8_t payload[kAdminFrameBytes] = {0};
+    for (size_t i = 0; i < sizeof(payload); ++i) {
+      payload[i] = static_cast<uint8_t>(i);
+    }
+    uint8_t command = 0;
+    uint8_t board = 0;
+    uint8_t data[kAdminDataBytes] = {0};
+    ReadAdminPayload(payload, command, board, data);
+    l.adminDataOffset = data[0];
+
+    uint8_t status = 0;
+    uint32_t offset = 0;
+    ReadUpdateAck(payload, status, offset);
+    l.updateAckStatus = status;
+    for (size_t i = 0; i + 4 <= kAdminFrameBytes - kHeaderBytes - kCrcBytes;
+         ++i) {
+      memset(payload, 0, sizeof(payload));
+      StoreU32(&payload[i], 0x5AA5C33Cu);
+      ReadUpdateAck(payload, status, offset);
+      if (offset == 0x5AA5C33Cu) {
+        l.updateAckOffset = i;
+        break;
+      }
+    }
+
+    uint8_t chunk[kUpdateChunkMaxFrameBytes] = {0};
+    l.updateChunkOverhead = BuildUpdateChunkFrame(chunk, 0, 0, 0, 0, data, 0);
+    return l;
+  }();
+  return layouts;
+}
+
+}  // namespace
+
+BoardSimulator::BoardSimulator(Transport* transport) {
+  m_pTransport = transport;
+  m_pThread = NULL;
+  m_turnaroundUs = RS485_MODE_SWITCH_DELAY;
+  GetLayouts();
+}
+
+BoardSimulator::~BoardSimulator() {
+  Stop();
+  delete m_pTransport;
+}
+
+void BoardSimulator::AddBoard(uint8_t number) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (number >= ppuc::v2::kMaxBoards || FindBoard(number)) {
+    return;
+  }
+  Board board;
+  board.number = number;
+  board.version.board = number;
+  m_boards.push_back(board);
+}
+
+void BoardSimulator::SetBoardVersion(uint8_t number,
+                                     const PPUCBoardVersion& version) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (Board* board = FindBoard(number)) {
+    board->version = version;
+  }
+}
+
+void BoardSimulator::SetTurnaroundUs(uint32_t turnaroundUs) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_turnaroundUs = turnaroundUs;
+}
+
+void BoardSimulator::SetBoardOnline(uint8_t number, bool online) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (Board* board = FindBoard(number)) {
+    board->online = online;
+  }
+}
+
+bool BoardSimulator::Start() {
+  if (m_pThread || m_pTransport == NULL || !m_pTransport->IsOpen()) {
+    return false;
+  }
+  m_stopRequested = false;
+  m_pThread = new std::thread([this]() { RunLoop(); });
+  return true;
+}
+
+void BoardSimulator::Stop() {
+  m_stopRequested = true;
+  if (m_pThread) {
+    if (m_pThread->joinable()) {
+      m_pThread->join();
+    }
+    delete m_pThread;
+    m_pThread = NULL;
+  }
+}
+
+void BoardSimulator::SetSwitchState(uint8_t number, uint16_t switchNumber,
+                                    bool state) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Board* board = FindBoard(number);
+  if (!board) {
+    return;
+  }
+  auto it = board->switchStates.find(switchNumber);
+  if (it != board->switchStates.end() && it->second == state) {
+    return;
+  }
+  board->switchStates[switchNumber] = state;
+  board->switchesDirty = true;
+}
+
+bool BoardSimulator::GetCoilState(uint16_t number) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (size_t i = 0; i < m_coilIndexToNumber.size(); ++i) {
+    if (m_coilIndexToNumber[i] == number) {
+      return ppuc::v2::GetBitmapBit(m_coilBitmap, static_cast<uint16_t>(i));
+    }
+  }
+  return false;
+}
+
+bool BoardSimulator::GetLampState(uint16_t number) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (size_t i = 0; i < m_lampIndexToNumber.size(); ++i) {
+    if (m_lampIndexToNumber[i] == number) {
+      return ppuc::v2::GetBitmapBit(m_lampBitmap, static_cast<uint16_t>(i));
+    }
+  }
+  return false;
+}
+
+uint8_t BoardSimulator::GetGILevel(uint8_t string) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (string == 0 || string > ppuc::v2::kGiStrings) {
+    return 0;
+  }
+  return m_giLevels[string - 1];
+}
+
+bool BoardSimulator::IsBoardSetUp(uint8_t number) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const Board* board = FindBoard(number);
+  return board && board->setUp;
+}
+
+bool BoardSimulator::GetConfigValue(uint8_t number, uint8_t topic,
+                                    uint8_t index, uint8_t key,
+                                    uint32_t* value) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const Board* board = FindBoard(number);
+  if (!board) {
+    return false;
+  }
+  auto it = board->config.find(std::make_tuple(topic, index, key));
+  if (it == board->config.end()) {
+    return false;
+  }
+  if (value) {
+    *value = it->second;
+  }
+  return true;
+}
+
+std::vector<uint8_t> BoardSimulator::GetReceivedImage(uint8_t number) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const Board* board = FindBoard(number);
+  return board ? board->image : std::vector<uint8_t>();
+}
+
+BoardSimulatorStats BoardSimulator::GetStats() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_stats;
+}
+
+BoardSimulator::Board* BoardSimulator::FindBoard(uint8_t number) {
+  for (Board& board : m_boards) {
+    if (board.number == number) {
+      return &board;
+    }
+  }
+  return nullptr;
+}
+
+const BoardSimulator::Board* BoardSimulator::FindBoard(uint8_t number) const {
+  for (const Board& board : m_boards) {
+    if (board.number == number) {
+      return &board;
+    }
+  }
+  return nullptr;
+}
+
+void BoardSimulator::RunLoop() {
+  uint8_t chunk[256];
+  while (!m_stopRequested) {
+    // Replies go out in the order their turnarounds expire. The bus is ours
+    // while one is pending: the host is waiting for it, not talking.
+    std::chrono::steady_clock::time_point due;
+    bool haveReply = false;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (!m_pendingReplies.empty()) {
+        due = m_pendingReplies.front().due;
+        haveReply = true;
+      }
+    }
+    if (haveReply) {
+      std::this_thread::sleep_until(due);
+      std::lock_guard<std::mutex> lock(m_mutex);
+      PendingReply reply = std::move(m_pendingReplies.front());
+      m_pendingReplies.pop_front();
+      Board* board = FindBoard(reply.board);
+      if (!board || !board->online) {
+        continue;
+      }
+      if (reply.token) {
+        SendSwitchReply(*board);
+      } else {
+        m_pTransport->Write(reply.frame.data(), reply.frame.size(), 20);
+      }
+      continue;
+    }
+
+    // Block for the first byte only, then take whatever else has arrived, so
+    // a frame is handled as soon as its last byte lands.
+    int read = m_pTransport->Read(chunk, 1, 1);
+    if (read <= 0) {
+      continue;
+    }
+    const int waiting = m_pTransport->InputWaiting();
+    if (waiting > 0) {
+      const int more = m_pTransport->Read(
+          &chunk[1], std::min<size_t>(waiting, sizeof(chunk) - 1), 1);
+      if (more > 0) {
+        read += more;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_input.insert(m_input.end(), chunk, chunk + read);
+    ProcessInput();
+  }
+}
+
+size_t BoardSimulator::FrameBytesFor(const uint8_t* header) const {
+  using namespace ppuc::v2;
+  switch (ExtractType(header[1])) {
+    case kFrameSetup:
+      return kSetupFrameBytes;
+    case kFrameMapping:
+      return kMappingFrameBytes;
+    case kFrameConfig:
+      return MultiKeyConfigFrame::IsMultiKeyFrame(header)
+                 ? MultiKeyConfigFrame::FrameBytes(header)
+                 : kConfigFrameBytes;
+    case kFrameConfigAck:
+      return kConfigAckFrameBytes;
+    case kFrameTrigger:
+      return kTriggerFrameBytes;
+    case kFrameRestart:
+    case kFrameReset:
+    case kFrameSwitchRefresh:
+    case kFrameHeartbeat:
+    case kFrameError:
+      return kHeaderBytes + kCrcBytes;
+    case kFrameOutputState:
+      if (!m_haveRuntimeConfig) {
+        return 0;
+      }
+      return OutputDeltaEncoder::IsDeltaFrame(header)
+                 ? OutputDeltaEncoder::DeltaFrameBytes(header)
+                 : m_outputFrameBytes;
+    case kFrameSwitchState:
+      return m_haveRuntimeConfig ? kHeaderBytes +
+                                       SwitchPayloadBytes(m_runtimeConfig) +
+                                       kCrcBytes
+                                 : 0;
+    case kFrameSwitchNoChange:
+      return kHeaderBytes + SwitchNoChangePayloadBytes() + kCrcBytes;
+    case kFrameAdmin:
+      return kAdminFrameBytes;
+    default:
+      return 0;
+  }
+}
+
+void BoardSimulator::ProcessInput() {
+  using namespace ppuc::v2;
+  while (!m_input.empty()) {
+    if (m_input[0] != kSyncByte) {
+      auto sync = std::find(m_input.begin(), m_input.end(), kSyncByte);
+      m_stats.discardedBytes +=
+          static_cast<uint32_t>(std::distance(m_input.begin(), sync));
+      m_input.erase(m_input.begin(), sync);
+      continue;
+    }
+    if (m_input.size() < kHeaderBytes + 2) {
+      return;
+    }
+
+    // Update chunks are the one variable-length frame a board has to take in
+    // without knowing its length up front.
+    const uint8_t* payload = &m_input[kHeaderBytes];
+    if (ExtractType(m_input[1]) == kFrameAdmin &&
+        payload[0] == kAdminUpdateChunk) {
+      Board* board = FindBoard(payload[1]);
+      if (board && board->online && board->updating) {
+        const ChunkResult result = TryTakeUpdateChunk(*board);
+        if (result == ChunkResult::NeedMore) {
+          return;
+        }
+        if (result == ChunkResult::Taken) {
+          continue;
+        }
+      }
+      m_input.erase(m_input.begin());
+      ++m_stats.discardedBytes;
+      continue;
+    }
+
+    // A multi-key config frame's length is in its prefix.
+    if (MultiKeyConfigFrame::IsMultiKeyFrame(m_input.data()) &&
+        m_input.size() < kHeaderBytes + MultiKeyConfigFrame::kPrefixBytes) {
+      return;
+    }
+
+    const size_t frameBytes = FrameBytesFor(m_input.data());
+    if (frameBytes == 0) {
+      m_input.erase(m_input.begin());
+      ++m_stats.discardedBytes;
+      continue;
+    }
+    if (m_input.size() < frameBytes) {
+      return;
+    }
+    if (!VerifyCrc(m_input.data(), frameBytes)) {
+      ++m_stats.crcErrors;
+      m_input.erase(m_input.begin());
+      ++m_stats.discardedBytes;
+      continue;
+    }
+
+    uint8_t frame[kMaxFrameBytes];
+    memcpy(frame, m_input.data(), frameBytes);
+    m_input.erase(m_input.begin(), m_input.begin() + frameBytes);
+    HandleFrame(frame, frameBytes);
+  }
+}
+
+BoardSimulator::ChunkResult BoardSimulator::TryTakeUpdateChunk(Board& board) {
+  using namespace ppuc::v2;
+  const Layouts& layouts = GetLayouts();
+  // The frame is recognised by rebuilding it: for each possible length, the
+  // data is whatever sits in front of the CRC, and the frame is ours if the
+  // builder reproduces it byte for byte. A retry of the previous chunk is
+  // matched the same way and acknowledged again.
+  uint8_t rebuilt[kUpdateChunkMaxFrameBytes];
+  for (uint16_t length = 1; length <= kAdminChunkBytes; ++length) {
+    const size_t frameBytes = layouts.updateChunkOverhead + length;
+    if (m_input.size() < frameBytes) {
+      return ChunkResult::NeedMore;
+    }
+    if (!VerifyCrc(m_input.data(), frameBytes)) {
+      continue;
+    }
+    const uint8_t* data = &m_input[frameBytes - kCrcBytes - length];
+    const uint32_t offsets[2] = {static_cast<uint32_t>(board.image.size()),
+                                 board.lastChunkOffset};
+    for (const uint32_t offset : offsets) {
+      const size_t built = BuildUpdateChunkFrame(
+          rebuilt, board.number, m_input[3], m_input[4], offset, data, length);
+      if (built != frameBytes || memcmp(rebuilt, m_input.data(), built) != 0) {
+        continue;
+      }
+      if (offset == board.image.size()) {
+        board.lastChunkOffset = offset;
+        board.image.insert(board.image.end(), data, data + length);
+      }
+      m_input.erase(m_input.begin(), m_input.begin() + frameBytes);
+      QueueUpdateAck(board, kAdminUpdateChunkAck, kUpdateOk, offset);
+      return ChunkResult::Taken;
+    }
+  }
+  return ChunkResult::NoMatch;
+}
+
+void BoardSimulator::HandleFrame(const uint8_t* frame, size_t bytes) {
+  using namespace ppuc::v2;
+  const FrameType type = ExtractType(frame[1]);
+  const bool fromHost = type != kFrameSwitchState &&
+                        type != kFrameSwitchNoChange &&
+                        type != kFrameConfigAck;
+  if (type == kFrameAdmin) {
+    const uint8_t command = frame[kHeaderBytes];
+    if (command != kAdminVersionQuery && command != kAdminUpdateBegin &&
+        command != kAdminUpdateCommit &&
+        command != ConfigFingerprint::kAdminQuery) {
+      return;  // another board's reply
+    }
+  }
+  if (fromHost) {
+    m_epoch = frame[4];
+  }
+
+  switch (type) {
+    case kFrameConfig:
+      HandleConfigFrame(frame);
+      break;
+    case kFrameSetup:
+      HandleSetupFrame(frame);
+      break;
+    case kFrameMapping:
+      HandleMappingFrame(frame);
+      break;
+    case kFrameOutputState:
+      HandleOutputFrame(frame, bytes);
+      break;
+    case kFrameSwitchRefresh:
+      ++m_stats.switchRefreshFrames;
+      m_lastHostSequence = frame[3];
+      m_refreshRound = true;
+      PassToken(frame[2]);
+      break;
+    case kFrameSwitchState:
+    case kFrameSwitchNoChange:
+      PassToken(frame[2]);
+      break;
+    case kFrameRestart:
+    case kFrameReset:
+      if (type == kFrameRestart) {
+        ++m_stats.restarts;
+      } else {
+        ++m_stats.resets;
+      }
+      for (Board& board : m_boards) {
+        if (board.online) {
+          ResetBoardState(board, type == kFrameRestart);
+        }
+      }
+      m_pendingReplies.clear();
+      m_haveRuntimeConfig = false;
+      m_coilIndexToNumber.clear();
+      m_lampIndexToNumber.clear();
+      m_switchIndexToNumber.clear();
+      break;
+    case kFrameAdmin:
+      HandleAdminFrame(frame);
+      break;
+    default:
+      break;
+  }
+}
+
+void BoardSimulator::ResetBoardState(Board& board, bool keepConfig) {
+  board.setUp = false;
+  board.switchesDirty = true;
+  board.nextBoard = ppuc::v2::kNoBoard;
+  board.replyDelayUs = 0;
+  board.updating = false;
+  board.startNewConfig = true;
+  if (!keepConfig) {
+    board.config.clear();
+    board.fingerprint.Reset();
+    board.holdsConfig = false;
+  }
+}
+
+void BoardSimulator::HandleConfigFrame(const uint8_t* frame) {
+  using namespace ppuc::v2;
+  const uint8_t* payload = &frame[kHeaderBytes];
+  Board* board = FindBoard(payload[0]);
+  if (!board || !board->online) {
+    return;
+  }
+
+  uint8_t ack[kConfigAckFrameBytes] = {0};
+  if (MultiKeyConfigFrame::IsMultiKeyFrame(frame)) {
+    // Firmware that does not report the capability does not know the frame.
+    if ((board->version.capabilities & MultiKeyConfigFrame::kCapability) ==
+        0) {
+      return;
+    }
+    for (uint8_t i = 0; i < payload[3]; ++i) {
+      uint8_t key = 0;
+      uint32_t value = 0;
+      MultiKeyConfigFrame::ReadKey(frame, i, &key, &value);
+      ApplyConfig(*board, payload[1], static_cast<uint8_t>(payload[2] + i),
+                  key, value);
+    }
+    MultiKeyConfigFrame::BuildAck(ack, board->sequence++, m_epoch, frame,
+                                  kConfigAckAccepted);
+    ++m_stats.multiKeyConfigFrames;
+  } else {
+    ApplyConfig(*board, payload[1], payload[2], payload[3],
+                ReadField(frame, GetLayouts().configValue));
+    BuildBareFrame(ack, kFrameConfigAck, kFlagNone, kNoBoard,
+                   board->sequence++, m_epoch);
+    memcpy(&ack[kHeaderBytes], payload, 4);
+    ack[kHeaderBytes + 4] = kConfigAckAccepted;
+    WriteFrameCrc(ack, sizeof(ack));
+  }
+  ++m_stats.configFramesAcked;
+  QueueReply(*board, ack, sizeof(ack));
+}
+
+void BoardSimulator::ApplyConfig(Board& board, uint8_t topic, uint8_t index,
+                                 uint8_t key, uint32_t value) {
+  if (ConfigFingerprint::Covers(topic)) {
+    if (board.startNewConfig) {
+      board.config.clear();
+      board.fingerprint.Reset();
+      board.startNewConfig = false;
+    }
+    board.fingerprint.Add(topic, index, key, value);
+    board.holdsConfig = true;
+  }
+  board.config[std::make_tuple(topic, index, key)] = value;
+  if (topic == CONFIG_TOPIC_SWITCH_CHAIN && key == CONFIG_TOPIC_NEXT_BOARD) {
+    board.nextBoard = static_cast<uint8_t>(value);
+  } else if (topic == CONFIG_TOPIC_SWITCH_CHAIN &&
+             key == CONFIG_TOPIC_SWITCH_REPLY_DELAY_US) {
+    board.replyDelayUs = value;
+  }
+}
+
+void BoardSimulator::HandleSetupFrame(const uint8_t* frame) {
+  using namespace ppuc::v2;
+  const Layouts& layouts = GetLayouts();
+  RuntimeConfig config;
+  config.coilBits =
+      static_cast<uint16_t>(ReadField(frame, layouts.setupCoilBits));
+  config.lampBits =
+      static_cast<uint16_t>(ReadField(frame, layouts.setupLampBits));
+  config.switchBits =
+      static_cast<uint16_t>(ReadField(frame, layouts.setupSwitchBits));
+  ++m_stats.setupFrames;
+  if (!IsValidRuntimeConfig(config)) {
+    return;
+  }
+
+  m_runtimeConfig = config;
+  m_haveRuntimeConfig = true;
+  m_outputDecoder.SetRuntimeConfig(config);
+
+  // Where the bitmaps sit depends on the sizes just announced.
+  uint8_t coils[kMaxCoilBytes] = {0};
+  uint8_t lamps[kMaxLampBytes] = {0};
+  uint8_t gi[kGiStrings] = {0};
+  uint8_t base[kMaxOutputFrameBytes] = {0};
+  uint8_t probe[kMaxOutputFrameBytes] = {0};
+  m_outputFrameBytes = kHeaderBytes + BitsToBytes(config.coilBits) +
+                       BitsToBytes(config.lampBits) + kGiBytes + kCrcBytes;
+  BuildOutputStateFrame(base, kNoBoard, 0, 0, config, coils, lamps, gi);
+  auto locate = [&]() -> size_t {
+    for (size_t i = kHeaderBytes; i + kCrcBytes < m_outputFrameBytes; ++i) {
+      if (probe[i] != base[i]) {
+        return i;
+      }
+    }
+    return kHeaderBytes;
+  };
+  coils[0] = 1;
+  BuildOutputStateFrame(probe, kNoBoard, 0, 0, config, coils, lamps, gi);
+  m_outputCoilOffset = locate();
+  coils[0] = 0;
+  lamps[0] = 1;
+  BuildOutputStateFrame(probe, kNoBoard, 0, 0, config, coils, lamps, gi);
+  m_outputLampOffset = locate();
+  lamps[0] = 0;
+  gi[0] = 1;
+  BuildOutputStateFrame(probe, kNoBoard, 0, 0, config, coils, lamps, gi);
+  m_outputGiOffset = locate();
+
+  for (Board& board : m_boards) {
+    if (board.online) {
+      board.setUp = true;
+      board.switchesDirty = true;
+    }
+  }
+}
+
+void BoardSimulator::HandleMappingFrame(const uint8_t* frame) {
+  using namespace ppuc::v2;
+  const Layouts& layouts = GetLayouts();
+  const uint8_t domain =
+      static_cast<uint8_t>(ReadField(frame, layouts.mappingDomain));
+  const uint16_t index =
+      static_cast<uint16_t>(ReadField(frame, layouts.mappingIndex));
+  const uint16_t number =
+      static_cast<uint16_t>(ReadField(frame, layouts.mappingNumber));
+  ++m_stats.mappingFrames;
+
+  std::vector<uint16_t>* table = nullptr;
+  if (domain == kDomainCoil) {
+    table = &m_coilIndexToNumber;
+  } else if (domain == kDomainLamp) {
+    table = &m_lampIndexToNumber;
+  } else if (domain == kDomainSwitch) {
+    table = &m_switchIndexToNumber;
+  }
+  if (!table) {
+    return;
+  }
+  if (table->size() <= index) {
+    table->resize(index + 1, 0xFFFF);
+  }
+  (*table)[index] = number;
+  if (domain == kDomainSwitch) {
+    for (Board& board : m_boards) {
+      board.switchesDirty = true;
+    }
+  }
+}
+
+void BoardSimulator::HandleOutputFrame(const uint8_t* frame, size_t bytes) {
+  using namespace ppuc::v2;
+  ++m_stats.outputFrames;
+  m_lastHostSequence = frame[3];
+  m_refreshRound = false;
+  // A delta against a frame that never arrived leaves the outputs as they
+  // were until the next full frame; the token is passed on regardless.
+  if (OutputDeltaEncoder::IsDeltaFrame(frame)) {
+    ++m_stats.outputDeltaFrames;
+  }
+  if (m_outputDecoder.Apply(frame, bytes)) {
+    const uint8_t* payload = m_outputDecoder.GetPayload();
+    memcpy(m_coilBitmap, &payload[m_outputCoilOffset - kHeaderBytes],
+           BitsToBytes(m_runtimeConfig.coilBits));
+    memcpy(m_lampBitmap, &payload[m_outputLampOffset - kHeaderBytes],
+           BitsToBytes(m_runtimeConfig.lampBits));
+    memcpy(m_giLevels, &payload[m_outputGiOffset - kHeaderBytes], kGiBytes);
+  } else {
+    ++m_stats.outputDeltasRejected;
+  }
+  PassToken(frame[2]);
+}
+
+void BoardSimulator::PassToken(uint8_t nextBoard) {
+  Board* board = FindBoard(nextBoard);
+  if (!board || !board->online) {
+    return;
+  }
+  PendingReply reply;
+  reply.due = std::chrono::steady_clock::now() +
+              std::chrono::microseconds(m_turnaroundUs + board->replyDelayUs);
+  reply.token = true;
+  reply.board = board->number;
+  m_pendingReplies.push_back(std::move(reply));
+}
+
+void BoardSimulator::SendSwitchReply(Board& board) {
+  using namespace ppuc::v2;
+  if (!m_haveRuntimeConfig) {
+    return;
+  }
+
+  const bool sendState = board.switchesDirty || m_refreshRound;
+  const size_t switchBytes = BitsToBytes(m_runtimeConfig.switchBits);
+  uint8_t bitmap[kMaxSwitchBytes] = {0};
+  for (size_t i = 0;
+       i < m_switchIndexToNumber.size() && i < m_runtimeConfig.switchBits;
+       ++i) {
+    auto it = board.switchStates.find(m_switchIndexToNumber[i]);
+    if (it != board.switchStates.end() && it->second) {
+      SetBitmapBit(bitmap, static_cast<uint16_t>(i), true);
+    }
+  }
+
+  const uint8_t status = board.setUp ? kStatusInSync : kStatusNeedsSetup;
+  uint8_t frame[kMaxSwitchFrameBytes];
+  BuildSwitchReplyFrame(frame, sendState, board.nextBoard, board.sequence++,
+                        m_epoch, m_epoch, m_lastHostSequence, status, bitmap,
+                        switchBytes);
+  const size_t frameBytes =
+      kHeaderBytes +
+      (sendState ? SwitchPayloadBytes(m_runtimeConfig)
+                 : SwitchNoChangePayloadBytes()) +
+      kCrcBytes;
+  m_pTransport->Write(frame, frameBytes, 20);
+  board.switchesDirty = false;
+  ++m_stats.switchReplies;
+  if (sendState) {
+    ++m_stats.switchStateReplies;
+  }
+
+  // Every board hears this reply, and the one it names answers next.
+  HandleFrame(frame, frameBytes);
+}
+
+void BoardSimulator::QueueReply(const Board& board, const uint8_t* frame,
+                                size_t bytes) {
+  PendingReply reply;
+  reply.due = std::chrono::steady_clock::now() +
+              std::chrono::microseconds(m_turnaroundUs);
+  reply.board = board.number;
+  reply.frame.assign(frame, frame + bytes);
+  m_pendingReplies.push_back(std::move(reply));
+}
+
+void BoardSimulator::QueueAdminReply(const Board& board, uint8_t command,
+                                     const uint8_t* data) {
+  using namespace ppuc::v2;
+  uint8_t frame[kAdminFrameBytes] = {0};
+  BuildBareFrame(frame, kFrameAdmin, kFlagNone, kNoBoard, 0, m_epoch);
+  memset(&frame[kHeaderBytes], 0, kAdminFrameBytes - kHeaderBytes);
+  frame[kHeaderBytes] = command;
+  frame[kHeaderBytes + 1] = board.number;
+  memcpy(&frame[kHeaderBytes + GetLayouts().adminDataOffset], data,
+         kAdminDataBytes);
+  WriteFrameCrc(frame, sizeof(frame));
+  ++m_stats.adminReplies;
+  QueueReply(board, frame, sizeof(frame));
+}
+
+void BoardSimulator::QueueUpdateAck(const Board& board, uint8_t command,
+                                    uint8_t status, uint32_t offset) {
+  using namespace ppuc::v2;
+  const Layouts& layouts = GetLayouts();
+  uint8_t frame[kUpdateAckFrameBytes] = {0};
+  BuildBareFrame(frame, kFrameAdmin, kFlagNone, kNoBoard, 0, m_epoch);
+  memset(&frame[kHeaderBytes], 0, kUpdateAckFrameBytes - kHeaderBytes);
+  frame[kHeaderBytes] = command;
+  frame[kHeaderBytes + 1] = board.number;
+  frame[kHeaderBytes + layouts.updateAckStatus] = status;
+  StoreU32(&frame[kHeaderBytes + layouts.updateAckOffset], offset);
+  WriteFrameCrc(frame, sizeof(frame));
+  ++m_stats.adminReplies;
+  QueueReply(board, frame, sizeof(frame));
+}
+
+void BoardSimulator::HandleAdminFrame(const uint8_t* frame) {
+  using namespace ppuc::v2;
+  const uint8_t* payload = &frame[kHeaderBytes];
+  Board* board = FindBoard(payload[1]);
+  if (!board || !board->online) {
+    return;
+  }
+
+  const Layouts& layouts = GetLayouts();
+  switch (payload[0]) {
+    case kAdminVersionQuery: {
+      uint8_t data[kAdminDataBytes] = {0};
+      data[kAdminVersionFirmwareMajor] = board->version.firmwareMajor;
+      data[kAdminVersionFirmwareMinor] = board->version.firmwareMinor;
+      data[kAdminVersionFirmwarePatch] = board->version.firmwarePatch;
+      data[kAdminVersionProtocolMajor] = board->version.adminProtocolMajor;
+      data[kAdminVersionProtocolMinor] = board->version.adminProtocolMinor;
+      data[kAdminVersionCapabilities] = board->version.capabilities;
+      data[kAdminVersionBoardType] = board->version.boardType;
+      StoreU32(&data[kAdminVersionBuildId], board->version.buildId);
+      QueueAdminReply(*board, kAdminVersionReport, data);
+      break;
+    }
+    case ConfigFingerprint::kAdminQuery: {
+      uint8_t data[kAdminDataBytes] = {0};
+      StoreU32(data, board->holdsConfig ? board->fingerprint.Value()
+                                        : ConfigFingerprint::kNone);
+      QueueAdminReply(*board, ConfigFingerprint::kAdminReport, data);
+      break;
+    }
+    case kAdminUpdateBegin:
+      board->image.clear();
+      board->lastChunkOffset = 0;
+      board->imageBytes = ReadField(frame, layouts.updateBeginSize);
+      board->imageCrc =
+          static_cast<uint16_t>(ReadField(frame, layouts.updateBeginCrc));
+      board->updating = true;
+      QueueUpdateAck(*board, kAdminUpdateBeginAck, kUpdateOk, 0);
+      break;
+    case kAdminUpdateCommit: {
+      const bool intact =
+          board->updating && board->image.size() == board->imageBytes &&
+          Crc16Ccitt(board->image.data(), board->image.size()) ==
+              board->imageCrc;
+      board->updating = false;
+      // Any status other than kUpdateOk reads as a failed update on the host.
+      QueueUpdateAck(*board, kAdminUpdateResult,
+                     intact ? kUpdateOk : static_cast<uint8_t>(0xFF),
+                     static_cast<uint32_t>(board->image.size()));
+      break;
+    }
+    default:
+      break;
+  }
+}
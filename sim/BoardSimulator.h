@@ -0,0 +1,186 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "ConfigFingerprint.h"
+#include "MultiKeyConfig.h"
+#include "OutputDelta.h"
+#include "PPUC_structs.h"
+#include "Transport.h"
+#include "io-boards/PPUCProtocolV2.h"
+
+// Counters for what the simulated boards saw and sent, for benchmarks to
+// divide by wall time and for soak tests to compare against the host's own
+// PPUCBusHealth.
+struct BoardSimulatorStats {
+  uint32_t configFramesAcked = 0;
+  uint32_t multiKeyConfigFrames = 0;  // of configFramesAcked, multi-key
+  uint32_t setupFrames = 0;
+  uint32_t mappingFrames = 0;
+  uint32_t outputFrames = 0;
+  uint32_t outputDeltaFrames = 0;     // of outputFrames, sent as deltas
+  uint32_t outputDeltasRejected = 0;  // deltas against a frame not seen
+  uint32_t switchRefreshFrames = 0;
+  uint32_t switchReplies = 0;       // state and no-change replies together
+  uint32_t switchStateReplies = 0;  // replies that carried a bitmap
+  uint32_t restarts = 0;
+  uint32_t resets = 0;
+  uint32_t adminReplies = 0;
+  uint32_t crcErrors = 0;
+  uint32_t discardedBytes = 0;  // bytes skipped while hunting for a frame
+};
+
+// Emulates up to eight io-boards on the far end of a Transport, speaking
+// PPUCProtocolV2 the way the firmware does: config frames are acknowledged,
+// setup and mapping frames are applied, the switch token is passed along the
+// configured chain, and admin version, config fingerprint and firmware
+// update frames are answered.
+//
+// Meant for benchmarks and soak tests, not for checking the firmware. Every
+// simulated board hears every frame on the bus, including the other simulated
+// boards' replies and the host's stand-in replies for virtualized boards, so
+// the token chain behaves as it does on a cabinet: a board answers when the
+// frame in front of it names it as next.
+//
+// Frames are decoded by locating each field through the builders in
+// PPUCProtocolV2.h rather than by restating the layout here, so the simulator
+// follows the header instead of drifting from it.
+class BoardSimulator {
+ public:
+  // Takes ownership of the transport, which must already be open.
+  explicit BoardSimulator(Transport* transport);
+  ~BoardSimulator();
+
+  // Adds a board before Start(). Boards not added stay silent, as an absent
+  // board would.
+  void AddBoard(uint8_t number);
+
+  // What a board reports when asked for its version. responded and board are
+  // ignored. A board whose capabilities include
+  // MultiKeyConfigFrame::kCapability also takes multi-key config frames.
+  void SetBoardVersion(uint8_t board, const PPUCBoardVersion& version);
+
+  // Time from the end of the frame that hands a board the token to the start
+  // of its reply: the RS485 driver turnaround plus firmware latency. Added to
+  // whatever switch reply delay the host configured.
+  void SetTurnaroundUs(uint32_t turnaroundUs);
+
+  // Takes a board off the bus, or puts it back, while running. An offline
+  // board hears nothing and answers nothing.
+  void SetBoardOnline(uint8_t board, bool online);
+
+  bool Start();
+  void Stop();
+
+  // Closes a switch on the given board. The board reports it on its next turn
+  // in the chain, as long as the host has mapped that switch number.
+  void SetSwitchState(uint8_t board, uint16_t number, bool state);
+
+  // The output state last broadcast by the host, by coil/lamp number.
+  bool GetCoilState(uint16_t number) const;
+  bool GetLampState(uint16_t number) const;
+  uint8_t GetGILevel(uint8_t string) const;
+
+  bool IsBoardSetUp(uint8_t board) const;
+  bool GetConfigValue(uint8_t board, uint8_t topic, uint8_t index, uint8_t key,
+                      uint32_t* value) const;
+  std::vector<uint8_t> GetReceivedImage(uint8_t board) const;
+  BoardSimulatorStats GetStats() const;
+
+ private:
+  struct Board {
+    uint8_t number = ppuc::v2::kNoBoard;
+    bool online = true;
+    bool setUp = false;
+    bool switchesDirty = true;
+    uint8_t nextBoard = ppuc::v2::kNoBoard;
+    uint32_t replyDelayUs = 0;
+    uint8_t sequence = 0;
+    PPUCBoardVersion version;
+    std::map<uint16_t, bool> switchStates;
+    std::map<std::tuple<uint8_t, uint8_t, uint8_t>, uint32_t> config;
+    // What the board answers a fingerprint query with. Config survives a
+    // soft restart; the first fingerprinted key after one starts afresh.
+    ConfigFingerprint fingerprint;
+    bool holdsConfig = false;
+    bool startNewConfig = true;
+    std::vector<uint8_t> image;
+    uint32_t imageBytes = 0;
+    uint16_t imageCrc = 0;
+    uint32_t lastChunkOffset = 0;
+    bool updating = false;
+  };
+
+  // A reply waiting out its board's turnaround. Token replies are built when
+  // they go out so they carry the switch state of that moment; everything
+  // else is built when the request arrives.
+  struct PendingReply {
+    std::chrono::steady_clock::time_point due;
+    bool token = false;
+    uint8_t board = ppuc::v2::kNoBoard;
+    std::vector<uint8_t> frame;
+  };
+
+  enum class ChunkResult { NeedMore, Taken, NoMatch };
+
+  void RunLoop();
+  // Takes complete frames off the front of m_input, stopping at the first
+  // incomplete one.
+  void ProcessInput();
+  size_t FrameBytesFor(const uint8_t* header) const;
+  ChunkResult TryTakeUpdateChunk(Board& board);
+  void HandleFrame(const uint8_t* frame, size_t bytes);
+  void HandleConfigFrame(const uint8_t* frame);
+  void ApplyConfig(Board& board, uint8_t topic, uint8_t index, uint8_t key,
+                   uint32_t value);
+  void HandleSetupFrame(const uint8_t* frame);
+  void HandleMappingFrame(const uint8_t* frame);
+  void HandleOutputFrame(const uint8_t* frame, size_t bytes);
+  void HandleAdminFrame(const uint8_t* frame);
+  void PassToken(uint8_t nextBoard);
+  void SendSwitchReply(Board& board);
+  void QueueReply(const Board& board, const uint8_t* frame, size_t bytes);
+  void QueueAdminReply(const Board& board, uint8_t command,
+                       const uint8_t* data);
+  void QueueUpdateAck(const Board& board, uint8_t command, uint8_t status,
+                      uint32_t offset);
+  void ResetBoardState(Board& board, bool keepConfig);
+  Board* FindBoard(uint8_t number);
+  const Board* FindBoard(uint8_t number) const;
+
+  Transport* m_pTransport;
+  std::thread* m_pThread;
+  std::atomic<bool> m_stopRequested{false};
+
+  mutable std::mutex m_mutex;  // guards everything below
+  uint32_t m_turnaroundUs;
+  std::vector<Board> m_boards;
+  std::vector<uint8_t> m_input;
+  ppuc::v2::RuntimeConfig m_runtimeConfig;
+  bool m_haveRuntimeConfig = false;
+  std::deque<PendingReply> m_pendingReplies;
+  uint8_t m_epoch = 0;
+  uint8_t m_lastHostSequence = 0;
+  bool m_refreshRound = false;
+  size_t m_outputFrameBytes = 0;
+  size_t m_outputCoilOffset = 0;
+  size_t m_outputLampOffset = 0;
+  size_t m_outputGiOffset = 0;
+  OutputDeltaDecoder m_outputDecoder;
+  std::vector<uint16_t> m_coilIndexToNumber;
+  std::vector<uint16_t> m_lampIndexToNumber;
+  std::vector<uint16_t> m_switchIndexToNumber;
+  uint8_t m_coilBitmap[ppuc::v2::kMaxCoilBytes] = {0};
+  uint8_t m_lampBitmap[ppuc::v2::kMaxLampBytes] = {0};
+  uint8_t m_giLevels[ppuc::v2::kGiStrings] = {0};
+  BoardSimulatorStats m_stats;
+};
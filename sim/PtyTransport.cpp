@@ -0,0 +1,177 @@
+#include "PtyTransport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <chrono>
+
+PtyTransport::PtyTransport() {
+  m_masterFd = -1;
+  m_slaveFd = -1;
+  m_lastErrno = 0;
+}
+
+PtyTransport::~PtyTransport() { Close(); }
+
+bool PtyTransport::Open() {
+  Close();
+
+  m_masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (m_masterFd < 0 || grantpt(m_masterFd) != 0 ||
+      unlockpt(m_masterFd) != 0) {
+    m_lastErrno = errno;
+    Close();
+    return false;
+  }
+
+  const char* path = ptsname(m_masterFd);
+  if (!path) {
+    m_lastErrno = errno;
+    Close();
+    return false;
+  }
+  m_devicePath = path;
+
+  m_slaveFd = open(path, O_RDWR | O_NOCTTY);
+  if (m_slaveFd < 0) {
+    m_lastErrno = errno;
+    Close();
+    return false;
+  }
+
+  // Raw from the start: until the host configures the port, a cooked slave
+  // would echo everything the simulated boards send straight back to them.
+  struct termios tio;
+  if (tcgetattr(m_slaveFd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(m_slaveFd, TCSANOW, &tio);
+  }
+
+  const int flags = fcntl(m_masterFd, F_GETFL);
+  fcntl(m_masterFd, F_SETFL, flags | O_NONBLOCK);
+  return true;
+}
+
+const char* PtyTransport::GetDevicePath() const { return m_devicePath.c_str(); }
+
+bool PtyTransport::IsOpen() const { return m_masterFd >= 0; }
+
+void PtyTransport::Close() {
+  if (m_slaveFd >= 0) {
+    close(m_slaveFd);
+    m_slaveFd = -1;
+  }
+  if (m_masterFd >= 0) {
+    close(m_masterFd);
+    m_masterFd = -1;
+  }
+}
+
+int PtyTransport::Write(const uint8_t* data, size_t size, uint32_t timeoutMs) {
+  if (m_masterFd < 0) {
+    return -1;
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(timeoutMs);
+  size_t written = 0;
+  while (written < size) {
+    const ssize_t n = write(m_masterFd, data + written, size - written);
+    if (n > 0) {
+      written += static_cast<size_t>(n);
+      continue;
+    }
+    if (n < 0 && errno != EAGAIN && errno != EINTR) {
+      m_lastErrno = errno;
+      return -1;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      break;
+    }
+    struct pollfd pfd = {m_masterFd, POLLOUT, 0};
+    poll(&pfd, 1,
+         static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                              deadline - now)
+                              .count()) +
+             1);
+  }
+  return static_cast<int>(written);
+}
+
+int PtyTransport::Read(uint8_t* data, size_t size, uint32_t timeoutMs) {
+  if (m_masterFd < 0) {
+    return -1;
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(timeoutMs);
+  size_t got = 0;
+  while (got < size) {
+    const ssize_t n = read(m_masterFd, data + got, size - got);
+    if (n > 0) {
+      got += static_cast<size_t>(n);
+      continue;
+    }
+    // EIO means no one has the slave open, which for us is just silence.
+    if (n < 0 && errno != EAGAIN && errno != EINTR && errno != EIO) {
+      m_lastErrno = errno;
+      return got > 0 ? static_cast<int>(got) : -1;
+    }
+    int waitMs = -1;
+    if (timeoutMs > 0) {
+      const auto now = std::chrono::steady_clock::now();
+      if (now >= deadline) {
+        break;
+      }
+      waitMs = static_cast<int>(
+                   std::chrono::duration_cast<std::chrono::milliseconds>(
+                       deadline - now)
+                       .count()) +
+               1;
+    }
+    struct pollfd pfd = {m_masterFd, POLLIN, 0};
+    poll(&pfd, 1, waitMs);
+  }
+  return static_cast<int>(got);
+}
+
+int PtyTransport::InputWaiting() {
+  if (m_masterFd < 0) {
+    return -1;
+  }
+  int waiting = 0;
+  if (ioctl(m_masterFd, FIONREAD, &waiting) != 0) {
+    m_lastErrno = errno;
+    return -1;
+  }
+  return waiting;
+}
+
+void PtyTransport::FlushInput() {
+  if (m_masterFd >= 0) {
+    tcflush(m_masterFd, TCIFLUSH);
+  }
+}
+
+void PtyTransport::Flush() {
+  if (m_masterFd >= 0) {
+    tcflush(m_masterFd, TCIOFLUSH);
+  }
+}
+
+void PtyTransport::Drain() {
+  if (m_masterFd >= 0) {
+    tcdrain(m_masterFd);
+  }
+}
+
+std::string PtyTransport::LastErrorMessage() const {
+  return m_lastErrno != 0 ? std::string(strerror(m_lastErrno)) : std::string();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Transport.h"
+
+// The master side of a pseudo terminal, for putting the board simulator on
+// the far end of a real serial device path. RS485Comm opens GetDevicePath()
+// through libserialport exactly as it would a USB adapter, so this exercises
+// the whole host stack including SerialTransport. POSIX only.
+//
+// A pty has no baud rate: bytes cross it as fast as the kernel moves them.
+// Use LoopbackTransport with a baud rate when wire time matters.
+class PtyTransport : public Transport {
+ public:
+  PtyTransport();
+  ~PtyTransport() override;
+
+  bool Open();
+  const char* GetDevicePath() const;
+
+  bool IsOpen() const override;
+  void Close() override;
+  int Write(const uint8_t* data, size_t size, uint32_t timeoutMs) override;
+  int Read(uint8_t* data, size_t size, uint32_t timeoutMs) override;
+  int InputWaiting() override;
+  void FlushInput() override;
+  void Flush() override;
+  void Drain() override;
+  std::string LastErrorMessage() const override;
+
+ private:
+  int m_masterFd;
+  // Held open so the master does not see a hangup between the host closing
+  // and reopening the device.
+  int m_slaveFd;
+  std::string m_devicePath;
+  int m_lastErrno;
+};
@@ -0,0 +1,413 @@
+#include "ConfigCache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+// For the version macros only; nothing here touches the YAML.
+#include "PPUC.h"
+
+namespace {
+
+constexpr uint8_t kMagic[4] = {'P', 'P', 'C', 'F'};
+constexpr uint32_t kLibraryVersion = (PPUC_VERSION_MAJOR << 16) |
+                                     (PPUC_VERSION_MINOR << 8) |
+                                     PPUC_VERSION_PATCH;
+
+constexpr uint32_t kFnvOffsetBasis = 2166136261u;
+constexpr uint32_t kFnvPrime = 16777619u;
+
+uint32_t Fnv1a(uint32_t hash, const uint8_t* data, size_t bytes) {
+  for (size_t i = 0; i < bytes; ++i) {
+    hash = (hash ^ data[i]) * kFnvPrime;
+  }
+  return hash;
+}
+
+class Writer {
+ public:
+  void U8(uint8_t value) { m_bytes.push_back(value); }
+  void U16(uint16_t value) {
+    U8(static_cast<uint8_t>(value));
+    U8(static_cast<uint8_t>(value >> 8));
+  }
+  void U32(uint32_t value) {
+    U16(static_cast<uint16_t>(value));
+    U16(static_cast<uint16_t>(value >> 16));
+  }
+  void String(const std::string& value) {
+    const size_t length = std::min<size_t>(value.size(), UINT16_MAX);
+    U16(static_cast<uint16_t>(length));
+    m_bytes.insert(m_bytes.end(), value.begin(), value.begin() + length);
+  }
+  template <typename Container>
+  void U8s(const Container& values) {
+    U32(static_cast<uint32_t>(values.size()));
+    for (const uint8_t value : values) {
+      U8(value);
+    }
+  }
+  template <typename Container>
+  void U16s(const Container& values) {
+    U32(static_cast<uint32_t>(values.size()));
+    for (const uint16_t value : values) {
+      U16(value);
+    }
+  }
+
+  std::vector<uint8_t>& Bytes() { return m_bytes; }
+
+ private:
+  std::vector<uint8_t> m_bytes;
+};
+
+// Reads past the end return zero and mark the reader failed, so a decode
+// runs to completion and is checked once.
+class Reader {
+ public:
+  Reader(const uint8_t* data, size_t bytes) : m_data(data), m_bytes(bytes) {}
+
+  uint8_t U8() {
+    if (m_pos >= m_bytes) {
+      m_ok = false;
+      return 0;
+    }
+    return m_data[m_pos++];
+  }
+  uint16_t U16() {
+    const uint16_t low = U8();
+    return static_cast<uint16_t>(low | (U8() << 8));
+  }
+  uint32_t U32() {
+    const uint32_t low = U16();
+    return low | (static_cast<uint32_t>(U16()) << 16);
+  }
+  std::string String() {
+    const size_t length = U16();
+    if (length > m_bytes - m_pos) {
+      m_ok = false;
+      return std::string();
+    }
+    std::string value(reinterpret_cast<const char*>(&m_data[m_pos]), length);
+    m_pos += length;
+    return value;
+  }
+  // A count that the remaining bytes cannot hold is an error, rather than
+  // a loop that runs to the end of the buffer one zero at a time.
+  uint32_t Count(size_t minBytesEach) {
+    const uint32_t count = U32();
+    if (minBytesEach > 0 && count > (m_bytes - m_pos) / minBytesEach) {
+      m_ok = false;
+      return 0;
+    }
+    return count;
+  }
+  template <typename Container>
+  void U8s(Container* values) {
+    const uint32_t count = Count(1);
+    for (uint32_t i = 0; i < count; ++i) {
+      values->insert(values->end(), U8());
+    }
+  }
+  template <typename Container>
+  void U16s(Container* values) {
+    const uint32_t count = Count(2);
+    for (uint32_t i = 0; i < count; ++i) {
+      values->insert(values->end(), U16());
+    }
+  }
+
+  bool Done() const { return m_ok && m_pos == m_bytes; }
+
+ private:
+  const uint8_t* m_data;
+  size_t m_bytes;
+  size_t m_pos = 0;
+  bool m_ok = true;
+};
+
+void EncodeProgram(const PPUCConfigProgram& program, Writer* out) {
+  out->U8s(program.boards);
+  out->U8s(program.switchBoards);
+  out->U32(static_cast<uint32_t>(program.records.size()));
+  for (const PPUCConfigRecord& record : program.records) {
+    out->U8(record.board);
+    out->U8(record.topic);
+    out->U8(record.index);
+    out->U8(record.key);
+    out->U32(record.value);
+  }
+
+  out->U16s(program.coilMapping);
+  out->U16s(program.lampMapping);
+  out->U16s(program.switchMapping);
+  // Sorted, so the same YAML always gives the same file.
+  std::vector<uint8_t> switchBoards;
+  for (const auto& entry : program.switchNumbersByBoard) {
+    switchBoards.push_back(entry.first);
+  }
+  std::sort(switchBoards.begin(), switchBoards.end());
+  out->U32(static_cast<uint32_t>(switchBoards.size()));
+  for (const uint8_t board : switchBoards) {
+    out->U8(board);
+    out->U16s(program.switchNumbersByBoard.at(board));
+  }
+  out->U16s(program.buttonSwitchNumbers);
+
+  out->U32(static_cast<uint32_t>(program.coils.size()));
+  for (const PPUCCoil& coil : program.coils) {
+    out->U8(coil.board);
+    out->U8(coil.port);
+    out->U8(coil.type);
+    out->U8(coil.number);
+    out->U8(coil.ballSearch);
+    out->String(coil.description);
+  }
+  out->U32(static_cast<uint32_t>(program.lamps.size()));
+  for (const PPUCLamp& lamp : program.lamps) {
+    out->U8(lamp.board);
+    out->U8(lamp.port);
+    out->U8(lamp.type);
+    out->U8(lamp.number);
+    out->U32(lamp.color);
+    out->String(lamp.description);
+  }
+  out->U32(static_cast<uint32_t>(program.switches.size()));
+  for (const PPUCSwitch& sw : program.switches) {
+    out->U8(sw.board);
+    out->U8(sw.port);
+    out->U8(sw.number);
+    out->U8(sw.button);
+    out->String(sw.description);
+  }
+  out->U8(program.coinDoorClosedSwitch);
+  out->U8(program.gameOnSolenoid);
+}
+
+void DecodeProgram(Reader* in, PPUCConfigProgram* program) {
+  in->U8s(&program->boards);
+  in->U8s(&program->switchBoards);
+  const uint32_t records = in->Count(8);
+  for (uint32_t i = 0; i < records; ++i) {
+    PPUCConfigRecord record;
+    record.board = in->U8();
+    record.topic = in->U8();
+    record.index = in->U8();
+    record.key = in->U8();
+    record.value = in->U32();
+    program->records.push_back(record);
+  }
+
+  in->U16s(&program->coilMapping);
+  in->U16s(&program->lampMapping);
+  in->U16s(&program->switchMapping);
+  const uint32_t switchBoards = in->Count(5);
+  for (uint32_t i = 0; i < switchBoards; ++i) {
+    const uint8_t board = in->U8();
+    in->U16s(&program->switchNumbersByBoard[board]);
+  }
+  in->U16s(&program->buttonSwitchNumbers);
+
+  const uint32_t coils = in->Count(7);
+  for (uint32_t i = 0; i < coils; ++i) {
+    const uint8_t board = in->U8();
+    const uint8_t port = in->U8();
+    const uint8_t type = in->U8();
+    const uint8_t number = in->U8();
+    const bool ballSearch = in->U8() != 0;
+    program->coils.push_back(
+        PPUCCoil(board, port, type, number, in->String(), ballSearch));
+  }
+  const uint32_t lamps = in->Count(10);
+  for (uint32_t i = 0; i < lamps; ++i) {
+    const uint8_t board = in->U8();
+    const uint8_t port = in->U8();
+    const uint8_t type = in->U8();
+    const uint8_t number = in->U8();
+    const uint32_t color = in->U32();
+    program->lamps.push_back(
+        PPUCLamp(board, port, type, number, in->String(), color));
+  }
+  const uint32_t switches = in->Count(6);
+  for (uint32_t i = 0; i < switches; ++i) {
+    const uint8_t board = in->U8();
+    const uint8_t port = in->U8();
+    const uint8_t number = in->U8();
+    const bool button = in->U8() != 0;
+    program->switches.push_back(
+        PPUCSwitch(board, port, number, in->String(), button));
+  }
+  program->coinDoorClosedSwitch = in->U8();
+  program->gameOnSolenoid = in->U8();
+}
+
+}  // namespace
+
+bool ConfigCache::HashFile(const char* path, uint32_t* hash) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return false;
+  }
+  uint32_t value = kFnvOffsetBasis;
+  uint8_t buffer[4096];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    value = Fnv1a(value, buffer, read);
+  }
+  const bool ok = !ferror(file);
+  fclose(file);
+  if (ok) {
+    *hash = value;
+  }
+  return ok;
+}
+
+std::vector<uint8_t> ConfigCache::Encode(const PPUCCompiledConfig& config,
+                                         uint32_t sourceHash) {
+  Writer payload;
+  payload.U8(config.debug);
+  payload.U8(config.platform);
+  payload.String(config.rom);
+  payload.String(config.serial);
+
+  std::vector<std::string> groups;
+  for (const auto& entry : config.switchGroups) {
+    groups.push_back(entry.first);
+  }
+  std::sort(groups.begin(), groups.end());
+  payload.U32(static_cast<uint32_t>(groups.size()));
+  for (const std::string& group : groups) {
+    payload.String(group);
+    payload.U16s(config.switchGroups.at(group));
+  }
+  payload.U32(static_cast<uint32_t>(config.coilGiMappings.size()));
+  for (const PPUCCoilGiMapping& mapping : config.coilGiMappings) {
+    payload.U16(mapping.coil);
+    payload.U8(mapping.gi);
+    payload.U8(mapping.onBrightness);
+    payload.U8(mapping.offBrightness);
+  }
+
+  payload.U8s(config.skippedBoards);
+  payload.U8(config.disableFastFlipForTests);
+  EncodeProgram(config.program, &payload);
+
+  const std::vector<uint8_t>& body = payload.Bytes();
+  Writer file;
+  for (const uint8_t byte : kMagic) {
+    file.U8(byte);
+  }
+  file.U16(kFormatVersion);
+  file.U16(0);
+  file.U32(kLibraryVersion);
+  file.U32(sourceHash);
+  file.U32(static_cast<uint32_t>(body.size()));
+  file.U32(Fnv1a(kFnvOffsetBasis, body.data(), body.size()));
+  file.Bytes().insert(file.Bytes().end(), body.begin(), body.end());
+  return file.Bytes();
+}
+
+bool ConfigCache::Decode(const uint8_t* data, size_t bytes,
+                         uint32_t sourceHash, PPUCCompiledConfig* config,
+                         std::string* reason) {
+  if (bytes < kHeaderBytes || memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+    *reason = "not a config cache";
+    return false;
+  }
+  Reader header(data + sizeof(kMagic), kHeaderBytes - sizeof(kMagic));
+  const uint16_t formatVersion = header.U16();
+  header.U16();
+  const uint32_t libraryVersion = header.U32();
+  const uint32_t cachedSourceHash = header.U32();
+  const uint32_t payloadBytes = header.U32();
+  const uint32_t payloadChecksum = header.U32();
+
+  if (formatVersion != kFormatVersion || libraryVersion != kLibraryVersion) {
+    *reason = "written by another version of libppuc";
+    return false;
+  }
+  if (cachedSourceHash != sourceHash) {
+    *reason = "the YAML has changed since it was written";
+    return false;
+  }
+  const uint8_t* payload = data + kHeaderBytes;
+  if (payloadBytes != bytes - kHeaderBytes ||
+      Fnv1a(kFnvOffsetBasis, payload, payloadBytes) != payloadChecksum) {
+    *reason = "it is damaged";
+    return false;
+  }
+
+  PPUCCompiledConfig decoded;
+  Reader in(payload, payloadBytes);
+  decoded.debug = in.U8() != 0;
+  decoded.platform = in.U8();
+  decoded.rom = in.String();
+  decoded.serial = in.String();
+  if (decoded.rom.size() > PPUCCompiledConfig::kMaxRomLength ||
+      decoded.serial.size() > PPUCCompiledConfig::kMaxSerialLength) {
+    *reason = "its rom or serial port name is too long";
+    return false;
+  }
+
+  const uint32_t groups = in.Count(6);
+  for (uint32_t i = 0; i < groups; ++i) {
+    const std::string group = in.String();
+    in.U16s(&decoded.switchGroups[group]);
+  }
+  const uint32_t mappings = in.Count(5);
+  for (uint32_t i = 0; i < mappings; ++i) {
+    PPUCCoilGiMapping mapping;
+    mapping.coil = in.U16();
+    mapping.gi = in.U8();
+    mapping.onBrightness = in.U8();
+    mapping.offBrightness = in.U8();
+    decoded.coilGiMappings.push_back(mapping);
+  }
+
+  in.U8s(&decoded.skippedBoards);
+  decoded.disableFastFlipForTests = in.U8() != 0;
+  DecodeProgram(&in, &decoded.program);
+
+  if (!in.Done()) {
+    *reason = "it is damaged";
+    return false;
+  }
+  *config = std::move(decoded);
+  return true;
+}
+
+bool ConfigCache::Write(const char* path, const PPUCCompiledConfig& config,
+                        uint32_t sourceHash) {
+  const std::vector<uint8_t> bytes = Encode(config, sourceHash);
+  FILE* file = fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+  const bool written = fwrite(bytes.data(), 1, bytes.size(), file) ==
+                       bytes.size();
+  return fclose(file) == 0 && written;
+}
+
+bool ConfigCache::Read(const char* path, uint32_t sourceHash,
+                       PPUCCompiledConfig* config, std::string* reason) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    *reason = "it cannot be opened";
+    return false;
+  }
+  // All of it at once; it is a few kilobytes.
+  std::vector<uint8_t> bytes;
+  uint8_t buffer[4096];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    bytes.insert(bytes.end(), buffer, buffer + read);
+  }
+  const bool ok = !ferror(file);
+  fclose(file);
+  if (!ok) {
+    *reason = "it cannot be read";
+    return false;
+  }
+  return Decode(bytes.data(), bytes.size(), sourceHash, config, reason);
+}
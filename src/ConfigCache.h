@@ -0,0 +1,43 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "PPUC_structs.h"
+
+// A compiled configuration in a file of its own, so a host can start without
+// parsing the YAML it came from.
+//
+// Little-endian throughout. A header, then the payload:
+//
+//   magic "PPCF" | format version u16 | reserved u16 | library version u32
+//   | source hash u32 | payload bytes u32 | payload checksum u32
+//
+// The source hash is FNV-1a over the bytes of the YAML file and the checksum
+// FNV-1a over the payload. A cache whose hash does not match the YAML, whose
+// checksum does not match its payload, or that another format or library
+// version wrote is stale and is not used. Fields are read a byte at a time,
+// so the payload decodes in place from a buffer or a mapping of the file.
+class ConfigCache {
+ public:
+  static constexpr uint16_t kFormatVersion = 1;
+  static constexpr size_t kHeaderBytes = 24;
+
+  // FNV-1a over the bytes of the file at path. False if it cannot be read.
+  static bool HashFile(const char* path, uint32_t* hash);
+
+  static std::vector<uint8_t> Encode(const PPUCCompiledConfig& config,
+                                     uint32_t sourceHash);
+  // False, with why in reason, unless data is a current cache of the YAML
+  // whose hash is sourceHash.
+  static bool Decode(const uint8_t* data, size_t bytes, uint32_t sourceHash,
+                     PPUCCompiledConfig* config, std::string* reason);
+
+  static bool Write(const char* path, const PPUCCompiledConfig& config,
+                    uint32_t sourceHash);
+  static bool Read(const char* path, uint32_t sourceHash,
+                   PPUCCompiledConfig* config, std::string* reason);
+};
@@ -0,0 +1,36 @@
+#include "ConfigFingerprint.h"
+
+#include "io-boards/Event.h"
+
+bool ConfigFingerprint::Covers(uint8_t topic) {
+  return topic != CONFIG_TOPIC_SWITCH_CHAIN;
+}
+
+void ConfigFingerprint::Add(uint8_t topic, uint8_t index, uint8_t key,
+                            uint32_t value) {
+  const uint8_t bytes[] = {topic,
+                           index,
+                           key,
+                           static_cast<uint8_t>(value >> 24),
+                           static_cast<uint8_t>(value >> 16),
+                           static_cast<uint8_t>(value >> 8),
+                           static_cast<uint8_t>(value)};
+  for (const uint8_t byte : bytes) {
+    m_hash = (m_hash ^ byte) * kPrime;
+  }
+}
+
+uint32_t ConfigFingerprint::Value() const {
+  return m_hash == kNone ? 1 : m_hash;
+}
+
+void ConfigFingerprint::BuildQuery(uint8_t* frame, uint8_t board,
+                                   uint8_t sequence, uint8_t epoch) {
+  // Laid out as a version query, with the command swapped.
+  ppuc::v2::BuildVersionQueryFrame(frame, board, sequence, epoch);
+  frame[ppuc::v2::kHeaderBytes] = kAdminQuery;
+  const uint16_t crc = ppuc::v2::Crc16Ccitt(
+      frame, ppuc::v2::kAdminFrameBytes - ppuc::v2::kCrcBytes);
+  frame[ppuc::v2::kAdminFrameBytes - 2] = static_cast<uint8_t>(crc >> 8);
+  frame[ppuc::v2::kAdminFrameBytes - 1] = static_cast<uint8_t>(crc & 0xFF);
+}
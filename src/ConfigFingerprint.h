@@ -0,0 +1,46 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "io-boards/PPUCProtocolV2.h"
+
+// A fingerprint of the config a board has been sent, so that a host about to
+// send the same config again can ask first and leave it out.
+//
+// FNV-1a over each key in the order the board applies them: topic, index,
+// key, then the value most significant byte first. A run sent as one
+// multi-key frame hashes the same as the frames it replaces. Switch chain
+// keys are left out, since they depend on which other boards answered; the
+// host sends them every time.
+//
+// A board answers kAdminQuery with kAdminReport, the fingerprint of the
+// config it holds in the first four data bytes, or kNone if it holds none.
+// It keeps its config across a soft restart and loses it on a hard reset,
+// and the first fingerprinted key it applies after either starts a new
+// config. Firmware that does not know the query does not answer, and is
+// sent its config as before.
+class ConfigFingerprint {
+ public:
+  static constexpr uint8_t kAdminQuery = 0x20;
+  static constexpr uint8_t kAdminReport = 0x21;
+  static constexpr uint32_t kNone = 0;
+
+  // Whether keys for topic are part of the fingerprint.
+  static bool Covers(uint8_t topic);
+
+  void Reset() { m_hash = kOffsetBasis; }
+  void Add(uint8_t topic, uint8_t index, uint8_t key, uint32_t value);
+  // Never kNone, so a board holding no config never matches.
+  uint32_t Value() const;
+
+  // Writes a query for board into frame, which must hold kAdminFrameBytes.
+  static void BuildQuery(uint8_t* frame, uint8_t board, uint8_t sequence,
+                         uint8_t epoch);
+
+ private:
+  static constexpr uint32_t kOffsetBasis = 2166136261u;
+  static constexpr uint32_t kPrime = 16777619u;
+
+  uint32_t m_hash = kOffsetBasis;
+};
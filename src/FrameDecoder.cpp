@@ -0,0 +1,158 @@
+#include "FrameDecoder.h"
+
+#include <string.h>
+
+#include "MultiKeyConfig.h"
+
+void FrameDecoder::SetRuntimeConfig(const ppuc::v2::RuntimeConfig& config) {
+  m_runtimeConfig = config;
+  m_haveRuntimeConfig = ppuc::v2::IsValidRuntimeConfig(config);
+}
+
+void FrameDecoder::SetAdminFrameBytes(size_t bytes) {
+  m_adminFrameBytes = std::min(bytes, kMaxFrameBytes);
+}
+
+int FrameDecoder::Fill(Transport* transport, uint32_t timeoutMs) {
+  if (!transport) {
+    return -1;
+  }
+
+  const int waiting = transport->InputWaiting();
+  if (waiting < 0) {
+    return -1;
+  }
+
+  // With nothing waiting, block for a single byte so the caller sleeps in
+  // the driver instead of spinning; whatever follows it comes with the next
+  // fill.
+  size_t wanted = waiting > 0 ? static_cast<size_t>(waiting) : 1;
+  size_t added = 0;
+  // The free space wraps at most once, so two reads cover it.
+  for (int span = 0; span < 2 && wanted > 0 && m_size < kRingBytes; ++span) {
+    const size_t tail = (m_head + m_size) % kRingBytes;
+    const size_t contiguous =
+        std::min(kRingBytes - m_size, kRingBytes - tail);
+    const int read = transport->Read(&m_ring[tail],
+                                     std::min(wanted, contiguous), timeoutMs);
+    if (read < 0) {
+      return added > 0 ? static_cast<int>(added) : -1;
+    }
+    if (read == 0) {
+      break;
+    }
+    m_size += static_cast<size_t>(read);
+    m_bytesReceived.fetch_add(static_cast<uint64_t>(read),
+                              std::memory_order_relaxed);
+    added += static_cast<size_t>(read);
+    wanted -= std::min(wanted, static_cast<size_t>(read));
+  }
+  return static_cast<int>(added);
+}
+
+size_t FrameDecoder::Feed(const uint8_t* data, size_t size) {
+  const size_t accepted = std::min(size, kRingBytes - m_size);
+  for (size_t i = 0; i < accepted; ++i) {
+    m_ring[(m_head + m_size + i) % kRingBytes] = data[i];
+  }
+  m_size += accepted;
+  m_bytesReceived.fetch_add(accepted, std::memory_order_relaxed);
+  return accepted;
+}
+
+FrameDecoder::Result FrameDecoder::Next(const uint8_t** frame,
+                                        size_t* frameBytes) {
+  while (m_size > 0) {
+    if (PeekAt(0) != ppuc::v2::kSyncByte) {
+      Consume(1);
+      ++m_discardedBytes;
+      continue;
+    }
+    if (m_size < ppuc::v2::kHeaderBytes) {
+      return Result::NeedMore;
+    }
+
+    const size_t bytes = FrameBytesFor(PeekAt(1));
+    if (bytes == 0) {
+      // Not a frame the host can receive, so this sync byte was noise.
+      Consume(1);
+      ++m_discardedBytes;
+      continue;
+    }
+    if (m_size < bytes) {
+      return Result::NeedMore;
+    }
+
+    CopyOut(bytes);
+    *frame = m_frame;
+    *frameBytes = bytes;
+    if (!ppuc::v2::VerifyCrc(m_frame, bytes)) {
+      // Give up the sync byte only: a real frame may start inside this one.
+      Consume(1);
+      ++m_discardedBytes;
+      return Result::BadCrc;
+    }
+    Consume(bytes);
+    return Result::Frame;
+  }
+  return Result::NeedMore;
+}
+
+void FrameDecoder::Reset() {
+  m_head = 0;
+  m_size = 0;
+}
+
+size_t FrameDecoder::FrameBytesFor(uint8_t typeAndFlags) const {
+  using namespace ppuc::v2;
+  switch (ExtractType(typeAndFlags)) {
+    case kFrameConfigAck:
+      return kConfigAckFrameBytes;
+    case kFrameSwitchState:
+      return m_haveRuntimeConfig
+                 ? kHeaderBytes + SwitchPayloadBytes(m_runtimeConfig) +
+                       kCrcBytes
+                 : 0;
+    case kFrameSwitchNoChange:
+      return kHeaderBytes + SwitchNoChangePayloadBytes() + kCrcBytes;
+    case kFrameAdmin:
+      return m_adminFrameBytes;
+    // Frames the host sent itself, heard back on adapters that echo.
+    case kFrameSetup:
+      return kSetupFrameBytes;
+    case kFrameMapping:
+      return kMappingFrameBytes;
+    case kFrameConfig:
+      // A multi-key frame's length is in its payload; skip over it like any
+      // other unrecognised bytes.
+      return (typeAndFlags >> 4) == MultiKeyConfigFrame::kMultiKeyFlag
+                 ? 0
+                 : kConfigFrameBytes;
+    case kFrameSwitchRefresh:
+      return kSwitchRefreshFrameBytes;
+    case kFrameRestart:
+      return kRestartFrameBytes;
+    case kFrameReset:
+      return kResetFrameBytes;
+    case kFrameHeartbeat:
+    case kFrameError:
+      return kHeaderBytes + kCrcBytes;
+    default:
+      return 0;
+  }
+}
+
+uint8_t FrameDecoder::PeekAt(size_t offset) const {
+  return m_ring[(m_head + offset) % kRingBytes];
+}
+
+void FrameDecoder::CopyOut(size_t bytes) {
+  const size_t first = std::min(bytes, kRingBytes - m_head);
+  memcpy(m_frame, &m_ring[m_head], first);
+  memcpy(&m_frame[first], m_ring, bytes - first);
+}
+
+void FrameDecoder::Consume(size_t bytes) {
+  m_head = (m_head + bytes) % kRingBytes;
+  m_size -= bytes;
+}
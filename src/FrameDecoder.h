@@ -0,0 +1,79 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "Transport.h"
+#include "io-boards/PPUCProtocolV2.h"
+
+// Incremental PPUCProtocolV2 frame decoder over a receive ring.
+//
+// Fill() takes whatever the transport has buffered in one or two reads
+// instead of a read per byte, and Next() hands back complete frames in the
+// order they arrived. Bytes that do not start a frame of a known type are
+// skipped, and a frame that fails its CRC gives up only its sync byte, so a
+// real frame hidden behind line noise is still found.
+//
+// Frame lengths come from the frame type. Switch replies depend on the
+// runtime config, and admin frames carry no length at all: the version report
+// and the update acks differ in size, so the caller says which it expects.
+class FrameDecoder {
+ public:
+  enum class Result { NeedMore, Frame, BadCrc };
+
+  static constexpr size_t kRingBytes = 1024;
+  static constexpr size_t kMaxFrameBytes = std::max<size_t>(
+      {ppuc::v2::kHeaderBytes + ppuc::v2::kSwitchStatusBytes +
+           ppuc::v2::kMaxSwitchBytes + ppuc::v2::kCrcBytes,
+       ppuc::v2::kAdminFrameBytes, ppuc::v2::kUpdateAckFrameBytes,
+       ppuc::v2::kConfigAckFrameBytes, ppuc::v2::kConfigFrameBytes,
+       ppuc::v2::kSetupFrameBytes, ppuc::v2::kMappingFrameBytes,
+       ppuc::v2::kSwitchRefreshFrameBytes, ppuc::v2::kRestartFrameBytes,
+       ppuc::v2::kResetFrameBytes});
+
+  void SetRuntimeConfig(const ppuc::v2::RuntimeConfig& config);
+  void SetAdminFrameBytes(size_t bytes);
+
+  // Reads what the transport has waiting, or waits up to timeoutMs for at
+  // least one byte if nothing is. Returns the number of bytes added, or -1 if
+  // the transport failed.
+  int Fill(Transport* transport, uint32_t timeoutMs);
+
+  // Appends bytes that arrived some other way. Returns how many fit.
+  size_t Feed(const uint8_t* data, size_t size);
+
+  // Takes the next frame off the ring. On Frame and BadCrc, *frame points at
+  // a copy of the frame that stays valid until the next call.
+  Result Next(const uint8_t** frame, size_t* frameBytes);
+
+  // Drops everything buffered, for when the transport input is flushed.
+  void Reset();
+
+  size_t GetBuffered() const { return m_size; }
+  uint64_t GetBytesReceived() const {
+    return m_bytesReceived.load(std::memory_order_relaxed);
+  }
+  uint32_t GetDiscardedBytes() const { return m_discardedBytes; }
+
+ private:
+  size_t FrameBytesFor(uint8_t typeAndFlags) const;
+  uint8_t PeekAt(size_t offset) const;
+  void CopyOut(size_t bytes);
+  void Consume(size_t bytes);
+
+  uint8_t m_ring[kRingBytes];
+  size_t m_head = 0;
+  size_t m_size = 0;
+  uint8_t m_frame[kMaxFrameBytes];
+  ppuc::v2::RuntimeConfig m_runtimeConfig;
+  bool m_haveRuntimeConfig = false;
+  // Set by whoever is waiting for an admin reply, which need not be the
+  // thread decoding.
+  std::atomic<size_t> m_adminFrameBytes{ppuc::v2::kAdminFrameBytes};
+  // Read from other threads to tell whether anything arrived at all.
+  std::atomic<uint64_t> m_bytesReceived{0};
+  uint32_t m_discardedBytes = 0;
+};
@@ -0,0 +1,142 @@
+#include "LoopbackTransport.h"
+
+#include <algorithm>
+#include <thread>
+
+void LoopbackTransport::CreatePair(LoopbackTransport** first,
+                                   LoopbackTransport** second,
+                                   uint32_t baudRate) {
+  auto aToB = std::make_shared<Channel>();
+  auto bToA = std::make_shared<Channel>();
+  if (baudRate > 0) {
+    // 8N1: a start bit, eight data bits and a stop bit per byte.
+    const std::chrono::nanoseconds byteTime(10ull * 1000000000ull / baudRate);
+    aToB->byteTime = byteTime;
+    bToA->byteTime = byteTime;
+  }
+  *first = new LoopbackTransport(bToA, aToB);
+  *second = new LoopbackTransport(aToB, bToA);
+}
+
+LoopbackTransport::LoopbackTransport(std::shared_ptr<Channel> rx,
+                                     std::shared_ptr<Channel> tx)
+    : m_rx(std::move(rx)), m_tx(std::move(tx)) {}
+
+LoopbackTransport::~LoopbackTransport() { Close(); }
+
+bool LoopbackTransport::IsOpen() const { return m_open; }
+
+void LoopbackTransport::Close() {
+  if (!m_open.exchange(false)) {
+    return;
+  }
+  // Wake a reader blocked on this end so it can notice.
+  std::lock_guard<std::mutex> lock(m_rx->mutex);
+  m_rx->readable.notify_all();
+}
+
+int LoopbackTransport::Write(const uint8_t* data, size_t size,
+                             uint32_t timeoutMs) {
+  (void)timeoutMs;
+  if (!m_open) {
+    return -1;
+  }
+
+  std::lock_guard<std::mutex> lock(m_tx->mutex);
+  auto readyAt = std::max(std::chrono::steady_clock::now(), m_tx->lineFreeAt);
+  for (size_t i = 0; i < size; ++i) {
+    readyAt += m_tx->byteTime;
+    m_tx->bytes.push_back({data[i], readyAt});
+  }
+  m_tx->lineFreeAt = readyAt;
+  m_tx->written += size;
+  m_tx->readable.notify_all();
+  return static_cast<int>(size);
+}
+
+int LoopbackTransport::Read(uint8_t* data, size_t size, uint32_t timeoutMs) {
+  if (!m_open) {
+    return -1;
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(timeoutMs);
+  size_t got = 0;
+  std::unique_lock<std::mutex> lock(m_rx->mutex);
+  while (true) {
+    const auto now = std::chrono::steady_clock::now();
+    while (got < size && !m_rx->bytes.empty() &&
+           m_rx->bytes.front().readyAt <= now) {
+      data[got++] = m_rx->bytes.front().value;
+      m_rx->bytes.pop_front();
+    }
+    if (got == size || !m_open || (timeoutMs > 0 && now >= deadline)) {
+      return static_cast<int>(got);
+    }
+
+    // Sleep until the next byte lands or the timeout expires, whichever is
+    // first. A write from the other end wakes us early.
+    auto wakeAt = timeoutMs > 0 ? deadline
+                                : std::chrono::steady_clock::time_point::max();
+    if (!m_rx->bytes.empty()) {
+      wakeAt = std::min(wakeAt, m_rx->bytes.front().readyAt);
+    }
+    if (wakeAt == std::chrono::steady_clock::time_point::max()) {
+      m_rx->readable.wait(lock);
+    } else {
+      m_rx->readable.wait_until(lock, wakeAt);
+    }
+  }
+}
+
+int LoopbackTransport::InputWaiting() {
+  if (!m_open) {
+    return -1;
+  }
+
+  std::lock_guard<std::mutex> lock(m_rx->mutex);
+  const auto now = std::chrono::steady_clock::now();
+  int waiting = 0;
+  for (const auto& byte : m_rx->bytes) {
+    if (byte.readyAt > now) {
+      break;
+    }
+    ++waiting;
+  }
+  return waiting;
+}
+
+void LoopbackTransport::FlushInput() {
+  // Like a UART, only what has already arrived is discarded. Bytes still on
+  // the wire land afterwards.
+  std::lock_guard<std::mutex> lock(m_rx->mutex);
+  const auto now = std::chrono::steady_clock::now();
+  while (!m_rx->bytes.empty() && m_rx->bytes.front().readyAt <= now) {
+    m_rx->bytes.pop_front();
+  }
+}
+
+void LoopbackTransport::Flush() {
+  FlushInput();
+
+  std::lock_guard<std::mutex> lock(m_tx->mutex);
+  const auto now = std::chrono::steady_clock::now();
+  while (!m_tx->bytes.empty() && m_tx->bytes.back().readyAt > now) {
+    m_tx->bytes.pop_back();
+  }
+  m_tx->lineFreeAt = std::min(m_tx->lineFreeAt, now);
+}
+
+void LoopbackTransport::Drain() {
+  std::chrono::steady_clock::time_point lineFreeAt;
+  {
+    std::lock_guard<std::mutex> lock(m_tx->mutex);
+    lineFreeAt = m_tx->lineFreeAt;
+  }
+  std::this_thread::sleep_until(lineFreeAt);
+}
+
+uint64_t LoopbackTransport::GetBytesWritten() const {
+  std::lock_guard<std::mutex> lock(m_tx->mutex);
+  return m_tx->written;
+}
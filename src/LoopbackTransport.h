@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Transport.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+// An in-process byte pipe with a Transport at each end. Whatever one end
+// writes, the other end reads.
+//
+// Exists so the bus code can be exercised without a cabinet: a test or a
+// board simulator holds one end, RS485Comm holds the other. With a baud rate
+// set, each byte only becomes readable once it would have finished crossing a
+// real 8N1 line, so chain timing and frame latency measured over the loopback
+// are in the same units as on hardware. Without one, bytes arrive at once.
+class LoopbackTransport : public Transport {
+ public:
+  // Creates two connected endpoints. The caller owns both.
+  static void CreatePair(LoopbackTransport** first,
+                         LoopbackTransport** second, uint32_t baudRate = 0);
+
+  ~LoopbackTransport() override;
+
+  bool IsOpen() const override;
+  void Close() override;
+  int Write(const uint8_t* data, size_t size, uint32_t timeoutMs) override;
+  int Read(uint8_t* data, size_t size, uint32_t timeoutMs) override;
+  int InputWaiting() override;
+  void FlushInput() override;
+  void Flush() override;
+  void Drain() override;
+
+  // Bytes written through this endpoint since it was created.
+  uint64_t GetBytesWritten() const;
+
+ private:
+  struct Channel {
+    struct Byte {
+      uint8_t value;
+      std::chrono::steady_clock::time_point readyAt;
+    };
+    std::mutex mutex;
+    std::condition_variable readable;
+    std::deque<Byte> bytes;
+    std::chrono::steady_clock::time_point lineFreeAt{};
+    std::chrono::nanoseconds byteTime{0};
+    uint64_t written = 0;
+  };
+
+  LoopbackTransport(std::shared_ptr<Channel> rx, std::shared_ptr<Channel> tx);
+
+  std::shared_ptr<Channel> m_rx;
+  std::shared_ptr<Channel> m_tx;
+  std::atomic<bool> m_open{true};
+};
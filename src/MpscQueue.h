@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// A fixed-capacity queue for any number of producer threads and exactly one
+// consumer thread, with no locks and no allocation after construction.
+//
+// Each slot carries a sequence number saying whose turn it is. A producer
+// claims a slot by advancing m_tail with a compare-exchange, fills it, and
+// then hands it to the consumer by bumping the slot's sequence; the consumer
+// hands it back the same way. A producer stalled between the two steps holds
+// up the consumer only at that slot, never the other producers. Capacity
+// must be a power of two, and unlike SpscQueue every slot is usable.
+template <typename T, size_t Capacity>
+class MpscQueue {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "MpscQueue capacity must be a power of two");
+
+ public:
+  MpscQueue() {
+    for (size_t i = 0; i < Capacity; ++i) {
+      m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Returns false, leaving the queue unchanged, when it is full.
+  bool TryPush(const T& item) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot& slot = m_slots[tail & (Capacity - 1)];
+      const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      const intptr_t lag =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(tail);
+      if (lag == 0) {
+        if (m_tail.compare_exchange_weak(tail, tail + 1,
+                                         std::memory_order_relaxed)) {
+          slot.item = item;
+          slot.sequence.store(tail + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (lag < 0) {
+        return false;
+      } else {
+        tail = m_tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Consumer only. Returns false when there is nothing to take.
+  bool TryPop(T* item) {
+    Slot& slot = m_slots[m_head & (Capacity - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != m_head + 1) {
+      return false;
+    }
+    *item = slot.item;
+    slot.sequence.store(m_head + Capacity, std::memory_order_release);
+    ++m_head;
+    return true;
+  }
+
+  static constexpr size_t MaxSize() { return Capacity; }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence{0};
+    T item;
+  };
+
+  Slot m_slots[Capacity];
+  alignas(64) std::atomic<size_t> m_tail{0};
+  alignas(64) size_t m_head = 0;  // consumer only
+};
@@ -0,0 +1,83 @@
+#include "MultiKeyConfig.h"
+
+#include <string.h>
+
+namespace {
+void WriteFrameCrc(uint8_t* frame, size_t frameBytes) {
+  const uint16_t crc =
+      ppuc::v2::Crc16Ccitt(frame, frameBytes - ppuc::v2::kCrcBytes);
+  frame[frameBytes - 2] = static_cast<uint8_t>(crc >> 8);
+  frame[frameBytes - 1] = static_cast<uint8_t>(crc & 0xFF);
+}
+
+void SetFlags(uint8_t* frame, uint8_t flags) {
+  frame[1] = static_cast<uint8_t>((flags << 4) | (frame[1] & 0x0F));
+}
+}  // namespace
+
+bool MultiKeyConfigFrame::IsMultiKeyFrame(const uint8_t* frame) {
+  const ppuc::v2::FrameType type = ppuc::v2::ExtractType(frame[1]);
+  return (type == ppuc::v2::kFrameConfig ||
+          type == ppuc::v2::kFrameConfigAck) &&
+         (frame[1] >> 4) == kMultiKeyFlag;
+}
+
+size_t MultiKeyConfigFrame::FrameBytes(const uint8_t* frame) {
+  const uint8_t count = frame[ppuc::v2::kHeaderBytes + 3];
+  if (count == 0 || count > kMaxKeys) {
+    return 0;
+  }
+  return ppuc::v2::kHeaderBytes + kPrefixBytes + count * kKeyBytes +
+         ppuc::v2::kCrcBytes;
+}
+
+size_t MultiKeyConfigFrame::Build(uint8_t* frame, uint8_t sequence,
+                                  uint8_t epoch, uint8_t board, uint8_t topic,
+                                  uint8_t firstIndex, const uint8_t* keys,
+                                  const uint32_t* values, uint8_t count) {
+  // The header is the one a plain ConfigFrame gets, flagged.
+  uint8_t single[ppuc::v2::kConfigFrameBytes];
+  ppuc::v2::BuildConfigFrame(single, ppuc::v2::kNoBoard, sequence, epoch,
+                             board, topic, firstIndex, keys[0], values[0]);
+  memcpy(frame, single, ppuc::v2::kHeaderBytes);
+  SetFlags(frame, kMultiKeyFlag);
+
+  size_t o = ppuc::v2::kHeaderBytes;
+  frame[o++] = board;
+  frame[o++] = topic;
+  frame[o++] = firstIndex;
+  frame[o++] = count;
+  for (size_t i = 0; i < count; ++i) {
+    frame[o++] = keys[i];
+    frame[o++] = static_cast<uint8_t>(values[i] >> 24);
+    frame[o++] = static_cast<uint8_t>(values[i] >> 16);
+    frame[o++] = static_cast<uint8_t>(values[i] >> 8);
+    frame[o++] = static_cast<uint8_t>(values[i]);
+  }
+  const size_t frameBytes = o + ppuc::v2::kCrcBytes;
+  WriteFrameCrc(frame, frameBytes);
+  return frameBytes;
+}
+
+void MultiKeyConfigFrame::ReadKey(const uint8_t* frame, size_t i,
+                                  uint8_t* key, uint32_t* value) {
+  const uint8_t* entry =
+      &frame[ppuc::v2::kHeaderBytes + kPrefixBytes + i * kKeyBytes];
+  *key = entry[0];
+  *value = (static_cast<uint32_t>(entry[1]) << 24) |
+           (static_cast<uint32_t>(entry[2]) << 16) |
+           (static_cast<uint32_t>(entry[3]) << 8) |
+           static_cast<uint32_t>(entry[4]);
+}
+
+void MultiKeyConfigFrame::BuildAck(uint8_t* ack, uint8_t sequence,
+                                   uint8_t epoch, const uint8_t* frame,
+                                   uint8_t status) {
+  memset(ack, 0, ppuc::v2::kConfigAckFrameBytes);
+  ppuc::v2::BuildBareFrame(ack, ppuc::v2::kFrameConfigAck, kMultiKeyFlag,
+                           ppuc::v2::kNoBoard, sequence, epoch);
+  memcpy(&ack[ppuc::v2::kHeaderBytes], &frame[ppuc::v2::kHeaderBytes],
+         kPrefixBytes);
+  ack[ppuc::v2::kHeaderBytes + kPrefixBytes] = status;
+  WriteFrameCrc(ack, ppuc::v2::kConfigAckFrameBytes);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "io-boards/PPUCProtocolV2.h"
+
+// Multi-key variant of the v2 ConfigFrame.
+//
+// A config item - a PWM output, a switch, an effect - goes to a board as a
+// run of ConfigFrames for one board and topic, with the index counting up
+// from zero, one key and value per frame. A multi-key frame carries the
+// whole run, and the board acknowledges it once:
+//
+//   header (type = ConfigFrame, flags = kMultiKeyFlag)
+//   | board | topic | first index | count | count x (key, value) | CRC16
+//
+// Each value is four bytes, most significant first. The board applies the
+// keys in order, as if it had received them one frame each with the index
+// counting up from the first. The ack is a ConfigAck with the same flag,
+// echoing board, topic, first index and count, then the status.
+//
+// Only boards that report kCapability in their version reply decode it;
+// every other board gets one frame per key, as before.
+class MultiKeyConfigFrame {
+ public:
+  static constexpr uint8_t kMultiKeyFlag = 0x1;
+  // The bit in PPUCBoardVersion::capabilities.
+  static constexpr uint8_t kCapability = 0x01;
+  static constexpr size_t kMaxKeys = 16;
+  static constexpr size_t kPrefixBytes = 4;
+  static constexpr size_t kKeyBytes = 5;
+  static constexpr size_t kMaxFrameBytes =
+      ppuc::v2::kHeaderBytes + kPrefixBytes + kMaxKeys * kKeyBytes +
+      ppuc::v2::kCrcBytes;
+
+  // True for multi-key config frames and their acks.
+  static bool IsMultiKeyFrame(const uint8_t* frame);
+  // Length of a multi-key config frame, from its header and prefix. Zero if
+  // the count is out of range.
+  static size_t FrameBytes(const uint8_t* frame);
+
+  // Writes the frame into frame, which must hold kMaxFrameBytes, and returns
+  // its length. count is between 1 and kMaxKeys.
+  static size_t Build(uint8_t* frame, uint8_t sequence, uint8_t epoch,
+                      uint8_t board, uint8_t topic, uint8_t firstIndex,
+                      const uint8_t* keys, const uint32_t* values,
+                      uint8_t count);
+
+  // The i-th key and value of a frame whose CRC has already been checked.
+  static void ReadKey(const uint8_t* frame, size_t i, uint8_t* key,
+                      uint32_t* value);
+
+  // The ack a board sends for frame, into ack, which must hold
+  // kConfigAckFrameBytes.
+  static void BuildAck(uint8_t* ack, uint8_t sequence, uint8_t epoch,
+                       const uint8_t* frame, uint8_t status);
+};
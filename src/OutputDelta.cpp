@@ -0,0 +1,142 @@
+#include "OutputDelta.h"
+
+#include <string.h>
+
+namespace {
+void WriteFrameCrc(uint8_t* frame, size_t frameBytes) {
+  const uint16_t crc =
+      ppuc::v2::Crc16Ccitt(frame, frameBytes - ppuc::v2::kCrcBytes);
+  frame[frameBytes - 2] = static_cast<uint8_t>(crc >> 8);
+  frame[frameBytes - 1] = static_cast<uint8_t>(crc & 0xFF);
+}
+}  // namespace
+
+size_t OutputDeltaEncoder::PayloadBytes(
+    const ppuc::v2::RuntimeConfig& config) {
+  return ppuc::v2::BitsToBytes(config.coilBits) +
+         ppuc::v2::BitsToBytes(config.lampBits) + ppuc::v2::kGiBytes;
+}
+
+bool OutputDeltaEncoder::IsDeltaFrame(const uint8_t* frame) {
+  return ppuc::v2::ExtractType(frame[1]) == ppuc::v2::kFrameOutputState &&
+         (frame[1] >> 4) == kDeltaFlag;
+}
+
+size_t OutputDeltaEncoder::DeltaFrameBytes(const uint8_t* frame) {
+  const uint8_t count = frame[ppuc::v2::kHeaderBytes + 1];
+  if (count > kMaxPayloadBytes) {
+    return 0;
+  }
+  return ppuc::v2::kHeaderBytes + kDeltaPrefixBytes + 2 * count +
+         ppuc::v2::kCrcBytes;
+}
+
+void OutputDeltaEncoder::SetKeyframeInterval(uint32_t frames) {
+  m_keyframeInterval = frames == 0 ? 1 : frames;
+}
+
+size_t OutputDeltaEncoder::Build(uint8_t* frame, uint8_t nextBoard,
+                                 uint8_t sequence, uint8_t epoch,
+                                 const ppuc::v2::RuntimeConfig& config,
+                                 const uint8_t* coils, const uint8_t* lamps,
+                                 const uint8_t* giLevels, bool* keyframe) {
+  // The full frame is built either way: it is the keyframe, and its payload
+  // is what the next delta is taken against.
+  uint8_t full[ppuc::v2::kHeaderBytes + kMaxPayloadBytes + ppuc::v2::kCrcBytes];
+  ppuc::v2::BuildOutputStateFrame(full, nextBoard, sequence, epoch, config,
+                                  coils, lamps, giLevels);
+  const size_t payloadBytes = PayloadBytes(config);
+  const size_t fullBytes =
+      ppuc::v2::kHeaderBytes + payloadBytes + ppuc::v2::kCrcBytes;
+  const uint8_t* payload = &full[ppuc::v2::kHeaderBytes];
+
+  bool sendFull = !m_haveBaseline || epoch != m_baselineEpoch ||
+                  payloadBytes != m_baselineBytes ||
+                  m_framesSinceKeyframe + 1 >= m_keyframeInterval;
+  size_t changes = 0;
+  if (!sendFull) {
+    for (size_t i = 0; i < payloadBytes; ++i) {
+      if (payload[i] != m_baseline[i]) {
+        ++changes;
+      }
+    }
+    sendFull = ppuc::v2::kHeaderBytes + kDeltaPrefixBytes + 2 * changes +
+                   ppuc::v2::kCrcBytes >=
+               fullBytes;
+  }
+
+  size_t frameBytes = fullBytes;
+  if (sendFull) {
+    memcpy(frame, full, fullBytes);
+    m_framesSinceKeyframe = 0;
+  } else {
+    memcpy(frame, full, ppuc::v2::kHeaderBytes);
+    frame[1] = static_cast<uint8_t>((kDeltaFlag << 4) | (frame[1] & 0x0F));
+    size_t o = ppuc::v2::kHeaderBytes;
+    frame[o++] = m_baselineSequence;
+    frame[o++] = static_cast<uint8_t>(changes);
+    for (size_t i = 0; i < payloadBytes; ++i) {
+      if (payload[i] != m_baseline[i]) {
+        frame[o++] = static_cast<uint8_t>(i);
+        frame[o++] = payload[i];
+      }
+    }
+    frameBytes = o + ppuc::v2::kCrcBytes;
+    WriteFrameCrc(frame, frameBytes);
+    ++m_framesSinceKeyframe;
+  }
+
+  memcpy(m_baseline, payload, payloadBytes);
+  m_baselineBytes = payloadBytes;
+  m_baselineSequence = sequence;
+  m_baselineEpoch = epoch;
+  m_haveBaseline = true;
+  if (keyframe) {
+    *keyframe = sendFull;
+  }
+  return frameBytes;
+}
+
+void OutputDeltaDecoder::SetRuntimeConfig(
+    const ppuc::v2::RuntimeConfig& config) {
+  m_payloadBytes = OutputDeltaEncoder::PayloadBytes(config);
+  memset(m_payload, 0, sizeof(m_payload));
+  m_haveBaseline = false;
+}
+
+bool OutputDeltaDecoder::Apply(const uint8_t* frame, size_t frameBytes) {
+  if (!OutputDeltaEncoder::IsDeltaFrame(frame)) {
+    if (frameBytes != ppuc::v2::kHeaderBytes + m_payloadBytes +
+                          ppuc::v2::kCrcBytes) {
+      return false;
+    }
+    memcpy(m_payload, &frame[ppuc::v2::kHeaderBytes], m_payloadBytes);
+    m_lastSequence = frame[3];
+    m_haveBaseline = true;
+    return true;
+  }
+
+  const uint8_t* delta = &frame[ppuc::v2::kHeaderBytes];
+  const uint8_t count = delta[1];
+  if (!m_haveBaseline || delta[0] != m_lastSequence ||
+      frameBytes != OutputDeltaEncoder::DeltaFrameBytes(frame)) {
+    // Whatever this builds on never arrived; wait for the next full frame.
+    m_haveBaseline = false;
+    ++m_rejectedDeltas;
+    return false;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    const uint8_t offset = delta[OutputDeltaEncoder::kDeltaPrefixBytes + 2 * i];
+    if (offset >= m_payloadBytes) {
+      m_haveBaseline = false;
+      ++m_rejectedDeltas;
+      return false;
+    }
+  }
+  for (size_t i = 0; i < count; ++i) {
+    const uint8_t* pair = &delta[OutputDeltaEncoder::kDeltaPrefixBytes + 2 * i];
+    m_payload[pair[0]] = pair[1];
+  }
+  m_lastSequence = frame[3];
+  return true;
+}
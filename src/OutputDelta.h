@@ -0,0 +1,89 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "io-boards/PPUCProtocolV2.h"
+
+// Delta-encoded variant of the v2 OutputStateFrame.
+//
+// A full output frame carries every coil, lamp and GI byte, although from
+// one frame to the next usually only a bit or two has changed. A delta frame
+// carries only the payload bytes that differ from the previous output frame:
+//
+//   header (flags = kDeltaFlag) | base seq | count | count x (offset, value)
+//   | CRC16
+//
+// Offsets index the payload of the full frame as BuildOutputStateFrame()
+// lays it out, so the delta does not depend on where the bitmaps sit. The
+// base seq names the output frame the delta applies to. A receiver that
+// missed that frame ignores deltas until the next full frame, which the
+// encoder sends at least every keyframe interval and whenever a delta would
+// not be smaller.
+class OutputDeltaEncoder {
+ public:
+  static constexpr uint8_t kDeltaFlag = 0x1;
+  static constexpr size_t kDeltaPrefixBytes = 2;
+  static constexpr size_t kMaxPayloadBytes = ppuc::v2::kMaxCoilBytes +
+                                             ppuc::v2::kMaxLampBytes +
+                                             ppuc::v2::kGiBytes;
+  // Offsets and the count go on the wire as one byte each.
+  static_assert(kMaxPayloadBytes <= 256,
+                "a delta offset must fit in one byte; widen it first");
+  static constexpr size_t kMaxFrameBytes =
+      ppuc::v2::kHeaderBytes + kDeltaPrefixBytes + 2 * kMaxPayloadBytes +
+      ppuc::v2::kCrcBytes;
+  static constexpr uint32_t kDefaultKeyframeInterval = 25;
+
+  static size_t PayloadBytes(const ppuc::v2::RuntimeConfig& config);
+  static bool IsDeltaFrame(const uint8_t* frame);
+  // Length of a delta frame, from its header and the two bytes after it.
+  static size_t DeltaFrameBytes(const uint8_t* frame);
+
+  // A full frame goes out at least once every this many output frames.
+  void SetKeyframeInterval(uint32_t frames);
+  // Makes the next frame a full one, for when the receivers may have lost
+  // track: after a failed write or anything else that breaks the chain.
+  void ForceKeyframe() { m_haveBaseline = false; }
+
+  // Writes the next output frame into frame, which must hold kMaxFrameBytes,
+  // and returns its length. *keyframe says which kind it was.
+  size_t Build(uint8_t* frame, uint8_t nextBoard, uint8_t sequence,
+               uint8_t epoch, const ppuc::v2::RuntimeConfig& config,
+               const uint8_t* coils, const uint8_t* lamps,
+               const uint8_t* giLevels, bool* keyframe);
+
+ private:
+  uint8_t m_baseline[kMaxPayloadBytes] = {0};
+  size_t m_baselineBytes = 0;
+  uint8_t m_baselineSequence = 0;
+  uint8_t m_baselineEpoch = 0;
+  bool m_haveBaseline = false;
+  uint32_t m_framesSinceKeyframe = 0;
+  uint32_t m_keyframeInterval = kDefaultKeyframeInterval;
+};
+
+// The receiving half, as a board applies full and delta output frames. The
+// host does not need it; it is here so the encoding can be checked against
+// full frames and so the board simulator speaks it.
+class OutputDeltaDecoder {
+ public:
+  void SetRuntimeConfig(const ppuc::v2::RuntimeConfig& config);
+
+  // Applies a frame whose CRC has already been checked. Returns false if it
+  // is a delta against a frame this decoder did not see, in which case the
+  // payload is left as it was.
+  bool Apply(const uint8_t* frame, size_t frameBytes);
+
+  // The payload of the full frame the applied frames add up to.
+  const uint8_t* GetPayload() const { return m_payload; }
+  size_t GetPayloadBytes() const { return m_payloadBytes; }
+  uint32_t GetRejectedDeltas() const { return m_rejectedDeltas; }
+
+ private:
+  uint8_t m_payload[OutputDeltaEncoder::kMaxPayloadBytes] = {0};
+  size_t m_payloadBytes = 0;
+  uint8_t m_lastSequence = 0;
+  bool m_haveBaseline = false;
+  uint32_t m_rejectedDeltas = 0;
+};
@@ -11,6 +11,7 @@
 #include <unordered_map>
 
 #include "Adafruit_NeoPixel.h"
+#include "ConfigCache.h"
 #include "RS485Comm.h"
 #include "io-boards/PPUCProtocolV2.h"
 #include "io-boards/Event.h"
@@ -708,8 +709,8 @@ std::vector<PPUCCoilGiMapping> ParseCoilGiMappings(const YAML::Node& config) {
 }  // namespace
 
 PPUC::PPUC() {
-  m_rom = (char*)malloc(16);
-  m_serial = (char*)malloc(128);
+  m_rom = (char*)malloc(PPUCCompiledConfig::kMaxRomLength + 1);
+  m_serial = (char*)malloc(PPUCCompiledConfig::kMaxSerialLength + 1);
 
   m_pRS485Comm = new RS485Comm();
 }
@@ -717,6 +718,7 @@ PPUC::PPUC() {
 PPUC::~PPUC() {
   m_pRS485Comm->Disconnect();
   delete m_pRS485Comm;
+  delete m_pTransport;
 }
 
 void PPUC::SetLogMessageCallback(PPUC_LogMessageCallback callback,
@@ -742,7 +744,15 @@ void PPUC::LoadConfiguration(const char* configFile) {
     ValidatePpucConfiguration(m_ppucConfig);
     WarnAboutUnprotectedSolenoids(m_ppucConfig);
     m_switchGroups = ParseSwitchGroups(m_ppucConfig);
+    BuildSwitchGroupMasks();
     m_coilGiMappings = ParseCoilGiMappings(m_ppucConfig);
+    m_configuredBoards.clear();
+    const YAML::Node& boards = m_ppucConfig["boards"];
+    if (HasSequenceItems(boards)) {
+      for (YAML::Node n_board : boards) {
+        m_configuredBoards.push_back(n_board["number"].as<uint8_t>());
+      }
+    }
   } catch (const YAML::Exception& e) {
     throw std::runtime_error(
         "invalid YAML configuration in '" + std::string(configFile) + "' at " +
@@ -788,6 +798,72 @@ void PPUC::LoadConfiguration(const char* configFile) {
     // always-on GI do not silently disappear on older systems.
     m_platform = PLATFORM_SYS11;
   }
+  m_configFile = configFile;
+  m_configFromCache = false;
+}
+
+bool PPUC::LoadCachedConfiguration(const char* configFile,
+                                   const char* cacheFile) {
+  uint32_t sourceHash = 0;
+  PPUCCompiledConfig config;
+  std::string reason = "the YAML cannot be read";
+  if (!ConfigCache::HashFile(configFile, &sourceHash) ||
+      !ConfigCache::Read(cacheFile, sourceHash, &config, &reason)) {
+    printf("PPUC: not using config cache '%s': %s. Loading '%s'.\n",
+           cacheFile, reason.c_str(), configFile);
+    LoadConfiguration(configFile);
+    return false;
+  }
+
+  m_ppucConfig = YAML::Node();
+  m_debug = config.debug;
+  strcpy(m_rom, config.rom.c_str());
+  strcpy(m_serial, config.serial.c_str());
+  m_platform = config.platform;
+  m_switchGroups = config.switchGroups;
+  BuildSwitchGroupMasks();
+  m_coilGiMappings = config.coilGiMappings;
+  m_configuredBoards = config.program.boards;
+  m_cachedConfig = std::move(config);
+  m_configFile = configFile;
+  m_configFromCache = true;
+  return true;
+}
+
+void PPUC::WriteConfigurationCache(const char* cacheFile) {
+  uint32_t sourceHash = 0;
+  if (!ConfigCache::HashFile(m_configFile.c_str(), &sourceHash)) {
+    throw std::runtime_error("cannot read '" + m_configFile + "'");
+  }
+
+  PPUCCompiledConfig config;
+  try {
+    config.program = CompileConfiguration();
+  } catch (const YAML::Exception& e) {
+    throw std::runtime_error("invalid YAML configuration in '" +
+                             m_configFile + "' at " +
+                             FormatYamlLocation(e.mark) + ": " + e.what());
+  }
+  config.debug = m_debug;
+  config.rom = m_rom;
+  config.serial = m_serial;
+  config.platform = m_platform;
+  config.switchGroups = m_switchGroups;
+  config.coilGiMappings = m_coilGiMappings;
+  config.skippedBoards = m_skippedBoards;
+  config.disableFastFlipForTests = m_disableFastFlipForTests;
+
+  if (!ConfigCache::Write(cacheFile, config, sourceHash)) {
+    throw std::runtime_error("cannot write config cache '" +
+                             std::string(cacheFile) + "'");
+  }
+}
+
+void PPUC::LoadYamlBehindCache() {
+  if (m_configFromCache) {
+    m_ppucConfig = YAML::LoadFile(m_configFile);
+    m_configFromCache = false;
+  }
 }
 
 void PPUC::SetDebug(bool debug) {
@@ -843,6 +919,22 @@ void PPUC::SetOutputFrameIntervalMs(uint32_t intervalMs) {
   m_pRS485Comm->SetOutputFrameIntervalMs(intervalMs);
 }
 
+void PPUC::SetReceiveThreadEnabled(bool enabled) {
+  m_pRS485Comm->SetReceiveThreadEnabled(enabled);
+}
+
+void PPUC::SetOutputDeltaFramesEnabled(bool enabled) {
+  m_pRS485Comm->SetOutputDeltaFramesEnabled(enabled);
+}
+
+void PPUC::SetConfigWindow(uint8_t frames) {
+  m_pRS485Comm->SetConfigWindow(frames);
+}
+
+void PPUC::SetConfigFingerprintsEnabled(bool enabled) {
+  m_pRS485Comm->SetConfigFingerprintsEnabled(enabled);
+}
+
 void PPUC::SetDisableFastFlipForTests(bool disableFastFlipForTests) {
   m_disableFastFlipForTests = disableFastFlipForTests;
 }
@@ -861,6 +953,11 @@ void PPUC::SetSerial(const char* serial) { strcpy(m_serial, serial); }
 
 const char* PPUC::GetSerial() { return m_serial; }
 
+void PPUC::SetTransport(Transport* transport) {
+  delete m_pTransport;
+  m_pTransport = transport;
+}
+
 bool PPUC::AbortConfigurationEarly() const {
   return m_pRS485Comm->ShouldAbortConfigurationEarly();
 }
@@ -1036,10 +1133,10 @@ uint32_t PPUC::ResolveSwitchDebounceMode(const YAML::Node& node) {
   return it->second;
 }
 
-void SendNamedEffectTriggerConfig(RS485Comm* comm, const YAML::Node& effectNode,
-                                  uint32_t type, uint8_t board,
-                                  uint32_t port) {
-  if (!comm || !effectNode || !effectNode["name"]) {
+void AddNamedEffectTriggerConfig(PPUCConfigProgram* program,
+                                 const YAML::Node& effectNode, uint32_t type,
+                                 uint8_t board, uint32_t port) {
+  if (!effectNode || !effectNode["name"]) {
     return;
   }
 
@@ -1053,21 +1150,14 @@ void SendNamedEffectTriggerConfig(RS485Comm* comm, const YAML::Node& effectNode,
   const uint32_t number = HashNamedTriggerId(name.c_str());
 
   uint8_t index = 0;
-  comm->SendConfigEvent(new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_TRIGGER,
-                                        index++, (uint8_t)CONFIG_TOPIC_PORT,
-                                        port));
-  comm->SendConfigEvent(new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_TRIGGER,
-                                        index++, (uint8_t)CONFIG_TOPIC_TYPE,
-                                        type));
-  comm->SendConfigEvent(new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_TRIGGER,
-                                        index++, (uint8_t)CONFIG_TOPIC_SOURCE,
-                                        EVENT_SOURCE_EFFECT));
-  comm->SendConfigEvent(new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_TRIGGER,
-                                        index++, (uint8_t)CONFIG_TOPIC_NUMBER,
-                                        number));
-  comm->SendConfigEvent(new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_TRIGGER,
-                                        index++, (uint8_t)CONFIG_TOPIC_VALUE,
-                                        value));
+  program->Add(board, CONFIG_TOPIC_TRIGGER, index++, CONFIG_TOPIC_PORT, port);
+  program->Add(board, CONFIG_TOPIC_TRIGGER, index++, CONFIG_TOPIC_TYPE, type);
+  program->Add(board, CONFIG_TOPIC_TRIGGER, index++, CONFIG_TOPIC_SOURCE,
+               EVENT_SOURCE_EFFECT);
+  program->Add(board, CONFIG_TOPIC_TRIGGER, index++, CONFIG_TOPIC_NUMBER,
+               number);
+  program->Add(board, CONFIG_TOPIC_TRIGGER, index++, CONFIG_TOPIC_VALUE,
+               value);
 }
 
 uint32_t ResolveSimpleTriggerSource(const std::string& source) {
@@ -1081,11 +1171,11 @@ uint32_t ResolveSimpleTriggerSource(const std::string& source) {
                            "'");
 }
 
-void SendSimpleEffectTriggerConfig(RS485Comm* comm, const YAML::Node& effectNode,
-                                   uint32_t type, uint8_t board,
-                                   uint32_t port,
-                                   const std::string& context) {
-  if (!comm || !effectNode || !effectNode["simpleTrigger"]) {
+void AddSimpleEffectTriggerConfig(PPUCConfigProgram* program,
+                                  const YAML::Node& effectNode, uint32_t type,
+                                  uint8_t board, uint32_t port,
+                                  const std::string& context) {
+  if (!effectNode || !effectNode["simpleTrigger"]) {
     return;
   }
 
@@ -1100,25 +1190,34 @@ void SendSimpleEffectTriggerConfig(RS485Comm* comm, const YAML::Node& effectNode
   }
 
   uint8_t index = 0;
-  comm->SendConfigEvent(new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_TRIGGER,
-                                        index++, (uint8_t)CONFIG_TOPIC_PORT,
-                                        port));
-  comm->SendConfigEvent(new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_TRIGGER,
-                                        index++, (uint8_t)CONFIG_TOPIC_TYPE,
-                                        type));
-  comm->SendConfigEvent(new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_TRIGGER,
-                                        index++, (uint8_t)CONFIG_TOPIC_SOURCE,
-                                        source));
-  comm->SendConfigEvent(new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_TRIGGER,
-                                        index++, (uint8_t)CONFIG_TOPIC_NUMBER,
-                                        number));
-  comm->SendConfigEvent(new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_TRIGGER,
-                                        index++, (uint8_t)CONFIG_TOPIC_VALUE,
-                                        value));
-}
-
-void PPUC::SendLedConfigBlock(const YAML::Node& items, uint32_t type,
-                              uint8_t board, uint32_t port) {
+  program->Add(board, CONFIG_TOPIC_TRIGGER, index++, CONFIG_TOPIC_PORT, port);
+  program->Add(board, CONFIG_TOPIC_TRIGGER, index++, CONFIG_TOPIC_TYPE, type);
+  program->Add(board, CONFIG_TOPIC_TRIGGER, index++, CONFIG_TOPIC_SOURCE,
+               source);
+  program->Add(board, CONFIG_TOPIC_TRIGGER, index++, CONFIG_TOPIC_NUMBER,
+               number);
+  program->Add(board, CONFIG_TOPIC_TRIGGER, index++, CONFIG_TOPIC_VALUE,
+               value);
+}
+
+namespace {
+// An effect's repeat count as the board takes it: -1 repeats forever and -2
+// holds the last frame.
+uint32_t ResolveEffectRepeat(const YAML::Node& node) {
+  const int16_t repeat = node.as<int16_t>();
+  if (repeat == -1) {
+    return 255;
+  }
+  if (repeat == -2) {
+    return 254;
+  }
+  return node.as<uint32_t>();
+}
+}  // namespace
+
+void PPUC::AddLedConfigBlock(PPUCConfigProgram* program,
+                             const YAML::Node& items, uint32_t type,
+                             uint8_t board, uint32_t port) {
   if (HasSequenceItems(items)) {
     size_t itemIndex = 0;
     for (YAML::Node n_item : items) {
@@ -1126,9 +1225,6 @@ void PPUC::SendLedConfigBlock(const YAML::Node& items, uint32_t type,
           LedConfigItemContext(n_item, type, board, port, itemIndex);
       ++itemIndex;
 
-      if (AbortConfigurationEarly()) {
-        return;
-      }
       const std::string description =
           ReadRequiredYamlField<std::string>(n_item, "description", context);
       if (m_debug) {
@@ -1144,250 +1240,157 @@ void PPUC::SendLedConfigBlock(const YAML::Node& items, uint32_t type,
           ParseRequiredHexColorField(n_item, "color", context);
 
       uint8_t index = 0;
-      m_pRS485Comm->SendConfigEvent(
-          new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_LAMPS, index++,
-                          (uint8_t)CONFIG_TOPIC_PORT, port));
-      m_pRS485Comm->SendConfigEvent(
-          new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_LAMPS, index++,
-                          (uint8_t)CONFIG_TOPIC_TYPE, type));
-      m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-          board, (uint8_t)CONFIG_TOPIC_LAMPS, index++,
-          (uint8_t)CONFIG_TOPIC_NUMBER, number));
-      m_pRS485Comm->SendConfigEvent(
-          new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_LAMPS, index++,
-                          (uint8_t)CONFIG_TOPIC_LED_NUMBER, ledNumber));
-
-      m_pRS485Comm->SendConfigEvent(
-          new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_LAMPS, index++,
-                          (uint8_t)CONFIG_TOPIC_COLOR, color));
-
-      m_lamps.push_back(
+      program->Add(board, CONFIG_TOPIC_LAMPS, index++, CONFIG_TOPIC_PORT,
+                   port);
+      program->Add(board, CONFIG_TOPIC_LAMPS, index++, CONFIG_TOPIC_TYPE,
+                   type);
+      program->Add(board, CONFIG_TOPIC_LAMPS, index++, CONFIG_TOPIC_NUMBER,
+                   number);
+      program->Add(board, CONFIG_TOPIC_LAMPS, index++,
+                   CONFIG_TOPIC_LED_NUMBER, ledNumber);
+      program->Add(board, CONFIG_TOPIC_LAMPS, index++, CONFIG_TOPIC_COLOR,
+                   color);
+
+      program->lamps.push_back(
           PPUCLamp(board, port, (uint8_t)type, static_cast<uint8_t>(number),
                    description, color));
     }
   }
 }
 
-bool PPUC::Connect() {
-  try {
-    ValidatePpucConfiguration(m_ppucConfig);
-  } catch (const std::exception& e) {
-    printf("PPUC: %s\n", e.what());
-    return false;
-  }
-
-  if (!m_pRS485Comm->Connect(m_serial)) {
-    return false;
-  }
+PPUCConfigProgram PPUC::CompileConfiguration() {
+  LoadYamlBehindCache();
+  PPUCConfigProgram program;
 
-  auto startupAttempt = [this]() -> bool {
-    m_coils.clear();
-    m_lamps.clear();
-    m_switches.clear();
-
-    auto isSkippedBoard = [this](uint8_t boardNumber) {
-      return m_skippedBoards.count(boardNumber) != 0;
-    };
-
-    uint8_t index = 0;
-    std::vector<uint8_t> switchBoards;
-    std::set<uint16_t> coilNumbers;
-    std::set<uint16_t> lampNumbers;
-    std::set<uint16_t> switchNumbers;
-    std::set<uint16_t> buttonSwitchNumbers;
-    std::unordered_map<uint8_t, std::vector<uint16_t>> switchNumbersByBoard;
-    const YAML::Node& boards = m_ppucConfig["boards"];
-    std::vector<uint8_t> configuredBoards;
-    for (YAML::Node n_board : boards) {
-      const uint8_t boardNumber = n_board["number"].as<uint8_t>();
-      configuredBoards.push_back(boardNumber);
-      if (isSkippedBoard(boardNumber)) {
-        continue;
-      }
-
-      m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-          boardNumber, (uint8_t)CONFIG_TOPIC_PLATFORM, 0,
-          (uint8_t)CONFIG_TOPIC_PLATFORM, m_platform));
-
-      m_pRS485Comm->SendConfigEvent(
-          new ConfigEvent(boardNumber,
-                          (uint8_t)CONFIG_TOPIC_COIN_DOOR_CLOSED_SWITCH, 0,
-                          (uint8_t)CONFIG_TOPIC_NUMBER,
-                          m_ppucConfig["coinDoorClosedSwitch"].as<uint8_t>()));
-      m_coinDoorClosedSwitch =
-          m_ppucConfig["coinDoorClosedSwitch"].as<uint8_t>();
-
-      m_pRS485Comm->SendConfigEvent(
-          new ConfigEvent(boardNumber,
-                          (uint8_t)CONFIG_TOPIC_GAME_ON_SOLENOID, 0,
-                          (uint8_t)CONFIG_TOPIC_NUMBER,
-                          m_ppucConfig["gameOnSolenoid"].as<uint8_t>()));
-      m_gameOnSolenoid = m_ppucConfig["gameOnSolenoid"].as<uint8_t>();
-
-      if (n_board["pollEvents"].as<bool>()) {
-        m_pRS485Comm->RegisterSwitchBoard(boardNumber);
-        switchBoards.push_back(boardNumber);
-      }
+  auto isSkippedBoard = [this](uint8_t boardNumber) {
+    return m_skippedBoards.count(boardNumber) != 0;
+  };
 
-      if (AbortConfigurationEarly()) {
-        return false;
-      }
+  uint8_t index = 0;
+  std::set<uint16_t> coilNumbers;
+  std::set<uint16_t> lampNumbers;
+  std::set<uint16_t> switchNumbers;
+
+  program.coinDoorClosedSwitch =
+      m_ppucConfig["coinDoorClosedSwitch"].as<uint8_t>();
+  program.gameOnSolenoid = m_ppucConfig["gameOnSolenoid"].as<uint8_t>();
+
+  const YAML::Node& boards = m_ppucConfig["boards"];
+  for (YAML::Node n_board : boards) {
+    const uint8_t boardNumber = n_board["number"].as<uint8_t>();
+    program.boards.push_back(boardNumber);
+    if (isSkippedBoard(boardNumber)) {
+      continue;
     }
 
-    if (AbortConfigurationEarly()) {
-      return false;
-    }
+    program.Add(boardNumber, CONFIG_TOPIC_PLATFORM, 0, CONFIG_TOPIC_PLATFORM,
+                m_platform);
+    program.Add(boardNumber, CONFIG_TOPIC_COIN_DOOR_CLOSED_SWITCH, 0,
+                CONFIG_TOPIC_NUMBER, program.coinDoorClosedSwitch);
+    program.Add(boardNumber, CONFIG_TOPIC_GAME_ON_SOLENOID, 0,
+                CONFIG_TOPIC_NUMBER, program.gameOnSolenoid);
 
-    coilNumbers.insert(m_gameOnSolenoid);
-
-    const YAML::Node& switchMatrix = m_ppucConfig["switchMatrix"];
-    if (switchMatrix) {
-      const YAML::Node& matrixSwitches = switchMatrix["switches"];
-      if (HasSequenceItems(matrixSwitches)) {
-        for (YAML::Node n_switch : matrixSwitches) {
-          const uint16_t switchNumber = n_switch["number"].as<uint16_t>();
-          switchNumbers.insert(switchNumber);
-          if (n_switch["button"] && n_switch["button"].as<bool>()) {
-            buttonSwitchNumbers.insert(switchNumber);
-          }
-          switchNumbersByBoard[n_switch["board"].as<uint8_t>()].push_back(
-              switchNumber);
-        }
-      }
+    if (n_board["pollEvents"].as<bool>()) {
+      program.switchBoards.push_back(boardNumber);
     }
+  }
 
-    const YAML::Node& switches = m_ppucConfig["switches"];
-    if (HasSequenceItems(switches)) {
-      for (YAML::Node n_switch : switches) {
+  coilNumbers.insert(program.gameOnSolenoid);
+
+  const YAML::Node& switchMatrix = m_ppucConfig["switchMatrix"];
+  if (switchMatrix) {
+    const YAML::Node& matrixSwitches = switchMatrix["switches"];
+    if (HasSequenceItems(matrixSwitches)) {
+      for (YAML::Node n_switch : matrixSwitches) {
         const uint16_t switchNumber = n_switch["number"].as<uint16_t>();
         switchNumbers.insert(switchNumber);
         if (n_switch["button"] && n_switch["button"].as<bool>()) {
-          buttonSwitchNumbers.insert(switchNumber);
+          program.buttonSwitchNumbers.insert(switchNumber);
         }
-        switchNumbersByBoard[n_switch["board"].as<uint8_t>()].push_back(
-            switchNumber);
+        program.switchNumbersByBoard[n_switch["board"].as<uint8_t>()]
+            .push_back(switchNumber);
       }
     }
+  }
 
-    const YAML::Node& pwmOutput = m_ppucConfig["pwmOutput"];
-    if (HasSequenceItems(pwmOutput)) {
-      for (YAML::Node n_pwmOutput : pwmOutput) {
-        if (isSkippedBoard(n_pwmOutput["board"].as<uint8_t>())) {
-          continue;
-        }
-        std::string c_type = n_pwmOutput["type"].as<std::string>();
-        const uint16_t number = n_pwmOutput["number"].as<uint16_t>();
-        if (strcmp(c_type.c_str(), "lamp") == 0) {
-          lampNumbers.insert(number);
-        } else {
-          coilNumbers.insert(number);
-        }
+  const YAML::Node& switches = m_ppucConfig["switches"];
+  if (HasSequenceItems(switches)) {
+    for (YAML::Node n_switch : switches) {
+      const uint16_t switchNumber = n_switch["number"].as<uint16_t>();
+      switchNumbers.insert(switchNumber);
+      if (n_switch["button"] && n_switch["button"].as<bool>()) {
+        program.buttonSwitchNumbers.insert(switchNumber);
       }
+      program.switchNumbersByBoard[n_switch["board"].as<uint8_t>()].push_back(
+          switchNumber);
     }
+  }
 
-    const YAML::Node& ledStripes = m_ppucConfig["ledStripes"];
-    if (HasSequenceItems(ledStripes)) {
-      for (YAML::Node n_ledStripe : ledStripes) {
-        if (isSkippedBoard(n_ledStripe["board"].as<uint8_t>())) {
-          continue;
-        }
-        const YAML::Node& lamps = n_ledStripe["lamps"];
-        if (HasSequenceItems(lamps)) {
-          for (YAML::Node n_lamp : lamps) {
-            lampNumbers.insert(n_lamp["number"].as<uint16_t>());
-          }
-        }
-        const YAML::Node& flashers = n_ledStripe["flashers"];
-        if (HasSequenceItems(flashers)) {
-          for (YAML::Node n_flasher : flashers) {
-            coilNumbers.insert(n_flasher["number"].as<uint16_t>());
-          }
-        }
+  const YAML::Node& pwmOutput = m_ppucConfig["pwmOutput"];
+  if (HasSequenceItems(pwmOutput)) {
+    for (YAML::Node n_pwmOutput : pwmOutput) {
+      if (isSkippedBoard(n_pwmOutput["board"].as<uint8_t>())) {
+        continue;
+      }
+      std::string c_type = n_pwmOutput["type"].as<std::string>();
+      const uint16_t number = n_pwmOutput["number"].as<uint16_t>();
+      if (strcmp(c_type.c_str(), "lamp") == 0) {
+        lampNumbers.insert(number);
+      } else {
+        coilNumbers.insert(number);
       }
     }
+  }
 
-    std::vector<uint16_t> coilMapping(coilNumbers.begin(), coilNumbers.end());
-    std::vector<uint16_t> lampMapping(lampNumbers.begin(), lampNumbers.end());
-    std::vector<uint16_t> switchMapping(switchNumbers.begin(),
-                                        switchNumbers.end());
-
-    ppuc::v2::RuntimeConfig runtimeConfig;
-    runtimeConfig.coilBits =
-        std::max<uint16_t>(1, static_cast<uint16_t>(coilMapping.size()));
-    runtimeConfig.lampBits =
-        std::max<uint16_t>(1, static_cast<uint16_t>(lampMapping.size()));
-    runtimeConfig.switchBits =
-        std::max<uint16_t>(1, static_cast<uint16_t>(switchMapping.size()));
-    runtimeConfig.coilBits =
-        std::min<uint16_t>(runtimeConfig.coilBits, ppuc::v2::kMaxCoilBits);
-    runtimeConfig.lampBits =
-        std::min<uint16_t>(runtimeConfig.lampBits, ppuc::v2::kMaxLampBits);
-    runtimeConfig.switchBits =
-        std::min<uint16_t>(runtimeConfig.switchBits, ppuc::v2::kMaxSwitchBits);
-    coilMapping.resize(runtimeConfig.coilBits);
-    lampMapping.resize(runtimeConfig.lampBits);
-    switchMapping.resize(runtimeConfig.switchBits);
-    m_pRS485Comm->SetMappings(coilMapping, lampMapping, switchMapping);
-    m_pRS485Comm->SetRuntimeConfig(runtimeConfig);
-    m_pRS485Comm->SetConfiguredBoards(configuredBoards);
-    m_pRS485Comm->SetSwitchNumbersByBoard(switchNumbersByBoard);
-    m_pRS485Comm->SetButtonSwitchNumbers(buttonSwitchNumbers);
-    m_pRS485Comm->SetSkippedBoards(m_skippedBoards);
-
-    // Send switch matrix configuration to I/O boards
-    // IMPORTANT: This must be done before sending individual switch configs
-    // because the existence of a switch matrix changes the amount of dedicated
-    // switches available.
-    if (switchMatrix &&
-        !isSkippedBoard(switchMatrix["board"].as<uint8_t>())) {
-      index = 0;
-      m_pRS485Comm->SendConfigEvent(
-          new ConfigEvent(switchMatrix["board"].as<uint8_t>(),
-                          (uint8_t)CONFIG_TOPIC_SWITCH_MATRIX, index++,
-                          (uint8_t)CONFIG_TOPIC_ACTIVE_LOW,
-                          switchMatrix["activeLow"].as<bool>()));
-      m_pRS485Comm->SendConfigEvent(
-          new ConfigEvent(switchMatrix["board"].as<uint8_t>(),
-                          (uint8_t)CONFIG_TOPIC_SWITCH_MATRIX, index++,
-                          (uint8_t)CONFIG_TOPIC_NUM_ROWS,
-                          switchMatrix["rows"].as<uint8_t>()));
-
-      const YAML::Node& switches = switchMatrix["switches"];
-      if (HasSequenceItems(switches)) {
-        for (YAML::Node n_switch : switches) {
-          if (m_debug) {
-            // @todo user logger
-            printf("Description: %s\n",
-                   n_switch["description"].as<std::string>().c_str());
-          }
-
-          if (!isSkippedBoard(n_switch["board"].as<uint8_t>())) {
-            index = 0;
-            m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-                n_switch["board"].as<uint8_t>(),
-                (uint8_t)CONFIG_TOPIC_SWITCH_MATRIX, index++,
-                (uint8_t)CONFIG_TOPIC_PORT, n_switch["port"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-                n_switch["board"].as<uint8_t>(),
-                (uint8_t)CONFIG_TOPIC_SWITCH_MATRIX, index++,
-                (uint8_t)CONFIG_TOPIC_NUMBER,
-                n_switch["number"].as<uint32_t>()));
-          }
-
-          m_switches.push_back(PPUCSwitch(
-              n_switch["board"].as<uint8_t>(), n_switch["port"].as<uint8_t>(),
-              n_switch["number"].as<uint8_t>(),
-              n_switch["description"].as<std::string>(),
-              n_switch["button"] && n_switch["button"].as<bool>()));
+  const YAML::Node& ledStripes = m_ppucConfig["ledStripes"];
+  if (HasSequenceItems(ledStripes)) {
+    for (YAML::Node n_ledStripe : ledStripes) {
+      if (isSkippedBoard(n_ledStripe["board"].as<uint8_t>())) {
+        continue;
+      }
+      const YAML::Node& lamps = n_ledStripe["lamps"];
+      if (HasSequenceItems(lamps)) {
+        for (YAML::Node n_lamp : lamps) {
+          lampNumbers.insert(n_lamp["number"].as<uint16_t>());
+        }
+      }
+      const YAML::Node& flashers = n_ledStripe["flashers"];
+      if (HasSequenceItems(flashers)) {
+        for (YAML::Node n_flasher : flashers) {
+          coilNumbers.insert(n_flasher["number"].as<uint16_t>());
         }
       }
     }
+  }
 
-    if (AbortConfigurationEarly()) {
-      return false;
-    }
-
-    // Send switch configuration to I/O boards
+  program.coilMapping.assign(coilNumbers.begin(), coilNumbers.end());
+  program.lampMapping.assign(lampNumbers.begin(), lampNumbers.end());
+  program.switchMapping.assign(switchNumbers.begin(), switchNumbers.end());
+  // At least one bit each, and no more than the frames carry.
+  program.coilMapping.resize(std::min<size_t>(
+      std::max<size_t>(1, program.coilMapping.size()),
+      ppuc::v2::kMaxCoilBits));
+  program.lampMapping.resize(std::min<size_t>(
+      std::max<size_t>(1, program.lampMapping.size()),
+      ppuc::v2::kMaxLampBits));
+  program.switchMapping.resize(std::min<size_t>(
+      std::max<size_t>(1, program.switchMapping.size()),
+      ppuc::v2::kMaxSwitchBits));
+
+  // Switch matrix configuration
+  // IMPORTANT: This must be sent before individual switch configs because
+  // the existence of a switch matrix changes the amount of dedicated
+  // switches available.
+  if (switchMatrix &&
+      !isSkippedBoard(switchMatrix["board"].as<uint8_t>())) {
+    const uint8_t matrixBoard = switchMatrix["board"].as<uint8_t>();
+    index = 0;
+    program.Add(matrixBoard, CONFIG_TOPIC_SWITCH_MATRIX, index++,
+                CONFIG_TOPIC_ACTIVE_LOW, switchMatrix["activeLow"].as<bool>());
+    program.Add(matrixBoard, CONFIG_TOPIC_SWITCH_MATRIX, index++,
+                CONFIG_TOPIC_NUM_ROWS, switchMatrix["rows"].as<uint8_t>());
+
+    const YAML::Node& switches = switchMatrix["switches"];
     if (HasSequenceItems(switches)) {
       for (YAML::Node n_switch : switches) {
         if (m_debug) {
@@ -1396,382 +1399,342 @@ bool PPUC::Connect() {
                  n_switch["description"].as<std::string>().c_str());
         }
 
-        if (!isSkippedBoard(n_switch["board"].as<uint8_t>())) {
+        const uint8_t board = n_switch["board"].as<uint8_t>();
+        if (!isSkippedBoard(board)) {
           index = 0;
-          m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-              n_switch["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_SWITCHES,
-              index++, (uint8_t)CONFIG_TOPIC_PORT,
-              n_switch["port"].as<uint32_t>()));
-          m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-              n_switch["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_SWITCHES,
-              index++, (uint8_t)CONFIG_TOPIC_NUMBER,
-              n_switch["number"].as<uint32_t>()));
-          m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-              n_switch["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_SWITCHES,
-              index++, (uint8_t)CONFIG_TOPIC_DEBOUNCE_TIME,
-              n_switch["debounce"].as<uint32_t>()));
-          YAML::Node debounceMode =
-              n_switch["debounceMode"] ? n_switch["debounceMode"]
-                                       : n_switch["debounce_mode"];
-          m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-              n_switch["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_SWITCHES,
-              index++, (uint8_t)CONFIG_TOPIC_MODE,
-              ResolveSwitchDebounceMode(debounceMode)));
+          program.Add(board, CONFIG_TOPIC_SWITCH_MATRIX, index++,
+                      CONFIG_TOPIC_PORT, n_switch["port"].as<uint32_t>());
+          program.Add(board, CONFIG_TOPIC_SWITCH_MATRIX, index++,
+                      CONFIG_TOPIC_NUMBER, n_switch["number"].as<uint32_t>());
         }
 
-        m_switches.push_back(PPUCSwitch(
-            n_switch["board"].as<uint8_t>(), n_switch["port"].as<uint8_t>(),
+        program.switches.push_back(PPUCSwitch(
+            board, n_switch["port"].as<uint8_t>(),
             n_switch["number"].as<uint8_t>(),
             n_switch["description"].as<std::string>(),
             n_switch["button"] && n_switch["button"].as<bool>()));
-
-        if (AbortConfigurationEarly()) {
-          return false;
-        }
       }
     }
+  }
 
-    if (AbortConfigurationEarly()) {
-      return false;
+  // Switch configuration
+  if (HasSequenceItems(switches)) {
+    for (YAML::Node n_switch : switches) {
+      if (m_debug) {
+        // @todo user logger
+        printf("Description: %s\n",
+               n_switch["description"].as<std::string>().c_str());
+      }
+
+      const uint8_t board = n_switch["board"].as<uint8_t>();
+      if (!isSkippedBoard(board)) {
+        index = 0;
+        program.Add(board, CONFIG_TOPIC_SWITCHES, index++, CONFIG_TOPIC_PORT,
+                    n_switch["port"].as<uint32_t>());
+        program.Add(board, CONFIG_TOPIC_SWITCHES, index++,
+                    CONFIG_TOPIC_NUMBER, n_switch["number"].as<uint32_t>());
+        program.Add(board, CONFIG_TOPIC_SWITCHES, index++,
+                    CONFIG_TOPIC_DEBOUNCE_TIME,
+                    n_switch["debounce"].as<uint32_t>());
+        YAML::Node debounceMode = n_switch["debounceMode"]
+                                      ? n_switch["debounceMode"]
+                                      : n_switch["debounce_mode"];
+        program.Add(board, CONFIG_TOPIC_SWITCHES, index++, CONFIG_TOPIC_MODE,
+                    ResolveSwitchDebounceMode(debounceMode));
+      }
+
+      program.switches.push_back(PPUCSwitch(
+          board, n_switch["port"].as<uint8_t>(),
+          n_switch["number"].as<uint8_t>(),
+          n_switch["description"].as<std::string>(),
+          n_switch["button"] && n_switch["button"].as<bool>()));
     }
+  }
 
-    // Send PWM configuration to I/O boards
-    if (HasSequenceItems(pwmOutput)) {
-      for (YAML::Node n_pwmOutput : pwmOutput) {
-        if (isSkippedBoard(n_pwmOutput["board"].as<uint8_t>())) {
-          continue;
-        }
-        if (m_debug) {
-          // @todo user logger
-          printf("Description: %s\n",
-                 n_pwmOutput["description"].as<std::string>().c_str());
-        }
+  // PWM configuration
+  if (HasSequenceItems(pwmOutput)) {
+    for (YAML::Node n_pwmOutput : pwmOutput) {
+      const uint8_t board = n_pwmOutput["board"].as<uint8_t>();
+      if (isSkippedBoard(board)) {
+        continue;
+      }
+      if (m_debug) {
+        // @todo user logger
+        printf("Description: %s\n",
+               n_pwmOutput["description"].as<std::string>().c_str());
+      }
 
-        index = 0;
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-            n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
-            index++, (uint8_t)CONFIG_TOPIC_PORT,
-            n_pwmOutput["port"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-            n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
-            index++, (uint8_t)CONFIG_TOPIC_NUMBER,
-            n_pwmOutput["number"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-            n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
-            index++, (uint8_t)CONFIG_TOPIC_POWER,
-            n_pwmOutput["power"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-            n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
-            index++, (uint8_t)CONFIG_TOPIC_MIN_PULSE_TIME,
-            n_pwmOutput["minPulseTime"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-            n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
-            index++, (uint8_t)CONFIG_TOPIC_MAX_PULSE_TIME,
-            n_pwmOutput["maxPulseTime"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-            n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
-            index++, (uint8_t)CONFIG_TOPIC_HOLD_POWER,
-            n_pwmOutput["holdPower"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-            n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
-            index++, (uint8_t)CONFIG_TOPIC_HOLD_POWER_ACTIVATION_TIME,
-            n_pwmOutput["holdPowerActivationTime"].as<uint32_t>()));
-        const uint32_t fastSwitch =
-            m_disableFastFlipForTests ? 0u
-                                      : n_pwmOutput["fastFlipSwitch"].as<uint32_t>();
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-            n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
-            index++, (uint8_t)CONFIG_TOPIC_FAST_SWITCH, fastSwitch));
-        std::string c_type = n_pwmOutput["type"].as<std::string>();
-        uint32_t type = ResolvePwmType(c_type);
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-            n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
-            index++, (uint8_t)CONFIG_TOPIC_TYPE, type));
-
-        const YAML::Node& pwm_effects = n_pwmOutput["effects"];
-        if (HasSequenceItems(pwm_effects)) {
-          for (YAML::Node n_pwm_effect : pwm_effects) {
-            index = 0;
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_PORT,
-                                n_pwmOutput["port"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_DURATION,
-                                n_pwm_effect["duration"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_EFFECT,
-                                ResolvePwmEffectMode(n_pwm_effect["effect"])));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_FREQUENCY,
-                                n_pwm_effect["frequency"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_MAX_INTENSITY,
-                                n_pwm_effect["maxIntensity"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_MIN_INTENSITY,
-                                n_pwm_effect["minIntensity"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_MODE,
-                                n_pwm_effect["mode"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_PRIORITY,
-                                n_pwm_effect["priority"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_REPEAT,
-                                n_pwm_effect["repeat"].as<int16_t>() == -1
-                                    ? 255
-                                    : (n_pwm_effect["repeat"].as<int16_t>() == -2
-                                           ? 254
-                                           : n_pwm_effect["repeat"]
-                                                 .as<uint32_t>())));
-
-            SendNamedEffectTriggerConfig(
-                m_pRS485Comm, n_pwm_effect, CONFIG_TOPIC_PWM_EFFECT,
-                n_pwmOutput["board"].as<uint8_t>(),
-                n_pwmOutput["port"].as<uint32_t>());
-            SendSimpleEffectTriggerConfig(
-                m_pRS485Comm, n_pwm_effect, CONFIG_TOPIC_PWM_EFFECT,
-                n_pwmOutput["board"].as<uint8_t>(),
-                n_pwmOutput["port"].as<uint32_t>(),
-                ConfigItemContext(n_pwm_effect, "pwmOutput.effects"));
-
-            if (AbortConfigurationEarly()) {
-              return false;
-            }
-          }
+      const uint32_t port = n_pwmOutput["port"].as<uint32_t>();
+      index = 0;
+      program.Add(board, CONFIG_TOPIC_PWM, index++, CONFIG_TOPIC_PORT, port);
+      program.Add(board, CONFIG_TOPIC_PWM, index++, CONFIG_TOPIC_NUMBER,
+                  n_pwmOutput["number"].as<uint32_t>());
+      program.Add(board, CONFIG_TOPIC_PWM, index++, CONFIG_TOPIC_POWER,
+                  n_pwmOutput["power"].as<uint32_t>());
+      program.Add(board, CONFIG_TOPIC_PWM, index++,
+                  CONFIG_TOPIC_MIN_PULSE_TIME,
+                  n_pwmOutput["minPulseTime"].as<uint32_t>());
+      program.Add(board, CONFIG_TOPIC_PWM, index++,
+                  CONFIG_TOPIC_MAX_PULSE_TIME,
+                  n_pwmOutput["maxPulseTime"].as<uint32_t>());
+      program.Add(board, CONFIG_TOPIC_PWM, index++, CONFIG_TOPIC_HOLD_POWER,
+                  n_pwmOutput["holdPower"].as<uint32_t>());
+      program.Add(board, CONFIG_TOPIC_PWM, index++,
+                  CONFIG_TOPIC_HOLD_POWER_ACTIVATION_TIME,
+                  n_pwmOutput["holdPowerActivationTime"].as<uint32_t>());
+      const uint32_t fastSwitch =
+          m_disableFastFlipForTests
+              ? 0u
+              : n_pwmOutput["fastFlipSwitch"].as<uint32_t>();
+      program.Add(board, CONFIG_TOPIC_PWM, index++, CONFIG_TOPIC_FAST_SWITCH,
+                  fastSwitch);
+      std::string c_type = n_pwmOutput["type"].as<std::string>();
+      uint32_t type = ResolvePwmType(c_type);
+      program.Add(board, CONFIG_TOPIC_PWM, index++, CONFIG_TOPIC_TYPE, type);
+
+      const YAML::Node& pwm_effects = n_pwmOutput["effects"];
+      if (HasSequenceItems(pwm_effects)) {
+        for (YAML::Node n_pwm_effect : pwm_effects) {
+          index = 0;
+          program.Add(board, CONFIG_TOPIC_PWM_EFFECT, index++,
+                      CONFIG_TOPIC_PORT, port);
+          program.Add(board, CONFIG_TOPIC_PWM_EFFECT, index++,
+                      CONFIG_TOPIC_DURATION,
+                      n_pwm_effect["duration"].as<uint32_t>());
+          program.Add(board, CONFIG_TOPIC_PWM_EFFECT, index++,
+                      CONFIG_TOPIC_EFFECT,
+                      ResolvePwmEffectMode(n_pwm_effect["effect"]));
+          program.Add(board, CONFIG_TOPIC_PWM_EFFECT, index++,
+                      CONFIG_TOPIC_FREQUENCY,
+                      n_pwm_effect["frequency"].as<uint32_t>());
+          program.Add(board, CONFIG_TOPIC_PWM_EFFECT, index++,
+                      CONFIG_TOPIC_MAX_INTENSITY,
+                      n_pwm_effect["maxIntensity"].as<uint32_t>());
+          program.Add(board, CONFIG_TOPIC_PWM_EFFECT, index++,
+                      CONFIG_TOPIC_MIN_INTENSITY,
+                      n_pwm_effect["minIntensity"].as<uint32_t>());
+          program.Add(board, CONFIG_TOPIC_PWM_EFFECT, index++,
+                      CONFIG_TOPIC_MODE, n_pwm_effect["mode"].as<uint32_t>());
+          program.Add(board, CONFIG_TOPIC_PWM_EFFECT, index++,
+                      CONFIG_TOPIC_PRIORITY,
+                      n_pwm_effect["priority"].as<uint32_t>());
+          program.Add(board, CONFIG_TOPIC_PWM_EFFECT, index++,
+                      CONFIG_TOPIC_REPEAT,
+                      ResolveEffectRepeat(n_pwm_effect["repeat"]));
+
+          AddNamedEffectTriggerConfig(&program, n_pwm_effect,
+                                      CONFIG_TOPIC_PWM_EFFECT, board, port);
+          AddSimpleEffectTriggerConfig(
+              &program, n_pwm_effect, CONFIG_TOPIC_PWM_EFFECT, board, port,
+              ConfigItemContext(n_pwm_effect, "pwmOutput.effects"));
         }
+      }
 
-        m_coils.push_back(
-            PPUCCoil(n_pwmOutput["board"].as<uint8_t>(),
-                     n_pwmOutput["port"].as<uint8_t>(), (uint8_t)type,
-                     n_pwmOutput["number"].as<uint8_t>(),
-                     n_pwmOutput["description"].as<std::string>(),
-                     n_pwmOutput["ballSearch"] &&
-                         n_pwmOutput["ballSearch"].as<bool>()));
+      program.coils.push_back(
+          PPUCCoil(board, n_pwmOutput["port"].as<uint8_t>(), (uint8_t)type,
+                   n_pwmOutput["number"].as<uint8_t>(),
+                   n_pwmOutput["description"].as<std::string>(),
+                   n_pwmOutput["ballSearch"] &&
+                       n_pwmOutput["ballSearch"].as<bool>()));
+    }
+  }
 
-        if (AbortConfigurationEarly()) {
-          return false;
+  // LED configuration
+  if (HasSequenceItems(ledStripes)) {
+    for (YAML::Node n_ledStripe : ledStripes) {
+      const uint8_t board = n_ledStripe["board"].as<uint8_t>();
+      if (isSkippedBoard(board)) {
+        continue;
+      }
+      const uint32_t port = n_ledStripe["port"].as<uint32_t>();
+      index = 0;
+      program.Add(board, CONFIG_TOPIC_LED_STRING, index++, CONFIG_TOPIC_PORT,
+                  port);
+      program.Add(board, CONFIG_TOPIC_LED_STRING, index++, CONFIG_TOPIC_TYPE,
+                  ResolveLedType(n_ledStripe["ledType"].as<std::string>()));
+      program.Add(board, CONFIG_TOPIC_LED_STRING, index++,
+                  CONFIG_TOPIC_BRIGHTNESS,
+                  n_ledStripe["brightness"].as<uint32_t>());
+      program.Add(board, CONFIG_TOPIC_LED_STRING, index++,
+                  CONFIG_TOPIC_AMOUNT_LEDS,
+                  n_ledStripe["amount"].as<uint32_t>());
+      program.Add(board, CONFIG_TOPIC_LED_STRING, index++,
+                  CONFIG_TOPIC_AFTER_GLOW,
+                  n_ledStripe["afterGlow"].as<uint32_t>());
+      program.Add(board, CONFIG_TOPIC_LED_STRING, index++,
+                  CONFIG_TOPIC_LIGHT_UP, n_ledStripe["lightUp"].as<uint32_t>());
+
+      const YAML::Node& segments = n_ledStripe["segments"];
+      if (HasSequenceItems(segments)) {
+        for (YAML::Node n_segment : segments) {
+          program.Add(board, CONFIG_TOPIC_LED_SEGMENT, index++,
+                      CONFIG_TOPIC_PORT, port);
+          program.Add(board, CONFIG_TOPIC_LED_SEGMENT, index++,
+                      CONFIG_TOPIC_NUMBER, n_segment["number"].as<uint32_t>());
+          program.Add(board, CONFIG_TOPIC_LED_SEGMENT, index++,
+                      CONFIG_TOPIC_FROM, n_segment["from"].as<uint32_t>());
+          program.Add(board, CONFIG_TOPIC_LED_SEGMENT, index++,
+                      CONFIG_TOPIC_TO, n_segment["to"].as<uint32_t>());
+        }
+      }
+
+      const YAML::Node& led_effects = n_ledStripe["effects"];
+      if (HasSequenceItems(led_effects)) {
+        for (YAML::Node n_led_effect : led_effects) {
+          index = 0;
+          program.Add(board, CONFIG_TOPIC_LED_EFFECT, index++,
+                      CONFIG_TOPIC_PORT, port);
+          program.Add(board, CONFIG_TOPIC_LED_EFFECT, index++,
+                      CONFIG_TOPIC_LED_SEGMENT,
+                      n_led_effect["segment"].as<uint32_t>());
+          const std::string effectContext =
+              ConfigItemContext(n_led_effect, "ledStripes.effects");
+          const std::array<uint32_t, 3> colors =
+              BuildLedEffectColors(n_led_effect, effectContext);
+          program.Add(board, CONFIG_TOPIC_LED_EFFECT, index++,
+                      CONFIG_TOPIC_COLOR, colors[0]);
+          program.Add(board, CONFIG_TOPIC_LED_EFFECT, index++,
+                      CONFIG_TOPIC_COLOR_2, colors[1]);
+          program.Add(board, CONFIG_TOPIC_LED_EFFECT, index++,
+                      CONFIG_TOPIC_COLOR_3, colors[2]);
+          program.Add(board, CONFIG_TOPIC_LED_EFFECT, index++,
+                      CONFIG_TOPIC_DURATION,
+                      n_led_effect["duration"].as<uint32_t>());
+          program.Add(board, CONFIG_TOPIC_LED_EFFECT, index++,
+                      CONFIG_TOPIC_EFFECT,
+                      ResolveLedEffectMode(n_led_effect["effect"]));
+          program.Add(board, CONFIG_TOPIC_LED_EFFECT, index++,
+                      CONFIG_TOPIC_REVERSE,
+                      n_led_effect["reverse"].as<uint32_t>());
+          program.Add(board, CONFIG_TOPIC_LED_EFFECT, index++,
+                      CONFIG_TOPIC_SPEED, n_led_effect["speed"].as<uint32_t>());
+          program.Add(board, CONFIG_TOPIC_LED_EFFECT, index++,
+                      CONFIG_TOPIC_MODE, n_led_effect["mode"].as<uint32_t>());
+          program.Add(board, CONFIG_TOPIC_LED_EFFECT, index++,
+                      CONFIG_TOPIC_PRIORITY,
+                      n_led_effect["priority"].as<uint32_t>());
+          program.Add(board, CONFIG_TOPIC_LED_EFFECT, index++,
+                      CONFIG_TOPIC_OPTIONS, BuildWs2812FxOptions(n_led_effect));
+          program.Add(board, CONFIG_TOPIC_LED_EFFECT, index++,
+                      CONFIG_TOPIC_REPEAT,
+                      ResolveEffectRepeat(n_led_effect["repeat"]));
+
+          AddNamedEffectTriggerConfig(&program, n_led_effect,
+                                      CONFIG_TOPIC_LED_EFFECT, board, port);
+          AddSimpleEffectTriggerConfig(&program, n_led_effect,
+                                       CONFIG_TOPIC_LED_EFFECT, board, port,
+                                       effectContext);
         }
       }
+
+      AddLedConfigBlock(&program, n_ledStripe["lamps"], LED_TYPE_LAMP, board,
+                        port);
+      AddLedConfigBlock(&program, n_ledStripe["flashers"], LED_TYPE_FLASHER,
+                        board, port);
+      AddLedConfigBlock(&program, n_ledStripe["gi"], LED_TYPE_GI, board, port);
     }
+  }
 
-    if (AbortConfigurationEarly()) {
-      return false;
+  return program;
+}
+
+bool PPUC::Connect() {
+  // Everything is read from the YAML, or the cache of it, here, so a
+  // configuration error stops startup before the bus is touched, and a retry
+  // only replays the records.
+  PPUCConfigProgram program;
+  try {
+    if (m_configFromCache &&
+        m_cachedConfig.skippedBoards == m_skippedBoards &&
+        m_cachedConfig.disableFastFlipForTests == m_disableFastFlipForTests) {
+      program = m_cachedConfig.program;
+    } else {
+      if (m_configFromCache) {
+        printf("PPUC: config cache was built for other board options; "
+               "loading '%s'.\n",
+               m_configFile.c_str());
+      }
+      LoadYamlBehindCache();
+      ValidatePpucConfiguration(m_ppucConfig);
+      program = CompileConfiguration();
     }
+  } catch (const YAML::Exception& e) {
+    printf("PPUC: invalid YAML configuration at %s: %s\n",
+           FormatYamlLocation(e.mark).c_str(), e.what());
+    return false;
+  } catch (const std::exception& e) {
+    printf("PPUC: %s\n", e.what());
+    return false;
+  }
 
-    // Send LED configuration to I/O boards
-    if (HasSequenceItems(ledStripes)) {
-      for (YAML::Node n_ledStripe : ledStripes) {
-        if (isSkippedBoard(n_ledStripe["board"].as<uint8_t>())) {
-          continue;
-        }
-        index = 0;
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-            n_ledStripe["board"].as<uint8_t>(),
-            (uint8_t)CONFIG_TOPIC_LED_STRING, index++,
-            (uint8_t)CONFIG_TOPIC_PORT, n_ledStripe["port"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-            n_ledStripe["board"].as<uint8_t>(),
-            (uint8_t)CONFIG_TOPIC_LED_STRING, index++,
-            (uint8_t)CONFIG_TOPIC_TYPE,
-            ResolveLedType(n_ledStripe["ledType"].as<std::string>())));
-        m_pRS485Comm->SendConfigEvent(
-            new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                            (uint8_t)CONFIG_TOPIC_LED_STRING, index++,
-                            (uint8_t)CONFIG_TOPIC_BRIGHTNESS,
-                            n_ledStripe["brightness"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(
-            new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                            (uint8_t)CONFIG_TOPIC_LED_STRING, index++,
-                            (uint8_t)CONFIG_TOPIC_AMOUNT_LEDS,
-                            n_ledStripe["amount"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(
-            new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                            (uint8_t)CONFIG_TOPIC_LED_STRING, index++,
-                            (uint8_t)CONFIG_TOPIC_AFTER_GLOW,
-                            n_ledStripe["afterGlow"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(
-            new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                            (uint8_t)CONFIG_TOPIC_LED_STRING, index++,
-                            (uint8_t)CONFIG_TOPIC_LIGHT_UP,
-                            n_ledStripe["lightUp"].as<uint32_t>()));
-
-        const YAML::Node& segments = n_ledStripe["segments"];
-        if (HasSequenceItems(segments)) {
-          for (YAML::Node n_segment : segments) {
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_LED_SEGMENT, index++,
-                                (uint8_t)CONFIG_TOPIC_PORT,
-                                n_ledStripe["port"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_LED_SEGMENT, index++,
-                                (uint8_t)CONFIG_TOPIC_NUMBER,
-                                n_segment["number"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-                n_ledStripe["board"].as<uint8_t>(),
-                (uint8_t)CONFIG_TOPIC_LED_SEGMENT, index++,
-                (uint8_t)CONFIG_TOPIC_FROM, n_segment["from"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-                n_ledStripe["board"].as<uint8_t>(),
-                (uint8_t)CONFIG_TOPIC_LED_SEGMENT, index++,
-                (uint8_t)CONFIG_TOPIC_TO, n_segment["to"].as<uint32_t>()));
-
-            if (AbortConfigurationEarly()) {
-              return false;
-            }
-          }
-        }
+  // A transport handed in through SetTransport() is consumed by this attempt.
+  Transport* transport = m_pTransport;
+  m_pTransport = nullptr;
+  if (transport ? !m_pRS485Comm->Connect(transport)
+                : !m_pRS485Comm->Connect(m_serial)) {
+    return false;
+  }
 
-        const YAML::Node& led_effects = n_ledStripe["effects"];
-        if (HasSequenceItems(led_effects)) {
-          for (YAML::Node n_led_effect : led_effects) {
-            index = 0;
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_PORT,
-                                n_ledStripe["port"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_LED_SEGMENT,
-                                n_led_effect["segment"].as<uint32_t>()));
-            const std::string effectContext =
-                ConfigItemContext(n_led_effect, "ledStripes.effects");
-            const std::array<uint32_t, 3> colors =
-                BuildLedEffectColors(n_led_effect, effectContext);
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_COLOR, colors[0]));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_COLOR_2, colors[1]));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_COLOR_3, colors[2]));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_DURATION,
-                                n_led_effect["duration"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_EFFECT,
-                                ResolveLedEffectMode(n_led_effect["effect"])));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_REVERSE,
-                                n_led_effect["reverse"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_SPEED,
-                                n_led_effect["speed"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_MODE,
-                                n_led_effect["mode"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_PRIORITY,
-                                n_led_effect["priority"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(new ConfigEvent(
-                n_ledStripe["board"].as<uint8_t>(),
-                (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
-                (uint8_t)CONFIG_TOPIC_OPTIONS,
-                BuildWs2812FxOptions(n_led_effect)));
-            m_pRS485Comm->SendConfigEvent(
-                new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
-                                (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
-                                (uint8_t)CONFIG_TOPIC_REPEAT,
-                                n_led_effect["repeat"].as<int16_t>() == -1
-                                    ? 255
-                                    : (n_led_effect["repeat"].as<int16_t>() == -2
-                                           ? 254
-                                           : n_led_effect["repeat"]
-                                                 .as<uint32_t>())));
-
-            SendNamedEffectTriggerConfig(
-                m_pRS485Comm, n_led_effect, CONFIG_TOPIC_LED_EFFECT,
-                n_ledStripe["board"].as<uint8_t>(),
-                n_ledStripe["port"].as<uint32_t>());
-            SendSimpleEffectTriggerConfig(
-                m_pRS485Comm, n_led_effect, CONFIG_TOPIC_LED_EFFECT,
-                n_ledStripe["board"].as<uint8_t>(),
-                n_ledStripe["port"].as<uint32_t>(),
-                ConfigItemContext(n_led_effect, "ledStripes.effects"));
-
-            if (AbortConfigurationEarly()) {
-              return false;
-            }
-          }
-        }
+  auto startupAttempt = [this, &program]() -> bool {
+    m_coils = program.coils;
+    m_lamps = program.lamps;
+    m_switches = program.switches;
+    m_coinDoorClosedSwitch = program.coinDoorClosedSwitch;
+    m_gameOnSolenoid = program.gameOnSolenoid;
 
-        SendLedConfigBlock(n_ledStripe["lamps"], LED_TYPE_LAMP,
-                           n_ledStripe["board"].as<uint8_t>(),
-                           n_ledStripe["port"].as<uint32_t>());
-        SendLedConfigBlock(n_ledStripe["flashers"], LED_TYPE_FLASHER,
-                           n_ledStripe["board"].as<uint8_t>(),
-                           n_ledStripe["port"].as<uint32_t>());
-        SendLedConfigBlock(n_ledStripe["gi"], LED_TYPE_GI,
-                           n_ledStripe["board"].as<uint8_t>(),
-                           n_ledStripe["port"].as<uint32_t>());
-
-        if (AbortConfigurationEarly()) {
-          return false;
-        }
+    // Boards that take a whole config item in one frame are sent it that way;
+    // the rest, and any that do not answer, get one frame per key.
+    for (const uint8_t boardNumber : program.boards) {
+      if (m_skippedBoards.count(boardNumber) == 0) {
+        m_pRS485Comm->QueryConfigCapabilities(boardNumber);
       }
     }
 
-    if (AbortConfigurationEarly()) {
-      return false;
+    for (const uint8_t boardNumber : program.switchBoards) {
+      m_pRS485Comm->RegisterSwitchBoard(boardNumber);
+    }
+
+    ppuc::v2::RuntimeConfig runtimeConfig;
+    runtimeConfig.coilBits = static_cast<uint16_t>(program.coilMapping.size());
+    runtimeConfig.lampBits = static_cast<uint16_t>(program.lampMapping.size());
+    runtimeConfig.switchBits =
+        static_cast<uint16_t>(program.switchMapping.size());
+    m_pRS485Comm->SetMappings(program.coilMapping, program.lampMapping,
+                              program.switchMapping);
+    m_pRS485Comm->SetRuntimeConfig(runtimeConfig);
+    m_pRS485Comm->SetConfiguredBoards(program.boards);
+    m_pRS485Comm->SetSwitchNumbersByBoard(program.switchNumbersByBoard);
+    m_pRS485Comm->SetButtonSwitchNumbers(program.buttonSwitchNumbers);
+    m_pRS485Comm->SetSkippedBoards(m_skippedBoards);
+
+    // Send the board-local configuration to the I/O boards.
+    for (const PPUCConfigRecord& record : program.records) {
+      m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+          record.board, record.topic, record.index, record.key, record.value));
+      if (AbortConfigurationEarly()) {
+        return false;
+      }
     }
 
+    m_pRS485Comm->FlushConfigEvents();
     if (m_pRS485Comm->HadConfigurationFailure()) {
       return false;
     }
 
     m_pRS485Comm->FinalizeConfiguredBoardPresence();
-    m_pRS485Comm->SetActiveSwitchBoards(switchBoards);
+    m_pRS485Comm->SetActiveSwitchBoards(program.switchBoards);
 
     // Configure token-ring handoff across the full logical switch-board
     // order, including virtualized boards. The host synthesizes replies for
     // virtualized boards when the chain reaches their token.
-    for (size_t i = 0; i < switchBoards.size(); ++i) {
-      const uint8_t current = switchBoards[i];
+    for (size_t i = 0; i < program.switchBoards.size(); ++i) {
+      const uint8_t current = program.switchBoards[i];
       if (!m_pRS485Comm->IsBoardPresent(current)) {
         continue;
       }
 
-      const uint8_t next = (i + 1 < switchBoards.size())
-                               ? switchBoards[i + 1]
+      const uint8_t next = (i + 1 < program.switchBoards.size())
+                               ? program.switchBoards[i + 1]
                                : ppuc::v2::kNoBoard;
       m_pRS485Comm->SendConfigEvent(new ConfigEvent(
           current, (uint8_t)CONFIG_TOPIC_SWITCH_CHAIN, 0,
@@ -1785,6 +1748,7 @@ bool PPUC::Connect() {
       return false;
     }
 
+    m_pRS485Comm->FlushConfigEvents();
     if (m_pRS485Comm->HadConfigurationFailure()) {
       return false;
     }
@@ -1815,11 +1779,6 @@ bool PPUC::Connect() {
                             &startupAttemptHadException]() -> bool {
     try {
       return startupAttempt();
-    } catch (const YAML::Exception& e) {
-      startupAttemptHadException = true;
-      printf("PPUC: invalid YAML configuration at %s: %s\n",
-             FormatYamlLocation(e.mark).c_str(), e.what());
-      return false;
     } catch (const std::exception& e) {
       startupAttemptHadException = true;
       printf("PPUC: %s\n", e.what());
@@ -1890,15 +1849,11 @@ bool PPUC::Connect() {
 }
 
 void PPUC::SetSolenoidState(int number, int state) {
-  uint16_t solNo = number;
-  uint8_t solState = state == 0 ? 0 : 1;
-  m_pRS485Comm->QueueEvent(new Event(EVENT_SOURCE_SOLENOID, solNo, solState));
+  m_pRS485Comm->SetCoilState(static_cast<uint16_t>(number), state != 0);
 }
 
 void PPUC::SetLampState(int number, int state) {
-  uint16_t lampNo = number;
-  uint8_t lampState = state == 0 ? 0 : 1;
-  m_pRS485Comm->QueueEvent(new Event(EVENT_SOURCE_LIGHT, lampNo, lampState));
+  m_pRS485Comm->SetLampState(static_cast<uint16_t>(number), state != 0);
 }
 
 void PPUC::SetGIState(int string, int brightness) {
@@ -1910,9 +1865,15 @@ void PPUC::SetGIState(int string, int brightness) {
   if (brightness > 0) {
     giBrightness = static_cast<uint8_t>(brightness);
   }
-  m_pRS485Comm->QueueEvent(new Event(
-      EVENT_SOURCE_GI, static_cast<uint16_t>(string),
-      ppuc::v2::ClampGiLevel(giBrightness)));
+  m_pRS485Comm->SetGILevel(static_cast<uint8_t>(string), giBrightness);
+}
+
+void PPUC::SetOutputStates(const PPUCOutputState* solenoids,
+                           size_t solenoidCount, const PPUCOutputState* lamps,
+                           size_t lampCount, const PPUCOutputState* gi,
+                           size_t giCount) {
+  m_pRS485Comm->SetOutputStates(solenoids, solenoidCount, lamps, lampCount, gi,
+                                giCount);
 }
 
 void PPUC::SetSwitchState(int number, int state) {
@@ -1942,6 +1903,71 @@ PPUCSwitchState* PPUC::GetNextSwitchState() {
   return m_pRS485Comm->GetNextSwitchState();
 }
 
+size_t PPUC::GetSwitchStates(PPUCSwitchState* out, size_t max) {
+  return m_pRS485Comm->GetSwitchStates(out, max);
+}
+
+size_t PPUC::GetSwitchEvents(PPUCSwitchEvent* out, size_t max) {
+  return m_pRS485Comm->GetSwitchEvents(out, max);
+}
+
+uint64_t PPUC::GetMonotonicTimeUs() { return RS485Comm::GetMonotonicTimeUs(); }
+
+PPUCSwitchSnapshot PPUC::GetSwitchSnapshot() {
+  return m_pRS485Comm->GetSwitchSnapshot();
+}
+
+bool PPUC::WaitForSwitchState(uint32_t timeoutMs) {
+  return m_pRS485Comm->WaitForSwitchState(timeoutMs);
+}
+
+int PPUC::GetSwitchEventFd() { return m_pRS485Comm->GetSwitchEventFd(); }
+
+// Groups get a bit each in name order, so the assignment does not depend on
+// hash order. A mask holds 32; any groups past that cannot take callbacks.
+void PPUC::BuildSwitchGroupMasks() {
+  std::vector<std::string> names;
+  for (const auto& entry : m_switchGroups) {
+    names.push_back(entry.first);
+  }
+  std::sort(names.begin(), names.end());
+
+  m_switchGroupBits.clear();
+  std::vector<uint32_t> masks;
+  for (size_t bit = 0; bit < names.size() && bit < 32; ++bit) {
+    const uint32_t groupBit = static_cast<uint32_t>(1) << bit;
+    m_switchGroupBits[names[bit]] = groupBit;
+    for (const uint16_t number : m_switchGroups[names[bit]]) {
+      if (number >= masks.size()) {
+        masks.resize(number + 1, 0);
+      }
+      masks[number] |= groupBit;
+    }
+  }
+  m_pRS485Comm->SetSwitchGroupMasks(masks);
+}
+
+void PPUC::AddSwitchCallback(PPUC_SwitchChangesCallback callback,
+                             const void* userData) {
+  m_pRS485Comm->AddSwitchChangesCallback(RS485_COMM_ALL_SWITCH_GROUPS,
+                                         callback, userData);
+}
+
+bool PPUC::AddSwitchGroupCallback(const std::string& group,
+                                  PPUC_SwitchChangesCallback callback,
+                                  const void* userData) {
+  auto it = m_switchGroupBits.find(group);
+  if (it == m_switchGroupBits.end() || !callback) {
+    return false;
+  }
+  m_pRS485Comm->AddSwitchChangesCallback(it->second, callback, userData);
+  return true;
+}
+
+void PPUC::ClearSwitchCallbacks() {
+  m_pRS485Comm->ClearSwitchChangesCallbacks();
+}
+
 PPUCBusHealth PPUC::GetBusHealth() { return m_pRS485Comm->GetBusHealth(); }
 
 std::vector<std::string> PPUC::GetRecentAnomalies() {
@@ -1961,13 +1987,9 @@ std::vector<PPUCBoardVersion> PPUC::QueryBoardVersions() {
   std::vector<PPUCBoardVersion> versions;
 
   std::set<uint8_t> boards;
-  const YAML::Node& configured = m_ppucConfig["boards"];
-  if (HasSequenceItems(configured)) {
-    for (YAML::Node board : configured) {
-      const uint8_t number = board["number"].as<uint8_t>();
-      if (m_skippedBoards.find(number) == m_skippedBoards.end()) {
-        boards.insert(number);
-      }
+  for (const uint8_t number : m_configuredBoards) {
+    if (m_skippedBoards.find(number) == m_skippedBoards.end()) {
+      boards.insert(number);
     }
   }
 
@@ -26,14 +26,7 @@
 #include <unordered_map>
 
 class RS485Comm;
-
-
-struct PPUCCoilGiMapping {
-  uint16_t coil = 0;
-  uint8_t gi = 0;
-  uint8_t onBrightness = 8;
-  uint8_t offBrightness = 0;
-};
+class Transport;
 
 
 class PPUCAPI PPUC {
@@ -45,12 +38,37 @@ class PPUCAPI PPUC {
                              const void* userData);
 
   void LoadConfiguration(const char* configFile);
+  // Loads the configuration from cacheFile, as WriteConfigurationCache()
+  // wrote it, without parsing configFile. If the cache is missing, damaged
+  // or stale - configFile has changed, or another libppuc wrote it - loads
+  // configFile instead, as LoadConfiguration() does. Returns whether the
+  // cache was used.
+  bool LoadCachedConfiguration(const char* configFile, const char* cacheFile);
+  // Compiles the loaded configuration, with the skipped boards and fast flip
+  // setting in effect now, into cacheFile. Connect() uses the cached program
+  // only while those settings match; otherwise it reads the YAML again.
+  // Throws on a configuration error or if the file cannot be written.
+  void WriteConfigurationCache(const char* cacheFile);
   void SetDebug(bool debug);
   void SetDebugErrors(bool debugErrors);
   void SetSkippedBoardsCsv(const char* skippedBoardsCsv);
   void SetSwitchReplyDelayUs(uint32_t delayUs);
   void SetSwitchRefreshIdleMs(uint32_t idleMs);
   void SetOutputFrameIntervalMs(uint32_t intervalMs);
+  // Decodes bus input on a thread of its own instead of on the bus thread.
+  // Call before Connect().
+  void SetReceiveThreadEnabled(bool enabled);
+  // Sends only the output bytes that changed, with periodic full frames.
+  // Needs board firmware that decodes delta frames; off by default.
+  void SetOutputDeltaFramesEnabled(bool enabled);
+  // Config frames sent ahead of their acks during Connect(). Only for links
+  // where an ack cannot collide with the next frame; one, the default, waits
+  // for each ack as a shared RS485 bus needs.
+  void SetConfigWindow(uint8_t frames);
+  // Leaves out the config of boards that report already holding it, as
+  // after a soft restart with the same YAML. Needs board firmware that
+  // answers config fingerprint queries; off by default.
+  void SetConfigFingerprintsEnabled(bool enabled);
   void SetCoilHoldFrames(uint8_t holdFrames);
   void SetDisableFastFlipForTests(bool disableFastFlipForTests);
   void SetForceHardReset(bool forceHardReset);
@@ -59,6 +77,14 @@ class PPUCAPI PPUC {
   const char* GetRom();
   void SetSerial(const char* serial);
   const char* GetSerial();
+  // Makes the next Connect() talk through the given transport instead of
+  // opening the serial device, e.g. a LoopbackTransport wired to a board
+  // simulator. Takes ownership.
+  void SetTransport(Transport* transport);
+  // The board config Connect() sends, compiled from the loaded YAML without
+  // touching the bus. Depends on the skipped boards and the fast flip
+  // setting. Throws on a configuration error, as Connect() reports it.
+  PPUCConfigProgram CompileConfiguration();
   bool Connect();
   void Disconnect();
   void StartUpdates();
@@ -67,11 +93,42 @@ class PPUCAPI PPUC {
   void SetSolenoidState(int number, int state);
   void SetLampState(int number, int state);
   void SetGIState(int string, int brightness);
+  // Everything one emulator tick changed, applied together so it goes out in
+  // one frame instead of one queued frame per coil.
+  void SetOutputStates(const PPUCOutputState* solenoids, size_t solenoidCount,
+                       const PPUCOutputState* lamps, size_t lampCount,
+                       const PPUCOutputState* gi, size_t giCount);
   void SetSwitchState(int number, int state);
   void TriggerEvent(uint8_t source, int number, int value);
   bool IsSwitchVirtualized(int number);
   bool IsBoardVirtualized(uint8_t board);
   PPUCSwitchState* GetNextSwitchState();
+  size_t GetSwitchStates(PPUCSwitchState* out, size_t max);
+  // The same changes with the time each reached the host. See
+  // PPUCSwitchEvent.
+  size_t GetSwitchEvents(PPUCSwitchEvent* out, size_t max);
+  uint64_t GetMonotonicTimeUs();
+  // All switches at once, by number, without draining GetSwitchStates().
+  PPUCSwitchSnapshot GetSwitchSnapshot();
+  // Sleeps until a switch change is waiting or timeoutMs passes, rather than
+  // polling GetNextSwitchState(). Returns whether one is waiting.
+  bool WaitForSwitchState(uint32_t timeoutMs);
+  // Readable while switch changes are waiting, for a host's own poll() or
+  // epoll loop. Do not close it. -1 on platforms without one.
+  int GetSwitchEventFd();
+
+  // Calls callback with each batch of switch changes, or with just those of
+  // a switchGroups group (or "buttons"), skipping batches that have none.
+  // Runs on the bus thread, so it must return quickly. Unaffected by, and
+  // does not drain, GetSwitchStates(). A callback may add or clear
+  // callbacks; that takes effect from the next batch. AddSwitchGroupCallback()
+  // returns false for a group the loaded configuration does not have.
+  void AddSwitchCallback(PPUC_SwitchChangesCallback callback,
+                         const void* userData);
+  bool AddSwitchGroupCallback(const std::string& group,
+                              PPUC_SwitchChangesCallback callback,
+                              const void* userData);
+  void ClearSwitchCallbacks();
   uint32_t GetCleanSwitchReplyChainCount();
 
   // Bus recovery counters since startup. See PPUCBusHealth.
@@ -88,6 +145,7 @@ class PPUCAPI PPUC {
   // chain, so nothing arbitrates who replies to a broadcast. Entries for
   // boards that did not answer are returned with responded == false rather
   // than omitted, so a missing board is visible instead of silently absent.
+  // Once connected, call StopUpdates() first; until then no board is asked.
   std::vector<PPUCBoardVersion> QueryBoardVersions();
 
   // Sends a firmware image to one board. Call StopUpdates() first: the runtime
@@ -109,7 +167,14 @@ class PPUCAPI PPUC {
 
  private:
   YAML::Node m_ppucConfig;
+  std::string m_configFile;
+  // Set while the configuration came from a cache and m_ppucConfig is empty.
+  bool m_configFromCache = false;
+  PPUCCompiledConfig m_cachedConfig;
+  std::vector<uint8_t> m_configuredBoards;
+  void LoadYamlBehindCache();
   RS485Comm* m_pRS485Comm;
+  Transport* m_pTransport = nullptr;
   uint8_t ResolveLedType(const std::string& type);
   uint32_t ResolveSwitchDebounceMode(const YAML::Node& node);
   std::vector<PPUCCoil> m_coils;
@@ -117,6 +182,9 @@ class PPUCAPI PPUC {
   std::vector<PPUCSwitch> m_switches;
   std::vector<PPUCCoilGiMapping> m_coilGiMappings;
   std::unordered_map<std::string, std::vector<uint16_t>> m_switchGroups;
+  // Each group's bit in the switch group masks handed to RS485Comm.
+  std::unordered_map<std::string, uint32_t> m_switchGroupBits;
+  void BuildSwitchGroupMasks();
 
   bool m_debug = false;
   char* m_rom;
@@ -131,7 +199,7 @@ class PPUCAPI PPUC {
   bool m_forceHardReset = false;
   std::set<uint8_t> m_skippedBoards;
 
-  void SendLedConfigBlock(const YAML::Node& items, uint32_t type, uint8_t board,
-                          uint32_t port);
+  void AddLedConfigBlock(PPUCConfigProgram* program, const YAML::Node& items,
+                         uint32_t type, uint8_t board, uint32_t port);
   bool AbortConfigurationEarly() const;
 };
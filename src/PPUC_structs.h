@@ -7,7 +7,9 @@
 #endif
 
 #include <inttypes.h>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 typedef void(CALLBACK* PPUC_LogMessageCallback)(const char* format,
@@ -18,12 +20,56 @@ struct PPUCSwitchState {
   int number;
   int state;
 
+  PPUCSwitchState() {
+    number = 0;
+    state = 0;
+  }
+
   PPUCSwitchState(int n, int s) {
     number = n;
     state = s;
   }
 };
 
+// A switch change stamped with when the host learned of it: when the board's
+// switch reply finished arriving, or when a virtual switch was set. In
+// microseconds on the host's monotonic clock, as GetMonotonicTimeUs()
+// reads it, so the time spent waiting to be collected is now minus
+// timestampUs.
+struct PPUCSwitchEvent {
+  int number = 0;
+  int state = 0;
+  uint64_t timestampUs = 0;
+};
+
+// A batch of switch changes, oldest first, as registered with
+// AddSwitchCallback() or AddSwitchGroupCallback().
+typedef void(CALLBACK* PPUC_SwitchChangesCallback)(
+    const PPUCSwitchState* changes, size_t count, const void* userData);
+
+// Every switch's state at one moment, indexed by switch number, as returned
+// by GetSwitchSnapshot(). sequence changes whenever any switch does, so a
+// poller can skip a frame in which nothing moved.
+struct PPUCSwitchSnapshot {
+  static constexpr int kMaxSwitchNumbers = 256;
+
+  uint8_t states[kMaxSwitchNumbers / 8] = {0};
+  uint32_t sequence = 0;
+
+  bool GetState(int number) const {
+    if (number < 0 || number >= kMaxSwitchNumbers) {
+      return false;
+    }
+    return (states[number / 8] >> (number % 8)) & 1;
+  }
+};
+
+// One coil, lamp or GI change in a batch passed to SetOutputStates().
+struct PPUCOutputState {
+  int number;
+  int state;
+};
+
 struct PPUCSwitch {
   uint8_t board;
   uint8_t port;
@@ -61,6 +107,13 @@ struct PPUCLamp {
   : board(b), port(p), type(t), number(n), description(d), color(c) {}
 };
 
+struct PPUCCoilGiMapping {
+  uint16_t coil = 0;
+  uint8_t gi = 0;
+  uint8_t onBrightness = 8;
+  uint8_t offBrightness = 0;
+};
+
 // A running tally of how often the bus needed the mechanisms that protect it.
 //
 // The host carries a number of timeouts, retries and windows - the 40 ms
@@ -135,8 +188,78 @@ struct PPUCBusHealth {
   // Board configuration, which happens at startup and after a resync.
   uint32_t configAckRetries = 0;   // config frames that needed repeating
   uint32_t configAckTimeouts = 0;  // config frames never acknowledged
+  uint32_t configUploadsSkipped = 0;  // boards that already held theirs
 
   // Transport faults, counted wherever they are reported.
   uint32_t serialWriteFailures = 0;  // the port rejected or truncated a write
   uint32_t frameCrcErrors = 0;       // a frame arrived corrupt
+
+  // Coil changes queued for a frame of their own, between the emulator
+  // thread and the bus thread.
+  uint32_t outputQueueDepth = 0;        // queued right now
+  uint32_t outputQueueHighWater = 0;    // deepest since connecting
+  uint32_t outputSnapshotsDropped = 0;  // lost because the queue was full
+  // Switch changes the application has not collected yet.
+  uint32_t switchEventsDropped = 0;  // oldest lost because nobody drained
+  // Effect triggers and virtual switch changes posted to the bus thread.
+  uint32_t commandsDropped = 0;  // lost because the queue was full
+  // Output frames sent as deltas rather than in full, if enabled.
+  uint32_t outputDeltaFrames = 0;
+};
+
+// One key of board config, as a ConfigFrame carries it.
+struct PPUCConfigRecord {
+  uint8_t board = 0;
+  uint8_t topic = 0;
+  uint8_t index = 0;
+  uint8_t key = 0;
+  uint32_t value = 0;
+};
+
+// Everything Connect() sends the boards, compiled from the YAML before the
+// bus is touched. A startup attempt replays it rather than reading the YAML
+// again. The switch chain is not part of it, since it depends on which
+// boards answer.
+struct PPUCConfigProgram {
+  std::vector<uint8_t> boards;            // configured, in YAML order
+  std::vector<uint8_t> switchBoards;      // polled for switches, not skipped
+  std::vector<PPUCConfigRecord> records;  // in the order they are sent
+
+  // Output and switch numbers in bit order, as the mapping frames send them.
+  std::vector<uint16_t> coilMapping;
+  std::vector<uint16_t> lampMapping;
+  std::vector<uint16_t> switchMapping;
+  std::unordered_map<uint8_t, std::vector<uint16_t>> switchNumbersByBoard;
+  std::set<uint16_t> buttonSwitchNumbers;
+
+  std::vector<PPUCCoil> coils;
+  std::vector<PPUCLamp> lamps;
+  std::vector<PPUCSwitch> switches;
+  uint8_t coinDoorClosedSwitch = 0;
+  uint8_t gameOnSolenoid = 0;
+
+  void Add(uint8_t board, uint8_t topic, uint8_t index, uint8_t key,
+           uint32_t value) {
+    records.push_back({board, topic, index, key, value});
+  }
+};
+
+// What loading a configuration takes from the YAML, compiled, as the config
+// cache stores it. program is only valid for the skipped boards and fast
+// flip setting it was compiled with.
+struct PPUCCompiledConfig {
+  // The longest rom and serial port names PPUC has room for.
+  static constexpr size_t kMaxRomLength = 15;
+  static constexpr size_t kMaxSerialLength = 127;
+
+  bool debug = false;
+  std::string rom;
+  std::string serial;
+  uint8_t platform = 0;
+  std::unordered_map<std::string, std::vector<uint16_t>> switchGroups;
+  std::vector<PPUCCoilGiMapping> coilGiMappings;
+
+  std::set<uint8_t> skippedBoards;
+  bool disableFastFlipForTests = false;
+  PPUCConfigProgram program;
 };
@@ -3,17 +3,10 @@
 #include <algorithm>
 #include <string>
 
+#include "SerialTransport.h"
+#include "SwitchBitmapDiff.h"
 #include "io-boards/PPUCTimings.h"
 
-#if defined(__linux__)
-#include <fcntl.h>
-#include <linux/serial.h>
-#include <stdlib.h>
-#include <string.h>
-#include <sys/ioctl.h>
-#include <unistd.h>
-#endif
-
 namespace {
 const char* SwitchStatusFlagName(uint8_t flag) {
   switch (flag) {
@@ -33,84 +26,45 @@ const char* SwitchStatusFlagName(uint8_t flag) {
       return "unknown";
   }
 }
-}  // namespace
 
-#if defined(__linux__)
-namespace {
-bool ShouldEnableHardwareRs485(const char* device) {
-  const char* force = getenv("PPUC_RS485_HW");
-  if (force && strcmp(force, "1") == 0) {
-    return true;
+// Inverts an index-to-number mapping into a table indexed by number. Indexes
+// the bitmaps cannot hold are left unmapped, so a lookup needs no further
+// range check.
+void BuildNumberToIndex(const std::vector<uint16_t>& indexToNumber,
+                        size_t maxBits, std::vector<uint16_t>* numberToIndex) {
+  uint16_t highest = 0;
+  for (const uint16_t number : indexToNumber) {
+    highest = std::max(highest, number);
   }
-  if (!device) {
-    return false;
+  numberToIndex->assign(indexToNumber.empty() ? 0 : highest + 1,
+                        RS485_COMM_UNMAPPED_INDEX);
+  for (uint16_t i = 0; i < indexToNumber.size() && i < maxBits; ++i) {
+    (*numberToIndex)[indexToNumber[i]] = i;
   }
-
-  // Raspberry Pi UART commonly used with RS485 overlay.
-  return strcmp(device, "/dev/ttyAMA0") == 0 ||
-         strcmp(device, "/dev/serial0") == 0;
 }
 
-void TryEnableHardwareRs485(const char* device, bool debug) {
-  if (!ShouldEnableHardwareRs485(device)) {
-    return;
-  }
-
-  const int fd = open(device, O_RDWR | O_NOCTTY);
-  if (fd < 0) {
-    if (debug) {
-      printf("RS485 HW mode: could not open %s for TIOCSRS485\n", device);
-    }
-    return;
-  }
-
-  struct serial_rs485 rs485;
-  memset(&rs485, 0, sizeof(rs485));
-  rs485.flags |= SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND;
-  rs485.flags &= ~SER_RS485_RTS_AFTER_SEND;
-  rs485.delay_rts_before_send = 0;
-  rs485.delay_rts_after_send = 0;
-
-  if (ioctl(fd, TIOCSRS485, &rs485) < 0) {
-    if (debug) {
-      printf("RS485 HW mode: TIOCSRS485 failed on %s\n", device);
-    }
-  } else if (debug) {
-    printf("RS485 HW mode enabled on %s (RTS as DE)\n", device);
-  }
-
-  close(fd);
+uint64_t MonotonicUs(std::chrono::steady_clock::time_point time) {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          time.time_since_epoch())
+          .count());
 }
-}  // namespace
-#endif
-
-#if defined(__APPLE__)
-namespace {
-std::string NormalizeSerialDevice(const char* device, bool debug) {
-  if (!device) {
-    return {};
-  }
-
-  const std::string name(device);
-  const std::string ttyPrefix = "/dev/tty.";
-  if (name.rfind(ttyPrefix, 0) == 0) {
-    const std::string normalized = "/dev/cu." + name.substr(ttyPrefix.size());
-    if (debug) {
-      printf("macOS serial: using callout device %s instead of %s\n",
-             normalized.c_str(), name.c_str());
-    }
-    return normalized;
-  }
 
-  return name;
+// Whether an ack with these fields answers the frame. The last field is the
+// key in a plain ack and the key count in a multi-key one.
+bool MatchesConfigAck(const PendingConfigFrame& frame, bool multiKey,
+                      uint8_t board, uint8_t topic, uint8_t index,
+                      uint8_t keyOrCount) {
+  return frame.multiKey == multiKey && frame.board == board &&
+         frame.topic == topic && frame.index == index &&
+         (multiKey ? frame.keyCount : frame.keys[0]) == keyOrCount;
 }
 }  // namespace
-#endif
 
 RS485Comm::RS485Comm() {
   m_pThread = NULL;
-  m_pSerialPort = NULL;
-  m_pSerialPortConfig = NULL;
+  m_pReceiveThread = NULL;
+  m_pTransport = NULL;
   m_runtimeConfig = ppuc::v2::RuntimeConfig();
   m_nextSwitchPollAt = std::chrono::steady_clock::now();
   m_nextSwitchRefreshAt = std::chrono::steady_clock::time_point::max();
@@ -148,6 +102,17 @@ void RS485Comm::SetDebugErrors(bool debugErrors) {
   m_debugErrors = debugErrors;
 }
 
+void RS485Comm::SetReceiveThreadEnabled(bool enabled) {
+  m_receiveThreadEnabled = enabled;
+}
+
+void RS485Comm::SetOutputDeltaFramesEnabled(bool enabled,
+                                            uint32_t keyframeInterval) {
+  m_outputDeltaFramesEnabled = enabled;
+  m_outputDeltaEncoder.SetKeyframeInterval(keyframeInterval);
+  m_outputDeltaEncoder.ForceKeyframe();
+}
+
 void RS485Comm::SetSwitchReplyDelayUs(uint32_t delayUs) {
   m_switchReplyDelayUs = delayUs;
 }
@@ -166,7 +131,6 @@ void RS485Comm::SetOutputFrameIntervalMs(uint32_t intervalMs) {
 }
 
 void RS485Comm::SetCoilHoldFrames(uint8_t holdFrames) {
-  std::lock_guard<std::mutex> lock(m_stateMutex);
   m_coilHoldFrameCount = holdFrames;
 }
 
@@ -264,7 +228,7 @@ const char* AnomalyName(RS485Comm::Anomaly kind) {
     case RS485Comm::Anomaly::SwitchChainMiss: return "switch chain miss";
     case RS485Comm::Anomaly::EpochMismatch: return "epoch mismatch";
     case RS485Comm::Anomaly::BoardStatus: return "board status";
-    case RS485Comm::Anomaly::QueueOverflow: return "output queue overflow";
+    case RS485Comm::Anomaly::QueueOverflow: return "queue overflow";
     case RS485Comm::Anomaly::SessionResync: return "session resync";
     default: return "unknown";
   }
@@ -318,35 +282,26 @@ int64_t RS485Comm::SwitchReplyWindowUs() const {
   return baseUs + configuredDelayUs;
 }
 
-uint32_t RS485Comm::SwitchReadTimeoutMs() const {
-  // Keep the total chain window generous, but avoid a disproportionately long
-  // per-read block when the configured board-side reply delay is very small.
-  const uint32_t derivedMs =
-      static_cast<uint32_t>((m_switchReplyDelayUs + 999) / 1000) + 1;
-  return std::max<uint32_t>(RS485_COMM_SERIAL_READ_TIMEOUT, derivedMs);
-}
-
 bool RS485Comm::WriteBytes(const char* context, const uint8_t* buffer,
                            size_t size) {
-  if (m_pSerialPort == NULL) {
+  if (m_pTransport == NULL) {
     return false;
   }
 
-  const int written = sp_blocking_write(m_pSerialPort, buffer, size,
-                                        RS485_COMM_SERIAL_WRITE_TIMEOUT);
+  const int written = m_pTransport->Write(buffer, size,
+                                          RS485_COMM_SERIAL_WRITE_TIMEOUT);
   if (written == static_cast<int>(size)) {
     return true;
   }
 
   if (written < 0) {
-    char* errorMessage = sp_last_error_message();
-    if (errorMessage) {
+    const std::string errorMessage = m_pTransport->LastErrorMessage();
+    if (!errorMessage.empty()) {
       ReportAnomaly(Anomaly::SerialWrite, "Serial write failed for %s: %s",
-                    context, errorMessage);
-      sp_free_error_message(errorMessage);
+                    context, errorMessage.c_str());
     } else {
       ReportAnomaly(Anomaly::SerialWrite,
-                    "Serial write failed for %s: libserialport error %d",
+                    "Serial write failed for %s: transport error %d",
                     context, written);
     }
   } else {
@@ -358,6 +313,123 @@ bool RS485Comm::WriteBytes(const char* context, const uint8_t* buffer,
   return false;
 }
 
+FrameDecoder::Result RS485Comm::ReceiveFrame(
+    std::chrono::steady_clock::time_point deadline, const uint8_t** frame,
+    size_t* frameBytes, std::chrono::steady_clock::time_point* receivedAt) {
+  if (m_pReceiveThread) {
+    while (true) {
+      if (m_receivedFrames.TryPop(&m_currentFrame)) {
+        if (m_currentFrame.flushGeneration != m_flushGeneration) {
+          continue;
+        }
+        *frame = m_currentFrame.data;
+        *frameBytes = m_currentFrame.bytes;
+        if (receivedAt) {
+          *receivedAt = m_currentFrame.receivedAt;
+        }
+        return m_currentFrame.crcOk ? FrameDecoder::Result::Frame
+                                    : FrameDecoder::Result::BadCrc;
+      }
+
+      std::unique_lock<std::mutex> lock(m_receivedFrameMutex);
+      if (!m_receivedFrameAvailable.wait_until(lock, deadline, [this]() {
+            return !m_receivedFrames.Empty() || m_stopRequested;
+          })) {
+        return FrameDecoder::Result::NeedMore;
+      }
+      if (m_receivedFrames.Empty()) {
+        return FrameDecoder::Result::NeedMore;
+      }
+    }
+  }
+
+  while (true) {
+    const FrameDecoder::Result result = m_frameDecoder.Next(frame, frameBytes);
+    if (result != FrameDecoder::Result::NeedMore) {
+      if (receivedAt) {
+        *receivedAt = std::chrono::steady_clock::now();
+      }
+      return result;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (m_pTransport == NULL || now >= deadline) {
+      return FrameDecoder::Result::NeedMore;
+    }
+    const int64_t remainingUs =
+        std::chrono::duration_cast<std::chrono::microseconds>(deadline - now)
+            .count();
+    const uint32_t timeoutMs = static_cast<uint32_t>(
+        std::max<int64_t>(1, (remainingUs + 999) / 1000));
+    if (m_frameDecoder.Fill(m_pTransport, timeoutMs) < 0) {
+      return FrameDecoder::Result::NeedMore;
+    }
+  }
+}
+
+void RS485Comm::FlushInput() {
+  m_pTransport->FlushInput();
+  DiscardReceivedInput();
+}
+
+void RS485Comm::DiscardReceivedInput() {
+  if (m_pReceiveThread) {
+    // The receive thread owns the decoder. It drops what it has buffered when
+    // it sees the generation change, and frames already queued are skipped
+    // by the generation they carry.
+    ++m_flushGeneration;
+    return;
+  }
+  m_frameDecoder.Reset();
+}
+
+void RS485Comm::RunReceiveThread() {
+  LogMessage("RS485Comm receive thread starting");
+
+  uint32_t generation = m_flushGeneration;
+  while (!m_stopRequested) {
+    if (generation != m_flushGeneration) {
+      generation = m_flushGeneration;
+      m_frameDecoder.Reset();
+    }
+    if (m_frameDecoder.Fill(m_pTransport, RS485_COMM_SERIAL_READ_TIMEOUT) < 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    const auto receivedAt = std::chrono::steady_clock::now();
+    const uint8_t* data = NULL;
+    size_t bytes = 0;
+    FrameDecoder::Result result;
+    bool queued = false;
+    while ((result = m_frameDecoder.Next(&data, &bytes)) !=
+           FrameDecoder::Result::NeedMore) {
+      ReceivedFrame frame;
+      memcpy(frame.data, data, bytes);
+      frame.bytes = bytes;
+      frame.crcOk = result == FrameDecoder::Result::Frame;
+      // The generation these bytes were read under, not the current one: a
+      // flush that lands while decoding must still drop them.
+      frame.flushGeneration = generation;
+      frame.receivedAt = receivedAt;
+      if (!m_receivedFrames.TryPush(frame)) {
+        ReportAnomaly(Anomaly::QueueOverflow,
+                      "Dropping received V2 frame type 0x%02X: queue_full",
+                      static_cast<unsigned>(ppuc::v2::ExtractType(data[1])));
+        continue;
+      }
+      queued = true;
+    }
+    if (queued) {
+      // Taking the lock orders this wakeup after the waiter's emptiness check.
+      { std::lock_guard<std::mutex> lock(m_receivedFrameMutex); }
+      m_receivedFrameAvailable.notify_one();
+    }
+  }
+
+  LogMessage("RS485Comm receive thread finished");
+}
+
 void RS485Comm::Run() {
   m_stopRequested = false;
   m_nextSwitchPollAt =
@@ -368,29 +440,16 @@ void RS485Comm::Run() {
           ? std::chrono::steady_clock::time_point::max()
           : std::chrono::steady_clock::now() +
                 std::chrono::milliseconds(m_switchRefreshIdleMs);
+  m_nextOutputFrameAt = std::chrono::steady_clock::now();
+  if (m_receiveThreadEnabled && m_pTransport != NULL) {
+    m_pReceiveThread = new std::thread([this]() { RunReceiveThread(); });
+  }
+  m_busThreadRunning = true;
   m_pThread = new std::thread([this]() {
     LogMessage("RS485Comm run thread starting");
 
     while (!m_stopRequested) {
-      uint8_t eventsSent = 0;
-      while (eventsSent++ < RS485_COMM_MAX_EVENTS_TO_SEND) {
-        Event* event = nullptr;
-        m_eventQueueMutex.lock();
-        if (!m_events.empty()) {
-          event = m_events.front();
-          m_events.pop();
-        }
-        m_eventQueueMutex.unlock();
-        if (!event) {
-          break;
-        }
-        SendEvent(event);
-        if (event->sourceId == EVENT_SOURCE_EFFECT) {
-          std::this_thread::sleep_for(
-              std::chrono::microseconds(RS485_COMM_EFFECT_EVENT_SPACING_US));
-        }
-        delete event;
-      }
+      RunQueuedCommands();
 
       if (!m_runtimeEnabled) {
         std::this_thread::sleep_for(std::chrono::milliseconds(1));
@@ -416,52 +475,48 @@ void RS485Comm::Run() {
       QueuedOutputSnapshot snapshot;
       bool haveQueuedSnapshot = false;
       if (!sendSwitchRefresh) {
-        std::lock_guard<std::mutex> lock(m_outputQueueMutex);
-        if (!m_outputSnapshots.empty()) {
-          snapshot = m_outputSnapshots.front();
-          m_outputSnapshots.pop();
-          haveQueuedSnapshot = true;
-        }
-      }
-
-      if (!haveQueuedSnapshot) {
-        std::this_thread::sleep_for(
-            std::chrono::milliseconds(m_outputFrameIntervalMs));
+        haveQueuedSnapshot = m_outputSnapshots.TryPop(&snapshot);
       }
 
-      uint8_t coilBitmap[ppuc::v2::kMaxCoilBytes] = {0};
-      uint8_t lampBitmap[ppuc::v2::kMaxLampBytes] = {0};
-      uint8_t giLevels[ppuc::v2::kGiStrings] = {0};
-      uint8_t holdFrames[ppuc::v2::kMaxCoilBits] = {0};
-      {
-        std::lock_guard<std::mutex> lock(m_stateMutex);
-        if (haveQueuedSnapshot) {
-          memcpy(coilBitmap, snapshot.coilBitmap, sizeof(coilBitmap));
-          memcpy(lampBitmap, snapshot.lampBitmap, sizeof(lampBitmap));
-          memcpy(giLevels, snapshot.giLevels, sizeof(giLevels));
-        } else {
-          memcpy(coilBitmap, m_coilBitmap, sizeof(coilBitmap));
-          memcpy(lampBitmap, m_lampBitmap, sizeof(lampBitmap));
-          memcpy(giLevels, m_giLevels, sizeof(giLevels));
-        }
-        memcpy(holdFrames, m_coilHoldFrames, sizeof(holdFrames));
-        ApplyCoilHoldover(coilBitmap, holdFrames);
+      // With nothing queued, idle until the next frame is due, but go as
+      // soon as a coil change or an effect event is queued: a flipper press
+      // must not wait out the rest of the interval. The deadline stays put
+      // across wakeups, so work that wakes the thread more often than once
+      // an interval cannot hold back the frame, or the switch poll riding
+      // on it.
+      if (!haveQueuedSnapshot && now < m_nextOutputFrameAt) {
+        WaitForOutputWork(m_nextOutputFrameAt);
+        continue;
       }
 
+      // Holds always come from the newest published state, which is never
+      // older than a queued snapshot, so a pulse is held even when the
+      // snapshot that carried it already shows the coil off again.
+      const PublishedOutputState& published = LatestPublishedOutputs();
+      StartCoilHolds(published.coilPulses);
+      const QueuedOutputSnapshot& outputs =
+          haveQueuedSnapshot ? snapshot : published.outputs;
+      uint8_t coilBitmap[ppuc::v2::kMaxCoilBytes];
+      memcpy(coilBitmap, outputs.coilBitmap, sizeof(coilBitmap));
+      ApplyCoilHoldover(coilBitmap, m_coilHoldActive);
+
+      const auto sentAt = std::chrono::steady_clock::now();
+      m_nextOutputFrameAt =
+          sentAt + std::chrono::milliseconds(m_outputFrameIntervalMs);
       const bool sent =
           sendSwitchRefresh
               ? SendSwitchRefreshFrame(nextBoard)
               : SendOutputStateFrameFromBuffers(nextBoard, coilBitmap,
-                                                lampBitmap, giLevels);
+                                                outputs.lampBitmap,
+                                                outputs.giLevels);
       if (!sent) {
         continue;
       }
       if (!sendSwitchRefresh) {
-        std::lock_guard<std::mutex> lock(m_stateMutex);
-        ConsumeCoilHoldoverLocked(holdFrames);
+        ConsumeCoilHoldover();
       }
       if (nextBoard != ppuc::v2::kNoBoard) {
-        ReceiveSwitchStateChain(nextBoard);
+        ReceiveSwitchStateChain(nextBoard, sentAt);
         if (sendSwitchRefresh && m_switchRefreshIdleMs > 0) {
           m_nextSwitchRefreshAt =
               std::chrono::steady_clock::now() +
@@ -480,42 +535,22 @@ void RS485Comm::QueueEvent(Event* event) {
   }
 
   switch (event->sourceId) {
-    case EVENT_SOURCE_SOLENOID: {
-      auto it = m_coilNumberToIndex.find(event->eventId);
-      if (it != m_coilNumberToIndex.end() &&
-          it->second < ppuc::v2::kMaxCoilBits) {
-        std::lock_guard<std::mutex> lock(m_stateMutex);
-        const bool coilOn = event->value != 0;
-        ppuc::v2::SetBitmapBit(m_coilBitmap, it->second, coilOn);
-        if (coilOn) {
-          m_coilHoldFrames[it->second] = m_coilHoldFrameCount;
-        }
-        QueueOutputSnapshotLocked();
-      }
+    case EVENT_SOURCE_SOLENOID:
+      SetCoilState(event->eventId, event->value != 0);
       delete event;
       return;
-    }
 
     case EVENT_SOURCE_LIGHT:
-    case EVENT_SOURCE_GI: {
-      if (event->sourceId == EVENT_SOURCE_GI) {
-        if (event->eventId >= 1 && event->eventId <= ppuc::v2::kGiStrings) {
-          std::lock_guard<std::mutex> lock(m_stateMutex);
-          m_giLevels[event->eventId - 1] = ppuc::v2::ClampGiLevel(event->value);
-        }
-        delete event;
-        return;
-      }
+      SetLampState(event->eventId, event->value != 0);
+      delete event;
+      return;
 
-      auto it = m_lampNumberToIndex.find(event->eventId);
-      if (it != m_lampNumberToIndex.end() &&
-          it->second < ppuc::v2::kMaxLampBits) {
-        std::lock_guard<std::mutex> lock(m_stateMutex);
-        ppuc::v2::SetBitmapBit(m_lampBitmap, it->second, event->value != 0);
+    case EVENT_SOURCE_GI:
+      if (event->eventId >= 1 && event->eventId <= ppuc::v2::kGiStrings) {
+        SetGILevel(static_cast<uint8_t>(event->eventId), event->value);
       }
       delete event;
       return;
-    }
 
     case EVENT_RUN:
       m_runtimeEnabled = event->value != 0;
@@ -528,13 +563,14 @@ void RS485Comm::QueueEvent(Event* event) {
 
     case EVENT_SOURCE_EFFECT:
       {
-        std::lock_guard<std::mutex> lock(m_eventQueueMutex);
-        if (m_events.size() >= RS485_COMM_QUEUE_SIZE_MAX) {
-          delete event;
-          return;
-        }
-        m_events.push(event);
+        BusCommand command;
+        command.type = BusCommand::EffectEvent;
+        command.sourceId = event->sourceId;
+        command.number = event->eventId;
+        command.value = event->value;
+        PostCommand(command);
       }
+      delete event;
       return;
   }
 
@@ -544,65 +580,257 @@ void RS485Comm::QueueEvent(Event* event) {
   delete event;
 }
 
-void RS485Comm::ClearQueuedEvents() {
-  std::lock_guard<std::mutex> lock(m_eventQueueMutex);
-  while (!m_events.empty()) {
-    delete m_events.front();
-    m_events.pop();
+uint16_t RS485Comm::CoilIndexFor(uint16_t number) const {
+  return number < m_coilNumberToIndex.size() ? m_coilNumberToIndex[number]
+                                             : RS485_COMM_UNMAPPED_INDEX;
+}
+
+uint16_t RS485Comm::LampIndexFor(uint16_t number) const {
+  return number < m_lampNumberToIndex.size() ? m_lampNumberToIndex[number]
+                                             : RS485_COMM_UNMAPPED_INDEX;
+}
+
+uint16_t RS485Comm::SwitchIndexFor(uint16_t number) const {
+  return number < m_switchNumberToIndex.size() ? m_switchNumberToIndex[number]
+                                               : RS485_COMM_UNMAPPED_INDEX;
+}
+
+void RS485Comm::SetCoilBitLocked(uint16_t index, bool on) {
+  ppuc::v2::SetBitmapBit(m_outputState.outputs.coilBitmap, index, on);
+  if (on) {
+    ++m_outputState.coilPulses[index];
+  }
+}
+
+void RS485Comm::SetCoilState(uint16_t number, bool on) {
+  const uint16_t index = CoilIndexFor(number);
+  if (index == RS485_COMM_UNMAPPED_INDEX) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(m_stateMutex);
+  SetCoilBitLocked(index, on);
+  PublishOutputStateLocked();
+  QueueOutputSnapshotLocked();
+}
+
+void RS485Comm::SetLampState(uint16_t number, bool on) {
+  const uint16_t index = LampIndexFor(number);
+  if (index == RS485_COMM_UNMAPPED_INDEX) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(m_stateMutex);
+  ppuc::v2::SetBitmapBit(m_outputState.outputs.lampBitmap, index, on);
+  PublishOutputStateLocked();
+}
+
+void RS485Comm::SetGILevel(uint8_t string, uint8_t level) {
+  if (string < 1 || string > ppuc::v2::kGiStrings) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(m_stateMutex);
+  m_outputState.outputs.giLevels[string - 1] = ppuc::v2::ClampGiLevel(level);
+  PublishOutputStateLocked();
+}
+
+void RS485Comm::SetOutputStates(const PPUCOutputState* coils,
+                                size_t coilCount,
+                                const PPUCOutputState* lamps,
+                                size_t lampCount, const PPUCOutputState* gi,
+                                size_t giCount) {
+  std::lock_guard<std::mutex> lock(m_stateMutex);
+
+  // Lamps and GI ride on the next frame as they do one at a time; only a coil
+  // change is worth a snapshot of its own, and then one covers them all.
+  bool coilChanged = false;
+  for (size_t i = 0; coils && i < coilCount; ++i) {
+    const uint16_t index = CoilIndexFor(static_cast<uint16_t>(coils[i].number));
+    if (index != RS485_COMM_UNMAPPED_INDEX) {
+      SetCoilBitLocked(index, coils[i].state != 0);
+      coilChanged = true;
+    }
+  }
+  for (size_t i = 0; lamps && i < lampCount; ++i) {
+    const uint16_t index = LampIndexFor(static_cast<uint16_t>(lamps[i].number));
+    if (index != RS485_COMM_UNMAPPED_INDEX) {
+      ppuc::v2::SetBitmapBit(m_outputState.outputs.lampBitmap, index,
+                             lamps[i].state != 0);
+    }
+  }
+  for (size_t i = 0; gi && i < giCount; ++i) {
+    if (gi[i].number >= 1 && gi[i].number <= ppuc::v2::kGiStrings) {
+      m_outputState.outputs.giLevels[gi[i].number - 1] =
+          ppuc::v2::ClampGiLevel(
+              static_cast<uint8_t>(gi[i].state > 0 ? gi[i].state : 0));
+    }
+  }
+
+  PublishOutputStateLocked();
+  if (coilChanged) {
+    QueueOutputSnapshotLocked();
+  }
+}
+
+bool RS485Comm::PostCommand(const BusCommand& command) {
+  if (!m_commands.TryPush(command)) {
+    ++m_commandsDropped;
+    ReportAnomaly(Anomaly::QueueOverflow, "Dropping bus command: queue_full");
+    return false;
+  }
+  // An effect trigger goes on the wire, so it is worth a wakeup. A virtual
+  // switch change only touches host state and is picked up on the next pass,
+  // within one frame interval.
+  if (command.type == BusCommand::EffectEvent) {
+    SignalOutputWork();
+  }
+  return true;
+}
+
+// Bus thread. Effect triggers are spaced out and limited per pass so a burst
+// of them cannot starve the output frames.
+void RS485Comm::RunQueuedCommands() {
+  uint8_t eventsSent = 0;
+  BusCommand command;
+  while (eventsSent < RS485_COMM_MAX_EVENTS_TO_SEND &&
+         m_commands.TryPop(&command)) {
+    switch (command.type) {
+      case BusCommand::EffectEvent:
+        {
+          Event event(command.sourceId, command.number, command.value);
+          SendEvent(&event);
+          ++eventsSent;
+          std::this_thread::sleep_for(
+              std::chrono::microseconds(RS485_COMM_EFFECT_EVENT_SPACING_US));
+        }
+        break;
+
+      case BusCommand::VirtualSwitch:
+        ApplyVirtualSwitchState(command.number, command.value,
+                                command.timestampUs);
+        break;
+    }
+  }
+}
+
+// With the bus thread stopped. Virtual switch changes are state and are kept;
+// effect triggers only mean something to a running bus and are dropped.
+void RS485Comm::DiscardQueuedCommands() {
+  BusCommand command;
+  while (m_commands.TryPop(&command)) {
+    if (command.type == BusCommand::VirtualSwitch) {
+      ApplyVirtualSwitchState(command.number, command.value,
+                              command.timestampUs);
+    }
   }
 }
 
 void RS485Comm::ClearQueuedOutputSnapshots() {
-  std::lock_guard<std::mutex> lock(m_outputQueueMutex);
-  while (!m_outputSnapshots.empty()) {
-    m_outputSnapshots.pop();
+  QueuedOutputSnapshot snapshot;
+  while (m_outputSnapshots.TryPop(&snapshot)) {
   }
 }
 
+// Only with the bus thread stopped, as it owns the hold state.
 void RS485Comm::ClearOutputState() {
   std::lock_guard<std::mutex> lock(m_stateMutex);
-  memset(m_coilBitmap, 0, sizeof(m_coilBitmap));
+  m_outputState = PublishedOutputState();
+  PublishOutputStateLocked();
   memset(m_coilHoldFrames, 0, sizeof(m_coilHoldFrames));
-  memset(m_lampBitmap, 0, sizeof(m_lampBitmap));
-  memset(m_giLevels, 0, sizeof(m_giLevels));
+  memset(m_coilHoldActive, 0, sizeof(m_coilHoldActive));
+  memset(m_coilPulsesSeen, 0, sizeof(m_coilPulsesSeen));
 }
 
-void RS485Comm::ApplyCoilHoldover(uint8_t* coils,
-                                  const uint8_t* holdFrames) const {
+void RS485Comm::PublishOutputStateLocked() {
+  m_publishedOutputs.Back() = m_outputState;
+  m_publishedOutputs.Publish();
+}
+
+const PublishedOutputState& RS485Comm::LatestPublishedOutputs() {
+  m_publishedOutputs.Update();
+  return m_publishedOutputs.Front();
+}
+
+void RS485Comm::StartCoilHolds(const uint8_t* coilPulses) {
   const uint16_t coilBits =
       std::min<uint16_t>(m_runtimeConfig.coilBits, ppuc::v2::kMaxCoilBits);
+  if (memcmp(coilPulses, m_coilPulsesSeen, coilBits) == 0) {
+    return;
+  }
+  const uint8_t holdFrames = m_coilHoldFrameCount.load();
   for (uint16_t i = 0; i < coilBits; ++i) {
-    if (holdFrames[i] == 0) {
+    if (coilPulses[i] == m_coilPulsesSeen[i]) {
       continue;
     }
-    ppuc::v2::SetBitmapBit(coils, i, true);
+    m_coilPulsesSeen[i] = coilPulses[i];
+    if (holdFrames > 0) {
+      m_coilHoldFrames[i] = holdFrames;
+      ppuc::v2::SetBitmapBit(m_coilHoldActive, i, true);
+    }
   }
 }
 
-void RS485Comm::ConsumeCoilHoldoverLocked(const uint8_t* holdFrames) {
+void RS485Comm::ApplyCoilHoldover(uint8_t* coils,
+                                  const uint8_t* holdActive) const {
   const uint16_t coilBits =
       std::min<uint16_t>(m_runtimeConfig.coilBits, ppuc::v2::kMaxCoilBits);
-  for (uint16_t i = 0; i < coilBits; ++i) {
-    if (holdFrames[i] == 0 || m_coilHoldFrames[i] == 0) {
-      continue;
+  const size_t coilBytes = ppuc::v2::BitsToBytes(coilBits);
+  for (size_t i = 0; i < coilBytes; ++i) {
+    uint8_t held = holdActive[i];
+    if (i + 1 == coilBytes && coilBits % 8 != 0) {
+      held &= static_cast<uint8_t>((1u << (coilBits % 8)) - 1);
     }
-    --m_coilHoldFrames[i];
+    coils[i] |= held;
   }
 }
 
+void RS485Comm::ConsumeCoilHoldover() {
+  const uint16_t coilBits =
+      std::min<uint16_t>(m_runtimeConfig.coilBits, ppuc::v2::kMaxCoilBits);
+  ForEachSetBit(m_coilHoldActive, coilBits, [this](uint16_t i) {
+    if (m_coilHoldFrames[i] == 0) {
+      return;
+    }
+    if (--m_coilHoldFrames[i] == 0) {
+      ppuc::v2::SetBitmapBit(m_coilHoldActive, i, false);
+    }
+  });
+}
+
 void RS485Comm::QueueOutputSnapshotLocked() {
-  std::lock_guard<std::mutex> queueLock(m_outputQueueMutex);
-  if (m_outputSnapshots.size() >= RS485_COMM_OUTPUT_QUEUE_SIZE_MAX) {
+  // Only the consumer may pop, so a full queue drops the newest snapshot
+  // rather than the oldest. The state it carried is still in the bitmaps and
+  // goes out with the next frame; what is lost is the intermediate step.
+  if (!m_outputSnapshots.TryPush(m_outputState.outputs)) {
+    ++m_outputSnapshotsDropped;
     ReportAnomaly(Anomaly::QueueOverflow,
-                  "Dropping oldest queued output snapshot: queue_full");
-    m_outputSnapshots.pop();
+                  "Dropping queued output snapshot: queue_full");
+  } else {
+    const uint32_t depth = static_cast<uint32_t>(m_outputSnapshots.Size());
+    if (depth > m_outputQueueHighWater.load(std::memory_order_relaxed)) {
+      m_outputQueueHighWater.store(depth, std::memory_order_relaxed);
+    }
   }
+  SignalOutputWork();
+}
 
-  QueuedOutputSnapshot snapshot;
-  memcpy(snapshot.coilBitmap, m_coilBitmap, sizeof(snapshot.coilBitmap));
-  memcpy(snapshot.lampBitmap, m_lampBitmap, sizeof(snapshot.lampBitmap));
-  memcpy(snapshot.giLevels, m_giLevels, sizeof(snapshot.giLevels));
-  m_outputSnapshots.push(snapshot);
+void RS485Comm::SignalOutputWork() {
+  {
+    std::lock_guard<std::mutex> lock(m_outputWorkMutex);
+    m_outputWorkPending = true;
+  }
+  m_outputWork.notify_one();
+}
+
+bool RS485Comm::WaitForOutputWork(
+    std::chrono::steady_clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(m_outputWorkMutex);
+  const bool woken = m_outputWork.wait_until(lock, deadline, [this]() {
+    return m_outputWorkPending || m_stopRequested;
+  });
+  m_outputWorkPending = false;
+  return woken;
 }
 
 bool RS485Comm::SendOutputsOffFrame() {
@@ -611,52 +839,47 @@ bool RS485Comm::SendOutputsOffFrame() {
 
 void RS485Comm::Disconnect() {
   m_stopRequested = true;
+  SignalOutputWork();
+  {
+    std::lock_guard<std::mutex> lock(m_receivedFrameMutex);
+  }
+  m_receivedFrameAvailable.notify_all();
 
   if (m_pThread && m_pThread->joinable()) {
     m_pThread->join();
     delete m_pThread;
     m_pThread = NULL;
   }
+  m_busThreadRunning = false;
+  DiscardQueuedCommands();
+  if (m_pReceiveThread && m_pReceiveThread->joinable()) {
+    m_pReceiveThread->join();
+    delete m_pReceiveThread;
+    m_pReceiveThread = NULL;
+    m_frameDecoder.Reset();
+  }
 
-  if (m_pSerialPort == NULL) {
+  if (m_pTransport == NULL) {
     return;
   }
 
   // Once the worker thread is down, no queued state changes will be transmitted
   // anymore. Drop them and send a deterministic all-off snapshot instead.
-  ClearQueuedEvents();
   ClearQueuedOutputSnapshots();
   ClearOutputState();
   SendOutputsOffFrame();
   std::this_thread::sleep_for(std::chrono::milliseconds(10));
   SendOutputsOffFrame();
-  sp_drain(m_pSerialPort);
-  std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-  // Some USB-RS485 adapters/drivers keep modem-control/flow-control state
-  // across close/open cycles. Drain and explicitly deassert those lines before
-  // closing so the next run starts from a neutral adapter state.
-  sp_drain(m_pSerialPort);
-  sp_flush(m_pSerialPort, SP_BUF_INPUT);
-  sp_set_flowcontrol(m_pSerialPort, SP_FLOWCONTROL_NONE);
-  sp_set_rts(m_pSerialPort, SP_RTS_OFF);
-  sp_set_dtr(m_pSerialPort, SP_DTR_OFF);
-
-  if (m_pSerialPortConfig != NULL) {
-    sp_set_config(m_pSerialPort, m_pSerialPortConfig);
-    sp_free_config(m_pSerialPortConfig);
-    m_pSerialPortConfig = NULL;
-  }
-
+  m_pTransport->Drain();
   std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
-  sp_close(m_pSerialPort);
-  sp_free_port(m_pSerialPort);
-  m_pSerialPort = NULL;
+  m_pTransport->Close();
+  delete m_pTransport;
+  m_pTransport = NULL;
 }
 
 bool RS485Comm::RestartBoards() {
-  if (m_pSerialPort == NULL) {
+  if (m_pTransport == NULL) {
     return false;
   }
 
@@ -667,22 +890,26 @@ bool RS485Comm::RestartBoards() {
          sizeof(m_initialConfigAckMissesByBoard));
   m_configEarlyAbortBoard = ppuc::v2::kNoBoard;
   m_configAckFailedBoards.clear();
+  m_configInFlight.clear();
+  m_configItem.keyCount = 0;
+  m_configFramesFailedAtFlush = m_configFramesFailed;
+  ResetConfigFingerprints();
   if (!SendRestartFrame()) {
     return false;
   }
-  sp_drain(m_pSerialPort);
+  m_pTransport->Drain();
   // Soft restart keeps the RP2040 alive, but a board with heavier local
   // teardown work (for example WS2812/effects state on the first board on the
   // bus) may need a little longer before it can reliably acknowledge the first
   // config frame of the next session.
   std::this_thread::sleep_for(std::chrono::milliseconds(400));
-  sp_flush(m_pSerialPort, SP_BUF_INPUT);
+  FlushInput();
   std::this_thread::sleep_for(std::chrono::milliseconds(250));
   return true;
 }
 
 bool RS485Comm::ResetBoards() {
-  if (m_pSerialPort == NULL) {
+  if (m_pTransport == NULL) {
     return false;
   }
 
@@ -693,105 +920,43 @@ bool RS485Comm::ResetBoards() {
          sizeof(m_initialConfigAckMissesByBoard));
   m_configEarlyAbortBoard = ppuc::v2::kNoBoard;
   m_configAckFailedBoards.clear();
+  m_configInFlight.clear();
+  m_configItem.keyCount = 0;
+  m_configFramesFailedAtFlush = m_configFramesFailed;
+  ResetConfigFingerprints();
   if (!SendResetFrame()) {
     return false;
   }
   std::this_thread::sleep_for(
       std::chrono::milliseconds(WAIT_FOR_IO_BOARD_RESET));
-  sp_flush(m_pSerialPort, SP_BUF_BOTH);
+  m_pTransport->Flush();
+  DiscardReceivedInput();
   std::this_thread::sleep_for(std::chrono::milliseconds(300));
   return true;
 }
 
-bool RS485Comm::Connect(const char* pDevice) {
-#if defined(__linux__)
-  TryEnableHardwareRs485(pDevice, m_debug);
-#endif
-
-  const char* device = pDevice;
-#if defined(__APPLE__)
-  const std::string normalizedDevice = NormalizeSerialDevice(pDevice, m_debug);
-  if (!normalizedDevice.empty()) {
-    device = normalizedDevice.c_str();
-  }
-#endif
-
-  m_stopRequested = false;
-
-  if (m_debug) {
-    printf("Opening serial device %s at %d baud\n", device,
-           RS485_COMM_BAUD_RATE);
-  }
-
-  enum sp_return result = sp_get_port_by_name(device, &m_pSerialPort);
-  if (result != SP_OK) {
-    if (m_debug) {
-      printf("sp_get_port_by_name failed for %s: %d\n", device, result);
-    }
+bool RS485Comm::Connect(const char* device) {
+  SerialTransport* transport = new SerialTransport();
+  if (!transport->Open(device, RS485_COMM_BAUD_RATE, m_debug)) {
+    delete transport;
     return false;
   }
+  return Connect(transport);
+}
 
-  result = sp_open(m_pSerialPort, SP_MODE_READ_WRITE);
-  if (result != SP_OK) {
-    if (m_debug) {
-      printf("sp_open failed for %s: %d\n", device, result);
-    }
-    sp_free_port(m_pSerialPort);
-    m_pSerialPort = NULL;
-    return false;
-  }
+bool RS485Comm::Connect(Transport* transport) {
+  Disconnect();
 
-  sp_new_config(&m_pSerialPortConfig);
-  sp_get_config(m_pSerialPort, m_pSerialPortConfig);
-  if (sp_set_config_baudrate(m_pSerialPortConfig, RS485_COMM_BAUD_RATE) !=
-      SP_OK) {
-    if (m_debug) {
-      printf("sp_set_baudrate failed\n");
-    }
-    sp_free_config(m_pSerialPortConfig);
-    m_pSerialPortConfig = NULL;
-    sp_close(m_pSerialPort);
-    sp_free_port(m_pSerialPort);
-    m_pSerialPort = NULL;
-    return false;
-  }
-  if (sp_set_config_bits(m_pSerialPortConfig, 8) != SP_OK ||
-      sp_set_config_parity(m_pSerialPortConfig, SP_PARITY_NONE) != SP_OK ||
-      sp_set_config_stopbits(m_pSerialPortConfig, 1) != SP_OK ||
-      sp_set_config_xon_xoff(m_pSerialPortConfig, SP_XONXOFF_DISABLED) !=
-          SP_OK ||
-      sp_set_config_flowcontrol(m_pSerialPortConfig, SP_FLOWCONTROL_NONE) !=
-          SP_OK) {
-    if (m_debug) {
-      printf("sp_set_* serial config failed\n");
-    }
-    sp_free_config(m_pSerialPortConfig);
-    m_pSerialPortConfig = NULL;
-    sp_close(m_pSerialPort);
-    sp_free_port(m_pSerialPort);
-    m_pSerialPort = NULL;
-    return false;
-  }
-  if (sp_set_config(m_pSerialPort, m_pSerialPortConfig) != SP_OK) {
-    if (m_debug) {
-      printf("sp_set_config failed\n");
-    }
-    sp_free_config(m_pSerialPortConfig);
-    m_pSerialPortConfig = NULL;
-    sp_close(m_pSerialPort);
-    sp_free_port(m_pSerialPort);
-    m_pSerialPort = NULL;
+  if (transport == NULL || !transport->IsOpen()) {
+    delete transport;
     return false;
   }
-  // Apply a fully passive host-side serial state. This avoids adapters getting
-  // wedged by inherited flow-control or modem-control settings between runs.
-  sp_set_flowcontrol(m_pSerialPort, SP_FLOWCONTROL_NONE);
-  sp_set_rts(m_pSerialPort, SP_RTS_OFF);
-  sp_set_dtr(m_pSerialPort, SP_DTR_OFF);
 
-  sp_flush(m_pSerialPort, SP_BUF_BOTH);
-  // Wait before continuing.
-  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  m_pTransport = transport;
+  m_frameDecoder.Reset();
+  m_outputDeltaEncoder.ForceKeyframe();
+  m_outputQueueHighWater = 0;
+  m_stopRequested = false;
 
   m_needSessionResync = false;
   m_epoch = 1;
@@ -807,6 +972,11 @@ bool RS485Comm::Connect(const char* pDevice) {
          sizeof(m_initialConfigAckMissesByBoard));
   m_configEarlyAbortBoard = ppuc::v2::kNoBoard;
   m_configAckFailedBoards.clear();
+  m_configInFlight.clear();
+  m_configItem.keyCount = 0;
+  m_configFramesFailedAtFlush = m_configFramesFailed;
+  ResetConfigFingerprints();
+  memset(m_multiKeyConfigBoards, 0, sizeof(m_multiKeyConfigBoards));
 
   return true;
 }
@@ -863,8 +1033,8 @@ void RS485Comm::FinalizeConfiguredBoardPresence() {
     printf("\n");
   }
 
+  m_virtualSwitchSlotByNumber.clear();
   m_virtualSwitchBoards.clear();
-  m_virtualSwitchOwnerByNumber.clear();
 
   for (const uint8_t board : m_configuredBoards) {
     if (m_presentBoards.find(board) != m_presentBoards.end()) {
@@ -878,11 +1048,19 @@ void RS485Comm::FinalizeConfiguredBoardPresence() {
     if (switches != m_switchNumbersByBoard.end()) {
       boardState.switchNumbers = switches->second;
       boardState.switchStates.assign(boardState.switchNumbers.size(), 0);
-      for (const uint16_t switchNumber : boardState.switchNumbers) {
-        m_virtualSwitchOwnerByNumber[switchNumber] = board;
+    }
+    VirtualSwitchBoardState& stored = m_virtualSwitchBoards[board];
+    stored = boardState;
+    // Walked backwards so that a number listed twice on one board resolves
+    // to its first slot; a later board still takes over a shared number.
+    for (size_t i = stored.switchNumbers.size(); i-- > 0;) {
+      const uint16_t switchNumber = stored.switchNumbers[i];
+      if (switchNumber >= m_virtualSwitchSlotByNumber.size()) {
+        m_virtualSwitchSlotByNumber.resize(switchNumber + 1);
       }
+      m_virtualSwitchSlotByNumber[switchNumber].board = &stored;
+      m_virtualSwitchSlotByNumber[switchNumber].slot = static_cast<uint16_t>(i);
     }
-    m_virtualSwitchBoards[board] = boardState;
 
     if (m_skippedBoards.find(board) != m_skippedBoards.end()) {
       printf("Board %u skipped; virtualized with %zu switch(es).\n", board,
@@ -950,12 +1128,11 @@ void RS485Comm::RebuildSwitchOwnershipMasks() {
       continue;
     }
     for (const uint16_t switchNumber : switchNumbers) {
-      const auto it = m_switchNumberToIndex.find(switchNumber);
-      if (it == m_switchNumberToIndex.end()) {
+      const uint16_t index = SwitchIndexFor(switchNumber);
+      if (index == RS485_COMM_UNMAPPED_INDEX) {
         continue;
       }
-      ppuc::v2::SetBitmapBit(m_switchOwnershipMaskByBoard[board], it->second,
-                             true);
+      ppuc::v2::SetBitmapBit(m_switchOwnershipMaskByBoard[board], index, true);
     }
   }
 }
@@ -963,58 +1140,61 @@ void RS485Comm::RebuildSwitchOwnershipMasks() {
 bool RS485Comm::SetVirtualSwitchState(uint16_t number, uint8_t state) {
   EnsureConfiguredBoardPresenceKnown();
 
-  const auto owner = m_virtualSwitchOwnerByNumber.find(number);
-  if (owner == m_virtualSwitchOwnerByNumber.end()) {
+  if (number >= m_virtualSwitchSlotByNumber.size() ||
+      !m_virtualSwitchSlotByNumber[number].board) {
     return false;
   }
 
-  auto boardIt = m_virtualSwitchBoards.find(owner->second);
-  if (boardIt == m_virtualSwitchBoards.end()) {
-    return false;
+  const uint64_t nowUs = GetMonotonicTimeUs();
+  if (!m_busThreadRunning) {
+    ApplyVirtualSwitchState(number, state, nowUs);
+    return true;
   }
 
-  auto& boardState = boardIt->second;
-  for (size_t i = 0; i < boardState.switchNumbers.size(); ++i) {
-    if (boardState.switchNumbers[i] != number) {
-      continue;
-    }
+  BusCommand command;
+  command.type = BusCommand::VirtualSwitch;
+  command.number = number;
+  command.value = state == 0 ? 0 : 1;
+  command.timestampUs = nowUs;
+  return PostCommand(command);
+}
 
-    const uint8_t normalizedState = state == 0 ? 0 : 1;
-    if (boardState.switchStates[i] == normalizedState) {
-      return true;
-    }
+// By whichever thread owns switch state: see m_busThreadRunning.
+void RS485Comm::ApplyVirtualSwitchState(uint16_t number, uint8_t state,
+                                        uint64_t timestampUs) {
+  if (number >= m_virtualSwitchSlotByNumber.size() ||
+      !m_virtualSwitchSlotByNumber[number].board) {
+    return;
+  }
 
-    boardState.switchStates[i] = normalizedState;
-    boardState.dirty = true;
-    NoteSwitchActivity(number);
-    {
-      std::lock_guard<std::mutex> lock(m_stateMutex);
-      const auto switchIt = m_switchNumberToIndex.find(number);
-      if (switchIt != m_switchNumberToIndex.end() &&
-          switchIt->second < ppuc::v2::kMaxSwitchBits) {
-        ppuc::v2::SetBitmapBit(m_switchBitmap, switchIt->second,
-                               normalizedState != 0);
-      }
-    }
-    {
-      std::lock_guard<std::mutex> lock(m_switchesQueueMutex);
-      m_switches.push(new PPUCSwitchState(number, normalizedState));
-    }
-    return true;
+  const VirtualSwitchSlot& slot = m_virtualSwitchSlotByNumber[number];
+  VirtualSwitchBoardState& boardState = *slot.board;
+  const uint8_t normalizedState = state == 0 ? 0 : 1;
+  if (boardState.switchStates[slot.slot] == normalizedState) {
+    return;
   }
 
-  return false;
+  boardState.switchStates[slot.slot] = normalizedState;
+  boardState.dirty = true;
+  NoteSwitchActivity(number);
+  const uint16_t index = SwitchIndexFor(number);
+  if (index != RS485_COMM_UNMAPPED_INDEX) {
+    ppuc::v2::SetBitmapBit(m_switchBitmap, index, normalizedState != 0);
+  }
+  QueueSwitchState(number, normalizedState, timestampUs);
 }
 
 bool RS485Comm::IsSwitchVirtualized(uint16_t number) const {
   const_cast<RS485Comm*>(this)->EnsureConfiguredBoardPresenceKnown();
-  return m_virtualSwitchOwnerByNumber.find(number) !=
-         m_virtualSwitchOwnerByNumber.end();
+  return number < m_virtualSwitchSlotByNumber.size() &&
+         m_virtualSwitchSlotByNumber[number].board != nullptr;
 }
 
 void RS485Comm::SetRuntimeConfig(const ppuc::v2::RuntimeConfig& config) {
   if (ppuc::v2::IsValidRuntimeConfig(config)) {
     m_runtimeConfig = config;
+    m_frameDecoder.SetRuntimeConfig(config);
+    m_outputDeltaEncoder.ForceKeyframe();
   }
 }
 
@@ -1025,18 +1205,12 @@ void RS485Comm::SetMappings(const std::vector<uint16_t>& coils,
   m_lampIndexToNumber = lamps;
   m_switchIndexToNumber = switches;
 
-  m_coilNumberToIndex.clear();
-  m_lampNumberToIndex.clear();
-  m_switchNumberToIndex.clear();
-  for (uint16_t i = 0; i < m_coilIndexToNumber.size(); ++i) {
-    m_coilNumberToIndex[m_coilIndexToNumber[i]] = i;
-  }
-  for (uint16_t i = 0; i < m_lampIndexToNumber.size(); ++i) {
-    m_lampNumberToIndex[m_lampIndexToNumber[i]] = i;
-  }
-  for (uint16_t i = 0; i < m_switchIndexToNumber.size(); ++i) {
-    m_switchNumberToIndex[m_switchIndexToNumber[i]] = i;
-  }
+  BuildNumberToIndex(m_coilIndexToNumber, ppuc::v2::kMaxCoilBits,
+                     &m_coilNumberToIndex);
+  BuildNumberToIndex(m_lampIndexToNumber, ppuc::v2::kMaxLampBits,
+                     &m_lampNumberToIndex);
+  BuildNumberToIndex(m_switchIndexToNumber, ppuc::v2::kMaxSwitchBits,
+                     &m_switchNumberToIndex);
 
   RebuildSwitchOwnershipMasks();
 }
@@ -1045,42 +1219,213 @@ void RS485Comm::SetButtonSwitchNumbers(const std::set<uint16_t>& numbers) {
   m_buttonSwitchNumbers = numbers;
 }
 
-PPUCSwitchState* RS485Comm::GetNextSwitchState() {
-  PPUCSwitchState* switchState = nullptr;
-
-  m_switchesQueueMutex.lock();
-
-  if (!m_switches.empty()) {
-    switchState = m_switches.front();
-    m_switches.pop();
+void RS485Comm::QueueSwitchState(int number, int state,
+                                 uint64_t timestampUs) {
+  {
+    std::lock_guard<std::mutex> lock(m_switchesQueueMutex);
+    m_switchSnapshot.BeginWrite();
+    QueueSwitchStateLocked(number, state, timestampUs);
+    m_switchSnapshot.EndWrite();
   }
+  m_switchEventsAvailable.notify_all();
+  const PPUCSwitchState change(number, state);
+  DispatchSwitchChanges(&change, 1);
+}
 
-  m_switchesQueueMutex.unlock();
+void RS485Comm::SetSwitchGroupMasks(
+    const std::vector<uint32_t>& masksByNumber) {
+  m_switchGroupMaskByNumber = masksByNumber;
+}
 
-  return switchState;
+void RS485Comm::AddSwitchChangesCallback(uint32_t groupMask,
+                                         PPUC_SwitchChangesCallback callback,
+                                         const void* userData) {
+  if (!callback || groupMask == 0) {
+    return;
+  }
+  SwitchChangesCallback registration;
+  registration.groupMask = groupMask;
+  registration.callback = callback;
+  registration.userData = userData;
+  std::lock_guard<std::mutex> lock(m_switchCallbackMutex);
+  std::shared_ptr<std::vector<SwitchChangesCallback>> callbacks =
+      std::make_shared<std::vector<SwitchChangesCallback>>();
+  if (m_switchCallbacks) {
+    *callbacks = *m_switchCallbacks;
+  }
+  callbacks->push_back(registration);
+  m_switchCallbacks = callbacks;
+  m_haveSwitchCallbacks = true;
 }
 
-uint32_t RS485Comm::GetCleanSwitchReplyChainCount() const {
-  return m_cleanSwitchReplyChainCount.load();
+void RS485Comm::ClearSwitchChangesCallbacks() {
+  std::lock_guard<std::mutex> lock(m_switchCallbackMutex);
+  m_switchCallbacks.reset();
+  m_haveSwitchCallbacks = false;
 }
 
-PPUCBusHealth RS485Comm::GetBusHealth() const {
-  PPUCBusHealth health;
-  health.switchReplyChains = m_switchReplyChainCount.load();
-  health.switchReplyChainsClean = m_cleanSwitchReplyChainCount.load();
-  health.switchReplyMisses = m_switchReplyMissCount.load();
-  health.sessionResyncs = m_sessionResyncCount.load();
-  health.configAckRetries = m_configAckRetryCount.load();
-  health.configAckTimeouts = m_configAckTimeoutCount.load();
-  health.serialWriteFailures =
-      m_anomalies[static_cast<size_t>(Anomaly::SerialWrite)].total.load();
+void RS485Comm::DispatchSwitchChanges(const PPUCSwitchState* changes,
+                                      size_t count) {
+  if (count == 0 || !m_haveSwitchCallbacks) {
+    return;
+  }
+  count = std::min<size_t>(count, ppuc::v2::kMaxSwitchBits);
+
+  // The groups touched by the batch as a whole, so a callback for a group
+  // that did not move costs one test.
+  uint32_t groupMasks[ppuc::v2::kMaxSwitchBits];
+  uint32_t batchGroups = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const size_t number = static_cast<size_t>(changes[i].number);
+    groupMasks[i] = number < m_switchGroupMaskByNumber.size()
+                        ? m_switchGroupMaskByNumber[number]
+                        : 0;
+    batchGroups |= groupMasks[i];
+  }
+
+  // The callbacks run without the lock, on the registrations as they were
+  // when the batch started, so one may add or clear callbacks itself.
+  std::shared_ptr<const std::vector<SwitchChangesCallback>> callbacks;
+  {
+    std::lock_guard<std::mutex> lock(m_switchCallbackMutex);
+    callbacks = m_switchCallbacks;
+  }
+  if (!callbacks) {
+    return;
+  }
+  for (const SwitchChangesCallback& registration : *callbacks) {
+    if (registration.groupMask == RS485_COMM_ALL_SWITCH_GROUPS) {
+      registration.callback(changes, count, registration.userData);
+      continue;
+    }
+    if ((batchGroups & registration.groupMask) == 0) {
+      continue;
+    }
+    PPUCSwitchState filtered[ppuc::v2::kMaxSwitchBits];
+    size_t filteredCount = 0;
+    for (size_t i = 0; i < count; ++i) {
+      if (groupMasks[i] & registration.groupMask) {
+        filtered[filteredCount++] = changes[i];
+      }
+    }
+    registration.callback(filtered, filteredCount, registration.userData);
+  }
+}
+
+// Both between m_switchSnapshot.BeginWrite() and EndWrite().
+void RS485Comm::QueueSwitchStateLocked(int number, int state,
+                                       uint64_t timestampUs) {
+  if (number >= 0) {
+    m_switchSnapshot.Set(static_cast<size_t>(number), state != 0);
+  }
+  // A full ring gives up its oldest change rather than the newest, so what
+  // the application sees last is still the switch's current state.
+  if (m_switchEventsCount == RS485_COMM_SWITCH_QUEUE_SIZE) {
+    m_switchEventsHead = (m_switchEventsHead + 1) % RS485_COMM_SWITCH_QUEUE_SIZE;
+    --m_switchEventsCount;
+    ++m_switchEventsDropped;
+  }
+  const size_t tail =
+      (m_switchEventsHead + m_switchEventsCount) % RS485_COMM_SWITCH_QUEUE_SIZE;
+  m_switchEvents[tail].number = number;
+  m_switchEvents[tail].state = state;
+  m_switchEvents[tail].timestampUs = timestampUs;
+  ++m_switchEventsCount;
+  m_switchEventsFd.Signal();
+}
+
+PPUCSwitchSnapshot RS485Comm::GetSwitchSnapshot() const {
+  PPUCSwitchSnapshot snapshot;
+  snapshot.sequence = m_switchSnapshot.Read(snapshot.states) / 2;
+  return snapshot;
+}
+
+size_t RS485Comm::GetSwitchStates(PPUCSwitchState* out, size_t max) {
+  return out ? TakeSwitchEvents(nullptr, out, max) : 0;
+}
+
+size_t RS485Comm::GetSwitchEvents(PPUCSwitchEvent* out, size_t max) {
+  return out ? TakeSwitchEvents(out, nullptr, max) : 0;
+}
+
+uint64_t RS485Comm::GetMonotonicTimeUs() {
+  return MonotonicUs(std::chrono::steady_clock::now());
+}
+
+// Fills whichever of events and states is not null.
+size_t RS485Comm::TakeSwitchEvents(PPUCSwitchEvent* events,
+                                   PPUCSwitchState* states, size_t max) {
+  if (max == 0) {
+    return 0;
+  }
+
+  std::lock_guard<std::mutex> lock(m_switchesQueueMutex);
+  const size_t count = std::min(max, m_switchEventsCount);
+  for (size_t i = 0; i < count; ++i) {
+    const PPUCSwitchEvent& event = m_switchEvents[m_switchEventsHead];
+    if (events) {
+      events[i] = event;
+    } else {
+      states[i] = PPUCSwitchState(event.number, event.state);
+    }
+    m_switchEventsHead = (m_switchEventsHead + 1) % RS485_COMM_SWITCH_QUEUE_SIZE;
+  }
+  m_switchEventsCount -= count;
+  if (m_switchEventsCount == 0) {
+    m_switchEventsFd.Clear();
+  }
+  return count;
+}
+
+bool RS485Comm::WaitForSwitchState(uint32_t timeoutMs) {
+  std::unique_lock<std::mutex> lock(m_switchesQueueMutex);
+  return m_switchEventsAvailable.wait_for(
+      lock, std::chrono::milliseconds(timeoutMs),
+      [this]() { return m_switchEventsCount > 0; });
+}
+
+int RS485Comm::GetSwitchEventFd() {
+  std::lock_guard<std::mutex> lock(m_switchesQueueMutex);
+  return m_switchEventsFd.Get();
+}
+
+PPUCSwitchState* RS485Comm::GetNextSwitchState() {
+  PPUCSwitchState switchState;
+  if (GetSwitchStates(&switchState, 1) == 0) {
+    return nullptr;
+  }
+
+  return new PPUCSwitchState(switchState.number, switchState.state);
+}
+
+uint32_t RS485Comm::GetCleanSwitchReplyChainCount() const {
+  return m_cleanSwitchReplyChainCount.load();
+}
+
+PPUCBusHealth RS485Comm::GetBusHealth() const {
+  PPUCBusHealth health;
+  health.switchReplyChains = m_switchReplyChainCount.load();
+  health.switchReplyChainsClean = m_cleanSwitchReplyChainCount.load();
+  health.switchReplyMisses = m_switchReplyMissCount.load();
+  health.sessionResyncs = m_sessionResyncCount.load();
+  health.configAckRetries = m_configAckRetryCount.load();
+  health.configAckTimeouts = m_configAckTimeoutCount.load();
+  health.configUploadsSkipped = m_configUploadsSkipped.load();
+  health.serialWriteFailures =
+      m_anomalies[static_cast<size_t>(Anomaly::SerialWrite)].total.load();
   health.frameCrcErrors =
       m_anomalies[static_cast<size_t>(Anomaly::FrameCrc)].total.load();
+  health.outputQueueDepth = static_cast<uint32_t>(m_outputSnapshots.Size());
+  health.outputQueueHighWater = m_outputQueueHighWater.load();
+  health.outputSnapshotsDropped = m_outputSnapshotsDropped.load();
+  health.switchEventsDropped = m_switchEventsDropped.load();
+  health.commandsDropped = m_commandsDropped.load();
+  health.outputDeltaFrames = m_outputDeltaFrameCount.load();
   return health;
 }
 
 bool RS485Comm::SendConfigEvent(ConfigEvent* event) {
-  if (m_pSerialPort == NULL || !event) {
+  if (m_pTransport == NULL || !event) {
     delete event;
     return false;
   }
@@ -1090,192 +1435,301 @@ bool RS485Comm::SendConfigEvent(ConfigEvent* event) {
     return false;
   }
 
-  // Wait a bit to not exceed the output buffer in case of large configurations.
-  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  PendingConfigFrame frame;
+  frame.board = event->boardId;
+  frame.topic = event->topic;
+  frame.index = event->index;
+  frame.keyCount = 1;
+  frame.keys[0] = event->key;
+  frame.values[0] = event->value;
+  delete event;
 
-  uint8_t buffer[ppuc::v2::kConfigFrameBytes];
-  ppuc::v2::BuildConfigFrame(buffer, ppuc::v2::kNoBoard, m_sequence++, m_epoch,
-                             event->boardId, event->topic, event->index,
-                             event->key, event->value);
-  if (m_skippedBoards.find(buffer[5]) != m_skippedBoards.end()) {
+  if (m_skippedBoards.find(frame.board) != m_skippedBoards.end()) {
     if (m_debug) {
       DebugPrintf(
           "Skipping V2 ConfigFrame for board=%u topic=%u index=%u key=%u due to forced virtualization",
-          buffer[5], buffer[6], buffer[7], buffer[8]);
+          frame.board, frame.topic, frame.index, frame.keys[0]);
     }
-    delete event;
     return true;
   }
-  delete event;
 
-  for (uint8_t attempt = 0; attempt < RS485_COMM_CONFIG_ACK_RETRIES; ++attempt) {
-    if (attempt > 0) {
-      // A repeat of a config frame the board never acknowledged.
-      ++m_configAckRetryCount;
-    }
-    if (!WriteBytes("ConfigFrame", buffer, sizeof(buffer))) {
-      return false;
-    }
+  if (m_configFingerprintsEnabled && frame.board < RS485_COMM_MAX_BOARDS &&
+      ConfigFingerprint::Covers(frame.topic)) {
+    m_configFingerprints[frame.board].Add(frame.topic, frame.index,
+                                          frame.keys[0], frame.values[0]);
+    m_heldBackConfig[frame.board].push_back(frame);
+    return true;
+  }
 
-    if (m_debug) {
-      DebugPrintf(
-          "Sent V2 ConfigFrame board=%u topic=%u index=%u key=%u seq=%u attempt=%u",
-          buffer[5], buffer[6], buffer[7], buffer[8], buffer[3],
-          static_cast<unsigned>(attempt + 1));
-    }
+  return QueueConfigKey(frame);
+}
 
-    if (ReceiveConfigAck(buffer[5], buffer[6], buffer[7], buffer[8])) {
-      m_initialConfigAckMissStreak = 0;
-      if (buffer[5] < RS485_COMM_MAX_BOARDS) {
-        m_initialConfigAckMissesByBoard[buffer[5]] = 0;
-      }
-      m_presentBoards.insert(buffer[5]);
-      if (buffer[5] < RS485_COMM_MAX_BOARDS) {
-        m_activeBoards[buffer[5]] = true;
-      }
+bool RS485Comm::QueueConfigKey(const PendingConfigFrame& frame) {
+  if (frame.board < RS485_COMM_MAX_BOARDS &&
+      m_multiKeyConfigBoards[frame.board]) {
+    // The next index for the same board and topic continues the item.
+    PendingConfigFrame& item = m_configItem;
+    if (item.keyCount > 0 && item.board == frame.board &&
+        item.topic == frame.topic &&
+        item.index + item.keyCount == frame.index &&
+        item.keyCount < MultiKeyConfigFrame::kMaxKeys) {
+      item.keys[item.keyCount] = frame.keys[0];
+      item.values[item.keyCount] = frame.values[0];
+      ++item.keyCount;
       return true;
     }
-
-    sp_flush(m_pSerialPort, SP_BUF_INPUT);
-    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    SendConfigItem();
+    m_configItem = frame;
+    return true;
   }
 
-  ReportAnomaly(Anomaly::ConfigAck, "Missing V2 config ack: board=%u topic=%u index=%u key=%u",
-              buffer[5], buffer[6], buffer[7], buffer[8]);
-  m_configFailed = true;
-  if (m_presentBoards.empty() &&
-      m_initialConfigAckMissStreak <
-          RS485_COMM_INITIAL_CONFIG_ACK_MISS_THRESHOLD) {
-    ++m_initialConfigAckMissStreak;
-  }
-  if (buffer[5] < RS485_COMM_MAX_BOARDS &&
-      m_initialConfigAckMissesByBoard[buffer[5]] <
-          RS485_COMM_INITIAL_CONFIG_ACK_MISS_THRESHOLD) {
-    ++m_initialConfigAckMissesByBoard[buffer[5]];
-    if (m_presentBoards.find(buffer[5]) == m_presentBoards.end() &&
-        m_initialConfigAckMissesByBoard[buffer[5]] >=
-            RS485_COMM_INITIAL_CONFIG_ACK_MISS_THRESHOLD) {
-      m_configEarlyAbortBoard = buffer[5];
-    }
+  SendConfigItem();
+  return SendConfigFrame(frame);
+}
+
+bool RS485Comm::FlushConfigEvents() {
+  SendHeldBackConfig();
+  SendConfigItem();
+  DrainConfigWindow();
+  const bool ok = m_configFramesFailed == m_configFramesFailedAtFlush;
+  m_configFramesFailedAtFlush = m_configFramesFailed;
+  return ok;
+}
+
+void RS485Comm::SetConfigWindow(uint8_t frames) {
+  m_configWindow = std::clamp<uint8_t>(frames, 1, RS485_COMM_CONFIG_WINDOW_MAX);
+  m_configInFlight.reserve(m_configWindow);
+}
+
+bool RS485Comm::QueryConfigCapabilities(uint8_t board) {
+  if (board >= RS485_COMM_MAX_BOARDS) {
+    return false;
   }
-  m_configAckFailedBoards.insert(buffer[5]);
-  if (!m_configEarlyAbortLogged && ShouldAbortConfigurationEarly()) {
-    if (m_configEarlyAbortBoard != ppuc::v2::kNoBoard) {
-      printf(
-          "PPUC: board %u missed its first %u config ACKs; aborting startup attempt early.\n",
-          static_cast<unsigned>(m_configEarlyAbortBoard),
-          static_cast<unsigned>(RS485_COMM_INITIAL_CONFIG_ACK_MISS_THRESHOLD));
-    } else {
-      printf(
-          "PPUC: the first %u config frames received no ACKs; aborting startup attempt early.\n",
-          static_cast<unsigned>(RS485_COMM_INITIAL_CONFIG_ACK_MISS_THRESHOLD));
-    }
-    m_configEarlyAbortLogged = true;
+  // The query clears the line first, which would lose acks still on it.
+  SendConfigItem();
+  DrainConfigWindow();
+
+  const PPUCBoardVersion version =
+      QueryBoardVersion(board, RS485_COMM_CAPABILITY_QUERY_TIMEOUT_MS);
+  m_multiKeyConfigBoards[board] =
+      version.responded &&
+      (version.capabilities & MultiKeyConfigFrame::kCapability) != 0;
+  if (m_debug) {
+    DebugPrintf("Board %u %s multi-key config frames", board,
+                m_multiKeyConfigBoards[board] ? "takes" : "does not take");
   }
-  return false;
+  return m_multiKeyConfigBoards[board];
+}
+
+void RS485Comm::SetConfigFingerprintsEnabled(bool enabled) {
+  m_configFingerprintsEnabled = enabled;
 }
 
-bool RS485Comm::ReceiveConfigAck(uint8_t boardId, uint8_t topic, uint8_t index,
-                                 uint8_t key) {
-  if (m_pSerialPort == NULL) {
+bool RS485Comm::QueryConfigFingerprint(uint8_t board, uint32_t* fingerprint) {
+  if (m_pTransport == NULL || board >= RS485_COMM_MAX_BOARDS ||
+      RuntimeOwnsBus()) {
     return false;
   }
+  // The query clears the line first, which would lose acks still on it.
+  SendConfigItem();
+  DrainConfigWindow();
+  FlushInput();
 
-  auto start = std::chrono::steady_clock::now();
-  uint8_t header[ppuc::v2::kHeaderBytes];
-  uint8_t buffer[ppuc::v2::kConfigAckFrameBytes];
-  auto readExact = [this](uint8_t* dst, size_t bytes) -> bool {
-    // libserialport may return fewer bytes than requested even with the
-    // blocking API. During Linux board configuration that caused partial
-    // config-ack frames to be parsed as failures, forcing retries.
-    size_t totalRead = 0;
-    while (totalRead < bytes) {
-      const int read = sp_blocking_read(
-          m_pSerialPort, dst + totalRead, bytes - totalRead,
-          RS485_COMM_SERIAL_READ_TIMEOUT);
-      if (read <= 0) {
-        if (m_debug) {
-          DebugPrintf("Timed out reading V2 config ack bytes (%zu/%zu read)",
-                      totalRead, bytes);
-        }
-        return false;
-      }
-      totalRead += static_cast<size_t>(read);
+  uint8_t query[ppuc::v2::kAdminFrameBytes];
+  ConfigFingerprint::BuildQuery(query, board, m_sequence++, m_epoch);
+  if (!WriteBytes("ConfigFingerprintQuery", query, sizeof(query))) {
+    return false;
+  }
+
+  const auto deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(RS485_COMM_FINGERPRINT_QUERY_TIMEOUT_MS);
+  m_frameDecoder.SetAdminFrameBytes(ppuc::v2::kAdminFrameBytes);
+  const uint8_t* frame = NULL;
+  size_t frameBytes = 0;
+  FrameDecoder::Result received;
+  while ((received = ReceiveFrame(deadline, &frame, &frameBytes)) !=
+         FrameDecoder::Result::NeedMore) {
+    if (ppuc::v2::ExtractType(frame[1]) != ppuc::v2::kFrameAdmin) {
+      continue;
+    }
+    if (received == FrameDecoder::Result::BadCrc) {
+      ReportAnomaly(Anomaly::FrameCrc,
+                    "Invalid admin frame CRC while querying board %u", board);
+      continue;
     }
-    return true;
-  };
 
-  while ((std::chrono::duration_cast<std::chrono::microseconds>(
-              std::chrono::steady_clock::now() - start))
-             .count() < RS485_COMM_CONFIG_ACK_TIMEOUT_US) {
-    if ((int)sp_input_waiting(m_pSerialPort) <= 0) {
+    uint8_t command = 0;
+    uint8_t reportedBoard = 0;
+    uint8_t data[ppuc::v2::kAdminDataBytes] = {0};
+    ppuc::v2::ReadAdminPayload(&frame[ppuc::v2::kHeaderBytes], command,
+                               reportedBoard, data);
+    if (command != ConfigFingerprint::kAdminReport || reportedBoard != board) {
       continue;
     }
+    *fingerprint = ppuc::v2::ReadU32(data);
+    return true;
+  }
+  return false;
+}
 
-    if (!readExact(&header[0], 1)) {
+void RS485Comm::SendHeldBackConfig() {
+  // Ask every board before sending to any, so the queries do not stall the
+  // config window between boards.
+  bool send[RS485_COMM_MAX_BOARDS] = {false};
+  for (uint8_t board = 0; board < RS485_COMM_MAX_BOARDS; ++board) {
+    if (m_heldBackConfig[board].empty()) {
       continue;
     }
-    if (header[0] != ppuc::v2::kSyncByte) {
+    uint32_t held = ConfigFingerprint::kNone;
+    if (QueryConfigFingerprint(board, &held) &&
+        held == m_configFingerprints[board].Value()) {
+      printf("PPUC: board %u already holds this configuration; not sending "
+             "it again.\n",
+             static_cast<unsigned>(board));
+      ++m_configUploadsSkipped;
+      NoteConfigBoardPresent(board);
+      m_heldBackConfig[board].clear();
       continue;
     }
+    send[board] = true;
+  }
 
-    if (!readExact(&header[1], ppuc::v2::kHeaderBytes - 1)) {
+  for (uint8_t board = 0; board < RS485_COMM_MAX_BOARDS; ++board) {
+    if (!send[board]) {
       continue;
     }
-    const ppuc::v2::FrameType frameType = ppuc::v2::ExtractType(header[1]);
-    if (frameType != ppuc::v2::kFrameConfigAck) {
-      size_t payloadBytes = 0;
-      switch (frameType) {
-        case ppuc::v2::kFrameSetup:
-          payloadBytes = ppuc::v2::kSetupPayloadBytes;
-          break;
-        case ppuc::v2::kFrameMapping:
-          payloadBytes = ppuc::v2::kMappingPayloadBytes;
-          break;
-        case ppuc::v2::kFrameConfig:
-          payloadBytes = ppuc::v2::kConfigPayloadBytes;
-          break;
-        case ppuc::v2::kFrameRestart:
-        case ppuc::v2::kFrameReset:
-        case ppuc::v2::kFrameHeartbeat:
-        case ppuc::v2::kFrameError:
-          payloadBytes = 0;
-          break;
-        default:
-          return false;
-      }
-      uint8_t discard[ppuc::v2::kHeaderBytes + ppuc::v2::kConfigPayloadBytes +
-                      ppuc::v2::kCrcBytes];
-      if (payloadBytes + ppuc::v2::kCrcBytes > sizeof(discard)) {
-        return false;
-      }
-      // Config startup is synchronous, but stale bytes from an earlier frame
-      // can still appear here. Drain the full frame before looking for the ack.
-      if (!readExact(discard, payloadBytes + ppuc::v2::kCrcBytes)) {
-        continue;
+    for (const PendingConfigFrame& key : m_heldBackConfig[board]) {
+      if (ShouldAbortConfigurationEarly()) {
+        break;
       }
-      continue;
+      QueueConfigKey(key);
+    }
+    m_heldBackConfig[board].clear();
+  }
+}
+
+bool RS485Comm::SendConfigItem() {
+  if (m_configItem.keyCount == 0) {
+    return true;
+  }
+  PendingConfigFrame item = m_configItem;
+  m_configItem.keyCount = 0;
+  // A lone key gains nothing from the longer frame.
+  item.multiKey = item.keyCount > 1;
+  return SendConfigFrame(item);
+}
+
+bool RS485Comm::SendConfigFrame(const PendingConfigFrame& pending) {
+  PendingConfigFrame frame = pending;
+
+  // Make room in the window. A frame whose ack would look the same as one
+  // still in flight waits for it too, or the two could not be told apart.
+  while (m_configInFlight.size() >= m_configWindow ||
+         IsConfigFrameInFlight(frame)) {
+    ServiceConfigAcks(NextConfigAckDeadline());
+  }
+
+  // Feed the window at about the rate the boards have been emptying it, so a
+  // board's receive buffer sees a steady stream rather than a window's worth
+  // at once. A quarter faster than measured: acks can only come as fast as
+  // frames were sent, so pacing at exactly the measured rate would hold on to
+  // whatever rate the host started with. With nothing in flight the last ack
+  // already said the board is ready.
+  if (!m_configInFlight.empty() && m_configAckIntervalUs > 0) {
+    const auto paceUntil =
+        m_lastConfigSentAt +
+        std::chrono::microseconds(m_configAckIntervalUs * 3 / 4);
+    while (!m_configInFlight.empty() &&
+           std::chrono::steady_clock::now() < paceUntil) {
+      ServiceConfigAcks(std::min(paceUntil, NextConfigAckDeadline()));
     }
+  }
+
+  const uint32_t failedBefore = m_configFramesFailed;
+  if (!WriteConfigFrame(&frame)) {
+    ++m_configFramesFailed;
+    return false;
+  }
+  m_configInFlight.push_back(frame);
+
+  if (m_configWindow == 1) {
+    DrainConfigWindow();
+    return m_configFramesFailed == failedBefore;
+  }
+  return true;
+}
 
-    memcpy(buffer, header, ppuc::v2::kHeaderBytes);
-    if (!readExact(&buffer[ppuc::v2::kHeaderBytes],
-                   ppuc::v2::kConfigAckPayloadBytes + ppuc::v2::kCrcBytes)) {
+void RS485Comm::DrainConfigWindow() {
+  while (!m_configInFlight.empty()) {
+    ServiceConfigAcks(NextConfigAckDeadline());
+  }
+}
+
+bool RS485Comm::WriteConfigFrame(PendingConfigFrame* frame) {
+  // Every attempt gets a sequence number of its own, so a repeat sent after
+  // later frames does not look to the board like the bus running backwards.
+  uint8_t buffer[MultiKeyConfigFrame::kMaxFrameBytes];
+  const uint8_t sequence = m_sequence++;
+  size_t frameBytes = ppuc::v2::kConfigFrameBytes;
+  if (frame->multiKey) {
+    frameBytes = MultiKeyConfigFrame::Build(
+        buffer, sequence, m_epoch, frame->board, frame->topic, frame->index,
+        frame->keys, frame->values, frame->keyCount);
+  } else {
+    ppuc::v2::BuildConfigFrame(buffer, ppuc::v2::kNoBoard, sequence, m_epoch,
+                               frame->board, frame->topic, frame->index,
+                               frame->keys[0], frame->values[0]);
+  }
+  if (!WriteBytes("ConfigFrame", buffer, frameBytes)) {
+    return false;
+  }
+  frame->sentAt = std::chrono::steady_clock::now();
+  m_lastConfigSentAt = frame->sentAt;
+  ++frame->attempts;
+
+  if (m_debug) {
+    DebugPrintf(
+        "Sent V2 ConfigFrame board=%u topic=%u index=%u key=%u keys=%u seq=%u attempt=%u",
+        frame->board, frame->topic, frame->index, frame->keys[0],
+        frame->keyCount, sequence, static_cast<unsigned>(frame->attempts));
+  }
+  return true;
+}
+
+void RS485Comm::ServiceConfigAcks(
+    std::chrono::steady_clock::time_point until) {
+  const uint8_t* buffer = NULL;
+  size_t frameBytes = 0;
+  FrameDecoder::Result result;
+  while ((result = ReceiveFrame(until, &buffer, &frameBytes)) !=
+         FrameDecoder::Result::NeedMore) {
+    // Config startup is synchronous, but stale frames from earlier traffic can
+    // still appear here. Skip them and keep looking for the ack.
+    if (ppuc::v2::ExtractType(buffer[1]) != ppuc::v2::kFrameConfigAck) {
       continue;
     }
 
-    const uint16_t receivedCrc =
-        (static_cast<uint16_t>(buffer[ppuc::v2::kConfigAckFrameBytes - 2]) << 8) |
-        static_cast<uint16_t>(buffer[ppuc::v2::kConfigAckFrameBytes - 1]);
-    const uint16_t calculatedCrc = ppuc::v2::Crc16Ccitt(
-        buffer, ppuc::v2::kHeaderBytes + ppuc::v2::kConfigAckPayloadBytes);
-    if (receivedCrc != calculatedCrc) {
+    if (result == FrameDecoder::Result::BadCrc) {
+      const uint16_t receivedCrc =
+          (static_cast<uint16_t>(buffer[frameBytes - 2]) << 8) |
+          static_cast<uint16_t>(buffer[frameBytes - 1]);
+      const uint16_t calculatedCrc = ppuc::v2::Crc16Ccitt(
+          buffer, frameBytes - ppuc::v2::kCrcBytes);
       ReportAnomaly(Anomaly::FrameCrc, "Invalid V2 config ack CRC: got=%04X expected=%04X",
                   receivedCrc, calculatedCrc);
       continue;
     }
 
-    if (buffer[5] != boardId || buffer[6] != topic || buffer[7] != index ||
-        buffer[8] != key) {
+    // A multi-key ack carries the key count where a plain one has the key.
+    const bool multiKey = MultiKeyConfigFrame::IsMultiKeyFrame(buffer);
+    size_t i = 0;
+    while (i < m_configInFlight.size() &&
+           !MatchesConfigAck(m_configInFlight[i], multiKey, buffer[5],
+                             buffer[6], buffer[7], buffer[8])) {
+      ++i;
+    }
+    if (i == m_configInFlight.size()) {
       ReportAnomaly(Anomaly::ConfigAck, "Unexpected V2 config ack: board=%u topic=%u index=%u key=%u",
                   buffer[5], buffer[6], buffer[7], buffer[8]);
       continue;
@@ -1284,24 +1738,168 @@ bool RS485Comm::ReceiveConfigAck(uint8_t boardId, uint8_t topic, uint8_t index,
     if (buffer[9] != ppuc::v2::kConfigAckAccepted) {
       ReportAnomaly(Anomaly::ConfigAck,
           "Rejected V2 config ack: board=%u topic=%u index=%u key=%u status=%u",
-          boardId, topic, index, key, buffer[9]);
-      return false;
+          buffer[5], buffer[6], buffer[7], buffer[8], buffer[9]);
+      RetryConfigFrame(i);
+    } else {
+      NoteConfigAcked(m_configInFlight[i], std::chrono::steady_clock::now());
+      m_configInFlight.erase(m_configInFlight.begin() + i);
     }
+    break;
+  }
 
-    return true;
+  ExpireConfigFrames();
+}
+
+void RS485Comm::ExpireConfigFrames() {
+  const auto now = std::chrono::steady_clock::now();
+  const auto timeout =
+      std::chrono::microseconds(RS485_COMM_CONFIG_ACK_TIMEOUT_US);
+  // A retried frame moves to the back, so visit each one there was only once.
+  size_t remaining = m_configInFlight.size();
+  size_t i = 0;
+  while (remaining-- > 0 && i < m_configInFlight.size()) {
+    const PendingConfigFrame& frame = m_configInFlight[i];
+    if (now - frame.sentAt < timeout) {
+      ++i;
+      continue;
+    }
+    if (m_debug) {
+      DebugPrintf("Timed out waiting for V2 config ack board=%u topic=%u",
+                  frame.board, frame.topic);
+    }
+    // Every attempt spent without an acknowledgement.
+    ++m_configAckTimeoutCount;
+    RetryConfigFrame(i);
   }
+}
+
+void RS485Comm::RetryConfigFrame(size_t i) {
+  PendingConfigFrame frame = m_configInFlight[i];
+  m_configInFlight.erase(m_configInFlight.begin() + i);
 
-  // Every attempt spent without an acknowledgement.
-  ++m_configAckTimeoutCount;
+  if (frame.attempts >= RS485_COMM_CONFIG_ACK_RETRIES) {
+    NoteConfigAckMissed(frame);
+    return;
+  }
+
+  // A repeat of a config frame the board never acknowledged.
+  ++m_configAckRetryCount;
+  if (m_configInFlight.empty()) {
+    // Nobody else's ack can be lost by clearing the line first.
+    FlushInput();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  if (!WriteConfigFrame(&frame)) {
+    ++m_configFramesFailed;
+    return;
+  }
+  m_configInFlight.push_back(frame);
+}
+
+void RS485Comm::NoteConfigAcked(
+    const PendingConfigFrame& frame,
+    std::chrono::steady_clock::time_point ackedAt) {
+  // A frame that was already waiting when the previous ack came kept the
+  // board busy in between, so the gap is how long the board took over it.
+  if (frame.sentAt < m_lastConfigAckAt) {
+    const int64_t intervalUs =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            ackedAt - m_lastConfigAckAt)
+            .count();
+    m_configAckIntervalUs = m_configAckIntervalUs == 0
+                                ? intervalUs
+                                : (3 * m_configAckIntervalUs + intervalUs) / 4;
+  }
+  m_lastConfigAckAt = ackedAt;
+  NoteConfigBoardPresent(frame.board);
+}
+
+void RS485Comm::NoteConfigBoardPresent(uint8_t board) {
+  m_initialConfigAckMissStreak = 0;
+  if (board < RS485_COMM_MAX_BOARDS) {
+    m_initialConfigAckMissesByBoard[board] = 0;
+  }
+  m_presentBoards.insert(board);
+  if (board < RS485_COMM_MAX_BOARDS) {
+    m_activeBoards[board] = true;
+  }
+}
+
+void RS485Comm::ResetConfigFingerprints() {
+  for (uint8_t board = 0; board < RS485_COMM_MAX_BOARDS; ++board) {
+    m_configFingerprints[board].Reset();
+    m_heldBackConfig[board].clear();
+  }
+}
+
+void RS485Comm::NoteConfigAckMissed(const PendingConfigFrame& frame) {
+  ReportAnomaly(Anomaly::ConfigAck, "Missing V2 config ack: board=%u topic=%u index=%u key=%u",
+              frame.board, frame.topic, frame.index, frame.keys[0]);
+  m_configFailed = true;
+  ++m_configFramesFailed;
+  if (m_presentBoards.empty() &&
+      m_initialConfigAckMissStreak <
+          RS485_COMM_INITIAL_CONFIG_ACK_MISS_THRESHOLD) {
+    ++m_initialConfigAckMissStreak;
+  }
+  if (frame.board < RS485_COMM_MAX_BOARDS &&
+      m_initialConfigAckMissesByBoard[frame.board] <
+          RS485_COMM_INITIAL_CONFIG_ACK_MISS_THRESHOLD) {
+    ++m_initialConfigAckMissesByBoard[frame.board];
+    if (m_presentBoards.find(frame.board) == m_presentBoards.end() &&
+        m_initialConfigAckMissesByBoard[frame.board] >=
+            RS485_COMM_INITIAL_CONFIG_ACK_MISS_THRESHOLD) {
+      m_configEarlyAbortBoard = frame.board;
+    }
+  }
+  m_configAckFailedBoards.insert(frame.board);
+  if (!m_configEarlyAbortLogged && ShouldAbortConfigurationEarly()) {
+    if (m_configEarlyAbortBoard != ppuc::v2::kNoBoard) {
+      printf(
+          "PPUC: board %u missed its first %u config ACKs; aborting startup attempt early.\n",
+          static_cast<unsigned>(m_configEarlyAbortBoard),
+          static_cast<unsigned>(RS485_COMM_INITIAL_CONFIG_ACK_MISS_THRESHOLD));
+    } else {
+      printf(
+          "PPUC: the first %u config frames received no ACKs; aborting startup attempt early.\n",
+          static_cast<unsigned>(RS485_COMM_INITIAL_CONFIG_ACK_MISS_THRESHOLD));
+    }
+    m_configEarlyAbortLogged = true;
+  }
+}
+
+bool RS485Comm::IsConfigFrameInFlight(
+    const PendingConfigFrame& frame) const {
+  const uint8_t keyOrCount = frame.multiKey ? frame.keyCount : frame.keys[0];
+  for (const PendingConfigFrame& pending : m_configInFlight) {
+    if (MatchesConfigAck(pending, frame.multiKey, frame.board, frame.topic,
+                         frame.index, keyOrCount)) {
+      return true;
+    }
+  }
   return false;
 }
 
+std::chrono::steady_clock::time_point RS485Comm::NextConfigAckDeadline()
+    const {
+  auto deadline = std::chrono::steady_clock::time_point::max();
+  for (const PendingConfigFrame& frame : m_configInFlight) {
+    deadline = std::min(
+        deadline,
+        frame.sentAt +
+            std::chrono::microseconds(RS485_COMM_CONFIG_ACK_TIMEOUT_US));
+  }
+  return deadline;
+}
+
 bool RS485Comm::SendSetupFrame() {
-  if (m_pSerialPort == NULL ||
+  if (m_pTransport == NULL ||
       !ppuc::v2::IsValidRuntimeConfig(m_runtimeConfig)) {
     return false;
   }
 
+  // Boards start over from a setup frame, so deltas have nothing to build on.
+  m_outputDeltaEncoder.ForceKeyframe();
   uint8_t buffer[ppuc::v2::kSetupFrameBytes];
   ppuc::v2::BuildSetupFrame(buffer, ppuc::v2::kNoBoard, m_sequence++, m_epoch,
                             m_runtimeConfig);
@@ -1318,7 +1916,9 @@ bool RS485Comm::SendSetupFrame() {
   return false;
 }
 
-void RS485Comm::ReceiveSwitchStateChain(uint8_t firstBoard) {
+void RS485Comm::ReceiveSwitchStateChain(
+    uint8_t firstBoard, std::chrono::steady_clock::time_point sentAt) {
+  m_switchChainSentAt = sentAt;
   uint8_t expected = firstBoard;
   uint8_t next = ppuc::v2::kNoBoard;
   bool hadState = false;
@@ -1376,7 +1976,7 @@ uint8_t RS485Comm::GetLogicalNextSwitchBoard(uint8_t board) const {
 bool RS485Comm::SendVirtualSwitchReply(uint8_t board, uint8_t nextBoard,
                                        bool* outHadState) {
   auto boardIt = m_virtualSwitchBoards.find(board);
-  if (boardIt == m_virtualSwitchBoards.end() || m_pSerialPort == NULL ||
+  if (boardIt == m_virtualSwitchBoards.end() || m_pTransport == NULL ||
       !ppuc::v2::IsValidRuntimeConfig(m_runtimeConfig)) {
     return false;
   }
@@ -1396,13 +1996,9 @@ bool RS485Comm::SendVirtualSwitchReply(uint8_t board, uint8_t nextBoard,
   uint8_t buffer[ppuc::v2::kHeaderBytes + ppuc::v2::kSwitchStatusBytes +
                  ppuc::v2::kMaxSwitchBytes + ppuc::v2::kCrcBytes];
 
-  // Copy the bitmap under the lock, then build outside it. This preserves the
-  // original locking exactly - m_stateMutex is taken only for a state reply and
-  // only for the duration of the copy - which matters on the switch-reply path
-  // where hold time is timing sensitive.
+  // The bus thread owns m_switchBitmap, so no lock is needed to copy it.
   uint8_t switchCopy[ppuc::v2::kMaxSwitchBytes];
   if (sendState) {
-    std::lock_guard<std::mutex> lock(m_stateMutex);
     memcpy(switchCopy, m_switchBitmap, switchBytes);
   }
 
@@ -1444,7 +2040,7 @@ bool RS485Comm::ResyncSession() {
   }
   // Drop any stale switch replies that were still in flight from the previous
   // epoch before the runtime loop starts polling again.
-  sp_flush(m_pSerialPort, SP_BUF_INPUT);
+  FlushInput();
   std::this_thread::sleep_for(std::chrono::milliseconds(20));
   m_needSessionResync = false;
   m_nextSwitchPollAt =
@@ -1454,7 +2050,7 @@ bool RS485Comm::ResyncSession() {
 }
 
 bool RS485Comm::SendResetFrame() {
-  if (m_pSerialPort == NULL) {
+  if (m_pTransport == NULL) {
     return false;
   }
 
@@ -1473,7 +2069,7 @@ bool RS485Comm::SendResetFrame() {
 }
 
 bool RS485Comm::SendRestartFrame() {
-  if (m_pSerialPort == NULL) {
+  if (m_pTransport == NULL) {
     return false;
   }
 
@@ -1496,12 +2092,13 @@ PPUCBoardVersion RS485Comm::QueryBoardVersion(uint8_t board,
                                               uint32_t timeoutMs) {
   PPUCBoardVersion result;
   result.board = board;
-  if (m_pSerialPort == NULL || !ppuc::v2::IsValidBoard(board)) {
+  if (m_pTransport == NULL || !ppuc::v2::IsValidBoard(board) ||
+      RuntimeOwnsBus()) {
     return result;
   }
 
   // Anything still in flight would be read as the reply.
-  sp_flush(m_pSerialPort, SP_BUF_INPUT);
+  FlushInput();
 
   uint8_t query[ppuc::v2::kAdminFrameBytes];
   ppuc::v2::BuildVersionQueryFrame(query, board, m_sequence++, m_epoch);
@@ -1511,40 +2108,19 @@ PPUCBoardVersion RS485Comm::QueryBoardVersion(uint8_t board,
 
   const auto deadline = std::chrono::steady_clock::now() +
                         std::chrono::milliseconds(timeoutMs);
-  uint8_t frame[ppuc::v2::kAdminFrameBytes];
-
-  while (std::chrono::steady_clock::now() < deadline) {
-    // Hunt for sync, then read the rest of a fixed-size admin frame. A board
-    // that is mid-boot can emit anything, so nothing here assumes the first
-    // byte seen is ours.
-    uint8_t byte = 0;
-    if (sp_blocking_read(m_pSerialPort, &byte, 1, 5) <= 0) {
-      continue;
-    }
-    if (byte != ppuc::v2::kSyncByte) {
-      continue;
-    }
-    frame[0] = byte;
-
-    size_t got = 1;
-    bool complete = true;
-    while (got < sizeof(frame)) {
-      const int read = sp_blocking_read(m_pSerialPort, &frame[got],
-                                        sizeof(frame) - got, 5);
-      if (read <= 0) {
-        complete = false;
-        break;
-      }
-      got += static_cast<size_t>(read);
-    }
-    if (!complete) {
-      continue;
-    }
-
+  m_frameDecoder.SetAdminFrameBytes(ppuc::v2::kAdminFrameBytes);
+  const uint8_t* frame = NULL;
+  size_t frameBytes = 0;
+  FrameDecoder::Result received;
+
+  // A board that is mid-boot can emit anything, so nothing here assumes the
+  // first frame seen is ours.
+  while ((received = ReceiveFrame(deadline, &frame, &frameBytes)) !=
+         FrameDecoder::Result::NeedMore) {
     if (ppuc::v2::ExtractType(frame[1]) != ppuc::v2::kFrameAdmin) {
       continue;
     }
-    if (!ppuc::v2::VerifyCrc(frame, sizeof(frame))) {
+    if (received == FrameDecoder::Result::BadCrc) {
       ReportAnomaly(Anomaly::FrameCrc,
                     "Invalid admin frame CRC while querying board %u", board);
       continue;
@@ -1579,33 +2155,17 @@ bool RS485Comm::AwaitAdminReply(uint8_t board, uint8_t expectedCommand,
                                 uint32_t timeoutMs) {
   const auto deadline = std::chrono::steady_clock::now() +
                         std::chrono::milliseconds(timeoutMs);
-  uint8_t frame[ppuc::v2::kUpdateAckFrameBytes];
+  m_frameDecoder.SetAdminFrameBytes(ppuc::v2::kUpdateAckFrameBytes);
+  const uint8_t* frame = NULL;
+  size_t frameBytes = 0;
+  FrameDecoder::Result received;
 
-  while (std::chrono::steady_clock::now() < deadline) {
-    uint8_t byte = 0;
-    if (sp_blocking_read(m_pSerialPort, &byte, 1, 5) <= 0) {
-      continue;
-    }
-    if (byte != ppuc::v2::kSyncByte) {
-      continue;
-    }
-    frame[0] = byte;
-
-    size_t got = 1;
-    bool complete = true;
-    while (got < sizeof(frame)) {
-      const int read =
-          sp_blocking_read(m_pSerialPort, &frame[got], sizeof(frame) - got, 5);
-      if (read <= 0) {
-        complete = false;
-        break;
-      }
-      got += static_cast<size_t>(read);
-    }
-    if (!complete || ppuc::v2::ExtractType(frame[1]) != ppuc::v2::kFrameAdmin) {
+  while ((received = ReceiveFrame(deadline, &frame, &frameBytes)) !=
+         FrameDecoder::Result::NeedMore) {
+    if (ppuc::v2::ExtractType(frame[1]) != ppuc::v2::kFrameAdmin) {
       continue;
     }
-    if (!ppuc::v2::VerifyCrc(frame, sizeof(frame))) {
+    if (received == FrameDecoder::Result::BadCrc) {
       ReportAnomaly(Anomaly::FrameCrc, "Invalid admin ack CRC from board %u",
                     board);
       continue;
@@ -1628,11 +2188,18 @@ PPUCFirmwareUpdateResult RS485Comm::UpdateBoardFirmware(
   PPUCFirmwareUpdateResult result;
   result.board = board;
 
-  if (m_pSerialPort == NULL || image == nullptr || imageBytes == 0) {
+  if (m_pTransport == NULL || image == nullptr || imageBytes == 0) {
     result.error = "no image or no serial port";
     return result;
   }
 
+  // The runtime loop must not be sending output frames into the middle of a
+  // transfer. Callers stop updates first; this is the check that says so.
+  if (m_runtimeEnabled) {
+    result.error = "runtime updates are still running";
+    return result;
+  }
+
   // Confirm what is on the other end immediately before writing to it. The
   // caller has already matched image to board, but that decision was made
   // against a version report taken earlier, and this is the last moment at
@@ -1649,15 +2216,8 @@ PPUCFirmwareUpdateResult RS485Comm::UpdateBoardFirmware(
     return result;
   }
 
-  // The runtime loop must not be sending output frames into the middle of a
-  // transfer. Callers stop updates first; this is the check that says so.
-  if (m_runtimeEnabled) {
-    result.error = "runtime updates are still running";
-    return result;
-  }
-
   const uint16_t imageCrc = ppuc::v2::Crc16Ccitt(image, imageBytes);
-  sp_flush(m_pSerialPort, SP_BUF_INPUT);
+  FlushInput();
 
   uint8_t begin[ppuc::v2::kUpdateBeginFrameBytes];
   ppuc::v2::BuildUpdateBeginFrame(begin, board, m_sequence++, m_epoch,
@@ -1749,7 +2309,7 @@ PPUCFirmwareUpdateResult RS485Comm::UpdateBoardFirmware(
 }
 
 bool RS485Comm::SendSwitchRefreshFrame(uint8_t nextBoard) {
-  if (m_pSerialPort == NULL ||
+  if (m_pTransport == NULL ||
       !ppuc::v2::IsValidRuntimeConfig(m_runtimeConfig) ||
       !ppuc::v2::IsValidBoard(nextBoard)) {
     return false;
@@ -1770,7 +2330,7 @@ bool RS485Comm::SendSwitchRefreshFrame(uint8_t nextBoard) {
 
 bool RS485Comm::SendMappingFrame(uint8_t domain, uint16_t index,
                                  uint16_t number) {
-  if (m_pSerialPort == NULL) {
+  if (m_pTransport == NULL) {
     return false;
   }
 
@@ -1807,36 +2367,50 @@ bool RS485Comm::SendMappingFrames() {
 }
 
 bool RS485Comm::SendOutputStateFrame(uint8_t nextBoard) {
-  if (m_pSerialPort == NULL ||
+  if (m_pTransport == NULL ||
       !ppuc::v2::IsValidRuntimeConfig(m_runtimeConfig) ||
       !ppuc::v2::IsValidBoard(nextBoard)) {
     return false;
   }
 
-  uint8_t coilBitmap[ppuc::v2::kMaxCoilBytes] = {0};
-  uint8_t lampBitmap[ppuc::v2::kMaxLampBytes] = {0};
-  uint8_t giLevels[ppuc::v2::kGiStrings] = {0};
-  uint8_t holdFrames[ppuc::v2::kMaxCoilBits] = {0};
-  std::lock_guard<std::mutex> lock(m_stateMutex);
-  memcpy(coilBitmap, m_coilBitmap, sizeof(coilBitmap));
-  memcpy(lampBitmap, m_lampBitmap, sizeof(lampBitmap));
-  memcpy(giLevels, m_giLevels, sizeof(giLevels));
-  memcpy(holdFrames, m_coilHoldFrames, sizeof(holdFrames));
-  ApplyCoilHoldover(coilBitmap, holdFrames);
-  return SendOutputStateFrameFromBuffers(nextBoard, coilBitmap, lampBitmap,
-                                         giLevels);
+  // Reads what the bus thread reads, so it must not run alongside it.
+  const QueuedOutputSnapshot& outputs = LatestPublishedOutputs().outputs;
+  uint8_t coilBitmap[ppuc::v2::kMaxCoilBytes];
+  memcpy(coilBitmap, outputs.coilBitmap, sizeof(coilBitmap));
+  ApplyCoilHoldover(coilBitmap, m_coilHoldActive);
+  return SendOutputStateFrameFromBuffers(nextBoard, coilBitmap,
+                                         outputs.lampBitmap, outputs.giLevels);
 }
 
 bool RS485Comm::SendOutputStateFrameFromBuffers(uint8_t nextBoard,
                                                 const uint8_t* coils,
                                                 const uint8_t* lamps,
                                                 const uint8_t* giLevels) {
-  if (m_pSerialPort == NULL ||
+  if (m_pTransport == NULL ||
       !ppuc::v2::IsValidRuntimeConfig(m_runtimeConfig) ||
       !ppuc::v2::IsValidBoard(nextBoard)) {
     return false;
   }
 
+  if (m_outputDeltaFramesEnabled) {
+    uint8_t frame[OutputDeltaEncoder::kMaxFrameBytes];
+    bool keyframe = true;
+    const size_t frameBytes = m_outputDeltaEncoder.Build(
+        frame, nextBoard, m_sequence++, m_epoch, m_runtimeConfig, coils,
+        lamps, giLevels, &keyframe);
+    m_lastOutputSequenceSent = frame[3];
+    if (!WriteBytes(keyframe ? "OutputStateFrame" : "OutputDeltaFrame", frame,
+                    frameBytes)) {
+      // The boards may not have what the next delta would build on.
+      m_outputDeltaEncoder.ForceKeyframe();
+      return false;
+    }
+    if (!keyframe) {
+      ++m_outputDeltaFrameCount;
+    }
+    return true;
+  }
+
   const size_t coilBytes = ppuc::v2::BitsToBytes(m_runtimeConfig.coilBits);
   const size_t lampBytes = ppuc::v2::BitsToBytes(m_runtimeConfig.lampBits);
   const size_t payloadBytes = coilBytes + lampBytes + ppuc::v2::kGiBytes;
@@ -1854,26 +2428,45 @@ bool RS485Comm::SendOutputStateFrameFromBuffers(uint8_t nextBoard,
 }
 
 void RS485Comm::ApplySwitchBitmapDiff(uint8_t board, const uint8_t* bitmap,
-                                      size_t bytes) {
+                                      size_t bytes, uint64_t receivedAtUs) {
   const uint8_t* ownershipMask =
       board < RS485_COMM_MAX_BOARDS ? m_switchOwnershipMaskByBoard[board]
                                     : nullptr;
-  for (uint16_t n = 0; n < m_runtimeConfig.switchBits; ++n) {
-    if (ownershipMask && !ppuc::v2::GetBitmapBit(ownershipMask, n)) {
-      continue;
-    }
-    const bool oldState = ppuc::v2::GetBitmapBit(m_switchBitmap, n);
-    const bool newState = ppuc::v2::GetBitmapBit(bitmap, n);
-    if (oldState != newState) {
-      int switchNumber = n;
-      if (n < m_switchIndexToNumber.size()) {
-        switchNumber = m_switchIndexToNumber[n];
-      }
-      NoteSwitchActivity(static_cast<uint16_t>(switchNumber));
-      std::lock_guard<std::mutex> lock(m_switchesQueueMutex);
-      m_switches.push(new PPUCSwitchState(switchNumber, newState ? 1 : 0));
+  // The whole reply is published as one snapshot version, so a reader
+  // never sees half of a board's changes.
+  bool publishing = false;
+  const bool gatherChanges = m_haveSwitchCallbacks;
+  size_t changeCount = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_switchesQueueMutex);
+    ForEachChangedBit(
+        m_switchBitmap, bitmap, ownershipMask, m_runtimeConfig.switchBits,
+        [this, &publishing, gatherChanges, &changeCount, receivedAtUs](
+            uint16_t n, bool newState) {
+          int switchNumber = n;
+          if (n < m_switchIndexToNumber.size()) {
+            switchNumber = m_switchIndexToNumber[n];
+          }
+          NoteSwitchActivity(static_cast<uint16_t>(switchNumber));
+          if (!publishing) {
+            m_switchSnapshot.BeginWrite();
+            publishing = true;
+          }
+          QueueSwitchStateLocked(switchNumber, newState ? 1 : 0,
+                                 receivedAtUs);
+          if (gatherChanges) {
+            m_switchChangeBatch[changeCount++] =
+                PPUCSwitchState(switchNumber, newState ? 1 : 0);
+          }
+        });
+    if (publishing) {
+      m_switchSnapshot.EndWrite();
     }
   }
+  if (publishing) {
+    m_switchEventsAvailable.notify_all();
+    DispatchSwitchChanges(m_switchChangeBatch, changeCount);
+  }
 
   if (!ownershipMask) {
     memcpy(m_switchBitmap, bitmap, bytes);
@@ -1900,94 +2493,35 @@ void RS485Comm::NoteSwitchActivity(uint16_t switchNumber) {
 bool RS485Comm::ReceiveSwitchStateFrame(uint8_t expectedBoard,
                                         uint8_t* outNextBoard,
                                         bool* outHadState) {
-  if (m_pSerialPort == NULL ||
+  if (m_pTransport == NULL ||
       !ppuc::v2::IsValidRuntimeConfig(m_runtimeConfig)) {
     return false;
   }
 
   const size_t switchBytes = ppuc::v2::BitsToBytes(m_runtimeConfig.switchBits);
-  uint8_t header[ppuc::v2::kHeaderBytes];
-  uint8_t buffer[ppuc::v2::kHeaderBytes + ppuc::v2::kSwitchStatusBytes +
-                 ppuc::v2::kMaxSwitchBytes +
-                 ppuc::v2::kCrcBytes];
-  auto readExact = [this](uint8_t* dst, size_t bytes,
-                          uint32_t timeoutMs) -> bool {
-    // Match config-ack handling: libserialport may complete a blocking read
-    // with only part of the requested frame on Linux, which would otherwise
-    // turn a valid switch reply into a false CRC/sequence/epoch failure.
-    size_t totalRead = 0;
-    while (totalRead < bytes) {
-      const int read =
-          sp_blocking_read(m_pSerialPort, dst + totalRead, bytes - totalRead,
-                           timeoutMs);
-      if (read <= 0) {
-        return false;
-      }
-      totalRead += static_cast<size_t>(read);
-    }
-    return true;
-  };
-  std::chrono::steady_clock::time_point start =
-      std::chrono::steady_clock::now();
   const int64_t switchReplyWindowUs = SwitchReplyWindowUs();
-  const uint32_t readTimeoutMs = SwitchReadTimeoutMs();
-  auto readOneByteWithinWindow =
-      [this, &start, switchReplyWindowUs](uint8_t* dst) -> bool {
-    while (true) {
-      const int64_t elapsedUs =
-          std::chrono::duration_cast<std::chrono::microseconds>(
-              std::chrono::steady_clock::now() - start)
-              .count();
-      if (elapsedUs >= switchReplyWindowUs) {
-        return false;
-      }
-
-      const int64_t remainingUs = switchReplyWindowUs - elapsedUs;
-      const uint32_t timeoutMs = static_cast<uint32_t>(
-          std::max<int64_t>(1, (remainingUs + 999) / 1000));
-      const int read = sp_blocking_read(m_pSerialPort, dst, 1, timeoutMs);
-      if (read > 0) {
-        return true;
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::microseconds(switchReplyWindowUs);
+  const uint64_t bytesBefore = m_frameDecoder.GetBytesReceived();
+  const uint8_t* buffer = NULL;
+  size_t frameBytes = 0;
+  FrameDecoder::Result received;
+
+  std::chrono::steady_clock::time_point receivedAt;
+  while ((received = ReceiveFrame(deadline, &buffer, &frameBytes,
+                                  &receivedAt)) !=
+         FrameDecoder::Result::NeedMore) {
+    const ppuc::v2::FrameType frameType = ppuc::v2::ExtractType(buffer[1]);
+    if (receivedAt < m_switchChainSentAt) {
+      // A reply to an earlier poll that missed its window.
+      if (m_debug) {
+        DebugPrintf("Dropping late V2 frame type 0x%02X from before the poll",
+                    static_cast<unsigned>(frameType));
       }
-    }
-  };
-  bool sawAnyReplyBytes = false;
-  while ((std::chrono::duration_cast<std::chrono::microseconds>(
-              std::chrono::steady_clock::now() - start))
-             .count() < switchReplyWindowUs) {
-    if (!readOneByteWithinWindow(&header[0])) {
-      break;
-    }
-    sawAnyReplyBytes = true;
-
-    if (header[0] != ppuc::v2::kSyncByte) {
       continue;
     }
-
-    if (!readExact(&header[1], ppuc::v2::kHeaderBytes - 1, readTimeoutMs)) {
-      continue;
-    }
-    const ppuc::v2::FrameType frameType = ppuc::v2::ExtractType(header[1]);
-    size_t payloadBytes = 0;
-    if (frameType == ppuc::v2::kFrameSwitchState) {
-      payloadBytes = ppuc::v2::SwitchPayloadBytes(m_runtimeConfig);
-      if (outHadState) {
-        *outHadState = true;
-      }
-      if (m_debug) {
-        DebugPrintf("Received V2 switch state frame for board token %u",
-                    expectedBoard);
-      }
-    } else if (frameType == ppuc::v2::kFrameSwitchNoChange) {
-      payloadBytes = ppuc::v2::SwitchNoChangePayloadBytes();
-      if (outHadState) {
-        *outHadState = false;
-      }
-      if (m_debug) {
-        DebugPrintf("Received V2 switch no-change frame for board token %u",
-                    expectedBoard);
-      }
-    } else {
+    if (frameType != ppuc::v2::kFrameSwitchState &&
+        frameType != ppuc::v2::kFrameSwitchNoChange) {
       if (m_debug) {
         DebugPrintf(
             "Ignoring unexpected V2 frame type 0x%02X while waiting for switch reply",
@@ -1996,14 +2530,27 @@ bool RS485Comm::ReceiveSwitchStateFrame(uint8_t expectedBoard,
       continue;
     }
 
-    memcpy(buffer, header, ppuc::v2::kHeaderBytes);
-    if (!readExact(&buffer[ppuc::v2::kHeaderBytes],
-                   payloadBytes + ppuc::v2::kCrcBytes, readTimeoutMs)) {
-      continue;
+    if (received == FrameDecoder::Result::BadCrc) {
+      const uint16_t receivedCrc =
+          (static_cast<uint16_t>(buffer[frameBytes - 2]) << 8) |
+          static_cast<uint16_t>(buffer[frameBytes - 1]);
+      const uint16_t calculatedCrc =
+          ppuc::v2::Crc16Ccitt(buffer, frameBytes - ppuc::v2::kCrcBytes);
+      ReportAnomaly(Anomaly::FrameCrc, "Invalid V2 switch frame CRC: got=%04X expected=%04X",
+                  receivedCrc, calculatedCrc);
+      return false;
     }
 
+    const bool hadState = frameType == ppuc::v2::kFrameSwitchState;
+    if (outHadState) {
+      *outHadState = hadState;
+    }
+    if (m_debug) {
+      DebugPrintf("Received V2 switch %s frame for board token %u",
+                  hadState ? "state" : "no-change", expectedBoard);
+    }
     if (outNextBoard) {
-      *outNextBoard = header[2];
+      *outNextBoard = buffer[2];
     }
 
     const uint8_t epochSeen = buffer[ppuc::v2::kHeaderBytes];
@@ -2040,24 +2587,11 @@ bool RS485Comm::ReceiveSwitchStateFrame(uint8_t expectedBoard,
                   switchOverflow ? " switch-overflow" : "");
     }
 
-    const size_t frameBytes =
-        ppuc::v2::kHeaderBytes + payloadBytes + ppuc::v2::kCrcBytes;
-    const uint16_t receivedCrc =
-        (static_cast<uint16_t>(buffer[frameBytes - 2]) << 8) |
-        static_cast<uint16_t>(buffer[frameBytes - 1]);
-    const uint16_t calculatedCrc =
-        ppuc::v2::Crc16Ccitt(buffer, frameBytes - ppuc::v2::kCrcBytes);
-    if (receivedCrc != calculatedCrc) {
-      ReportAnomaly(Anomaly::FrameCrc, "Invalid V2 switch frame CRC: got=%04X expected=%04X",
-                  receivedCrc, calculatedCrc);
-      return false;
-    }
-
-    if (frameType == ppuc::v2::kFrameSwitchState) {
+    if (hadState) {
       ApplySwitchBitmapDiff(
           expectedBoard,
           &buffer[ppuc::v2::kHeaderBytes + ppuc::v2::kSwitchStatusBytes],
-          switchBytes);
+          switchBytes, MonotonicUs(receivedAt));
       if (m_debug) {
         DebugPrintf("Applied V2 switch bitmap diff for board token %u",
                     expectedBoard);
@@ -2066,21 +2600,22 @@ bool RS485Comm::ReceiveSwitchStateFrame(uint8_t expectedBoard,
     return true;
   }
 
+  const bool sawAnyReplyBytes = m_frameDecoder.GetBytesReceived() != bytesBefore;
   ReportAnomaly(Anomaly::SwitchChainMiss,
-      "Timed out waiting for V2 switch reply for board token %u (windowUs=%lld readTimeoutMs=%u sawBytes=%s inputWaiting=%d lastOutputSeq=%u epoch=%u)",
+      "Timed out waiting for V2 switch reply for board token %u (windowUs=%lld sawBytes=%s inputWaiting=%d lastOutputSeq=%u epoch=%u)",
       expectedBoard, static_cast<long long>(switchReplyWindowUs),
-      static_cast<unsigned>(readTimeoutMs), sawAnyReplyBytes ? "yes" : "no",
-      static_cast<int>(sp_input_waiting(m_pSerialPort)),
+      sawAnyReplyBytes ? "yes" : "no",
+      static_cast<int>(m_pTransport->InputWaiting()),
       static_cast<unsigned>(m_lastOutputSequenceSent),
       static_cast<unsigned>(m_epoch));
-  if (sp_input_waiting(m_pSerialPort) <= 0) {
-    sp_flush(m_pSerialPort, SP_BUF_INPUT);
+  if (m_pTransport->InputWaiting() <= 0) {
+    FlushInput();
   }
   return false;
 }
 
 bool RS485Comm::SendEvent(Event* event) {
-  if (!event || m_pSerialPort == NULL) {
+  if (!event || m_pTransport == NULL) {
     return false;
   }
 
@@ -2091,7 +2626,7 @@ bool RS485Comm::SendEvent(Event* event) {
 }
 
 Event* RS485Comm::receiveEvent() {
-  if (m_pSerialPort != NULL) {
+  if (m_pTransport != NULL) {
     std::chrono::steady_clock::time_point start =
         std::chrono::steady_clock::now();
 
@@ -2102,33 +2637,27 @@ Event* RS485Comm::receiveEvent() {
                 std::chrono::steady_clock::now() - start))
                .count() < 8000) {
       // printf("Available %d\n", m_serialPort.Available());
-      if ((int)sp_input_waiting(m_pSerialPort) >= 6) {
+      if ((int)m_pTransport->InputWaiting() >= 6) {
         uint8_t startByte;
-        sp_blocking_read(m_pSerialPort, &startByte, 1,
-                         RS485_COMM_SERIAL_READ_TIMEOUT);
+        m_pTransport->Read(&startByte, 1, RS485_COMM_SERIAL_READ_TIMEOUT);
         if (startByte == 255) {
           uint8_t sourceId;
-          sp_blocking_read(m_pSerialPort, &sourceId, 1,
-                           RS485_COMM_SERIAL_READ_TIMEOUT);
+          m_pTransport->Read(&sourceId, 1, RS485_COMM_SERIAL_READ_TIMEOUT);
           if (sourceId != 0) {
             uint8_t eventIdHigh;
             uint8_t eventIdLow;
-            sp_blocking_read(m_pSerialPort, &eventIdHigh, 1,
-                             RS485_COMM_SERIAL_READ_TIMEOUT);
-            sp_blocking_read(m_pSerialPort, &eventIdLow, 1,
-                             RS485_COMM_SERIAL_READ_TIMEOUT);
+            m_pTransport->Read(&eventIdHigh, 1, RS485_COMM_SERIAL_READ_TIMEOUT);
+            m_pTransport->Read(&eventIdLow, 1, RS485_COMM_SERIAL_READ_TIMEOUT);
             uint16_t eventId = (((uint16_t)eventIdHigh) << 8) + eventIdLow;
             if (eventId != 0) {
               uint8_t value;
-              sp_blocking_read(m_pSerialPort, &value, 1,
-                               RS485_COMM_SERIAL_READ_TIMEOUT);
+              m_pTransport->Read(&value, 1, RS485_COMM_SERIAL_READ_TIMEOUT);
 
               uint8_t stopByte;
-              sp_blocking_read(m_pSerialPort, &stopByte, 1,
-                               RS485_COMM_SERIAL_READ_TIMEOUT);
+              m_pTransport->Read(&stopByte, 1, RS485_COMM_SERIAL_READ_TIMEOUT);
               if (stopByte == 0b10101010) {
-                sp_blocking_read(m_pSerialPort, &stopByte, 1,
-                                 RS485_COMM_SERIAL_READ_TIMEOUT);
+                m_pTransport->Read(&stopByte, 1,
+                                   RS485_COMM_SERIAL_READ_TIMEOUT);
                 if (stopByte == 0b01010101) {
                   if (m_debug) {
                     // @todo use logger
@@ -2154,18 +2683,16 @@ Event* RS485Comm::receiveEvent() {
           }
 
           // Something went wrong after the start byte, try to get back in sync.
-          while (sp_input_waiting(m_pSerialPort) > 0) {
+          while (m_pTransport->InputWaiting() > 0) {
             if (m_debug) {
               // @todo use logger
               printf("Error: Lost sync, %d bytes remaining\n",
-                     sp_input_waiting(m_pSerialPort));
+                     m_pTransport->InputWaiting());
             }
             uint8_t stopByte;
-            sp_blocking_read(m_pSerialPort, &stopByte, 1,
-                             RS485_COMM_SERIAL_READ_TIMEOUT);
+            m_pTransport->Read(&stopByte, 1, RS485_COMM_SERIAL_READ_TIMEOUT);
             if (stopByte == 0b10101010) {
-              sp_blocking_read(m_pSerialPort, &stopByte, 1,
-                               RS485_COMM_SERIAL_READ_TIMEOUT);
+              m_pTransport->Read(&stopByte, 1, RS485_COMM_SERIAL_READ_TIMEOUT);
               if (stopByte == 0b01010101) {
                 // Now we should be back in sync.
                 break;
@@ -2219,10 +2746,8 @@ void RS485Comm::PollEvents(int board) {
           break;
 
         case EVENT_SOURCE_SWITCH:
-          m_switchesQueueMutex.lock();
-          m_switches.push(
-              new PPUCSwitchState(event_recv->eventId, event_recv->value));
-          m_switchesQueueMutex.unlock();
+          QueueSwitchState(event_recv->eventId, event_recv->value,
+                           GetMonotonicTimeUs());
           break;
 
         default:
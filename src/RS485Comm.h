@@ -7,10 +7,11 @@
 
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cstdio>
 #include <cstring>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <set>
 #include <thread>
 #include <unordered_map>
@@ -19,7 +20,16 @@
 #include "io-boards/PPUCProtocolV2.h"
 #include "PPUC_structs.h"
 #include "io-boards/Event.h"
-#include "libserialport.h"
+#include "ConfigFingerprint.h"
+#include "FrameDecoder.h"
+#include "MpscQueue.h"
+#include "MultiKeyConfig.h"
+#include "OutputDelta.h"
+#include "ReadinessFd.h"
+#include "SeqlockBitmap.h"
+#include "SpscQueue.h"
+#include "TripleBuffer.h"
+#include "Transport.h"
 
 #if _MSC_VER
 #define CALLBACK __stdcall
@@ -41,8 +51,15 @@ static constexpr uint32_t RS485_COMM_BAUD_RATE = ppuc::v2::kBaudRate;
 #define RS485_COMM_MAX_SERIAL_WRITE_AT_ONCE 256
 #endif
 
-#define RS485_COMM_QUEUE_SIZE_MAX 128
+// A power of two, as MpscQueue requires.
+#define RS485_COMM_COMMAND_QUEUE_SIZE 256
+#define RS485_COMM_RX_QUEUE_SIZE 64
+// A power of two, as SpscQueue requires; one slot is never used.
 #define RS485_COMM_OUTPUT_QUEUE_SIZE_MAX 256
+#define RS485_COMM_SWITCH_QUEUE_SIZE 256
+static constexpr uint16_t RS485_COMM_UNMAPPED_INDEX = 0xFFFF;
+// A switch callback group mask that matches every switch, grouped or not.
+static constexpr uint32_t RS485_COMM_ALL_SWITCH_GROUPS = 0xFFFFFFFF;
 #define RS485_COMM_MAX_EVENTS_TO_SEND 32
 static constexpr uint32_t RS485_COMM_DEFAULT_OUTPUT_FRAME_INTERVAL_MS = 4;
 #define RS485_COMM_EFFECT_EVENT_SPACING_US 1000
@@ -50,8 +67,27 @@ static constexpr uint32_t RS485_COMM_DEFAULT_OUTPUT_FRAME_INTERVAL_MS = 4;
 #define RS485_COMM_SWITCH_POLL_STARTUP_HOLD_MS 250
 #define RS485_COMM_CONFIG_ACK_TIMEOUT_US 50000
 #define RS485_COMM_CONFIG_ACK_RETRIES 3
+#define RS485_COMM_CONFIG_WINDOW_MAX 16
+#define RS485_COMM_CAPABILITY_QUERY_TIMEOUT_MS 20
+#define RS485_COMM_FINGERPRINT_QUERY_TIMEOUT_MS 20
 #define RS485_COMM_INITIAL_CONFIG_ACK_MISS_THRESHOLD 10
 
+// A config frame sent and not yet acknowledged: one key, or a run of keys
+// for one item sent as a multi-key frame. Acks are matched back to it by
+// board, topic and index, and by the key or the key count, which is all a
+// board echoes.
+struct PendingConfigFrame {
+  uint8_t board = ppuc::v2::kNoBoard;
+  uint8_t topic = 0;
+  uint8_t index = 0;  // of the first key
+  uint8_t keyCount = 0;
+  uint8_t keys[MultiKeyConfigFrame::kMaxKeys] = {0};
+  uint32_t values[MultiKeyConfigFrame::kMaxKeys] = {0};
+  bool multiKey = false;
+  uint8_t attempts = 0;
+  std::chrono::steady_clock::time_point sentAt;
+};
+
 struct VirtualSwitchBoardState {
   uint8_t board = ppuc::v2::kNoBoard;
   std::vector<uint16_t> switchNumbers;
@@ -59,12 +95,60 @@ struct VirtualSwitchBoardState {
   bool dirty = false;
 };
 
+// Work posted to the bus thread by the application's threads. Small and
+// fixed-size so posting never allocates.
+struct BusCommand {
+  enum Type : uint8_t {
+    EffectEvent,    // send a trigger frame: sourceId, number, value
+    VirtualSwitch,  // set a virtual switch: number, value
+  };
+
+  uint8_t type = EffectEvent;
+  uint8_t sourceId = 0;
+  uint8_t value = 0;
+  uint16_t number = 0;
+  uint64_t timestampUs = 0;  // when a virtual switch was set
+};
+
+struct SwitchChangesCallback {
+  uint32_t groupMask = RS485_COMM_ALL_SWITCH_GROUPS;
+  PPUC_SwitchChangesCallback callback = nullptr;
+  const void* userData = nullptr;
+};
+
+// Where a virtual switch's state lives, found by switch number without a
+// search. board is null for switches that are not virtual.
+struct VirtualSwitchSlot {
+  VirtualSwitchBoardState* board = nullptr;
+  uint16_t slot = 0;
+};
+
 struct QueuedOutputSnapshot {
   uint8_t coilBitmap[ppuc::v2::kMaxCoilBytes] = {0};
   uint8_t lampBitmap[ppuc::v2::kMaxLampBytes] = {0};
   uint8_t giLevels[ppuc::v2::kGiStrings] = {0};
 };
 
+// The outputs as the application last set them, as the bus thread sees them.
+struct PublishedOutputState {
+  QueuedOutputSnapshot outputs;
+  // Bumped each time a coil is switched on. The bus thread starts a coil's
+  // holdover when its count moves, so a pulse shorter than a frame still
+  // goes out.
+  uint8_t coilPulses[ppuc::v2::kMaxCoilBits] = {0};
+};
+
+// A frame taken off the bus by the receive thread, waiting for the bus
+// thread.
+struct ReceivedFrame {
+  uint8_t data[FrameDecoder::kMaxFrameBytes];
+  size_t bytes = 0;
+  bool crcOk = false;
+  // Frames decoded before the last input flush are stale.
+  uint32_t flushGeneration = 0;
+  std::chrono::steady_clock::time_point receivedAt;
+};
+
 class RS485Comm {
  public:
   RS485Comm();
@@ -79,7 +163,7 @@ class RS485Comm {
     SwitchChainMiss,   // a switch reply chain did not complete
     EpochMismatch,     // a board is answering for a previous session
     BoardStatus,       // a board reported a status flag worth knowing about
-    QueueOverflow,     // host-side output snapshots were dropped
+    QueueOverflow,     // a host-side queue dropped entries
     SessionResync,     // the host restarted the session
     Count
   };
@@ -88,14 +172,66 @@ class RS485Comm {
                              const void* userData);
 
   bool Connect(const char* device);
+  // Talks to the boards through an already open transport instead of a serial
+  // device. Takes ownership; the transport is closed and deleted on
+  // Disconnect() or when connecting fails.
+  bool Connect(Transport* transport);
   void Disconnect();
   bool RestartBoards();
   bool ResetBoards();
 
   void Run();
+  // Decodes incoming frames on a thread of their own instead of on the bus
+  // thread while it waits for a reply. The bus thread then takes frames off a
+  // queue with a deadline, and a reply that arrives after its window is
+  // recognised by its receive time and dropped rather than read as the answer
+  // to the next poll. Takes effect at the next Run().
+  void SetReceiveThreadEnabled(bool enabled);
+  // Sends output frames as deltas against the previous one, with a full frame
+  // at least every keyframeInterval frames. See OutputDelta.h. Off by
+  // default: only boards whose firmware decodes delta frames can take them.
+  void SetOutputDeltaFramesEnabled(
+      bool enabled,
+      uint32_t keyframeInterval = OutputDeltaEncoder::kDefaultKeyframeInterval);
 
   void QueueEvent(Event* event);
+  // Direct output setters for the emulator's hot path. They do what
+  // QueueEvent() does for the matching event, without allocating one.
+  void SetCoilState(uint16_t number, bool on);
+  void SetLampState(uint16_t number, bool on);
+  void SetGILevel(uint8_t string, uint8_t level);
+  // Applies a whole emulator tick of changes under one lock and queues at
+  // most one output snapshot for them. A GI state is a brightness level.
+  void SetOutputStates(const PPUCOutputState* coils, size_t coilCount,
+                       const PPUCOutputState* lamps, size_t lampCount,
+                       const PPUCOutputState* gi, size_t giCount);
+  // Sends one config key. With a window of one, the default, it waits for
+  // the ack and returns whether it came. With a larger window it returns once
+  // the frame is sent, and FlushConfigEvents() reports the outcome. So it
+  // does for a board that takes multi-key frames, where keys are held back
+  // until their item is complete and then sent together.
   bool SendConfigEvent(ConfigEvent* configEvent);
+  // Waits until every config frame sent is acknowledged or has used up its
+  // retries, and returns false if any failed since the last flush.
+  bool FlushConfigEvents();
+  // How many config frames may await their acks at once, up to
+  // RS485_COMM_CONFIG_WINDOW_MAX. Only for links where a board's ack cannot
+  // collide with the host's next frame, such as a full-duplex adapter or the
+  // board simulator: on a shared half-duplex bus keep the default of one.
+  void SetConfigWindow(uint8_t frames);
+  // Asks a board for its version and, if it reports
+  // MultiKeyConfigFrame::kCapability, sends it an item's keys in one frame
+  // from then on. Returns whether it does. Until asked, or if it does not
+  // answer, a board gets one frame per key.
+  bool QueryConfigCapabilities(uint8_t board);
+  // Holds back each board's config, apart from the switch chain keys, until
+  // FlushConfigEvents(). Then each board is asked for the fingerprint of the
+  // config it holds, and only those that hold something else are sent
+  // theirs. See ConfigFingerprint.h. Off by default.
+  void SetConfigFingerprintsEnabled(bool enabled);
+  // Asks a board for the fingerprint of the config it holds. Returns false
+  // if it does not answer, or while runtime updates run.
+  bool QueryConfigFingerprint(uint8_t board, uint32_t* fingerprint);
   void SetRuntimeConfig(const ppuc::v2::RuntimeConfig& config);
   bool SendSetupFrame();
   bool SendResetFrame();
@@ -119,13 +255,46 @@ class RS485Comm {
   std::vector<uint8_t> GetMissingConfiguredBoards() const;
 
   void RegisterSwitchBoard(uint8_t number);
+  // Copies up to max pending switch changes into out, oldest first, and
+  // returns how many it copied.
+  size_t GetSwitchStates(PPUCSwitchState* out, size_t max);
+  // GetSwitchStates() with the time each change reached the host. Both take
+  // from the same queue.
+  size_t GetSwitchEvents(PPUCSwitchEvent* out, size_t max);
+  // The clock switch event timestamps are on.
+  static uint64_t GetMonotonicTimeUs();
+  // Heap-allocated wrapper around GetSwitchStates(); the caller deletes the
+  // result.
   PPUCSwitchState* GetNextSwitchState();
+  // Blocks until a switch change is waiting or timeoutMs passes, and returns
+  // whether one is waiting. Takes nothing off the queue.
+  bool WaitForSwitchState(uint32_t timeoutMs);
+  // A descriptor that is readable while switch changes are waiting, for a
+  // host's own poll loop; draining them with GetSwitchStates() makes it
+  // unreadable again. Owned by RS485Comm. -1 where the platform has none.
+  int GetSwitchEventFd();
+  // Switch group membership, indexed by switch number: bit g is set when the
+  // switch is in group g. Set before Run().
+  void SetSwitchGroupMasks(const std::vector<uint32_t>& masksByNumber);
+  // Calls callback with each batch of switch changes, narrowed to the
+  // switches in groupMask's groups; batches with none of them are not passed
+  // on at all. Runs on whichever thread owns switch state - the bus thread
+  // while it runs - so it must return quickly. Independent of, and does not
+  // drain, GetSwitchStates().
+  void AddSwitchChangesCallback(uint32_t groupMask,
+                                PPUC_SwitchChangesCallback callback,
+                                const void* userData);
+  void ClearSwitchChangesCallbacks();
+  // Copies every switch's current state at once. Never waits for the bus
+  // thread; a copy that races a switch reply is simply taken again.
+  PPUCSwitchSnapshot GetSwitchSnapshot() const;
   uint32_t GetCleanSwitchReplyChainCount() const;
   PPUCBusHealth GetBusHealth() const;
 
   // Asks one board what it is running. Polls a single board rather than
   // broadcasting: administration happens outside the switch chain, so nothing
-  // arbitrates who replies.
+  // arbitrates who replies. While runtime updates run the bus thread owns
+  // the replies, so no board is asked and none is reported as answering.
   PPUCBoardVersion QueryBoardVersion(uint8_t board, uint32_t timeoutMs = 250);
 
   // Sends a firmware image to one board and asks it to install.
@@ -147,6 +316,8 @@ class RS485Comm {
  public:
   std::vector<std::string> GetRecentAnomalies() const;
   bool IsBoardActive(uint8_t number) const;
+  // False if number is not a virtual switch, or if the change was dropped
+  // because the bus thread's command queue was full.
   bool SetVirtualSwitchState(uint16_t number, uint8_t state);
   bool IsSwitchVirtualized(uint16_t number) const;
 
@@ -165,15 +336,41 @@ class RS485Comm {
   void PollEvents(int board);
   bool ResyncSession();
   bool SendOutputStateFrame(uint8_t nextBoard);
-  bool ReceiveConfigAck(uint8_t boardId, uint8_t topic, uint8_t index,
-                        uint8_t key);
+  // Waits until deadline for the next CRC-checked frame from the bus. Returns
+  // BadCrc with the corrupt frame so the caller can report it in context, and
+  // NeedMore when the deadline passes.
+  FrameDecoder::Result ReceiveFrame(
+      std::chrono::steady_clock::time_point deadline, const uint8_t** frame,
+      size_t* frameBytes,
+      std::chrono::steady_clock::time_point* receivedAt = nullptr);
+  void FlushInput();
+  void DiscardReceivedInput();
+  void RunReceiveThread();
+  bool QueueConfigKey(const PendingConfigFrame& frame);
+  void SendHeldBackConfig();
+  bool SendConfigItem();
+  bool SendConfigFrame(const PendingConfigFrame& frame);
+  void DrainConfigWindow();
+  bool WriteConfigFrame(PendingConfigFrame* frame);
+  void ServiceConfigAcks(std::chrono::steady_clock::time_point until);
+  void ExpireConfigFrames();
+  void RetryConfigFrame(size_t i);
+  void NoteConfigAcked(const PendingConfigFrame& frame,
+                       std::chrono::steady_clock::time_point ackedAt);
+  void NoteConfigAckMissed(const PendingConfigFrame& frame);
+  void NoteConfigBoardPresent(uint8_t board);
+  void ResetConfigFingerprints();
+  bool IsConfigFrameInFlight(const PendingConfigFrame& frame) const;
+  std::chrono::steady_clock::time_point NextConfigAckDeadline() const;
   bool ReceiveSwitchStateFrame(uint8_t expectedBoard, uint8_t* outNextBoard,
                                bool* outHadState);
   bool SendVirtualSwitchReply(uint8_t board, uint8_t nextBoard,
                               bool* outHadState);
   uint8_t GetLogicalNextSwitchBoard(uint8_t board) const;
-  void ReceiveSwitchStateChain(uint8_t firstBoard);
-  void ApplySwitchBitmapDiff(uint8_t board, const uint8_t* bitmap, size_t bytes);
+  void ReceiveSwitchStateChain(uint8_t firstBoard,
+                               std::chrono::steady_clock::time_point sentAt);
+  void ApplySwitchBitmapDiff(uint8_t board, const uint8_t* bitmap, size_t bytes,
+                             uint64_t receivedAtUs);
   void RebuildSwitchOwnershipMasks();
   void EnsureConfiguredBoardPresenceKnown();
   bool SendMappingFrame(uint8_t domain, uint16_t index, uint16_t number);
@@ -181,17 +378,40 @@ class RS485Comm {
                                        const uint8_t* lamps,
                                        const uint8_t* giLevels);
   void NoteSwitchActivity(uint16_t switchNumber);
-  void ApplyCoilHoldover(uint8_t* coils, const uint8_t* holdFrames) const;
-  void ConsumeCoilHoldoverLocked(const uint8_t* holdFrames);
+  void QueueSwitchState(int number, int state, uint64_t timestampUs);
+  void QueueSwitchStateLocked(int number, int state, uint64_t timestampUs);
+  size_t TakeSwitchEvents(PPUCSwitchEvent* events, PPUCSwitchState* states,
+                          size_t max);
+  void DispatchSwitchChanges(const PPUCSwitchState* changes, size_t count);
+  const PublishedOutputState& LatestPublishedOutputs();
+  void StartCoilHolds(const uint8_t* coilPulses);
+  void ApplyCoilHoldover(uint8_t* coils, const uint8_t* holdActive) const;
+  void ConsumeCoilHoldover();
   bool WriteBytes(const char* context, const uint8_t* buffer, size_t size);
-  void ClearQueuedEvents();
+  bool PostCommand(const BusCommand& command);
+  void RunQueuedCommands();
+  void DiscardQueuedCommands();
+  void ApplyVirtualSwitchState(uint16_t number, uint8_t state,
+                               uint64_t timestampUs);
   void ClearQueuedOutputSnapshots();
   void ClearOutputState();
   void QueueOutputSnapshotLocked();
+  void PublishOutputStateLocked();
+  uint16_t CoilIndexFor(uint16_t number) const;
+  uint16_t LampIndexFor(uint16_t number) const;
+  uint16_t SwitchIndexFor(uint16_t number) const;
+  void SetCoilBitLocked(uint16_t index, bool on);
+  // Wakes the bus thread out of its idle wait between output frames.
+  void SignalOutputWork();
+  // Returns true if woken by SignalOutputWork() or a stop request, false if
+  // the deadline passed first.
+  bool WaitForOutputWork(std::chrono::steady_clock::time_point deadline);
   bool SendOutputsOffFrame();
+  // True while the bus thread reads replies off the line, when no other
+  // thread may.
+  bool RuntimeOwnsBus() const { return m_busThreadRunning && m_runtimeEnabled; }
   void DebugPrintf(const char* format, ...);
   int64_t SwitchReplyWindowUs() const;
-  uint32_t SwitchReadTimeoutMs() const;
 
   PPUC_LogMessageCallback m_logMessageCallback = nullptr;
   const void* m_logMessageUserData = nullptr;
@@ -206,13 +426,17 @@ class RS485Comm {
   uint8_t m_switchOwnershipMaskByBoard[RS485_COMM_MAX_BOARDS]
                                       [ppuc::v2::kMaxSwitchBytes] = {{0}};
   std::unordered_map<uint8_t, VirtualSwitchBoardState> m_virtualSwitchBoards;
-  std::unordered_map<uint16_t, uint8_t> m_virtualSwitchOwnerByNumber;
+  // Indexed by switch number. Points into m_virtualSwitchBoards, whose
+  // entries stay put until presence is finalized again.
+  std::vector<VirtualSwitchSlot> m_virtualSwitchSlotByNumber;
   bool m_activeBoards[RS485_COMM_MAX_BOARDS] = {false};
 
   bool m_debug = false;
   bool m_debugErrors = false;
-  bool m_runtimeEnabled = true;
-  uint8_t m_coilHoldFrameCount = 3;
+  // Written by QueueEvent() from any thread; a flag the bus thread and
+  // firmware updates check, not state either of them owns.
+  std::atomic<bool> m_runtimeEnabled{true};
+  std::atomic<uint8_t> m_coilHoldFrameCount{3};
   uint8_t m_sequence = 0;
   uint8_t m_epoch = 1;
   uint8_t m_lastOutputSequenceSent = 0;
@@ -225,15 +449,24 @@ class RS485Comm {
   std::vector<uint16_t> m_coilIndexToNumber;
   std::vector<uint16_t> m_lampIndexToNumber;
   std::vector<uint16_t> m_switchIndexToNumber;
-  std::unordered_map<uint16_t, uint16_t> m_coilNumberToIndex;
-  std::unordered_map<uint16_t, uint16_t> m_lampNumberToIndex;
-  std::unordered_map<uint16_t, uint16_t> m_switchNumberToIndex;
+  // Indexed by coil, lamp or switch number, giving that number's bit or
+  // RS485_COMM_UNMAPPED_INDEX. Sized to the highest mapped number.
+  std::vector<uint16_t> m_coilNumberToIndex;
+  std::vector<uint16_t> m_lampNumberToIndex;
+  std::vector<uint16_t> m_switchNumberToIndex;
   std::set<uint16_t> m_buttonSwitchNumbers;
 
-  uint8_t m_coilBitmap[ppuc::v2::kMaxCoilBytes] = {0};
+  // Guarded by m_stateMutex, which only ever serializes the threads setting
+  // outputs. Every change is copied into m_publishedOutputs, which the bus
+  // thread reads without a lock.
+  PublishedOutputState m_outputState;
+  TripleBuffer<PublishedOutputState> m_publishedOutputs;
+  // Bus thread only.
   uint8_t m_coilHoldFrames[ppuc::v2::kMaxCoilBits] = {0};
-  uint8_t m_lampBitmap[ppuc::v2::kMaxLampBytes] = {0};
-  uint8_t m_giLevels[ppuc::v2::kGiStrings] = {0};
+  // Coils whose hold counter is not zero, so holdover only visits those.
+  uint8_t m_coilHoldActive[ppuc::v2::kMaxCoilBytes] = {0};
+  uint8_t m_coilPulsesSeen[ppuc::v2::kMaxCoilBits] = {0};
+  // By wire bit. Owned by the bus thread while it runs.
   uint8_t m_switchBitmap[ppuc::v2::kMaxSwitchBytes] = {0};
 
   // Event message buffers, we need two independent for events and config events
@@ -241,16 +474,61 @@ class RS485Comm {
   uint8_t m_msg[7];
   uint8_t m_cmsg[12];
 
-  struct sp_port* m_pSerialPort;
-  struct sp_port_config* m_pSerialPortConfig;
+  Transport* m_pTransport;
+  FrameDecoder m_frameDecoder;
+  bool m_outputDeltaFramesEnabled = false;
+  OutputDeltaEncoder m_outputDeltaEncoder;  // bus thread only
+  std::atomic<uint32_t> m_outputDeltaFrameCount{0};
   std::thread* m_pThread;
-  std::queue<Event*> m_events;
-  std::queue<QueuedOutputSnapshot> m_outputSnapshots;
-  std::queue<PPUCSwitchState*> m_switches;
-  std::mutex m_eventQueueMutex;
-  std::mutex m_outputQueueMutex;
+  // While set, the bus thread owns switch and virtual board state and other
+  // threads change it only by posting to m_commands. Otherwise the caller
+  // owns it and commands are applied on the spot.
+  std::atomic<bool> m_busThreadRunning{false};
+  bool m_receiveThreadEnabled = false;
+  std::thread* m_pReceiveThread;
+  SpscQueue<ReceivedFrame, RS485_COMM_RX_QUEUE_SIZE> m_receivedFrames;
+  ReceivedFrame m_currentFrame;  // the bus thread's copy of the frame in hand
+  std::mutex m_receivedFrameMutex;
+  std::condition_variable m_receivedFrameAvailable;
+  std::atomic<uint32_t> m_flushGeneration{0};
+  // When the frame handing out the switch token went out. No reply to it can
+  // have been received earlier.
+  std::chrono::steady_clock::time_point m_switchChainSentAt;
+  MpscQueue<BusCommand, RS485_COMM_COMMAND_QUEUE_SIZE> m_commands;
+  std::atomic<uint32_t> m_commandsDropped{0};
+  // Filled under m_stateMutex, so producers are serialized and the queue
+  // sees a single producer; drained by the bus thread.
+  SpscQueue<QueuedOutputSnapshot, RS485_COMM_OUTPUT_QUEUE_SIZE_MAX>
+      m_outputSnapshots;
+  std::atomic<uint32_t> m_outputQueueHighWater{0};
+  std::atomic<uint32_t> m_outputSnapshotsDropped{0};
+  // Ring of switch changes waiting for the application, guarded by
+  // m_switchesQueueMutex, which orders the one thread that owns switch state
+  // against the application draining it.
+  PPUCSwitchEvent m_switchEvents[RS485_COMM_SWITCH_QUEUE_SIZE];
+  size_t m_switchEventsHead = 0;
+  size_t m_switchEventsCount = 0;
+  std::atomic<uint32_t> m_switchEventsDropped{0};
+  // Every switch by number, for GetSwitchSnapshot(). Written alongside
+  // m_switchEvents, only by the thread that owns switch state.
+  SeqlockBitmap<PPUCSwitchSnapshot::kMaxSwitchNumbers> m_switchSnapshot;
+  std::vector<uint32_t> m_switchGroupMaskByNumber;
+  // Replaced whole rather than changed in place, so a dispatch can keep
+  // using the one it took while a callback registers or clears others.
+  std::shared_ptr<const std::vector<SwitchChangesCallback>> m_switchCallbacks;
+  std::atomic<bool> m_haveSwitchCallbacks{false};
+  std::mutex m_switchCallbackMutex;
+  // One reply's changes, gathered for the callbacks by the switch state
+  // owner. Kept here so a reply does not build it on the stack.
+  PPUCSwitchState m_switchChangeBatch[ppuc::v2::kMaxSwitchBits];
+  // Both tell waiters the ring is not empty; guarded like the ring.
+  std::condition_variable m_switchEventsAvailable;
+  ReadinessFd m_switchEventsFd;
   std::mutex m_switchesQueueMutex;
   std::mutex m_stateMutex;
+  std::mutex m_outputWorkMutex;
+  std::condition_variable m_outputWork;
+  bool m_outputWorkPending = false;  // guarded by m_outputWorkMutex
   std::atomic<bool> m_stopRequested{false};
   // Reports an unexpected condition. Always emitted, never behind a debug
   // flag: a fault that only shows up when tracing is enabled is a fault
@@ -303,7 +581,30 @@ class RS485Comm {
   uint8_t m_initialConfigAckMissesByBoard[RS485_COMM_MAX_BOARDS] = {0};
   uint8_t m_configEarlyAbortBoard = ppuc::v2::kNoBoard;
   std::set<uint8_t> m_configAckFailedBoards;
+  // Config frames awaiting acks, oldest first, at most m_configWindow.
+  uint8_t m_configWindow = 1;
+  std::vector<PendingConfigFrame> m_configInFlight;
+  uint32_t m_configFramesFailed = 0;
+  uint32_t m_configFramesFailedAtFlush = 0;
+  // The keys of an item for a multi-key board, collected until the item is
+  // complete. keyCount is zero when there is none.
+  PendingConfigFrame m_configItem;
+  bool m_multiKeyConfigBoards[RS485_COMM_MAX_BOARDS] = {false};
+  // Each board's config as sent since connecting, restarting or resetting,
+  // and the keys still held back from it, with fingerprints enabled.
+  bool m_configFingerprintsEnabled = false;
+  ConfigFingerprint m_configFingerprints[RS485_COMM_MAX_BOARDS];
+  std::vector<PendingConfigFrame> m_heldBackConfig[RS485_COMM_MAX_BOARDS];
+  std::atomic<uint32_t> m_configUploadsSkipped{0};
+  // The time a board takes to handle one config frame, learned from acks
+  // that arrived back to back, so a window is fed no faster than the boards
+  // empty it. Zero until measured.
+  int64_t m_configAckIntervalUs = 0;
+  std::chrono::steady_clock::time_point m_lastConfigAckAt;
+  std::chrono::steady_clock::time_point m_lastConfigSentAt;
   std::chrono::steady_clock::time_point m_nextSwitchPollAt;
+  // When the next output frame is due, whatever wakes the bus thread before.
+  std::chrono::steady_clock::time_point m_nextOutputFrameAt;
   std::chrono::steady_clock::time_point m_nextSwitchRefreshAt;
   bool m_boardPresenceFinalized = false;
 };
@@ -0,0 +1,89 @@
+#include "ReadinessFd.h"
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#elif !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <stdint.h>
+
+ReadinessFd::ReadinessFd() {
+  m_readFd = -1;
+  m_writeFd = -1;
+  m_signaled = false;
+}
+
+ReadinessFd::~ReadinessFd() {
+#if !defined(_WIN32)
+  if (m_writeFd >= 0 && m_writeFd != m_readFd) {
+    close(m_writeFd);
+  }
+  if (m_readFd >= 0) {
+    close(m_readFd);
+  }
+#endif
+}
+
+int ReadinessFd::Get() {
+  if (m_readFd >= 0) {
+    return m_readFd;
+  }
+
+#if defined(__linux__)
+  m_readFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  m_writeFd = m_readFd;
+#elif !defined(_WIN32)
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return -1;
+  }
+  for (const int fd : fds) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+  m_readFd = fds[0];
+  m_writeFd = fds[1];
+#endif
+
+  // Whatever was pending before anyone asked still has to show.
+  if (m_readFd >= 0 && m_signaled) {
+    m_signaled = false;
+    Signal();
+  }
+  return m_readFd;
+}
+
+void ReadinessFd::Signal() {
+  if (m_signaled) {
+    return;
+  }
+  m_signaled = true;
+#if !defined(_WIN32)
+  if (m_writeFd < 0) {
+    return;
+  }
+  const uint64_t one = 1;
+  // The only failure is a full pipe or counter, which is readable anyway.
+  const ssize_t written =
+      write(m_writeFd, &one, m_writeFd == m_readFd ? sizeof(one) : 1);
+  (void)written;
+#endif
+}
+
+void ReadinessFd::Clear() {
+  if (!m_signaled) {
+    return;
+  }
+  m_signaled = false;
+#if !defined(_WIN32)
+  if (m_readFd < 0) {
+    return;
+  }
+  uint64_t drain[8];
+  while (read(m_readFd, drain, sizeof(drain)) > 0) {
+  }
+#endif
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+// A file descriptor that is readable while something is pending, so a host
+// can fold libppuc into its own poll()/epoll()/select() loop.
+//
+// An eventfd on Linux and a non-blocking pipe on other POSIX systems. There
+// is nothing to hand out on Windows, where Get() returns -1 and callers use
+// the blocking waits instead.
+//
+// Not thread-safe by itself: the owner calls Signal() and Clear() under the
+// same lock that guards whatever is pending.
+class ReadinessFd {
+ public:
+  ReadinessFd();
+  ~ReadinessFd();
+
+  ReadinessFd(const ReadinessFd&) = delete;
+  ReadinessFd& operator=(const ReadinessFd&) = delete;
+
+  // Creates the descriptor on first use. Returns -1 if the platform has none
+  // or it could not be created.
+  int Get();
+
+  // Makes the descriptor readable. Repeated calls cost nothing.
+  void Signal();
+  // Makes it unreadable again.
+  void Clear();
+
+ private:
+  int m_readFd;
+  int m_writeFd;
+  bool m_signaled;
+};
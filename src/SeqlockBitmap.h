@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// A bitmap published under a sequence lock, so readers on any thread copy a
+// consistent version without ever blocking the writer.
+//
+// The writer makes the sequence odd, changes bits, and makes it even again;
+// a reader that saw an odd sequence, or a different one before and after its
+// copy, raced a write and tries again. Writes are rare next to the copy, so
+// retries are too. The bits are held in relaxed atomics so the racing read
+// is not a data race.
+//
+// There must be one writer at a time; callers with more than one writer
+// serialize them themselves.
+template <size_t Bits>
+class SeqlockBitmap {
+  static_assert(Bits % 64 == 0, "SeqlockBitmap holds whole 64-bit words");
+
+ public:
+  static constexpr size_t kBytes = Bits / 8;
+
+  void BeginWrite() {
+    const uint32_t sequence = m_sequence.load(std::memory_order_relaxed);
+    m_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  // Only between BeginWrite() and EndWrite().
+  void Set(size_t bit, bool value) {
+    if (bit >= Bits) {
+      return;
+    }
+    std::atomic<uint64_t>& word = m_words[bit / 64];
+    const uint64_t mask = static_cast<uint64_t>(1) << (bit % 64);
+    const uint64_t old = word.load(std::memory_order_relaxed);
+    word.store(value ? old | mask : old & ~mask, std::memory_order_relaxed);
+  }
+
+  void EndWrite() {
+    m_sequence.fetch_add(1, std::memory_order_release);
+  }
+
+  // Copies the bitmap into out, bit n of the bitmap being bit n % 8 of byte
+  // n / 8, and returns the even sequence number of the copy.
+  uint32_t Read(uint8_t* out) const {
+    uint64_t words[Bits / 64];
+    uint32_t before = 0;
+    for (;;) {
+      before = m_sequence.load(std::memory_order_acquire);
+      if (before & 1) {
+        continue;
+      }
+      for (size_t i = 0; i < Bits / 64; ++i) {
+        words[i] = m_words[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (m_sequence.load(std::memory_order_relaxed) == before) {
+        break;
+      }
+    }
+    for (size_t i = 0; i < Bits / 64; ++i) {
+      for (size_t b = 0; b < 8; ++b) {
+        out[i * 8 + b] = static_cast<uint8_t>(words[i] >> (8 * b));
+      }
+    }
+    return before;
+  }
+
+ private:
+  std::atomic<uint32_t> m_sequence{0};
+  std::atomic<uint64_t> m_words[Bits / 64] = {};
+};
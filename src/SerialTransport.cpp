@@ -0,0 +1,261 @@
+#include "SerialTransport.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/serial.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+namespace {
+bool ShouldEnableHardwareRs485(const char* device) {
+  const char* force = getenv("PPUC_RS485_HW");
+  if (force && strcmp(force, "1") == 0) {
+    return true;
+  }
+  if (!device) {
+    return false;
+  }
+
+  // Raspberry Pi UART commonly used with RS485 overlay.
+  return strcmp(device, "/dev/ttyAMA0") == 0 ||
+         strcmp(device, "/dev/serial0") == 0;
+}
+
+void TryEnableHardwareRs485(const char* device, bool debug) {
+  if (!ShouldEnableHardwareRs485(device)) {
+    return;
+  }
+
+  const int fd = open(device, O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    if (debug) {
+      printf("RS485 HW mode: could not open %s for TIOCSRS485\n", device);
+    }
+    return;
+  }
+
+  struct serial_rs485 rs485;
+  memset(&rs485, 0, sizeof(rs485));
+  rs485.flags |= SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND;
+  rs485.flags &= ~SER_RS485_RTS_AFTER_SEND;
+  rs485.delay_rts_before_send = 0;
+  rs485.delay_rts_after_send = 0;
+
+  if (ioctl(fd, TIOCSRS485, &rs485) < 0) {
+    if (debug) {
+      printf("RS485 HW mode: TIOCSRS485 failed on %s\n", device);
+    }
+  } else if (debug) {
+    printf("RS485 HW mode enabled on %s (RTS as DE)\n", device);
+  }
+
+  close(fd);
+}
+}  // namespace
+#endif
+
+#if defined(__APPLE__)
+namespace {
+std::string NormalizeSerialDevice(const char* device, bool debug) {
+  if (!device) {
+    return {};
+  }
+
+  const std::string name(device);
+  const std::string ttyPrefix = "/dev/tty.";
+  if (name.rfind(ttyPrefix, 0) == 0) {
+    const std::string normalized = "/dev/cu." + name.substr(ttyPrefix.size());
+    if (debug) {
+      printf("macOS serial: using callout device %s instead of %s\n",
+             normalized.c_str(), name.c_str());
+    }
+    return normalized;
+  }
+
+  return name;
+}
+}  // namespace
+#endif
+
+SerialTransport::SerialTransport() {
+  m_pSerialPort = NULL;
+  m_pSerialPortConfig = NULL;
+}
+
+SerialTransport::~SerialTransport() { Close(); }
+
+bool SerialTransport::Open(const char* pDevice, uint32_t baudRate,
+                           bool debug) {
+  Close();
+
+#if defined(__linux__)
+  TryEnableHardwareRs485(pDevice, debug);
+#endif
+
+  const char* device = pDevice;
+#if defined(__APPLE__)
+  const std::string normalizedDevice = NormalizeSerialDevice(pDevice, debug);
+  if (!normalizedDevice.empty()) {
+    device = normalizedDevice.c_str();
+  }
+#endif
+
+  if (debug) {
+    printf("Opening serial device %s at %u baud\n", device,
+           static_cast<unsigned>(baudRate));
+  }
+
+  enum sp_return result = sp_get_port_by_name(device, &m_pSerialPort);
+  if (result != SP_OK) {
+    if (debug) {
+      printf("sp_get_port_by_name failed for %s: %d\n", device, result);
+    }
+    m_pSerialPort = NULL;
+    return false;
+  }
+
+  result = sp_open(m_pSerialPort, SP_MODE_READ_WRITE);
+  if (result != SP_OK) {
+    if (debug) {
+      printf("sp_open failed for %s: %d\n", device, result);
+    }
+    sp_free_port(m_pSerialPort);
+    m_pSerialPort = NULL;
+    return false;
+  }
+
+  sp_new_config(&m_pSerialPortConfig);
+  sp_get_config(m_pSerialPort, m_pSerialPortConfig);
+  if (sp_set_config_baudrate(m_pSerialPortConfig, baudRate) != SP_OK) {
+    if (debug) {
+      printf("sp_set_baudrate failed\n");
+    }
+    FreePort();
+    return false;
+  }
+  if (sp_set_config_bits(m_pSerialPortConfig, 8) != SP_OK ||
+      sp_set_config_parity(m_pSerialPortConfig, SP_PARITY_NONE) != SP_OK ||
+      sp_set_config_stopbits(m_pSerialPortConfig, 1) != SP_OK ||
+      sp_set_config_xon_xoff(m_pSerialPortConfig, SP_XONXOFF_DISABLED) !=
+          SP_OK ||
+      sp_set_config_flowcontrol(m_pSerialPortConfig, SP_FLOWCONTROL_NONE) !=
+          SP_OK) {
+    if (debug) {
+      printf("sp_set_* serial config failed\n");
+    }
+    FreePort();
+    return false;
+  }
+  if (sp_set_config(m_pSerialPort, m_pSerialPortConfig) != SP_OK) {
+    if (debug) {
+      printf("sp_set_config failed\n");
+    }
+    FreePort();
+    return false;
+  }
+  // Apply a fully passive host-side serial state. This avoids adapters getting
+  // wedged by inherited flow-control or modem-control settings between runs.
+  sp_set_flowcontrol(m_pSerialPort, SP_FLOWCONTROL_NONE);
+  sp_set_rts(m_pSerialPort, SP_RTS_OFF);
+  sp_set_dtr(m_pSerialPort, SP_DTR_OFF);
+
+  sp_flush(m_pSerialPort, SP_BUF_BOTH);
+  // Wait before continuing.
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  return true;
+}
+
+bool SerialTransport::IsOpen() const { return m_pSerialPort != NULL; }
+
+void SerialTransport::Close() {
+  if (m_pSerialPort == NULL) {
+    return;
+  }
+
+  // Some USB-RS485 adapters/drivers keep modem-control/flow-control state
+  // across close/open cycles. Drain and explicitly deassert those lines before
+  // closing so the next run starts from a neutral adapter state.
+  sp_drain(m_pSerialPort);
+  sp_flush(m_pSerialPort, SP_BUF_INPUT);
+  sp_set_flowcontrol(m_pSerialPort, SP_FLOWCONTROL_NONE);
+  sp_set_rts(m_pSerialPort, SP_RTS_OFF);
+  sp_set_dtr(m_pSerialPort, SP_DTR_OFF);
+
+  if (m_pSerialPortConfig != NULL) {
+    sp_set_config(m_pSerialPort, m_pSerialPortConfig);
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  FreePort();
+}
+
+void SerialTransport::FreePort() {
+  if (m_pSerialPortConfig != NULL) {
+    sp_free_config(m_pSerialPortConfig);
+    m_pSerialPortConfig = NULL;
+  }
+  if (m_pSerialPort != NULL) {
+    sp_close(m_pSerialPort);
+    sp_free_port(m_pSerialPort);
+    m_pSerialPort = NULL;
+  }
+}
+
+int SerialTransport::Write(const uint8_t* data, size_t size,
+                           uint32_t timeoutMs) {
+  if (m_pSerialPort == NULL) {
+    return SP_ERR_FAIL;
+  }
+  return sp_blocking_write(m_pSerialPort, data, size, timeoutMs);
+}
+
+int SerialTransport::Read(uint8_t* data, size_t size, uint32_t timeoutMs) {
+  if (m_pSerialPort == NULL) {
+    return SP_ERR_FAIL;
+  }
+  return sp_blocking_read(m_pSerialPort, data, size, timeoutMs);
+}
+
+int SerialTransport::InputWaiting() {
+  if (m_pSerialPort == NULL) {
+    return SP_ERR_FAIL;
+  }
+  return sp_input_waiting(m_pSerialPort);
+}
+
+void SerialTransport::FlushInput() {
+  if (m_pSerialPort != NULL) {
+    sp_flush(m_pSerialPort, SP_BUF_INPUT);
+  }
+}
+
+void SerialTransport::Flush() {
+  if (m_pSerialPort != NULL) {
+    sp_flush(m_pSerialPort, SP_BUF_BOTH);
+  }
+}
+
+void SerialTransport::Drain() {
+  if (m_pSerialPort != NULL) {
+    sp_drain(m_pSerialPort);
+  }
+}
+
+std::string SerialTransport::LastErrorMessage() const {
+  char* errorMessage = sp_last_error_message();
+  if (!errorMessage) {
+    return {};
+  }
+  std::string message(errorMessage);
+  sp_free_error_message(errorMessage);
+  return message;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Transport.h"
+
+#include "libserialport.h"
+
+// Transport over a local serial device through libserialport: the USB-RS485
+// adapter or UART the io-boards are wired to.
+class SerialTransport : public Transport {
+ public:
+  SerialTransport();
+  ~SerialTransport() override;
+
+  // Opens the device at the given baud rate, 8N1 without flow control, and
+  // leaves the adapter in a passive modem-control state.
+  bool Open(const char* device, uint32_t baudRate, bool debug);
+
+  bool IsOpen() const override;
+  void Close() override;
+  int Write(const uint8_t* data, size_t size, uint32_t timeoutMs) override;
+  int Read(uint8_t* data, size_t size, uint32_t timeoutMs) override;
+  int InputWaiting() override;
+  void FlushInput() override;
+  void Flush() override;
+  void Drain() override;
+  std::string LastErrorMessage() const override;
+
+ private:
+  void FreePort();
+
+  struct sp_port* m_pSerialPort;
+  struct sp_port_config* m_pSerialPortConfig;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <atomic>
+
+// A fixed-capacity queue for exactly one producer thread and one consumer
+// thread, with no locks and no allocation after construction.
+//
+// The producer only writes m_tail and the consumer only writes m_head, so
+// each side needs nothing stronger than an acquire of the other's index.
+// Capacity must be a power of two; one slot is never used so that full and
+// empty can be told apart.
+template <typename T, size_t Capacity>
+class SpscQueue {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "SpscQueue capacity must be a power of two");
+
+ public:
+  // Returns false, leaving the queue unchanged, when it is full.
+  bool TryPush(const T& item) {
+    const size_t tail = m_tail.load(std::memory_order_relaxed);
+    const size_t next = (tail + 1) & (Capacity - 1);
+    if (next == m_head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    m_items[tail] = item;
+    m_tail.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // Returns false when there is nothing to take.
+  bool TryPop(T* item) {
+    const size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    *item = m_items[head];
+    m_head.store((head + 1) & (Capacity - 1), std::memory_order_release);
+    return true;
+  }
+
+  bool Empty() const {
+    return m_head.load(std::memory_order_acquire) ==
+           m_tail.load(std::memory_order_acquire);
+  }
+
+  // Exact from either end's own thread, approximate from anywhere else.
+  size_t Size() const {
+    return (m_tail.load(std::memory_order_acquire) -
+            m_head.load(std::memory_order_acquire)) &
+           (Capacity - 1);
+  }
+
+  static constexpr size_t MaxSize() { return Capacity - 1; }
+
+ private:
+  T m_items[Capacity];
+  // Kept on separate cache lines so the two threads do not contend on them.
+  alignas(64) std::atomic<size_t> m_head{0};
+  alignas(64) std::atomic<size_t> m_tail{0};
+};
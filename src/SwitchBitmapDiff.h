@@ -0,0 +1,70 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <bit>
+
+// Change detection between two switch bitmaps, 64 switches at a time.
+//
+// Switch replies arrive for every board on every chain, and nearly all of
+// them change nothing. Comparing whole words and walking only the set bits
+// of (before ^ after) & mask makes the cost follow the number of switches
+// that changed rather than the size of the switch table. ForEachSetBit()
+// does the same for sparse sets such as the coils currently held over.
+
+// Bytes start to start + 7 of a bitmap as one word, with bit i of the word
+// being bit start * 8 + i of the bitmap whatever the host byte order. Bytes
+// at or past `bytes` read as zero.
+inline uint64_t LoadBitmapWord(const uint8_t* bitmap, size_t start,
+                               size_t bytes) {
+  uint64_t word = 0;
+  for (size_t i = 0; i < 8 && start + i < bytes; ++i) {
+    word |= static_cast<uint64_t>(bitmap[start + i]) << (8 * i);
+  }
+  return word;
+}
+
+// Calls visit(index, newState) for each of the first `bits` bits that
+// differs between before and after, lowest index first. A null mask
+// compares every bit; otherwise only bits set in mask are compared.
+template <typename Visit>
+void ForEachChangedBit(const uint8_t* before, const uint8_t* after,
+                       const uint8_t* mask, uint16_t bits, Visit visit) {
+  const size_t bytes = (bits + 7u) / 8u;
+  for (size_t start = 0; start < bytes; start += 8) {
+    const uint64_t afterWord = LoadBitmapWord(after, start, bytes);
+    uint64_t changed = LoadBitmapWord(before, start, bytes) ^ afterWord;
+    if (mask) {
+      changed &= LoadBitmapWord(mask, start, bytes);
+    }
+    const size_t firstBit = start * 8;
+    if (bits - firstBit < 64) {
+      changed &= (static_cast<uint64_t>(1) << (bits - firstBit)) - 1;
+    }
+    while (changed != 0) {
+      const int bit = std::countr_zero(changed);
+      changed &= changed - 1;
+      visit(static_cast<uint16_t>(firstBit + bit),
+            ((afterWord >> bit) & 1u) != 0);
+    }
+  }
+}
+
+// Calls visit(index) for each set bit among the first `bits`, lowest first.
+template <typename Visit>
+void ForEachSetBit(const uint8_t* bitmap, uint16_t bits, Visit visit) {
+  const size_t bytes = (bits + 7u) / 8u;
+  for (size_t start = 0; start < bytes; start += 8) {
+    uint64_t set = LoadBitmapWord(bitmap, start, bytes);
+    const size_t firstBit = start * 8;
+    if (bits - firstBit < 64) {
+      set &= (static_cast<uint64_t>(1) << (bits - firstBit)) - 1;
+    }
+    while (set != 0) {
+      const int bit = std::countr_zero(set);
+      set &= set - 1;
+      visit(static_cast<uint16_t>(firstBit + bit));
+    }
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <string>
+
+// The byte pipe RS485Comm talks through.
+//
+// Everything above this line is protocol; everything below it is a device.
+// The contract deliberately mirrors the libserialport calls RS485Comm was
+// written against, so the bus timing code did not have to change when the
+// port stopped being the only thing it could talk to. In particular Read()
+// may return fewer bytes than requested even before the timeout expires, and
+// callers already loop for that.
+class Transport {
+ public:
+  virtual ~Transport() = default;
+
+  virtual bool IsOpen() const = 0;
+
+  // Releases the device. Safe to call more than once.
+  virtual void Close() = 0;
+
+  // Writes up to size bytes, blocking for at most timeoutMs. Returns the number
+  // of bytes written, or a negative value on error (see LastErrorMessage()).
+  virtual int Write(const uint8_t* data, size_t size, uint32_t timeoutMs) = 0;
+
+  // Reads up to size bytes, blocking for at most timeoutMs (0 blocks until
+  // size bytes arrived, as libserialport does). Returns the number of bytes
+  // read, 0 on timeout, or a negative value on error.
+  virtual int Read(uint8_t* data, size_t size, uint32_t timeoutMs) = 0;
+
+  // Bytes that can be read without blocking, or a negative value on error.
+  virtual int InputWaiting() = 0;
+
+  // Discards received bytes that have not been read yet.
+  virtual void FlushInput() = 0;
+
+  // Discards received bytes and anything still queued for transmission.
+  virtual void Flush() = 0;
+
+  // Blocks until everything written has left the host.
+  virtual void Drain() = 0;
+
+  // Describes the last failed call, or an empty string if there is nothing to
+  // say beyond the return code.
+  virtual std::string LastErrorMessage() const { return {}; }
+};
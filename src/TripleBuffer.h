@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+// The latest value from one producer thread, handed to one consumer thread
+// with no locks and no waiting on either side.
+//
+// There are three buffers: the producer fills the back one, the consumer
+// reads the front one, and the third holds the most recently published
+// value. Publish() and Update() each swap their own buffer with that middle
+// one in a single atomic exchange, so neither side ever touches a buffer the
+// other is using. Values published between two Update() calls are skipped;
+// the consumer always gets the newest.
+//
+// Back() holds whatever the consumer last gave up, not what was published,
+// so the producer writes a complete value before each Publish().
+template <typename T>
+class TripleBuffer {
+ public:
+  T& Back() { return m_buffers[m_back]; }
+
+  void Publish() {
+    m_back = m_middle.exchange(m_back | kFresh, std::memory_order_acq_rel) &
+             kIndexMask;
+  }
+
+  // Moves the front buffer to the newest published value. Returns false,
+  // leaving it as it was, when nothing was published since the last call.
+  bool Update() {
+    if ((m_middle.load(std::memory_order_relaxed) & kFresh) == 0) {
+      return false;
+    }
+    m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) &
+              kIndexMask;
+    return true;
+  }
+
+  // Stays put until the consumer's next Update().
+  const T& Front() const { return m_buffers[m_front]; }
+
+ private:
+  static constexpr uint8_t kIndexMask = 0x03;
+  static constexpr uint8_t kFresh = 0x04;
+
+  T m_buffers[3];
+  uint8_t m_back = 0;  // producer only
+  alignas(64) std::atomic<uint8_t> m_middle{1};
+  alignas(64) uint8_t m_front = 2;  // consumer only
+};
@@ -0,0 +1,561 @@
+// Tests for the io-board simulator, driven by RS485Comm over a loopback pair.
+//
+// These are not firmware tests. They check that the simulator answers the
+// host the way a board would, so the benchmarks and soak tests built on it
+// measure the host rather than a simulator that has drifted from the wire
+// format.
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "BoardSimulator.h"
+#include "LoopbackTransport.h"
+#include "RS485Comm.h"
+#include "doctest.h"
+
+namespace {
+
+// Waits up to timeoutMs for the host to report the given switch change.
+bool WaitForSwitch(RS485Comm& comm, uint16_t number, uint8_t state,
+                   uint32_t timeoutMs) {
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(timeoutMs);
+  while (std::chrono::steady_clock::now() < deadline) {
+    PPUCSwitchState* switchState = comm.GetNextSwitchState();
+    if (switchState) {
+      const bool match =
+          switchState->number == number && switchState->state == state;
+      delete switchState;
+      if (match) {
+        return true;
+      }
+      continue;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+// Brings a two-board chain up the way PPUC::Connect() does: board config,
+// chain order, setup and mappings, then the runtime thread.
+void StartTwoBoardBus(RS485Comm& comm) {
+  ppuc::v2::RuntimeConfig config;
+  config.coilBits = 8;
+  config.lampBits = 8;
+  config.switchBits = 8;
+  comm.SetRuntimeConfig(config);
+  comm.SetMappings({10, 11}, {20}, {5, 6});
+  comm.SetConfiguredBoards({1, 2});
+  comm.SetSwitchNumbersByBoard({{1, {5}}, {2, {6}}});
+
+  comm.SendConfigEvent(new ConfigEvent(1, CONFIG_TOPIC_SWITCH_CHAIN, 0,
+                                       CONFIG_TOPIC_NEXT_BOARD, 2));
+  comm.SendConfigEvent(new ConfigEvent(2, CONFIG_TOPIC_SWITCH_CHAIN, 0,
+                                       CONFIG_TOPIC_NEXT_BOARD,
+                                       ppuc::v2::kNoBoard));
+  comm.FinalizeConfiguredBoardPresence();
+  comm.SetActiveSwitchBoards({1, 2});
+  comm.SendSetupFrame();
+  comm.SendMappingFrames();
+  comm.Run();
+}
+
+}  // namespace
+
+TEST_CASE("simulated boards acknowledge config and absent boards do not") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* boards = nullptr;
+  LoopbackTransport::CreatePair(&host, &boards);
+
+  BoardSimulator sim(boards);
+  sim.AddBoard(3);
+  REQUIRE(sim.Start());
+
+  RS485Comm comm;
+  REQUIRE(comm.Connect(host));
+
+  CHECK(comm.SendConfigEvent(new ConfigEvent(3, 7, 1, 4, 1234)));
+  uint32_t value = 0;
+  CHECK(sim.GetConfigValue(3, 7, 1, 4, &value));
+  CHECK(value == 1234);
+
+  CHECK_FALSE(comm.SendConfigEvent(new ConfigEvent(4, 7, 1, 4, 1234)));
+  CHECK_FALSE(comm.IsBoardPresent(4));
+  CHECK(sim.GetStats().configFramesAcked == 1);
+
+  comm.Disconnect();
+  sim.Stop();
+}
+
+TEST_CASE("a config window keeps several frames in flight") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* boards = nullptr;
+  LoopbackTransport::CreatePair(&host, &boards, RS485_COMM_BAUD_RATE);
+
+  BoardSimulator sim(boards);
+  sim.AddBoard(3);
+  sim.SetTurnaroundUs(100);
+  REQUIRE(sim.Start());
+
+  RS485Comm comm;
+  comm.SetConfigWindow(8);
+  REQUIRE(comm.Connect(host));
+
+  for (uint8_t i = 0; i < 64; ++i) {
+    CHECK(comm.SendConfigEvent(new ConfigEvent(3, 7, i, 4, 1000 + i)));
+  }
+  CHECK(comm.FlushConfigEvents());
+  CHECK(sim.GetStats().configFramesAcked == 64);
+  for (uint8_t i = 0; i < 64; ++i) {
+    uint32_t value = 0;
+    CHECK(sim.GetConfigValue(3, 7, i, 4, &value));
+    CHECK(value == 1000u + i);
+  }
+  CHECK(comm.IsBoardPresent(3));
+  CHECK(comm.GetBusHealth().configAckRetries == 0);
+
+  // Only the frames for the absent board are repeated; the rest of the
+  // window carries on around them.
+  CHECK(comm.SendConfigEvent(new ConfigEvent(4, 7, 0, 4, 1)));
+  for (uint8_t i = 0; i < 8; ++i) {
+    CHECK(comm.SendConfigEvent(new ConfigEvent(3, 8, i, 4, i)));
+  }
+  CHECK_FALSE(comm.FlushConfigEvents());
+  CHECK(sim.GetStats().configFramesAcked == 72);
+  const PPUCBusHealth health = comm.GetBusHealth();
+  CHECK(health.configAckRetries == RS485_COMM_CONFIG_ACK_RETRIES - 1);
+  CHECK(health.configAckTimeouts == RS485_COMM_CONFIG_ACK_RETRIES);
+  CHECK(comm.HadConfigurationFailure());
+  CHECK_FALSE(comm.IsBoardPresent(4));
+
+  // The failure is reported once, not again at the next flush.
+  CHECK(comm.FlushConfigEvents());
+
+  comm.Disconnect();
+  sim.Stop();
+}
+
+TEST_CASE("boards that report the capability take an item per frame") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* boards = nullptr;
+  LoopbackTransport::CreatePair(&host, &boards, RS485_COMM_BAUD_RATE);
+
+  BoardSimulator sim(boards);
+  sim.AddBoard(2);
+  sim.AddBoard(3);
+  PPUCBoardVersion version;
+  version.capabilities = MultiKeyConfigFrame::kCapability;
+  sim.SetBoardVersion(3, version);
+  REQUIRE(sim.Start());
+
+  RS485Comm comm;
+  REQUIRE(comm.Connect(host));
+  CHECK_FALSE(comm.QueryConfigCapabilities(2));
+  CHECK(comm.QueryConfigCapabilities(3));
+  CHECK_FALSE(comm.QueryConfigCapabilities(5));
+
+  // One PWM output's worth of keys for each board, then an item too long for
+  // one frame.
+  for (const uint8_t board : {2, 3}) {
+    for (uint8_t i = 0; i < 9; ++i) {
+      CHECK(comm.SendConfigEvent(new ConfigEvent(
+          board, CONFIG_TOPIC_PWM, i, static_cast<uint8_t>(10 + i), 100 + i)));
+    }
+  }
+  for (uint8_t i = 0; i < 20; ++i) {
+    CHECK(comm.SendConfigEvent(
+        new ConfigEvent(3, CONFIG_TOPIC_LED_EFFECT, i, 1, i)));
+  }
+  CHECK(comm.FlushConfigEvents());
+
+  const BoardSimulatorStats stats = sim.GetStats();
+  CHECK(stats.multiKeyConfigFrames == 3);
+  CHECK(stats.configFramesAcked == 9 + 3);
+  for (const uint8_t board : {2, 3}) {
+    for (uint8_t i = 0; i < 9; ++i) {
+      uint32_t value = 0;
+      CHECK(sim.GetConfigValue(board, CONFIG_TOPIC_PWM, i,
+                               static_cast<uint8_t>(10 + i), &value));
+      CHECK(value == 100u + i);
+    }
+  }
+  for (uint8_t i = 0; i < 20; ++i) {
+    uint32_t value = 0;
+    CHECK(sim.GetConfigValue(3, CONFIG_TOPIC_LED_EFFECT, i, 1, &value));
+    CHECK(value == i);
+  }
+  CHECK(comm.IsBoardPresent(2));
+  CHECK(comm.IsBoardPresent(3));
+  CHECK(comm.GetBusHealth().configAckRetries == 0);
+
+  comm.Disconnect();
+  sim.Stop();
+}
+
+TEST_CASE("boards that already hold their config are not sent it again") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* boards = nullptr;
+  LoopbackTransport::CreatePair(&host, &boards);
+
+  BoardSimulator sim(boards);
+  sim.AddBoard(2);
+  sim.AddBoard(3);
+  REQUIRE(sim.Start());
+
+  RS485Comm comm;
+  comm.SetConfigFingerprintsEnabled(true);
+  REQUIRE(comm.Connect(host));
+
+  auto sendConfig = [&comm](uint32_t board3Power) {
+    for (const uint8_t board : {2, 3}) {
+      comm.SendConfigEvent(new ConfigEvent(board, CONFIG_TOPIC_PWM, 0,
+                                           CONFIG_TOPIC_PORT, 5));
+      comm.SendConfigEvent(new ConfigEvent(
+          board, CONFIG_TOPIC_PWM, 1, CONFIG_TOPIC_POWER,
+          board == 3 ? board3Power : 100));
+    }
+    // Not fingerprinted, so always sent.
+    comm.SendConfigEvent(new ConfigEvent(2, CONFIG_TOPIC_SWITCH_CHAIN, 0,
+                                         CONFIG_TOPIC_NEXT_BOARD, 3));
+    return comm.FlushConfigEvents();
+  };
+
+  // Nothing held yet, so everything goes.
+  CHECK(sendConfig(100));
+  CHECK(sim.GetStats().configFramesAcked == 5);
+  CHECK(comm.GetBusHealth().configUploadsSkipped == 0);
+
+  // The same config after a soft restart: only the chain key goes.
+  REQUIRE(comm.RestartBoards());
+  CHECK(sendConfig(100));
+  CHECK(sim.GetStats().configFramesAcked == 6);
+  CHECK(comm.GetBusHealth().configUploadsSkipped == 2);
+  CHECK(comm.IsBoardPresent(2));
+  CHECK(comm.IsBoardPresent(3));
+  uint32_t value = 0;
+  CHECK(sim.GetConfigValue(3, CONFIG_TOPIC_PWM, 1, CONFIG_TOPIC_POWER,
+                           &value));
+  CHECK(value == 100);
+
+  // One value changed: only that board is sent its config.
+  REQUIRE(comm.RestartBoards());
+  CHECK(sendConfig(80));
+  CHECK(sim.GetStats().configFramesAcked == 9);
+  CHECK(comm.GetBusHealth().configUploadsSkipped == 3);
+  CHECK(sim.GetConfigValue(3, CONFIG_TOPIC_PWM, 1, CONFIG_TOPIC_POWER,
+                           &value));
+  CHECK(value == 80);
+
+  // A hard reset loses everything.
+  REQUIRE(comm.ResetBoards());
+  CHECK(sendConfig(80));
+  CHECK(sim.GetStats().configFramesAcked == 14);
+  CHECK(comm.GetBusHealth().configUploadsSkipped == 3);
+
+  comm.Disconnect();
+  sim.Stop();
+}
+
+TEST_CASE("simulated boards take part in the switch token chain") {
+  bool receiveThread = false;
+  bool deltaFrames = false;
+  SUBCASE("decoding on the bus thread") {}
+  SUBCASE("decoding on a receive thread") { receiveThread = true; }
+  SUBCASE("sending delta output frames") { deltaFrames = true; }
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* boards = nullptr;
+  LoopbackTransport::CreatePair(&host, &boards, RS485_COMM_BAUD_RATE);
+
+  BoardSimulator sim(boards);
+  sim.AddBoard(1);
+  sim.AddBoard(2);
+  sim.SetTurnaroundUs(50);
+  REQUIRE(sim.Start());
+
+  RS485Comm comm;
+  comm.SetReceiveThreadEnabled(receiveThread);
+  comm.SetOutputDeltaFramesEnabled(deltaFrames);
+  REQUIRE(comm.Connect(host));
+  StartTwoBoardBus(comm);
+  CHECK(sim.IsBoardSetUp(1));
+  CHECK(sim.IsBoardSetUp(2));
+
+  sim.SetSwitchState(2, 6, true);
+  CHECK(WaitForSwitch(comm, 6, 1, 2000));
+  sim.SetSwitchState(1, 5, true);
+  CHECK(WaitForSwitch(comm, 5, 1, 2000));
+  CHECK(comm.GetCleanSwitchReplyChainCount() > 0);
+
+  // A change is stamped when its reply arrived.
+  const uint64_t flipped = RS485Comm::GetMonotonicTimeUs();
+  sim.SetSwitchState(2, 6, false);
+  PPUCSwitchEvent event;
+  const auto eventDeadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  while (comm.GetSwitchEvents(&event, 1) == 0 &&
+         std::chrono::steady_clock::now() < eventDeadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  CHECK(event.number == 6);
+  CHECK(event.state == 0);
+  CHECK(event.timestampUs >= flipped);
+  CHECK(event.timestampUs <= RS485Comm::GetMonotonicTimeUs());
+
+  comm.QueueEvent(new Event(EVENT_SOURCE_SOLENOID, 11, 1));
+  comm.QueueEvent(new Event(EVENT_SOURCE_LIGHT, 20, 1));
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  while ((!sim.GetCoilState(11) || !sim.GetLampState(20)) &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  CHECK(sim.GetCoilState(11));
+  CHECK_FALSE(sim.GetCoilState(10));
+  CHECK(sim.GetLampState(20));
+
+  comm.Disconnect();
+  sim.Stop();
+  CHECK(sim.GetStats().crcErrors == 0);
+  CHECK(sim.GetStats().outputDeltasRejected == 0);
+  CHECK((sim.GetStats().outputDeltaFrames > 0) == deltaFrames);
+  CHECK(sim.GetStats().outputDeltaFrames <=
+        comm.GetBusHealth().outputDeltaFrames);
+}
+
+TEST_CASE("simulated boards answer version queries") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* boards = nullptr;
+  LoopbackTransport::CreatePair(&host, &boards);
+
+  BoardSimulator sim(boards);
+  sim.AddBoard(5);
+  PPUCBoardVersion version;
+  version.firmwareMajor = 1;
+  version.firmwareMinor = 4;
+  version.firmwarePatch = 2;
+  sim.SetBoardVersion(5, version);
+  REQUIRE(sim.Start());
+
+  RS485Comm comm;
+  REQUIRE(comm.Connect(host));
+
+  const PPUCBoardVersion reported = comm.QueryBoardVersion(5);
+  CHECK(reported.responded);
+  CHECK(reported.board == 5);
+  CHECK(reported.firmwareMajor == 1);
+  CHECK(reported.firmwareMinor == 4);
+  CHECK(reported.firmwarePatch == 2);
+  CHECK_FALSE(comm.QueryBoardVersion(6).responded);
+
+  comm.Disconnect();
+  sim.Stop();
+}
+
+TEST_CASE("version queries wait until runtime updates stop") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* boards = nullptr;
+  LoopbackTransport::CreatePair(&host, &boards, RS485_COMM_BAUD_RATE);
+
+  BoardSimulator sim(boards);
+  sim.AddBoard(1);
+  sim.AddBoard(2);
+  sim.SetTurnaroundUs(50);
+  REQUIRE(sim.Start());
+
+  RS485Comm comm;
+  REQUIRE(comm.Connect(host));
+  StartTwoBoardBus(comm);
+  std::this_thread::sleep_for(std::chrono::milliseconds(
+      RS485_COMM_SWITCH_POLL_STARTUP_HOLD_MS + 50));
+
+  // The bus thread is reading switch replies, so nothing else may.
+  const uint32_t adminRepliesBefore = sim.GetStats().adminReplies;
+  CHECK_FALSE(comm.QueryBoardVersion(1).responded);
+  uint32_t fingerprint = 0;
+  CHECK_FALSE(comm.QueryConfigFingerprint(1, &fingerprint));
+  CHECK(sim.GetStats().adminReplies == adminRepliesBefore);
+
+  comm.QueueEvent(new Event(EVENT_RUN, 1, 0));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  CHECK(comm.QueryBoardVersion(1).responded);
+
+  comm.Disconnect();
+  sim.Stop();
+}
+
+TEST_CASE("a coil change goes out without waiting for the frame interval") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* boards = nullptr;
+  LoopbackTransport::CreatePair(&host, &boards, RS485_COMM_BAUD_RATE);
+
+  BoardSimulator sim(boards);
+  sim.AddBoard(0);
+  REQUIRE(sim.Start());
+
+  RS485Comm comm;
+  REQUIRE(comm.Connect(host));
+  ppuc::v2::RuntimeConfig config;
+  config.coilBits = 8;
+  config.lampBits = 8;
+  config.switchBits = 8;
+  comm.SetRuntimeConfig(config);
+  comm.SetMappings({1}, {1}, {1});
+  comm.SendSetupFrame();
+  comm.SendMappingFrames();
+  // Long enough that a coil change waiting for the next idle frame would be
+  // obvious.
+  comm.SetOutputFrameIntervalMs(200);
+  comm.Run();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  const auto start = std::chrono::steady_clock::now();
+  comm.QueueEvent(new Event(EVENT_SOURCE_SOLENOID, 1, 1));
+  while (!sim.GetCoilState(1) &&
+         std::chrono::steady_clock::now() - start < std::chrono::seconds(1)) {
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  CHECK(sim.GetCoilState(1));
+  CHECK(elapsed < std::chrono::milliseconds(50));
+
+  comm.Disconnect();
+  sim.Stop();
+}
+
+TEST_CASE("commands posted faster than the frame interval do not stop frames") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* boards = nullptr;
+  LoopbackTransport::CreatePair(&host, &boards, RS485_COMM_BAUD_RATE);
+
+  BoardSimulator sim(boards);
+  sim.AddBoard(1);
+  REQUIRE(sim.Start());
+
+  // Board 3 is configured but absent, so its switch is virtual.
+  RS485Comm comm;
+  REQUIRE(comm.Connect(host));
+  ppuc::v2::RuntimeConfig config;
+  config.coilBits = 8;
+  config.lampBits = 8;
+  config.switchBits = 8;
+  comm.SetRuntimeConfig(config);
+  comm.SetMappings({10}, {20}, {5, 7});
+  comm.SetConfiguredBoards({1, 3});
+  comm.SetSwitchNumbersByBoard({{1, {5}}, {3, {7}}});
+  comm.SendConfigEvent(new ConfigEvent(1, CONFIG_TOPIC_SWITCH_CHAIN, 0,
+                                       CONFIG_TOPIC_NEXT_BOARD,
+                                       ppuc::v2::kNoBoard));
+  comm.FinalizeConfiguredBoardPresence();
+  REQUIRE(comm.IsSwitchVirtualized(7));
+  comm.SetActiveSwitchBoards({1});
+  comm.SendSetupFrame();
+  comm.SendMappingFrames();
+  comm.SetOutputFrameIntervalMs(10);
+  comm.Run();
+  // Past the startup hold, so switch polls are riding on the frames.
+  std::this_thread::sleep_for(std::chrono::milliseconds(
+      RS485_COMM_SWITCH_POLL_STARTUP_HOLD_MS + 50));
+
+  // A virtual switch toggled every millisecond, as an emulator might.
+  const BoardSimulatorStats before = sim.GetStats();
+  const auto end =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+  uint8_t state = 0;
+  while (std::chrono::steady_clock::now() < end) {
+    state = 1 - state;
+    comm.SetVirtualSwitchState(7, state);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  const BoardSimulatorStats after = sim.GetStats();
+
+  // Thirty intervals; allow for a loaded machine.
+  CHECK(after.outputFrames - before.outputFrames >= 10);
+  CHECK(after.switchReplies - before.switchReplies >= 10);
+
+  comm.Disconnect();
+  sim.Stop();
+}
+
+TEST_CASE("a coil pulse shorter than a frame is held for the hold frames") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* boards = nullptr;
+  LoopbackTransport::CreatePair(&host, &boards, RS485_COMM_BAUD_RATE);
+
+  BoardSimulator sim(boards);
+  sim.AddBoard(0);
+  REQUIRE(sim.Start());
+
+  RS485Comm comm;
+  REQUIRE(comm.Connect(host));
+  ppuc::v2::RuntimeConfig config;
+  config.coilBits = 12;
+  config.lampBits = 8;
+  config.switchBits = 8;
+  comm.SetRuntimeConfig(config);
+  comm.SetMappings({1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12}, {1}, {1});
+  comm.SetCoilHoldFrames(3);
+  comm.SendSetupFrame();
+  comm.SendMappingFrames();
+  comm.Run();
+
+  // On and off again within one batch: only the holdover puts it on the wire.
+  const PPUCOutputState pulse[] = {{11, 1}, {11, 0}};
+  const uint32_t framesBefore = sim.GetStats().outputFrames;
+  comm.SetOutputStates(pulse, 2, nullptr, 0, nullptr, 0);
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (!sim.GetCoilState(11) && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  CHECK(sim.GetCoilState(11));
+  while (sim.GetCoilState(11) && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  CHECK_FALSE(sim.GetCoilState(11));
+  CHECK(sim.GetStats().outputFrames - framesBefore >= 3);
+
+  comm.Disconnect();
+  sim.Stop();
+}
+
+TEST_CASE("switch group callbacks see only their group's replies") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* boards = nullptr;
+  LoopbackTransport::CreatePair(&host, &boards, RS485_COMM_BAUD_RATE);
+
+  BoardSimulator sim(boards);
+  sim.AddBoard(1);
+  sim.AddBoard(2);
+  sim.SetTurnaroundUs(50);
+  REQUIRE(sim.Start());
+
+  struct Seen {
+    std::atomic<int> six{0};
+    std::atomic<int> other{0};
+  } seen;
+  auto record = [](const PPUCSwitchState* changes, size_t count,
+                   const void* userData) {
+    Seen* seen = static_cast<Seen*>(const_cast<void*>(userData));
+    for (size_t i = 0; i < count; ++i) {
+      ++(changes[i].number == 6 ? seen->six : seen->other);
+    }
+  };
+
+  RS485Comm comm;
+  // Only switch 6 is in group 0.
+  comm.SetSwitchGroupMasks({0, 0, 0, 0, 0, 0, 0x1});
+  comm.AddSwitchChangesCallback(0x1, record, &seen);
+  REQUIRE(comm.Connect(host));
+  StartTwoBoardBus(comm);
+
+  sim.SetSwitchState(1, 5, true);
+  CHECK(WaitForSwitch(comm, 5, 1, 2000));
+  sim.SetSwitchState(2, 6, true);
+  CHECK(WaitForSwitch(comm, 6, 1, 2000));
+
+  comm.Disconnect();
+  sim.Stop();
+  CHECK(seen.six == 1);
+  CHECK(seen.other == 0);
+}
@@ -0,0 +1,239 @@
+// Tests for the compiled config cache.
+//
+// The format is checked by encoding and decoding directly; the fallback to
+// the YAML and a startup from the cache go through PPUC, as a host uses them.
+
+#include <cstdio>
+#include <fstream>
+
+#include "BoardSimulator.h"
+#include "ConfigCache.h"
+#include "ConfigFixture.h"
+#include "LoopbackTransport.h"
+#include "io-boards/Event.h"
+
+using ppuc_test::CaptureStdout;
+using ppuc_test::TempYaml;
+using ppuc_test::ValidConfig;
+
+namespace {
+
+PPUCCompiledConfig SampleConfig() {
+  PPUCCompiledConfig config;
+  config.debug = true;
+  config.rom = "tz_92";
+  config.serial = "/dev/ttyUSB0";
+  config.platform = 3;
+  config.switchGroups["buttons"] = {11, 12};
+  config.switchGroups["flippers"] = {63};
+  PPUCCoilGiMapping mapping;
+  mapping.coil = 7;
+  mapping.gi = 2;
+  config.coilGiMappings.push_back(mapping);
+  config.skippedBoards = {4};
+
+  PPUCConfigProgram& program = config.program;
+  program.boards = {1, 2, 4};
+  program.switchBoards = {1};
+  program.Add(1, 2, 0, 3, 0xDEADBEEF);
+  program.Add(2, 5, 1, 6, 255);
+  program.coilMapping = {7, 19};
+  program.lampMapping = {50};
+  program.switchMapping = {11, 12, 63};
+  program.switchNumbersByBoard[1] = {11, 12};
+  program.switchNumbersByBoard[2] = {63};
+  program.buttonSwitchNumbers = {11};
+  program.coils.push_back(PPUCCoil(2, 17, 1, 7, "Outhole Kicker", true));
+  program.lamps.push_back(PPUCLamp(2, 5, 1, 50, "L1", 0xFF8800));
+  program.switches.push_back(PPUCSwitch(1, 1, 11, "START BUTTON", true));
+  program.coinDoorClosedSwitch = 22;
+  program.gameOnSolenoid = 19;
+  return config;
+}
+
+bool Decode(const std::vector<uint8_t>& bytes, uint32_t sourceHash,
+            PPUCCompiledConfig* config, std::string* reason) {
+  return ConfigCache::Decode(bytes.data(), bytes.size(), sourceHash, config,
+                             reason);
+}
+
+std::string TempPath() {
+  static int counter = 0;
+  return std::string(P_tmpdir) + "/ppuc_test_cache_" +
+         std::to_string(counter++) + ".bin";
+}
+
+void Rewrite(const char* path, const std::string& contents) {
+  std::ofstream out(path, std::ios::trunc);
+  out << contents;
+}
+
+}  // namespace
+
+TEST_CASE("a compiled config comes back out of the cache unchanged") {
+  const PPUCCompiledConfig config = SampleConfig();
+  const std::vector<uint8_t> bytes = ConfigCache::Encode(config, 1234);
+
+  PPUCCompiledConfig decoded;
+  std::string reason;
+  REQUIRE(Decode(bytes, 1234, &decoded, &reason));
+
+  CHECK(decoded.debug);
+  CHECK(decoded.rom == "tz_92");
+  CHECK(decoded.serial == "/dev/ttyUSB0");
+  CHECK(decoded.platform == 3);
+  CHECK(decoded.switchGroups == config.switchGroups);
+  REQUIRE(decoded.coilGiMappings.size() == 1);
+  CHECK(decoded.coilGiMappings[0].coil == 7);
+  CHECK(decoded.coilGiMappings[0].onBrightness == 8);
+  CHECK(decoded.skippedBoards == config.skippedBoards);
+
+  const PPUCConfigProgram& program = decoded.program;
+  CHECK(program.boards == config.program.boards);
+  REQUIRE(program.records.size() == 2);
+  CHECK(program.records[0].topic == 2);
+  CHECK(program.records[0].value == 0xDEADBEEF);
+  CHECK(program.coilMapping == config.program.coilMapping);
+  CHECK(program.switchNumbersByBoard == config.program.switchNumbersByBoard);
+  CHECK(program.buttonSwitchNumbers == config.program.buttonSwitchNumbers);
+  REQUIRE(program.coils.size() == 1);
+  CHECK(program.coils[0].description == "Outhole Kicker");
+  CHECK(program.coils[0].ballSearch);
+  REQUIRE(program.lamps.size() == 1);
+  CHECK(program.lamps[0].color == 0xFF8800);
+  REQUIRE(program.switches.size() == 1);
+  CHECK(program.switches[0].button);
+  CHECK(program.gameOnSolenoid == 19);
+
+  // Nothing was lost that the encoding holds.
+  CHECK(ConfigCache::Encode(decoded, 1234) == bytes);
+}
+
+TEST_CASE("a stale or damaged cache is not used") {
+  const std::vector<uint8_t> bytes =
+      ConfigCache::Encode(SampleConfig(), 1234);
+  PPUCCompiledConfig decoded;
+  std::string reason;
+
+  SUBCASE("built from other YAML") {
+    CHECK_FALSE(Decode(bytes, 4321, &decoded, &reason));
+    CHECK(reason.find("YAML has changed") != std::string::npos);
+  }
+
+  SUBCASE("another format version") {
+    std::vector<uint8_t> other = bytes;
+    other[4] ^= 0xFF;
+    CHECK_FALSE(Decode(other, 1234, &decoded, &reason));
+    CHECK(reason.find("another version") != std::string::npos);
+  }
+
+  SUBCASE("a payload byte changed") {
+    std::vector<uint8_t> damaged = bytes;
+    damaged[ConfigCache::kHeaderBytes + 3] ^= 0x01;
+    CHECK_FALSE(Decode(damaged, 1234, &decoded, &reason));
+    CHECK(reason.find("damaged") != std::string::npos);
+  }
+
+  SUBCASE("cut short") {
+    std::vector<uint8_t> truncated(bytes.begin(), bytes.end() - 1);
+    CHECK_FALSE(Decode(truncated, 1234, &decoded, &reason));
+    CHECK(reason.find("damaged") != std::string::npos);
+  }
+
+  SUBCASE("not a cache at all") {
+    const std::string text = ValidConfig();
+    const std::vector<uint8_t> yaml(text.begin(), text.end());
+    CHECK_FALSE(Decode(yaml, 1234, &decoded, &reason));
+  }
+
+  SUBCASE("a rom name PPUC has no room for") {
+    PPUCCompiledConfig config = SampleConfig();
+    config.rom.assign(PPUCCompiledConfig::kMaxRomLength + 1, 'r');
+    CHECK_FALSE(Decode(ConfigCache::Encode(config, 1234), 1234, &decoded,
+                       &reason));
+    CHECK(reason.find("too long") != std::string::npos);
+  }
+
+  SUBCASE("a serial port name PPUC has no room for") {
+    PPUCCompiledConfig config = SampleConfig();
+    config.serial.assign(PPUCCompiledConfig::kMaxSerialLength + 1, 's');
+    CHECK_FALSE(Decode(ConfigCache::Encode(config, 1234), 1234, &decoded,
+                       &reason));
+    CHECK(reason.find("too long") != std::string::npos);
+  }
+}
+
+TEST_CASE("a host loads the cache until the YAML changes") {
+  TempYaml yaml(ValidConfig());
+  const std::string cache = TempPath();
+
+  CaptureStdout([&] {
+    PPUC writer;
+    writer.LoadConfiguration(yaml.path());
+    writer.WriteConfigurationCache(cache.c_str());
+  });
+
+  PPUC ppuc;
+  bool usedCache = false;
+  CaptureStdout(
+      [&] { usedCache = ppuc.LoadCachedConfiguration(yaml.path(),
+                                                      cache.c_str()); });
+  CHECK(usedCache);
+  CHECK(std::string(ppuc.GetRom()) == "testrom");
+  CHECK(ppuc.GetSwitchGroups()["buttons"] == std::vector<uint16_t>({11}));
+
+  std::string rom = ValidConfig();
+  rom.replace(rom.find("rom: testrom"), 12, "rom: otherrom");
+  Rewrite(yaml.path(), rom);
+  std::string output;
+  output = CaptureStdout(
+      [&] { usedCache = ppuc.LoadCachedConfiguration(yaml.path(),
+                                                      cache.c_str()); });
+  CHECK_FALSE(usedCache);
+  CHECK(output.find("YAML has changed") != std::string::npos);
+  CHECK(std::string(ppuc.GetRom()) == "otherrom");
+
+  std::remove(cache.c_str());
+}
+
+TEST_CASE("Connect() sends the boards the cached program") {
+  TempYaml yaml(ValidConfig());
+  const std::string cache = TempPath();
+  CaptureStdout([&] {
+    PPUC writer;
+    writer.LoadConfiguration(yaml.path());
+    writer.WriteConfigurationCache(cache.c_str());
+  });
+
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* boards = nullptr;
+  LoopbackTransport::CreatePair(&host, &boards);
+  BoardSimulator sim(boards);
+  sim.AddBoard(1);
+  sim.AddBoard(2);
+  REQUIRE(sim.Start());
+
+  PPUC ppuc;
+  bool usedCache = false;
+  bool connected = false;
+  CaptureStdout([&] {
+    usedCache = ppuc.LoadCachedConfiguration(yaml.path(), cache.c_str());
+    ppuc.SetTransport(host);
+    connected = ppuc.Connect();
+  });
+  CHECK(usedCache);
+  CHECK(connected);
+
+  uint32_t value = 0;
+  CHECK(sim.GetConfigValue(2, CONFIG_TOPIC_GAME_ON_SOLENOID, 0,
+                           CONFIG_TOPIC_NUMBER, &value));
+  CHECK(value == 19);
+  CHECK(sim.GetConfigValue(1, CONFIG_TOPIC_SWITCHES, 3, CONFIG_TOPIC_MODE,
+                           &value));
+  CHECK(value == SWITCH_DEBOUNCE_SLOW_STABLE);
+  CHECK(ppuc.GetSwitches().size() == 2);
+
+  ppuc.Disconnect();
+  sim.Stop();
+  std::remove(cache.c_str());
+}
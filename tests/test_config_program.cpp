@@ -0,0 +1,192 @@
+// Tests for the config program Connect() compiles from the YAML.
+//
+// Compiling needs no bus, so what a game sends its boards can be checked
+// record by record. The one test that connects does so to show that a
+// configuration error stops startup before the first frame.
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "BoardSimulator.h"
+#include "ConfigFixture.h"
+#include "LoopbackTransport.h"
+#include "io-boards/Event.h"
+
+using ppuc_test::CaptureStdout;
+using ppuc_test::TempYaml;
+using ppuc_test::ValidConfig;
+
+namespace {
+
+std::string PwmBlock(const char* effect) {
+  return std::string(R"YAML(
+pwmOutput:
+  -
+    description: 'Outhole Kicker'
+    board: 2
+    port: 17
+    number: 7
+    power: 255
+    minPulseTime: 20
+    maxPulseTime: 120
+    holdPower: 0
+    holdPowerActivationTime: 0
+    fastFlipSwitch: 11
+    type: solenoid
+    effects:
+      -
+        duration: 300
+        effect: )YAML") +
+         effect + R"YAML(
+        frequency: 4
+        maxIntensity: 255
+        minIntensity: 0
+        mode: 1
+        priority: 2
+        repeat: -1
+)YAML";
+}
+
+std::string WithPwm() { return ValidConfig() + PwmBlock("sine"); }
+
+size_t CountRecords(const PPUCConfigProgram& program, uint8_t board,
+                    uint8_t topic) {
+  return std::count_if(program.records.begin(), program.records.end(),
+                       [board, topic](const PPUCConfigRecord& record) {
+                         return record.board == board && record.topic == topic;
+                       });
+}
+
+const PPUCConfigRecord* FindRecord(const PPUCConfigProgram& program,
+                                   uint8_t board, uint8_t topic, uint8_t key) {
+  for (const PPUCConfigRecord& record : program.records) {
+    if (record.board == board && record.topic == topic && record.key == key) {
+      return &record;
+    }
+  }
+  return nullptr;
+}
+
+// Loads yaml into ppuc and compiles it, with anything printed swallowed.
+PPUCConfigProgram Compile(PPUC& ppuc, const std::string& yaml) {
+  TempYaml file(yaml);
+  PPUCConfigProgram program;
+  CaptureStdout([&] {
+    ppuc.LoadConfiguration(file.path());
+    program = ppuc.CompileConfiguration();
+  });
+  return program;
+}
+
+}  // namespace
+
+TEST_CASE("the fixture compiles to its boards, switches and mappings") {
+  PPUC ppuc;
+  const PPUCConfigProgram program = Compile(ppuc, ValidConfig());
+
+  CHECK(program.boards == std::vector<uint8_t>({1, 2}));
+  CHECK(program.switchBoards == std::vector<uint8_t>({1}));
+  CHECK(program.coinDoorClosedSwitch == 22);
+  CHECK(program.gameOnSolenoid == 19);
+
+  // Platform, coin door and game-on for each board, then four keys per
+  // switch.
+  CHECK(program.records.size() == 2 * 3 + 2 * 4);
+  REQUIRE(!program.records.empty());
+  CHECK(program.records[0].board == 1);
+  CHECK(program.records[0].topic == CONFIG_TOPIC_PLATFORM);
+  CHECK(CountRecords(program, 1, CONFIG_TOPIC_SWITCHES) == 8);
+
+  const PPUCConfigRecord* mode =
+      FindRecord(program, 1, CONFIG_TOPIC_SWITCHES, CONFIG_TOPIC_MODE);
+  REQUIRE(mode != nullptr);
+  CHECK(mode->value == SWITCH_DEBOUNCE_STANDARD);
+
+  CHECK(program.switchMapping == std::vector<uint16_t>({11, 12}));
+  CHECK(program.coilMapping == std::vector<uint16_t>({19}));
+  // Nothing to map still takes one bit.
+  CHECK(program.lampMapping.size() == 1);
+  CHECK(program.buttonSwitchNumbers == std::set<uint16_t>({11}));
+  REQUIRE(program.switches.size() == 2);
+  CHECK(program.switches[0].description == "START BUTTON");
+}
+
+TEST_CASE("a coil compiles to its PWM and effect records") {
+  PPUC ppuc;
+  const PPUCConfigProgram program = Compile(ppuc, WithPwm());
+
+  CHECK(CountRecords(program, 2, CONFIG_TOPIC_PWM) == 9);
+  CHECK(CountRecords(program, 2, CONFIG_TOPIC_PWM_EFFECT) == 9);
+  CHECK(program.coilMapping == std::vector<uint16_t>({7, 19}));
+  REQUIRE(program.coils.size() == 1);
+  CHECK(program.coils[0].number == 7);
+
+  const PPUCConfigRecord* repeat =
+      FindRecord(program, 2, CONFIG_TOPIC_PWM_EFFECT, CONFIG_TOPIC_REPEAT);
+  REQUIRE(repeat != nullptr);
+  CHECK(repeat->value == 255);
+  const PPUCConfigRecord* fastSwitch =
+      FindRecord(program, 2, CONFIG_TOPIC_PWM, CONFIG_TOPIC_FAST_SWITCH);
+  REQUIRE(fastSwitch != nullptr);
+  CHECK(fastSwitch->value == 11);
+}
+
+TEST_CASE("the compile options shape the program") {
+  SUBCASE("a skipped board is left out") {
+    PPUC ppuc;
+    ppuc.SetSkippedBoardsCsv("2");
+    const PPUCConfigProgram program = Compile(ppuc, WithPwm());
+
+    CHECK(program.boards == std::vector<uint8_t>({1, 2}));
+    CHECK(CountRecords(program, 2, CONFIG_TOPIC_PLATFORM) == 0);
+    CHECK(CountRecords(program, 2, CONFIG_TOPIC_PWM) == 0);
+    CHECK(program.coilMapping == std::vector<uint16_t>({19}));
+  }
+
+  SUBCASE("fast flip can be turned off for tests") {
+    PPUC ppuc;
+    ppuc.SetDisableFastFlipForTests(true);
+    const PPUCConfigProgram program = Compile(ppuc, WithPwm());
+
+    const PPUCConfigRecord* fastSwitch =
+        FindRecord(program, 2, CONFIG_TOPIC_PWM, CONFIG_TOPIC_FAST_SWITCH);
+    REQUIRE(fastSwitch != nullptr);
+    CHECK(fastSwitch->value == 0);
+  }
+}
+
+TEST_CASE("a configuration error stops Connect() before any frame is sent") {
+  // An unknown effect name gets past validation and is only caught when the
+  // effect is resolved.
+  TempYaml file(ValidConfig() + PwmBlock("wobble"));
+
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* boards = nullptr;
+  LoopbackTransport::CreatePair(&host, &boards);
+  BoardSimulator sim(boards);
+  sim.AddBoard(1);
+  sim.AddBoard(2);
+  REQUIRE(sim.Start());
+
+  PPUC ppuc;
+  std::string error;
+  const std::string output = CaptureStdout([&] {
+    ppuc.LoadConfiguration(file.path());
+    try {
+      ppuc.CompileConfiguration();
+    } catch (const std::exception& e) {
+      error = e.what();
+    }
+    ppuc.SetTransport(host);
+    CHECK_FALSE(ppuc.Connect());
+  });
+
+  CHECK(error.find("unknown PWM effect 'wobble'") != std::string::npos);
+  CHECK(output.find("unknown PWM effect 'wobble'") != std::string::npos);
+  // Connect() starts with a soft restart, so that is what would show.
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  CHECK(sim.GetStats().restarts == 0);
+  CHECK(sim.GetStats().discardedBytes == 0);
+  sim.Stop();
+}
@@ -0,0 +1,134 @@
+// Tests for the receive-side frame decoder shared by the switch reply, config
+// ack and admin paths.
+//
+// What matters on the bus is recovery: frames split across reads, noise in
+// front of a frame, and a corrupt frame hiding the start of a good one must
+// all still come out as the good frames, in order.
+
+#include <cstring>
+
+#include "FrameDecoder.h"
+#include "LoopbackTransport.h"
+#include "doctest.h"
+
+namespace {
+
+size_t BuildAck(uint8_t* ack, uint8_t board, uint8_t status) {
+  ppuc::v2::BuildBareFrame(ack, ppuc::v2::kFrameConfigAck,
+                           ppuc::v2::kFlagNone, ppuc::v2::kNoBoard, 0, 1);
+  ack[ppuc::v2::kHeaderBytes] = board;
+  ack[ppuc::v2::kHeaderBytes + 1] = 7;
+  ack[ppuc::v2::kHeaderBytes + 2] = 0;
+  ack[ppuc::v2::kHeaderBytes + 3] = 3;
+  ack[ppuc::v2::kHeaderBytes + 4] = status;
+  const size_t body = ppuc::v2::kHeaderBytes + ppuc::v2::kConfigAckPayloadBytes;
+  const uint16_t crc = ppuc::v2::Crc16Ccitt(ack, body);
+  ack[body] = static_cast<uint8_t>(crc >> 8);
+  ack[body + 1] = static_cast<uint8_t>(crc & 0xFF);
+  return ppuc::v2::kConfigAckFrameBytes;
+}
+
+}  // namespace
+
+TEST_CASE("frame decoder reassembles a frame fed in pieces") {
+  FrameDecoder decoder;
+  uint8_t ack[ppuc::v2::kConfigAckFrameBytes];
+  const size_t bytes = BuildAck(ack, 2, ppuc::v2::kConfigAckAccepted);
+
+  const uint8_t* frame = nullptr;
+  size_t frameBytes = 0;
+  decoder.Feed(ack, 3);
+  CHECK(decoder.Next(&frame, &frameBytes) == FrameDecoder::Result::NeedMore);
+  decoder.Feed(&ack[3], bytes - 3);
+  REQUIRE(decoder.Next(&frame, &frameBytes) == FrameDecoder::Result::Frame);
+  CHECK(frameBytes == bytes);
+  CHECK(memcmp(frame, ack, bytes) == 0);
+  CHECK(decoder.GetBuffered() == 0);
+}
+
+TEST_CASE("frame decoder skips noise and survives a corrupt frame") {
+  FrameDecoder decoder;
+  uint8_t good[ppuc::v2::kConfigAckFrameBytes];
+  const size_t bytes = BuildAck(good, 4, ppuc::v2::kConfigAckAccepted);
+  uint8_t corrupt[ppuc::v2::kConfigAckFrameBytes];
+  BuildAck(corrupt, 3, ppuc::v2::kConfigAckAccepted);
+  corrupt[bytes - 1] ^= 0xFF;
+
+  const uint8_t noise[] = {0x00, 0x13, 0xFF};
+  decoder.Feed(noise, sizeof(noise));
+  decoder.Feed(corrupt, bytes);
+  decoder.Feed(good, bytes);
+
+  const uint8_t* frame = nullptr;
+  size_t frameBytes = 0;
+  CHECK(decoder.Next(&frame, &frameBytes) == FrameDecoder::Result::BadCrc);
+  REQUIRE(decoder.Next(&frame, &frameBytes) == FrameDecoder::Result::Frame);
+  CHECK(frame[ppuc::v2::kHeaderBytes] == 4);
+  CHECK(decoder.Next(&frame, &frameBytes) == FrameDecoder::Result::NeedMore);
+  CHECK(decoder.GetDiscardedBytes() >= sizeof(noise) + 1);
+}
+
+TEST_CASE("frame decoder sizes switch replies from the runtime config") {
+  FrameDecoder decoder;
+  ppuc::v2::RuntimeConfig config;
+  config.coilBits = 8;
+  config.lampBits = 8;
+  config.switchBits = 24;
+  decoder.SetRuntimeConfig(config);
+
+  uint8_t bitmap[ppuc::v2::kMaxSwitchBytes] = {0x81, 0x00, 0x02};
+  uint8_t reply[FrameDecoder::kMaxFrameBytes];
+  ppuc::v2::BuildSwitchReplyFrame(reply, true, ppuc::v2::kNoBoard, 0, 1, 1, 0,
+                                  ppuc::v2::kStatusInSync, bitmap, 3);
+  const size_t bytes = ppuc::v2::kHeaderBytes +
+                       ppuc::v2::SwitchPayloadBytes(config) +
+                       ppuc::v2::kCrcBytes;
+  uint8_t noChange[FrameDecoder::kMaxFrameBytes];
+  ppuc::v2::BuildSwitchReplyFrame(noChange, false, ppuc::v2::kNoBoard, 1, 1, 1,
+                                  0, ppuc::v2::kStatusInSync, bitmap, 3);
+  const size_t noChangeBytes = ppuc::v2::kHeaderBytes +
+                               ppuc::v2::SwitchNoChangePayloadBytes() +
+                               ppuc::v2::kCrcBytes;
+
+  decoder.Feed(reply, bytes);
+  decoder.Feed(noChange, noChangeBytes);
+  const uint8_t* frame = nullptr;
+  size_t frameBytes = 0;
+  REQUIRE(decoder.Next(&frame, &frameBytes) == FrameDecoder::Result::Frame);
+  CHECK(ppuc::v2::ExtractType(frame[1]) == ppuc::v2::kFrameSwitchState);
+  CHECK(frameBytes == bytes);
+  REQUIRE(decoder.Next(&frame, &frameBytes) == FrameDecoder::Result::Frame);
+  CHECK(ppuc::v2::ExtractType(frame[1]) == ppuc::v2::kFrameSwitchNoChange);
+  CHECK(frameBytes == noChangeBytes);
+}
+
+TEST_CASE("frame decoder fills from a transport across the ring wrap") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* board = nullptr;
+  LoopbackTransport::CreatePair(&host, &board);
+
+  FrameDecoder decoder;
+  uint8_t ack[ppuc::v2::kConfigAckFrameBytes];
+  const size_t bytes = BuildAck(ack, 1, ppuc::v2::kConfigAckAccepted);
+  // Enough frames to go round the ring several times.
+  const size_t frames = 3 * FrameDecoder::kRingBytes / bytes;
+  size_t decoded = 0;
+  for (size_t i = 0; i < frames; ++i) {
+    board->Write(ack, bytes, 20);
+    if (i % 7 != 6) {
+      continue;
+    }
+    while (decoder.Fill(host, 5) > 0) {
+    }
+    const uint8_t* frame = nullptr;
+    size_t frameBytes = 0;
+    while (decoder.Next(&frame, &frameBytes) == FrameDecoder::Result::Frame) {
+      ++decoded;
+    }
+  }
+  CHECK(decoded == frames - frames % 7);
+  CHECK(decoder.GetDiscardedBytes() == 0);
+
+  delete host;
+  delete board;
+}
@@ -0,0 +1,550 @@
+// Tests for the in-process loopback transport and for RS485Comm running over
+// it.
+//
+// The loopback is what lets bus code be exercised without a cabinet, so these
+// pin down the parts of its contract the bus timing depends on: reads may come
+// back short on timeout, and with a baud rate set nothing is readable before
+// it would have crossed the wire. The RS485Comm cases check that frames really
+// do go through the Transport rather than straight to libserialport.
+
+#if !defined(_WIN32)
+#include <poll.h>
+#endif
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "LoopbackTransport.h"
+#include "RS485Comm.h"
+#include "doctest.h"
+
+TEST_CASE("loopback delivers bytes to the other end in both directions") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* board = nullptr;
+  LoopbackTransport::CreatePair(&host, &board);
+
+  const uint8_t ping[] = {1, 2, 3};
+  const uint8_t pong[] = {4, 5};
+  CHECK(host->Write(ping, sizeof(ping), 20) == 3);
+  CHECK(board->Write(pong, sizeof(pong), 20) == 2);
+
+  uint8_t buffer[8] = {0};
+  CHECK(board->InputWaiting() == 3);
+  REQUIRE(board->Read(buffer, 3, 20) == 3);
+  CHECK(memcmp(buffer, ping, sizeof(ping)) == 0);
+  REQUIRE(host->Read(buffer, 2, 20) == 2);
+  CHECK(memcmp(buffer, pong, sizeof(pong)) == 0);
+  CHECK(host->GetBytesWritten() == 3);
+  CHECK(board->GetBytesWritten() == 2);
+
+  delete host;
+  delete board;
+}
+
+TEST_CASE("loopback read returns what arrived when the timeout expires") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* board = nullptr;
+  LoopbackTransport::CreatePair(&host, &board);
+
+  const uint8_t partial[] = {0xA5, 0x01};
+  host->Write(partial, sizeof(partial), 20);
+
+  uint8_t buffer[8] = {0};
+  CHECK(board->Read(buffer, sizeof(buffer), 5) == 2);
+  CHECK(board->Read(buffer, sizeof(buffer), 5) == 0);
+
+  delete host;
+  delete board;
+}
+
+TEST_CASE("loopback flush discards unread input") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* board = nullptr;
+  LoopbackTransport::CreatePair(&host, &board);
+
+  const uint8_t stale[] = {9, 9, 9};
+  host->Write(stale, sizeof(stale), 20);
+  board->FlushInput();
+  CHECK(board->InputWaiting() == 0);
+
+  delete host;
+  delete board;
+}
+
+TEST_CASE("loopback with a baud rate delays bytes by their wire time") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* board = nullptr;
+  // 10 bytes at 9600 baud take a little over 10ms to cross the line.
+  LoopbackTransport::CreatePair(&host, &board, 9600);
+
+  uint8_t frame[10] = {0};
+  const auto start = std::chrono::steady_clock::now();
+  host->Write(frame, sizeof(frame), 20);
+  CHECK(board->InputWaiting() < static_cast<int>(sizeof(frame)));
+
+  uint8_t buffer[10] = {0};
+  CHECK(board->Read(buffer, sizeof(buffer), 100) == 10);
+  const auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  CHECK(elapsedUs >= 10000);
+
+  delete host;
+  delete board;
+}
+
+TEST_CASE("RS485Comm writes v2 frames through the transport") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* board = nullptr;
+  LoopbackTransport::CreatePair(&host, &board);
+
+  RS485Comm comm;
+  ppuc::v2::RuntimeConfig config;
+  config.coilBits = 8;
+  config.lampBits = 8;
+  config.switchBits = 8;
+  comm.SetRuntimeConfig(config);
+  REQUIRE(comm.Connect(host));
+
+  REQUIRE(comm.SendSetupFrame());
+  uint8_t frame[ppuc::v2::kSetupFrameBytes] = {0};
+  REQUIRE(board->Read(frame, sizeof(frame), 20) ==
+          static_cast<int>(sizeof(frame)));
+  CHECK(frame[0] == ppuc::v2::kSyncByte);
+  CHECK(ppuc::v2::ExtractType(frame[1]) == ppuc::v2::kFrameSetup);
+  CHECK(ppuc::v2::VerifyCrc(frame, sizeof(frame)));
+
+  comm.Disconnect();
+  delete board;
+}
+
+TEST_CASE("RS485Comm reads config acks through the transport") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* board = nullptr;
+  LoopbackTransport::CreatePair(&host, &board);
+
+  RS485Comm comm;
+  REQUIRE(comm.Connect(host));
+
+  // Play the board: answer the one config frame with an accepting ack.
+  std::thread responder([board]() {
+    uint8_t config[ppuc::v2::kConfigFrameBytes] = {0};
+    if (board->Read(config, sizeof(config), 500) !=
+        static_cast<int>(sizeof(config))) {
+      return;
+    }
+    uint8_t ack[ppuc::v2::kConfigAckFrameBytes] = {0};
+    ppuc::v2::BuildBareFrame(ack, ppuc::v2::kFrameConfigAck,
+                             ppuc::v2::kFlagNone, ppuc::v2::kNoBoard,
+                             config[3], config[4]);
+    memcpy(&ack[ppuc::v2::kHeaderBytes], &config[ppuc::v2::kHeaderBytes], 4);
+    ack[ppuc::v2::kHeaderBytes + 4] = ppuc::v2::kConfigAckAccepted;
+    const size_t body = ppuc::v2::kHeaderBytes + ppuc::v2::kConfigAckPayloadBytes;
+    const uint16_t crc = ppuc::v2::Crc16Ccitt(ack, body);
+    ack[body] = static_cast<uint8_t>(crc >> 8);
+    ack[body + 1] = static_cast<uint8_t>(crc & 0xFF);
+    board->Write(ack, sizeof(ack), 20);
+  });
+
+  CHECK(comm.SendConfigEvent(new ConfigEvent(2, 7, 0, 3, 42)));
+  responder.join();
+  CHECK(comm.IsBoardPresent(2));
+  CHECK(comm.GetBusHealth().configAckRetries == 0);
+
+  comm.Disconnect();
+  delete board;
+}
+
+TEST_CASE("RS485Comm reports output queue depth and drops when full") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* board = nullptr;
+  LoopbackTransport::CreatePair(&host, &board);
+
+  RS485Comm comm;
+  REQUIRE(comm.Connect(host));
+  comm.SetMappings({7}, {1}, {1});
+
+  // Nothing drains the queue until Run(), so every coil change stays queued.
+  const int changes = RS485_COMM_OUTPUT_QUEUE_SIZE_MAX + 10;
+  for (int i = 0; i < changes; ++i) {
+    comm.QueueEvent(new Event(EVENT_SOURCE_SOLENOID, 7, i % 2));
+  }
+  const PPUCBusHealth health = comm.GetBusHealth();
+  CHECK(health.outputQueueDepth == RS485_COMM_OUTPUT_QUEUE_SIZE_MAX - 1);
+  CHECK(health.outputQueueHighWater == RS485_COMM_OUTPUT_QUEUE_SIZE_MAX - 1);
+  CHECK(health.outputSnapshotsDropped == 11);
+
+  comm.Disconnect();
+  CHECK(comm.GetBusHealth().outputQueueDepth == 0);
+  delete board;
+}
+
+TEST_CASE("RS485Comm hands out switch changes in batches, oldest first") {
+  RS485Comm comm;
+  // Board 1 never answers, so its switch is virtual and set from here.
+  comm.SetMappings({1}, {1}, {3});
+  comm.SetConfiguredBoards({1});
+  comm.SetSwitchNumbersByBoard({{1, {3}}});
+  comm.FinalizeConfiguredBoardPresence();
+
+  const int changes = RS485_COMM_SWITCH_QUEUE_SIZE + 5;
+  for (int i = 0; i < changes; ++i) {
+    REQUIRE(comm.SetVirtualSwitchState(3, (i + 1) % 2));
+  }
+  CHECK(comm.GetBusHealth().switchEventsDropped == 5);
+
+  PPUCSwitchState states[100];
+  std::vector<PPUCSwitchState> drained;
+  size_t count = 0;
+  while ((count = comm.GetSwitchStates(states, 100)) > 0) {
+    drained.insert(drained.end(), states, states + count);
+  }
+  REQUIRE(drained.size() == RS485_COMM_SWITCH_QUEUE_SIZE);
+  // The five oldest changes were dropped, so the first one left is the sixth.
+  CHECK(drained.front().number == 3);
+  CHECK(drained.front().state == 0);
+  CHECK(drained.back().state == changes % 2);
+  CHECK(comm.GetNextSwitchState() == nullptr);
+
+  REQUIRE(comm.SetVirtualSwitchState(3, 1 - changes % 2));
+  PPUCSwitchState* switchState = comm.GetNextSwitchState();
+  REQUIRE(switchState != nullptr);
+  CHECK(switchState->state == 1 - changes % 2);
+  delete switchState;
+}
+
+TEST_CASE("RS485Comm direct output setters ignore unmapped numbers") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* board = nullptr;
+  LoopbackTransport::CreatePair(&host, &board);
+
+  RS485Comm comm;
+  REQUIRE(comm.Connect(host));
+  comm.SetMappings({7, 3}, {12}, {1});
+
+  comm.SetCoilState(5, true);
+  comm.SetCoilState(900, true);
+  comm.SetLampState(900, true);
+  CHECK(comm.GetBusHealth().outputQueueDepth == 0);
+
+  comm.SetCoilState(3, true);
+  comm.SetCoilState(7, false);
+  CHECK(comm.GetBusHealth().outputQueueDepth == 2);
+
+  comm.Disconnect();
+  delete board;
+}
+
+TEST_CASE("RS485Comm queues one snapshot for a batch of output changes") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* board = nullptr;
+  LoopbackTransport::CreatePair(&host, &board);
+
+  RS485Comm comm;
+  REQUIRE(comm.Connect(host));
+  std::vector<uint16_t> lampNumbers;
+  for (uint16_t n = 1; n <= 20; ++n) {
+    lampNumbers.push_back(n);
+  }
+  comm.SetMappings({7, 3}, lampNumbers, {1});
+
+  const PPUCOutputState coils[] = {{7, 1}, {3, 1}, {99, 1}};
+  std::vector<PPUCOutputState> lamps;
+  for (int n = 1; n <= 20; ++n) {
+    lamps.push_back({n, 1});
+  }
+  const PPUCOutputState gi[] = {{1, 8}};
+  comm.SetOutputStates(coils, 3, lamps.data(), lamps.size(), gi, 1);
+  CHECK(comm.GetBusHealth().outputQueueDepth == 1);
+
+  // Lamps alone ride on the next frame, as they do one at a time.
+  comm.SetOutputStates(nullptr, 0, lamps.data(), lamps.size(), nullptr, 0);
+  CHECK(comm.GetBusHealth().outputQueueDepth == 1);
+
+  comm.Disconnect();
+  delete board;
+}
+
+TEST_CASE("RS485Comm resolves virtual switches across missing boards") {
+  RS485Comm comm;
+  comm.SetMappings({1}, {1}, {3, 4, 40, 41});
+  comm.SetConfiguredBoards({1, 2});
+  comm.SetSwitchNumbersByBoard({{1, {3, 4}}, {2, {40, 41}}});
+  comm.FinalizeConfiguredBoardPresence();
+
+  CHECK(comm.IsBoardVirtualized(1));
+  CHECK(comm.IsBoardVirtualized(2));
+  CHECK(comm.IsSwitchVirtualized(4));
+  CHECK(comm.IsSwitchVirtualized(41));
+  CHECK_FALSE(comm.IsSwitchVirtualized(5));
+  CHECK_FALSE(comm.IsSwitchVirtualized(1000));
+
+  CHECK(comm.SetVirtualSwitchState(41, 1));
+  CHECK(comm.SetVirtualSwitchState(4, 1));
+  // Unchanged, so nothing new is reported.
+  CHECK(comm.SetVirtualSwitchState(4, 1));
+  CHECK_FALSE(comm.SetVirtualSwitchState(5, 1));
+  CHECK_FALSE(comm.SetVirtualSwitchState(1000, 1));
+
+  PPUCSwitchState states[4];
+  REQUIRE(comm.GetSwitchStates(states, 4) == 2);
+  CHECK(states[0].number == 41);
+  CHECK(states[1].number == 4);
+}
+
+TEST_CASE("RS485Comm publishes switch state by number in a snapshot") {
+  RS485Comm comm;
+  comm.SetMappings({1}, {1}, {3, 4, 200});
+  comm.SetConfiguredBoards({1});
+  comm.SetSwitchNumbersByBoard({{1, {3, 4, 200}}});
+  comm.FinalizeConfiguredBoardPresence();
+
+  const PPUCSwitchSnapshot empty = comm.GetSwitchSnapshot();
+  CHECK_FALSE(empty.GetState(4));
+
+  CHECK(comm.SetVirtualSwitchState(4, 1));
+  CHECK(comm.SetVirtualSwitchState(200, 1));
+  const PPUCSwitchSnapshot first = comm.GetSwitchSnapshot();
+  CHECK(first.sequence != empty.sequence);
+  CHECK_FALSE(first.GetState(3));
+  CHECK(first.GetState(4));
+  CHECK(first.GetState(200));
+  CHECK_FALSE(first.GetState(-1));
+  CHECK_FALSE(first.GetState(PPUCSwitchSnapshot::kMaxSwitchNumbers));
+
+  // Unchanged switches publish nothing new.
+  CHECK(comm.SetVirtualSwitchState(4, 1));
+  CHECK(comm.GetSwitchSnapshot().sequence == first.sequence);
+
+  CHECK(comm.SetVirtualSwitchState(4, 0));
+  const PPUCSwitchSnapshot second = comm.GetSwitchSnapshot();
+  CHECK(second.sequence != first.sequence);
+  CHECK_FALSE(second.GetState(4));
+  CHECK(second.GetState(200));
+
+  // Taking a snapshot leaves the change queue alone.
+  PPUCSwitchState states[4];
+  CHECK(comm.GetSwitchStates(states, 4) == 3);
+}
+
+TEST_CASE("RS485Comm applies virtual switches on the running bus thread") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* board = nullptr;
+  LoopbackTransport::CreatePair(&host, &board);
+
+  RS485Comm comm;
+  REQUIRE(comm.Connect(host));
+  comm.SetMappings({1}, {1}, {3, 4});
+  comm.SetConfiguredBoards({1});
+  comm.SetSwitchNumbersByBoard({{1, {3, 4}}});
+  comm.FinalizeConfiguredBoardPresence();
+  comm.Run();
+
+  CHECK(comm.SetVirtualSwitchState(4, 1));
+  CHECK_FALSE(comm.SetVirtualSwitchState(5, 1));
+  PPUCSwitchState states[4];
+  size_t count = 0;
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  while (count == 0 && std::chrono::steady_clock::now() < deadline) {
+    count = comm.GetSwitchStates(states, 4);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  REQUIRE(count == 1);
+  CHECK(states[0].number == 4);
+  CHECK(states[0].state == 1);
+  CHECK(comm.GetSwitchSnapshot().GetState(4));
+
+  // With the bus stopped the caller owns switch state again.
+  comm.Disconnect();
+  CHECK(comm.SetVirtualSwitchState(3, 1));
+  CHECK(comm.GetSwitchSnapshot().GetState(3));
+  CHECK(comm.GetBusHealth().commandsDropped == 0);
+  delete board;
+}
+
+TEST_CASE("RS485Comm reports virtual switch changes it had to drop") {
+  LoopbackTransport* host = nullptr;
+  LoopbackTransport* board = nullptr;
+  LoopbackTransport::CreatePair(&host, &board);
+
+  RS485Comm comm;
+  REQUIRE(comm.Connect(host));
+  comm.SetMappings({1}, {1}, {3});
+  comm.SetConfiguredBoards({1});
+  comm.SetSwitchNumbersByBoard({{1, {3}}});
+  comm.FinalizeConfiguredBoardPresence();
+  // Long enough that the queue fills before the bus thread drains it.
+  comm.SetOutputFrameIntervalMs(500);
+  comm.Run();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  uint32_t refused = 0;
+  for (int i = 0; i < 2 * RS485_COMM_COMMAND_QUEUE_SIZE; ++i) {
+    if (!comm.SetVirtualSwitchState(3, i % 2)) {
+      ++refused;
+    }
+  }
+  CHECK(refused > 0);
+  CHECK(refused == comm.GetBusHealth().commandsDropped);
+
+  comm.Disconnect();
+  delete board;
+}
+
+TEST_CASE("RS485Comm wakes switch waiters and its event descriptor") {
+  RS485Comm comm;
+  comm.SetMappings({1}, {1}, {3});
+  comm.SetConfiguredBoards({1});
+  comm.SetSwitchNumbersByBoard({{1, {3}}});
+  comm.FinalizeConfiguredBoardPresence();
+
+  CHECK_FALSE(comm.WaitForSwitchState(1));
+  const int fd = comm.GetSwitchEventFd();
+#if !defined(_WIN32)
+  REQUIRE(fd >= 0);
+  pollfd waiting = {fd, POLLIN, 0};
+  CHECK(poll(&waiting, 1, 0) == 0);
+#endif
+
+  std::thread setter([&comm]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    comm.SetVirtualSwitchState(3, 1);
+  });
+  CHECK(comm.WaitForSwitchState(2000));
+  setter.join();
+  // Still there: waiting takes nothing.
+  CHECK(comm.WaitForSwitchState(0));
+#if !defined(_WIN32)
+  CHECK(poll(&waiting, 1, 0) == 1);
+#endif
+
+  PPUCSwitchState states[4];
+  CHECK(comm.GetSwitchStates(states, 4) == 1);
+  CHECK_FALSE(comm.WaitForSwitchState(0));
+#if !defined(_WIN32)
+  CHECK(poll(&waiting, 1, 0) == 0);
+#endif
+  (void)fd;
+}
+
+namespace {
+
+struct CallbackLog {
+  std::vector<std::vector<int>> batches;
+};
+
+void RecordSwitchChanges(const PPUCSwitchState* changes, size_t count,
+                         const void* userData) {
+  CallbackLog* log =
+      static_cast<CallbackLog*>(const_cast<void*>(userData));
+  std::vector<int> numbers;
+  for (size_t i = 0; i < count; ++i) {
+    numbers.push_back(changes[i].number);
+  }
+  log->batches.push_back(numbers);
+}
+
+}  // namespace
+
+TEST_CASE("RS485Comm passes switch changes only to callbacks for their group") {
+  RS485Comm comm;
+  comm.SetMappings({1}, {1}, {3, 4, 5});
+  comm.SetConfiguredBoards({1});
+  comm.SetSwitchNumbersByBoard({{1, {3, 4, 5}}});
+  comm.FinalizeConfiguredBoardPresence();
+  // Switch 3 is in group 0, switch 4 in groups 0 and 1, switch 5 in none.
+  comm.SetSwitchGroupMasks({0, 0, 0, 0x1, 0x3});
+
+  CallbackLog all;
+  CallbackLog group0;
+  CallbackLog group1;
+  comm.AddSwitchChangesCallback(RS485_COMM_ALL_SWITCH_GROUPS,
+                                RecordSwitchChanges, &all);
+  comm.AddSwitchChangesCallback(0x1, RecordSwitchChanges, &group0);
+  comm.AddSwitchChangesCallback(0x2, RecordSwitchChanges, &group1);
+
+  comm.SetVirtualSwitchState(3, 1);
+  comm.SetVirtualSwitchState(4, 1);
+  comm.SetVirtualSwitchState(5, 1);
+  CHECK(all.batches.size() == 3);
+  REQUIRE(group0.batches.size() == 2);
+  CHECK(group0.batches[0] == std::vector<int>{3});
+  CHECK(group0.batches[1] == std::vector<int>{4});
+  REQUIRE(group1.batches.size() == 1);
+  CHECK(group1.batches[0] == std::vector<int>{4});
+
+  // Callbacks see changes whether or not anyone drains the queue.
+  PPUCSwitchState states[4];
+  CHECK(comm.GetSwitchStates(states, 4) == 3);
+
+  comm.ClearSwitchChangesCallbacks();
+  comm.SetVirtualSwitchState(3, 0);
+  CHECK(all.batches.size() == 3);
+}
+
+TEST_CASE("RS485Comm lets a switch callback change the callbacks") {
+  RS485Comm comm;
+  comm.SetMappings({1}, {1}, {3});
+  comm.SetConfiguredBoards({1});
+  comm.SetSwitchNumbersByBoard({{1, {3}}});
+  comm.FinalizeConfiguredBoardPresence();
+
+  // Replaces itself with a plain recorder the first time it is called.
+  struct OneShot {
+    RS485Comm* comm;
+    CallbackLog log;
+    int calls = 0;
+  } oneShot;
+  oneShot.comm = &comm;
+  auto replace = [](const PPUCSwitchState*, size_t, const void* userData) {
+    OneShot* oneShot = static_cast<OneShot*>(const_cast<void*>(userData));
+    ++oneShot->calls;
+    oneShot->comm->ClearSwitchChangesCallbacks();
+    oneShot->comm->AddSwitchChangesCallback(
+        RS485_COMM_ALL_SWITCH_GROUPS, RecordSwitchChanges, &oneShot->log);
+  };
+  CallbackLog later;
+  comm.AddSwitchChangesCallback(RS485_COMM_ALL_SWITCH_GROUPS, replace,
+                                &oneShot);
+  comm.AddSwitchChangesCallback(RS485_COMM_ALL_SWITCH_GROUPS,
+                                RecordSwitchChanges, &later);
+
+  // The batch in progress still reaches everything registered when it began.
+  comm.SetVirtualSwitchState(3, 1);
+  CHECK(oneShot.calls == 1);
+  CHECK(oneShot.log.batches.empty());
+  CHECK(later.batches.size() == 1);
+
+  comm.SetVirtualSwitchState(3, 0);
+  CHECK(oneShot.calls == 1);
+  CHECK(oneShot.log.batches.size() == 1);
+  CHECK(later.batches.size() == 1);
+}
+
+TEST_CASE("RS485Comm stamps each switch change with when it was set") {
+  RS485Comm comm;
+  comm.SetMappings({1}, {1}, {3, 4});
+  comm.SetConfiguredBoards({1});
+  comm.SetSwitchNumbersByBoard({{1, {3, 4}}});
+  comm.FinalizeConfiguredBoardPresence();
+
+  const uint64_t before = RS485Comm::GetMonotonicTimeUs();
+  comm.SetVirtualSwitchState(3, 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  const uint64_t between = RS485Comm::GetMonotonicTimeUs();
+  comm.SetVirtualSwitchState(4, 1);
+  const uint64_t after = RS485Comm::GetMonotonicTimeUs();
+
+  PPUCSwitchEvent events[4];
+  REQUIRE(comm.GetSwitchEvents(events, 4) == 2);
+  CHECK(events[0].number == 3);
+  CHECK(events[0].state == 1);
+  CHECK(events[0].timestampUs >= before);
+  CHECK(events[0].timestampUs <= between);
+  CHECK(events[1].number == 4);
+  CHECK(events[1].timestampUs >= between);
+  CHECK(events[1].timestampUs <= after);
+}
@@ -0,0 +1,79 @@
+// Tests for the multi-producer command queue.
+//
+// Every item pushed by any producer must come out exactly once, and each
+// producer's items in the order that producer pushed them.
+
+#include <thread>
+#include <vector>
+
+#include "MpscQueue.h"
+#include "doctest.h"
+
+namespace {
+
+struct Item {
+  uint16_t producer = 0;
+  uint32_t n = 0;
+};
+
+}  // namespace
+
+TEST_CASE("mpsc queue fills every slot and refuses one more") {
+  MpscQueue<Item, 8> queue;
+  Item item;
+  CHECK_FALSE(queue.TryPop(&item));
+  for (uint32_t n = 0; n < 8; ++n) {
+    item.n = n;
+    REQUIRE(queue.TryPush(item));
+  }
+  CHECK_FALSE(queue.TryPush(item));
+
+  // Round the ring a few times.
+  for (uint32_t n = 0; n < 40; ++n) {
+    REQUIRE(queue.TryPop(&item));
+    CHECK(item.n == n);
+    item.n = n + 8;
+    REQUIRE(queue.TryPush(item));
+  }
+}
+
+TEST_CASE("mpsc queue keeps each producer's items in order") {
+  constexpr int kProducers = 4;
+  constexpr uint32_t kItemsEach = 20000;
+  MpscQueue<Item, 64> queue;
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&queue, p]() {
+      Item item;
+      item.producer = static_cast<uint16_t>(p);
+      for (uint32_t n = 0; n < kItemsEach; ++n) {
+        item.n = n;
+        while (!queue.TryPush(item)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  uint32_t next[kProducers] = {0};
+  int outOfOrder = 0;
+  uint32_t received = 0;
+  Item item;
+  while (received < kProducers * kItemsEach) {
+    if (!queue.TryPop(&item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    if (item.n != next[item.producer]) {
+      ++outOfOrder;
+    }
+    next[item.producer] = item.n + 1;
+    ++received;
+  }
+  for (std::thread& producer : producers) {
+    producer.join();
+  }
+  CHECK(outOfOrder == 0);
+  CHECK_FALSE(queue.TryPop(&item));
+}
@@ -0,0 +1,55 @@
+// Tests for the multi-key config frame.
+
+#include "MultiKeyConfig.h"
+#include "doctest.h"
+
+TEST_CASE("a multi-key config frame carries every key of an item") {
+  const uint8_t keys[] = {3, 1, 9, 200};
+  const uint32_t values[] = {0, 1, 0x12345678, 0xFFFFFFFF};
+  uint8_t frame[MultiKeyConfigFrame::kMaxFrameBytes];
+  const size_t frameBytes =
+      MultiKeyConfigFrame::Build(frame, 7, 2, 5, 11, 4, keys, values, 4);
+
+  CHECK(ppuc::v2::ExtractType(frame[1]) == ppuc::v2::kFrameConfig);
+  CHECK(MultiKeyConfigFrame::IsMultiKeyFrame(frame));
+  CHECK(MultiKeyConfigFrame::FrameBytes(frame) == frameBytes);
+  CHECK(frameBytes == ppuc::v2::kHeaderBytes +
+                          MultiKeyConfigFrame::kPrefixBytes +
+                          4 * MultiKeyConfigFrame::kKeyBytes +
+                          ppuc::v2::kCrcBytes);
+  CHECK(ppuc::v2::VerifyCrc(frame, frameBytes));
+  CHECK(frame[3] == 7);
+  CHECK(frame[4] == 2);
+  CHECK(frame[ppuc::v2::kHeaderBytes] == 5);
+  CHECK(frame[ppuc::v2::kHeaderBytes + 1] == 11);
+  CHECK(frame[ppuc::v2::kHeaderBytes + 2] == 4);
+  for (size_t i = 0; i < 4; ++i) {
+    uint8_t key = 0;
+    uint32_t value = 0;
+    MultiKeyConfigFrame::ReadKey(frame, i, &key, &value);
+    CHECK(key == keys[i]);
+    CHECK(value == values[i]);
+  }
+
+  uint8_t ack[ppuc::v2::kConfigAckFrameBytes];
+  MultiKeyConfigFrame::BuildAck(ack, 1, 2, frame,
+                                ppuc::v2::kConfigAckAccepted);
+  CHECK(ppuc::v2::ExtractType(ack[1]) == ppuc::v2::kFrameConfigAck);
+  CHECK(MultiKeyConfigFrame::IsMultiKeyFrame(ack));
+  CHECK(ppuc::v2::VerifyCrc(ack, sizeof(ack)));
+  CHECK(ack[ppuc::v2::kHeaderBytes + 3] == 4);
+  CHECK(ack[ppuc::v2::kHeaderBytes + 4] == ppuc::v2::kConfigAckAccepted);
+}
+
+TEST_CASE("plain config frames are not taken for multi-key ones") {
+  uint8_t frame[ppuc::v2::kConfigFrameBytes];
+  ppuc::v2::BuildConfigFrame(frame, ppuc::v2::kNoBoard, 0, 1, 2, 3, 4, 5, 6);
+  CHECK_FALSE(MultiKeyConfigFrame::IsMultiKeyFrame(frame));
+
+  uint8_t multi[MultiKeyConfigFrame::kMaxFrameBytes];
+  const uint8_t key = 1;
+  const uint32_t value = 2;
+  MultiKeyConfigFrame::Build(multi, 0, 1, 2, 3, 4, &key, &value, 1);
+  multi[ppuc::v2::kHeaderBytes + 3] = MultiKeyConfigFrame::kMaxKeys + 1;
+  CHECK(MultiKeyConfigFrame::FrameBytes(multi) == 0);
+}
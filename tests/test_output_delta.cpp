@@ -0,0 +1,136 @@
+// Tests for the delta-encoded output frame.
+//
+// A delta frame is only correct if applying it gives exactly the payload the
+// full frame would have carried, so each case checks the decoder against
+// ppuc::v2::BuildOutputStateFrame() for the same outputs.
+
+#include <cstring>
+
+#include "OutputDelta.h"
+#include "doctest.h"
+
+namespace {
+
+struct Outputs {
+  uint8_t coils[ppuc::v2::kMaxCoilBytes] = {0};
+  uint8_t lamps[ppuc::v2::kMaxLampBytes] = {0};
+  uint8_t gi[ppuc::v2::kGiStrings] = {0};
+};
+
+ppuc::v2::RuntimeConfig TestConfig() {
+  ppuc::v2::RuntimeConfig config;
+  config.coilBits = 64;
+  config.lampBits = 200;
+  config.switchBits = 64;
+  return config;
+}
+
+bool MatchesFullFrame(const OutputDeltaDecoder& decoder,
+                      const ppuc::v2::RuntimeConfig& config,
+                      const Outputs& outputs) {
+  uint8_t full[OutputDeltaEncoder::kMaxFrameBytes];
+  ppuc::v2::BuildOutputStateFrame(full, ppuc::v2::kNoBoard, 0, 1, config,
+                                  outputs.coils, outputs.lamps, outputs.gi);
+  return decoder.GetPayloadBytes() ==
+             OutputDeltaEncoder::PayloadBytes(config) &&
+         memcmp(decoder.GetPayload(), &full[ppuc::v2::kHeaderBytes],
+                decoder.GetPayloadBytes()) == 0;
+}
+
+}  // namespace
+
+TEST_CASE("delta output frames rebuild the full frame payload") {
+  const ppuc::v2::RuntimeConfig config = TestConfig();
+  const size_t fullBytes = ppuc::v2::kHeaderBytes +
+                           OutputDeltaEncoder::PayloadBytes(config) +
+                           ppuc::v2::kCrcBytes;
+  OutputDeltaEncoder encoder;
+  encoder.SetKeyframeInterval(10);
+  OutputDeltaDecoder decoder;
+  decoder.SetRuntimeConfig(config);
+
+  Outputs outputs;
+  uint8_t frame[OutputDeltaEncoder::kMaxFrameBytes];
+  int keyframes = 0;
+  for (uint8_t seq = 0; seq < 39; ++seq) {
+    ppuc::v2::SetBitmapBit(outputs.lamps, (seq * 7) % config.lampBits,
+                           seq % 3 != 0);
+    if (seq % 5 == 0) {
+      ppuc::v2::SetBitmapBit(outputs.coils, seq % config.coilBits, true);
+      outputs.gi[seq % ppuc::v2::kGiStrings] = seq % 9;
+    }
+    bool keyframe = false;
+    const size_t bytes =
+        encoder.Build(frame, 2, seq, 1, config, outputs.coils, outputs.lamps,
+                      outputs.gi, &keyframe);
+    CAPTURE(seq);
+    REQUIRE(ppuc::v2::VerifyCrc(frame, bytes));
+    CHECK(OutputDeltaEncoder::IsDeltaFrame(frame) == !keyframe);
+    if (keyframe) {
+      ++keyframes;
+      CHECK(bytes == fullBytes);
+    } else {
+      CHECK(bytes < fullBytes);
+      CHECK(bytes == OutputDeltaEncoder::DeltaFrameBytes(frame));
+    }
+    CHECK(frame[2] == 2);
+    CHECK(frame[3] == seq);
+    REQUIRE(decoder.Apply(frame, bytes));
+    CHECK(MatchesFullFrame(decoder, config, outputs));
+  }
+  CHECK(keyframes == 4);
+
+  // Nothing changed: the delta is just the prefix.
+  bool keyframe = true;
+  CHECK(encoder.Build(frame, 2, 39, 1, config, outputs.coils, outputs.lamps,
+                      outputs.gi, &keyframe) ==
+        ppuc::v2::kHeaderBytes + OutputDeltaEncoder::kDeltaPrefixBytes +
+            ppuc::v2::kCrcBytes);
+  CHECK_FALSE(keyframe);
+}
+
+TEST_CASE("a missed output frame stalls deltas until the next keyframe") {
+  const ppuc::v2::RuntimeConfig config = TestConfig();
+  OutputDeltaEncoder encoder;
+  encoder.SetKeyframeInterval(8);
+  OutputDeltaDecoder decoder;
+  decoder.SetRuntimeConfig(config);
+
+  Outputs outputs;
+  uint8_t frame[OutputDeltaEncoder::kMaxFrameBytes];
+  bool keyframe = false;
+  size_t bytes = encoder.Build(frame, ppuc::v2::kNoBoard, 0, 1, config,
+                               outputs.coils, outputs.lamps, outputs.gi,
+                               &keyframe);
+  REQUIRE(keyframe);
+  REQUIRE(decoder.Apply(frame, bytes));
+
+  // Frame 1 is lost on the wire.
+  ppuc::v2::SetBitmapBit(outputs.lamps, 3, true);
+  encoder.Build(frame, ppuc::v2::kNoBoard, 1, 1, config, outputs.coils,
+                outputs.lamps, outputs.gi, &keyframe);
+  REQUIRE_FALSE(keyframe);
+
+  uint8_t seq = 2;
+  for (; seq < 8; ++seq) {
+    ppuc::v2::SetBitmapBit(outputs.coils, seq, true);
+    bytes = encoder.Build(frame, ppuc::v2::kNoBoard, seq, 1, config,
+                          outputs.coils, outputs.lamps, outputs.gi, &keyframe);
+    REQUIRE_FALSE(keyframe);
+    CHECK_FALSE(decoder.Apply(frame, bytes));
+  }
+  CHECK(decoder.GetRejectedDeltas() == 6);
+  CHECK_FALSE(MatchesFullFrame(decoder, config, outputs));
+
+  bytes = encoder.Build(frame, ppuc::v2::kNoBoard, seq, 1, config,
+                        outputs.coils, outputs.lamps, outputs.gi, &keyframe);
+  CHECK(keyframe);
+  CHECK(decoder.Apply(frame, bytes));
+  CHECK(MatchesFullFrame(decoder, config, outputs));
+
+  // A new epoch means the boards were set up again, so it starts with a
+  // full frame too.
+  bytes = encoder.Build(frame, ppuc::v2::kNoBoard, ++seq, 2, config,
+                        outputs.coils, outputs.lamps, outputs.gi, &keyframe);
+  CHECK(keyframe);
+}
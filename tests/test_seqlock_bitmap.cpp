@@ -0,0 +1,70 @@
+// Tests for the seqlock-published bitmap.
+//
+// The reader must never return a copy that mixes two writes. The writer
+// flips between two patterns that differ in every word, so any torn copy
+// matches neither.
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#include "SeqlockBitmap.h"
+#include "doctest.h"
+
+TEST_CASE("seqlock bitmap reads back what was written") {
+  SeqlockBitmap<256> bitmap;
+  uint8_t out[SeqlockBitmap<256>::kBytes];
+  CHECK(bitmap.Read(out) == 0);
+
+  bitmap.BeginWrite();
+  bitmap.Set(0, true);
+  bitmap.Set(9, true);
+  bitmap.Set(255, true);
+  bitmap.Set(256, true);  // out of range, ignored
+  bitmap.EndWrite();
+  CHECK(bitmap.Read(out) == 2);
+  CHECK(out[0] == 0x01);
+  CHECK(out[1] == 0x02);
+  CHECK(out[31] == 0x80);
+
+  bitmap.BeginWrite();
+  bitmap.Set(9, false);
+  bitmap.EndWrite();
+  CHECK(bitmap.Read(out) == 4);
+  CHECK(out[1] == 0x00);
+  CHECK(out[0] == 0x01);
+}
+
+TEST_CASE("seqlock bitmap never hands out a torn copy") {
+  SeqlockBitmap<256> bitmap;
+  std::atomic<bool> stop{false};
+  std::thread writer([&]() {
+    bool odd = false;
+    while (!stop.load()) {
+      bitmap.BeginWrite();
+      for (size_t bit = 0; bit < 256; ++bit) {
+        bitmap.Set(bit, (bit % 2 == 1) == odd);
+      }
+      bitmap.EndWrite();
+      odd = !odd;
+    }
+  });
+
+  uint8_t out[SeqlockBitmap<256>::kBytes];
+  int torn = 0;
+  for (int i = 0; i < 20000; ++i) {
+    bitmap.Read(out);
+    for (size_t b = 1; b < sizeof(out); ++b) {
+      if (out[b] != out[0]) {
+        ++torn;
+        break;
+      }
+    }
+    if (out[0] != 0x00 && out[0] != 0x55 && out[0] != 0xAA) {
+      ++torn;
+    }
+  }
+  stop = true;
+  writer.join();
+  CHECK(torn == 0);
+}
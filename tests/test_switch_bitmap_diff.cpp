@@ -0,0 +1,95 @@
+// Tests for the word-wise switch bitmap diff.
+//
+// It has to report exactly what a bit-by-bit comparison would, including at
+// the edges: switch counts that end mid-word or mid-byte, and bits past the
+// configured count that must be ignored even when they differ.
+
+#include <cstring>
+#include <vector>
+
+#include "SwitchBitmapDiff.h"
+#include "doctest.h"
+#include "io-boards/PPUCProtocolV2.h"
+
+namespace {
+
+struct Change {
+  uint16_t index;
+  bool state;
+};
+
+std::vector<Change> Diff(const uint8_t* before, const uint8_t* after,
+                         const uint8_t* mask, uint16_t bits) {
+  std::vector<Change> changes;
+  ForEachChangedBit(before, after, mask, bits, [&](uint16_t n, bool state) {
+    changes.push_back({n, state});
+  });
+  return changes;
+}
+
+std::vector<Change> BitwiseDiff(const uint8_t* before, const uint8_t* after,
+                                const uint8_t* mask, uint16_t bits) {
+  std::vector<Change> changes;
+  for (uint16_t n = 0; n < bits; ++n) {
+    if (mask && !ppuc::v2::GetBitmapBit(mask, n)) {
+      continue;
+    }
+    if (ppuc::v2::GetBitmapBit(before, n) != ppuc::v2::GetBitmapBit(after, n)) {
+      changes.push_back({n, ppuc::v2::GetBitmapBit(after, n)});
+    }
+  }
+  return changes;
+}
+
+bool Same(const std::vector<Change>& a, const std::vector<Change>& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a[i].index != b[i].index || a[i].state != b[i].state) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST_CASE("switch bitmap diff matches a bit-by-bit comparison") {
+  uint8_t before[ppuc::v2::kMaxSwitchBytes];
+  uint8_t after[ppuc::v2::kMaxSwitchBytes];
+  uint8_t mask[ppuc::v2::kMaxSwitchBytes];
+  uint32_t seed = 12345;
+  auto next = [&seed]() {
+    seed = seed * 1103515245u + 12345u;
+    return static_cast<uint8_t>(seed >> 16);
+  };
+
+  const uint16_t bitCounts[] = {1, 7, 8, 13, 63, 64, 65, 70, 200, 256};
+  for (const uint16_t bits : bitCounts) {
+    for (int round = 0; round < 20; ++round) {
+      for (size_t i = 0; i < sizeof(before); ++i) {
+        before[i] = next();
+        after[i] = round % 4 == 0 ? before[i] : next();
+        mask[i] = next();
+      }
+      CAPTURE(bits);
+      CAPTURE(round);
+      CHECK(Same(Diff(before, after, nullptr, bits),
+                 BitwiseDiff(before, after, nullptr, bits)));
+      CHECK(Same(Diff(before, after, mask, bits),
+                 BitwiseDiff(before, after, mask, bits)));
+    }
+  }
+}
+
+TEST_CASE("switch bitmap diff ignores bits past the switch count") {
+  uint8_t before[ppuc::v2::kMaxSwitchBytes] = {0};
+  uint8_t after[ppuc::v2::kMaxSwitchBytes] = {0};
+  after[1] = 0xFF;  // bits 8 to 15
+  const std::vector<Change> changes = Diff(before, after, nullptr, 10);
+  REQUIRE(changes.size() == 2);
+  CHECK(changes[0].index == 8);
+  CHECK(changes[1].index == 9);
+  CHECK(changes[1].state);
+}
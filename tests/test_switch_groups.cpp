@@ -93,3 +93,20 @@ switchGroups:
   CHECK(error.find("buttons") != std::string::npos);
   CHECK(error.find("reserved") != std::string::npos);
 }
+
+TEST_CASE("switch callbacks can only be registered for known groups") {
+  TempYaml file(WithGroups(R"YAML(
+switchGroups:
+  playfield:
+    switches: [12]
+)YAML"));
+  PPUC ppuc;
+  ppuc.LoadConfiguration(file.path());
+
+  auto ignore = [](const PPUCSwitchState*, size_t, const void*) {};
+  CHECK(ppuc.AddSwitchGroupCallback("playfield", ignore, nullptr));
+  CHECK(ppuc.AddSwitchGroupCallback("buttons", ignore, nullptr));
+  CHECK_FALSE(ppuc.AddSwitchGroupCallback("flippers", ignore, nullptr));
+  CHECK_FALSE(ppuc.AddSwitchGroupCallback("playfield", nullptr, nullptr));
+  ppuc.ClearSwitchCallbacks();
+}
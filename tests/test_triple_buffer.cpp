@@ -0,0 +1,80 @@
+// Tests for the triple buffer handing output state to the bus thread.
+//
+// The consumer must only ever see whole published values, and the newest
+// one whenever it looks after a Publish().
+
+#include <atomic>
+#include <thread>
+
+#include "TripleBuffer.h"
+#include "doctest.h"
+
+namespace {
+
+struct Value {
+  uint32_t words[16] = {0};
+};
+
+void Fill(Value* value, uint32_t n) {
+  for (uint32_t& word : value->words) {
+    word = n;
+  }
+}
+
+}  // namespace
+
+TEST_CASE("triple buffer hands the consumer the newest value") {
+  TripleBuffer<Value> buffer;
+  CHECK_FALSE(buffer.Update());
+
+  Fill(&buffer.Back(), 1);
+  buffer.Publish();
+  Fill(&buffer.Back(), 2);
+  buffer.Publish();
+  REQUIRE(buffer.Update());
+  CHECK(buffer.Front().words[0] == 2);
+
+  // Nothing new: the front stays where it was.
+  CHECK_FALSE(buffer.Update());
+  CHECK(buffer.Front().words[15] == 2);
+
+  Fill(&buffer.Back(), 3);
+  buffer.Publish();
+  REQUIRE(buffer.Update());
+  CHECK(buffer.Front().words[0] == 3);
+}
+
+TEST_CASE("triple buffer never hands out a half-written value") {
+  TripleBuffer<Value> buffer;
+  std::atomic<bool> stop{false};
+  std::thread producer([&]() {
+    for (uint32_t n = 1; !stop.load(); ++n) {
+      Fill(&buffer.Back(), n);
+      buffer.Publish();
+    }
+  });
+
+  int torn = 0;
+  int backwards = 0;
+  uint32_t last = 0;
+  for (int i = 0; i < 20000; ++i) {
+    if (!buffer.Update()) {
+      continue;
+    }
+    const Value& value = buffer.Front();
+    for (const uint32_t word : value.words) {
+      if (word != value.words[0]) {
+        ++torn;
+        break;
+      }
+    }
+    if (value.words[0] < last) {
+      ++backwards;
+    }
+    last = value.words[0];
+  }
+  stop = true;
+  producer.join();
+  CHECK(torn == 0);
+  CHECK(backwards == 0);
+}
@@ -0,0 +1,48 @@
+// Compiles a game YAML into the cache PPUC::LoadCachedConfiguration() reads,
+// so a host that starts from it does not parse the YAML.
+//
+// Run it wherever the YAML is edited, e.g. when building the image for a
+// read-only target. The cache records a hash of the YAML it came from; a host
+// whose YAML no longer matches loads the YAML instead. --skip-boards compiles
+// for the boards a host will skip, as the option of the same name does there.
+//
+// Usage: ppuc_config_cache CONFIG OUTPUT [--skip-boards CSV]
+
+#include <stdio.h>
+#include <string.h>
+
+#include <stdexcept>
+
+#include "PPUC.h"
+
+namespace {
+
+void PrintUsage() {
+  printf("Usage: ppuc_config_cache CONFIG OUTPUT [--skip-boards CSV]\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 3 && !(argc == 5 && strcmp(argv[3], "--skip-boards") == 0)) {
+    PrintUsage();
+    return 1;
+  }
+  const char* configFile = argv[1];
+  const char* cacheFile = argv[2];
+
+  PPUC ppuc;
+  try {
+    ppuc.LoadConfiguration(configFile);
+    if (argc == 5) {
+      ppuc.SetSkippedBoardsCsv(argv[4]);
+    }
+    ppuc.WriteConfigurationCache(cacheFile);
+  } catch (const std::exception& e) {
+    printf("PPUC: %s\n", e.what());
+    return 1;
+  }
+
+  printf("Wrote %s from %s.\n", cacheFile, configFile);
+  return 0;
+}